@@ -6,7 +6,16 @@ args <- commandArgs(trailingOnly = TRUE)
 distanceMatrixFilename = args[1]
 
 
-distanceMatrix = as.matrix(read.table(file=distanceMatrixFilename, sep=";", header=TRUE, row.names=1))
+#Newick tree computed by simkaAnalyze (ward.D2 by default, see its option -linkage), or distance matrix of simka
+if(grepl("\\.newick$", distanceMatrixFilename)){
+	suppressPackageStartupMessages(library(ape))
+	hc = as.hclust(read.tree(distanceMatrixFilename))
+	hc$height = hc$height*100
+	dataset_labels = hc$labels
+} else{
+	distanceMatrix = as.matrix(read.table(file=distanceMatrixFilename, sep=";", header=TRUE, row.names=1))
+	dataset_labels = rownames(distanceMatrix)
+}
 
 width = as.numeric(args[3])
 height = as.numeric(args[4])
@@ -41,8 +50,8 @@ if(length(args) == 7){
 	}
 	
 	colors = c()
-	dataset_ids = rownames(distanceMatrix)
-	for(i in 1:dim(distanceMatrix)[1]){
+	dataset_ids = dataset_labels
+	for(i in 1:length(dataset_ids)){
 		dataset_id = dataset_ids[i]
 		colors = c(colors, meatadata_index[[dataset_id]])
 	}
@@ -58,10 +67,12 @@ if(length(args) == 7){
 
 
 
-distanceMatrix = distanceMatrix*100
-#inv_cr3 = matrix(100, ncol=dim(cr3)[1], nrow=dim(cr3)[1]) - cr3
-Commet_distance = as.dist(distanceMatrix)
-hc = hclust(Commet_distance, method="ward.D2")
+if(!exists("hc")){
+	distanceMatrix = distanceMatrix*100
+	#inv_cr3 = matrix(100, ncol=dim(cr3)[1], nrow=dim(cr3)[1]) - cr3
+	Commet_distance = as.dist(distanceMatrix)
+	hc = hclust(Commet_distance, method="ward.D2")
+}
 dendo_cr3 = as.dendrogram(hc)
 
 if(use_metadata){
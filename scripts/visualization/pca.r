@@ -19,7 +19,15 @@ if(format == "png"){
 }
 
 
-distanceMatrix = as.matrix(read.table(file=distanceMatrixFilename, sep=";", header=TRUE, row.names=1))
+#Coordinates computed by simkaAnalyze (pcoa_*.csv), or distance matrix of simka
+use_coordinates = grepl("pcoa_.*\\.csv$", basename(distanceMatrixFilename))
+if(use_coordinates){
+	coordinates = as.matrix(read.table(file=distanceMatrixFilename, sep=";", header=TRUE, row.names=1))
+	dataset_labels = rownames(coordinates)
+} else{
+	distanceMatrix = as.matrix(read.table(file=distanceMatrixFilename, sep=";", header=TRUE, row.names=1))
+	dataset_labels = rownames(distanceMatrix)
+}
 
 use_metadata = F
 if(length(args) == 9){
@@ -43,8 +51,8 @@ if(length(args) == 9){
 	}
 	
 	colors = c()
-	dataset_ids = rownames(distanceMatrix)
-	for(i in 1:dim(distanceMatrix)[1]){
+	dataset_ids = dataset_labels
+	for(i in 1:length(dataset_ids)){
 		dataset_id = dataset_ids[i]
 		colors = c(colors, meatadata_index[[dataset_id]])
 	}
@@ -78,7 +86,14 @@ format_distance <- function(distanceMatrix, numberAxis) {
 }
 
 #print(distanceMatrix)
-distData <- format_distance(distanceMatrix, max(pca_axis1, pca_axis2))
+if(use_coordinates){
+	eigenvalues = read.table(file=sub("\\.csv$", "_eigenvalues.csv", distanceMatrixFilename), sep=";", header=TRUE)
+	plotData <- data.frame(coordinates)
+	colnames(plotData) <- paste0("Dim", seq(1, dim(coordinates)[2]))
+	distData <- list(data = plotData, eig = eigenvalues$percentage)
+} else{
+	distData <- format_distance(distanceMatrix, max(pca_axis1, pca_axis2))
+}
 x = distData$data[,paste0("Dim", pca_axis1)]
 y = distData$data[,paste0("Dim", pca_axis2)]
 
@@ -27,6 +27,7 @@ parserVisualization.add_argument('-tree', action="store_true", dest="want_tree",
 parserVisualization.add_argument('-pca', action="store_true", dest="want_pca", help="compute and output pca (more precisely mds/PCoA)")
 parserVisualization.add_argument('-pca-axis-1', action="store", dest="pca_axis_1", help="the number of the first axis of the PCA (only used if -pca)", default="1")
 parserVisualization.add_argument('-pca-axis-2', action="store", dest="pca_axis_2", help="the number of the second axis of the PCA (only used if -pca)", default="2")
+parserVisualization.add_argument('-simka-analyze', action="store", dest="simka_analyze", help="path to the simkaAnalyze binary, used to compute the tree and the PCoA instead of R (faster and less memory on large matrices)")
 
 args =  parser.parse_args()
 
@@ -74,7 +75,11 @@ def outputHeatmap(outputFilename, matrixAsymFilename, matrixSymFilename):
 def outputHclust(outputFilename, matrixNormFilename):
 	if not args.want_tree: return
 
-	command = "Rscript " +  hclust_script_filename + " " + join(args.input_dir, matrixNormFilename) + " " + join(args.output_dir, outputFilename)
+	inputFilename = join(args.input_dir, matrixNormFilename)
+	if args.simka_analyze != None:
+		inputFilename = join(args.output_dir, outputFilename + ".newick")
+
+	command = "Rscript " +  hclust_script_filename + " " + inputFilename + " " + join(args.output_dir, outputFilename)
 	command = add_metadata_args(command)
 
 	print("\t"+command)
@@ -84,7 +89,11 @@ def outputHclust(outputFilename, matrixNormFilename):
 def outputPca(outputFilename, matrixNormFilename):
 	if not args.want_pca: return
 	
-	command = "Rscript " +  pca_script_filename + " " + join(args.input_dir, matrixNormFilename) + " " + join(args.output_dir, outputFilename) + " " + args.pca_axis_1 + " " + args.pca_axis_2
+	inputFilename = join(args.input_dir, matrixNormFilename)
+	if args.simka_analyze != None:
+		inputFilename = join(args.output_dir, outputFilename.replace("pca_", "pcoa_", 1) + ".csv")
+
+	command = "Rscript " +  pca_script_filename + " " + inputFilename + " " + join(args.output_dir, outputFilename) + " " + args.pca_axis_1 + " " + args.pca_axis_2
 	command = add_metadata_args(command)
 
 
@@ -94,7 +103,22 @@ def outputPca(outputFilename, matrixNormFilename):
 	#print command
 	os.system(command + " > /dev/null 2>&1  ")
 
+def simkaAnalyze():
+	if args.simka_analyze == None: return
+	if not args.want_tree and not args.want_pca: return
+
+	command = args.simka_analyze + " -in " + args.input_dir + " -out " + args.output_dir
+	if args.want_tree: command += " -tree"
+	if args.want_pca: command += " -pcoa -pcoa-axes " + str(max(int(args.pca_axis_1), int(args.pca_axis_2)))
+
+	print("\t"+command)
+	if os.system(command + " > /dev/null 2>&1  ") != 0:
+		print("Error: simkaAnalyze failed")
+		exit(1)
+
 def execute():
+	simkaAnalyze()
+
 	files = [ f for f in listdir(args.input_dir) if isfile(join(args.input_dir,f))]
 	for filename in files:
 		asym = False
@@ -0,0 +1,701 @@
+/*****************************************************************************
+ *   Simka: Fast kmer-based method for estimating the similarity between numerous metagenomic datasets
+ *   A tool from the GATB (Genome Assembly Tool Box)
+ *   Copyright (C) 2015  INRIA
+ *   Authors: G.Benoit, C.Lemaitre, P.Peterlongo
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+
+#include <gatb/gatb_core.hpp>
+#include <SimkaAlgorithm.hpp>
+#include <SimkaDistance.hpp>
+#include <limits>
+
+// We use the required packages
+using namespace std;
+
+
+#define SIMKA_ANALYZE_OVERSAMPLING 10 //Extra random vectors of the truncated eigensolver of the PCoA
+#define SIMKA_ANALYZE_POWER_ITERATIONS 4 //Power iterations of the truncated eigensolver of the PCoA
+#define SIMKA_ANALYZE_JACOBI_MAX_SWEEPS 100
+
+const string STR_SIMKA_ANALYZE_TREE = "-tree";
+const string STR_SIMKA_ANALYZE_LINKAGE = "-linkage";
+const string STR_SIMKA_ANALYZE_PCOA = "-pcoa";
+const string STR_SIMKA_ANALYZE_PCOA_AXES = "-pcoa-axes";
+
+
+
+/*********************************************************************
+* ** SimkaCondensedMatrix
+*
+* Symmetric distance matrix of a Simka output, only the pairs i<j are stored, row after row.
+*********************************************************************/
+class SimkaCondensedMatrix{
+
+public:
+
+	SimkaCondensedMatrix(){
+		_nbBanks = 0;
+	}
+
+	/** Load a matrix written by simka. The matrix is symmetrized: the distance of a pair is the mean of its two values. */
+	bool load(const string& filename){
+
+		SimkaMatrixReader reader(filename);
+		if(!reader.isOpen()) return false;
+
+		_bankNames = reader._bankNames;
+		_nbBanks = _bankNames.size();
+		_values.assign((u_int64_t)_nbBanks * (_nbBanks - 1) / 2, 0);
+
+		string name;
+		vector<float> row;
+		for(size_t i=0; i<_nbBanks; i++){
+			if(!reader.readRow(name, row) || row.size() != _nbBanks){
+				cout << "Error: " << filename << " is not a square matrix (row " << i << ")" << endl;
+				exit(1);
+			}
+			for(size_t j=0; j<i; j++) _values[getIndex(j, i)] = (_values[getIndex(j, i)] + row[j]) / 2;
+			for(size_t j=i+1; j<_nbBanks; j++) _values[getIndex(i, j)] = row[j];
+		}
+
+		return true;
+	}
+
+	inline u_int64_t getIndex(size_t i, size_t j) const {
+		return (u_int64_t)i * (2*_nbBanks - i - 1) / 2 + (j - i - 1);
+	}
+
+	inline float get(size_t i, size_t j) const {
+		if(i == j) return 0;
+		return i < j ? _values[getIndex(i, j)] : _values[getIndex(j, i)];
+	}
+
+	inline void set(size_t i, size_t j, float value){
+		if(i < j) _values[getIndex(i, j)] = value;
+		else _values[getIndex(j, i)] = value;
+	}
+
+	size_t _nbBanks;
+	vector<string> _bankNames;
+	vector<float> _values;
+};
+
+
+
+/*********************************************************************
+* ** SimkaHclust
+*
+* Hierarchical clustering with the nearest-neighbor chain algorithm: O(N^2) time and no memory besides
+* the distance matrix, which is updated in place by the Lance-Williams formula. The linkages are those of
+* R hclust used by the visualization scripts: Ward (method "ward.D2") and average linkage (UPGMA, method
+* "average"), both give the same merges as the naive algorithm.
+*********************************************************************/
+class SimkaHclust{
+
+public:
+
+	enum Linkage{
+		WARD,
+		AVERAGE
+	};
+
+	struct Node{
+		size_t _left;
+		size_t _right;
+		double _height;
+	};
+
+	SimkaHclust(SimkaCondensedMatrix& matrix, Linkage linkage) : _matrix(matrix), _linkage(linkage){}
+
+	void execute(){
+
+		size_t nbBanks = _matrix._nbBanks;
+		_nodes.clear();
+		if(nbBanks < 2) return;
+
+		//Ward's criterion is updated on the squared distances
+		if(_linkage == WARD){
+			for(size_t i=0; i<_matrix._values.size(); i++) _matrix._values[i] *= _matrix._values[i];
+		}
+
+		//Slot i of the matrix holds the cluster of node _nodeIds[i], the leaves are the nodes 0 to nbBanks-1
+		vector<bool> isActive(nbBanks, true);
+		vector<size_t> sizes(nbBanks, 1);
+		vector<size_t> nodeIds(nbBanks);
+		for(size_t i=0; i<nbBanks; i++) nodeIds[i] = i;
+
+		vector<size_t> chain;
+		size_t firstActive = 0;
+
+		for(size_t nbMerges=0; nbMerges<nbBanks-1; nbMerges++){
+
+			if(chain.empty()){
+				while(!isActive[firstActive]) firstActive += 1;
+				chain.push_back(firstActive);
+			}
+
+			size_t a;
+			size_t b;
+
+			//The chain grows until its two last clusters are reciprocal nearest neighbors
+			while(true){
+
+				a = chain.back();
+				size_t previous = chain.size() > 1 ? chain[chain.size()-2] : a;
+
+				b = previous;
+				float minDistance = (previous != a) ? _matrix.get(a, previous) : numeric_limits<float>::max();
+				for(size_t k=0; k<nbBanks; k++){
+					if(!isActive[k] || k == a) continue;
+					float distance = _matrix.get(a, k);
+					if(distance < minDistance){
+						minDistance = distance;
+						b = k;
+					}
+				}
+
+				if(b == previous) break;
+				chain.push_back(b);
+			}
+
+			chain.pop_back();
+			chain.pop_back();
+
+			//The merged cluster takes the slot of b. The height of a node is half of its merge distance (the
+			//height of hclust), so that the tree is ultrametric with the distances between the leaves.
+			double distanceAB = _matrix.get(a, b);
+			Node node;
+			node._left = nodeIds[a];
+			node._right = nodeIds[b];
+			node._height = (_linkage == WARD ? sqrt(max(distanceAB, 0.0)) : distanceAB) / 2;
+			_nodes.push_back(node);
+
+			double sizeA = sizes[a];
+			double sizeB = sizes[b];
+			for(size_t k=0; k<nbBanks; k++){
+				if(!isActive[k] || k == a || k == b) continue;
+				if(_linkage == WARD){
+					double sizeK = sizes[k];
+					_matrix.set(b, k, ((sizeA + sizeK) * _matrix.get(a, k) + (sizeB + sizeK) * _matrix.get(b, k) - sizeK * distanceAB) / (sizeA + sizeB + sizeK));
+				}
+				else{
+					_matrix.set(b, k, (sizeA * _matrix.get(a, k) + sizeB * _matrix.get(b, k)) / (sizeA + sizeB));
+				}
+			}
+
+			isActive[a] = false;
+			sizes[b] += sizes[a];
+			nodeIds[b] = nbBanks + _nodes.size() - 1;
+		}
+	}
+
+	/** Rooted tree in Newick format, the branch lengths are the differences of the heights of the nodes */
+	string toNewick(){
+
+		size_t nbBanks = _matrix._nbBanks;
+		if(nbBanks == 0) return ";\n";
+		if(nbBanks == 1) return getName(0) + ";\n";
+
+		string str;
+
+		//Depth-first traversal with an explicit stack, the tree of a chain of merges is as deep as the number of banks
+		//(node, number of children already written)
+		vector<pair<size_t, int> > stack;
+		stack.push_back(pair<size_t, int>(nbBanks + _nodes.size() - 1, 0));
+
+		while(!stack.empty()){
+
+			size_t nodeId = stack.back().first;
+			int state = stack.back().second;
+
+			if(nodeId < nbBanks){
+				str += getName(nodeId);
+				stack.pop_back();
+				writeBranchLength(str, stack, nodeId);
+				continue;
+			}
+
+			const Node& node = _nodes[nodeId - nbBanks];
+
+			if(state == 0){
+				str += "(";
+				stack.back().second = 1;
+				stack.push_back(pair<size_t, int>(node._left, 0));
+			}
+			else if(state == 1){
+				str += ",";
+				stack.back().second = 2;
+				stack.push_back(pair<size_t, int>(node._right, 0));
+			}
+			else{
+				str += ")";
+				stack.pop_back();
+				writeBranchLength(str, stack, nodeId);
+			}
+		}
+
+		return str + ";\n";
+	}
+
+private:
+
+	double getHeight(size_t nodeId){
+		return nodeId < _matrix._nbBanks ? 0 : _nodes[nodeId - _matrix._nbBanks]._height;
+	}
+
+	void writeBranchLength(string& str, const vector<pair<size_t, int> >& stack, size_t nodeId){
+		if(stack.empty()) return;
+		double length = getHeight(stack.back().first) - getHeight(nodeId);
+		//Enough digits for the tree to be ultrametric for R (ape is.ultrametric)
+		str += ":" + Stringify::format("%.12g", max(length, 0.0));
+	}
+
+	/** Names with Newick special characters are quoted */
+	string getName(size_t i){
+		const string& name = _matrix._bankNames[i];
+		if(name.find_first_of(" \t()[]':;,") == string::npos) return name;
+
+		string quoted = "'";
+		for(size_t c=0; c<name.size(); c++){
+			if(name[c] == '\'') quoted += "'";
+			quoted += name[c];
+		}
+		return quoted + "'";
+	}
+
+	SimkaCondensedMatrix& _matrix;
+	Linkage _linkage;
+	vector<Node> _nodes; //node nbBanks+i is _nodes[i], the root is the last one
+};
+
+
+
+/** Product of the squared distance matrix and a block of vectors (N x nbVectors, row-major), for the rows
+ * threadId, threadId+nbThreads... Each pair i<j is read once and added to the rows i and j of the result
+ * of the thread. */
+class SimkaSquaredDistanceProductCommand : public ICommand
+{
+public:
+
+	SimkaSquaredDistanceProductCommand(const SimkaCondensedMatrix& matrix, const vector<double>& vectors, size_t nbVectors, size_t threadId, size_t nbThreads, vector<double>& result) :
+		_matrix(matrix), _vectors(vectors), _result(result)
+	{
+		_nbVectors = nbVectors;
+		_threadId = threadId;
+		_nbThreads = nbThreads;
+	}
+
+	void execute(){
+
+		size_t nbBanks = _matrix._nbBanks;
+		_result.assign(nbBanks * _nbVectors, 0);
+
+		for(size_t i=_threadId; i<nbBanks; i+=_nbThreads){
+
+			const double* vectorI = &_vectors[i * _nbVectors];
+			double* resultI = &_result[i * _nbVectors];
+			const float* distances = nbBanks > i+1 ? &_matrix._values[_matrix.getIndex(i, i+1)] : 0;
+
+			for(size_t j=i+1; j<nbBanks; j++){
+
+				double distance = distances[j-i-1];
+				double squared = distance * distance;
+				const double* vectorJ = &_vectors[j * _nbVectors];
+				double* resultJ = &_result[j * _nbVectors];
+
+				for(size_t c=0; c<_nbVectors; c++){
+					resultI[c] += squared * vectorJ[c];
+					resultJ[c] += squared * vectorI[c];
+				}
+			}
+		}
+	}
+
+	void use () {}
+	void forget () {}
+
+private:
+
+	const SimkaCondensedMatrix& _matrix;
+	const vector<double>& _vectors;
+	vector<double>& _result;
+	size_t _nbVectors;
+	size_t _threadId;
+	size_t _nbThreads;
+};
+
+
+
+/*********************************************************************
+* ** SimkaPcoa
+*
+* Principal coordinates analysis (classical MDS) of a distance matrix. The first eigenvectors of the
+* double centered matrix B = -1/2 J D^2 J are computed by a randomized truncated eigensolver: B is
+* only used through products with a few vectors, without being stored, and the products are split
+* between the threads.
+*********************************************************************/
+class SimkaPcoa{
+
+public:
+
+	SimkaPcoa(const SimkaCondensedMatrix& matrix, size_t nbAxes, IDispatcher* dispatcher) : _matrix(matrix), _dispatcher(dispatcher){
+		_nbBanks = matrix._nbBanks;
+		_nbAxes = min(nbAxes, _nbBanks);
+	}
+
+	void execute(){
+
+		size_t nbVectors = min(_nbAxes + SIMKA_ANALYZE_OVERSAMPLING, _nbBanks);
+
+		//Row means of D^2 and their mean, for the double centering
+		vector<double> ones(_nbBanks, 1);
+		multiplySquaredDistances(ones, 1, _rowMeans);
+		_mean = 0;
+		for(size_t i=0; i<_nbBanks; i++){
+			_rowMeans[i] /= _nbBanks;
+			_mean += _rowMeans[i] / _nbBanks;
+		}
+
+		//Random starting vectors, fixed seed so that the coordinates are the same for the same matrix
+		vector<double> basis(_nbBanks * nbVectors);
+		u_int64_t seed = 0x9e3779b97f4a7c15ULL;
+		for(size_t i=0; i<basis.size(); i++){
+			seed ^= seed << 13;
+			seed ^= seed >> 7;
+			seed ^= seed << 17;
+			basis[i] = (seed >> 11) * (2.0 / 9007199254740992.0) - 1;
+		}
+
+		vector<double> product;
+		multiplyCentered(basis, nbVectors, product);
+		orthonormalize(product, nbVectors);
+		basis.swap(product);
+
+		for(size_t iter=0; iter<SIMKA_ANALYZE_POWER_ITERATIONS; iter++){
+			multiplyCentered(basis, nbVectors, product);
+			orthonormalize(product, nbVectors);
+			basis.swap(product);
+		}
+
+		//Rayleigh-Ritz: eigen decomposition of the projection of B on the basis
+		multiplyCentered(basis, nbVectors, product);
+		vector<double> projection(nbVectors * nbVectors, 0);
+		for(size_t i=0; i<_nbBanks; i++){
+			for(size_t r=0; r<nbVectors; r++){
+				for(size_t c=0; c<nbVectors; c++){
+					projection[r*nbVectors + c] += basis[i*nbVectors + r] * product[i*nbVectors + c];
+				}
+			}
+		}
+		for(size_t r=0; r<nbVectors; r++){
+			for(size_t c=r+1; c<nbVectors; c++){
+				double value = (projection[r*nbVectors + c] + projection[c*nbVectors + r]) / 2;
+				projection[r*nbVectors + c] = value;
+				projection[c*nbVectors + r] = value;
+			}
+		}
+
+		vector<double> eigenValues;
+		vector<double> eigenVectors;
+		jacobi(projection, nbVectors, eigenValues, eigenVectors);
+
+		//Axes by decreasing eigenvalue
+		vector<pair<double, size_t> > order;
+		for(size_t c=0; c<nbVectors; c++) order.push_back(pair<double, size_t>(-eigenValues[c], c));
+		sort(order.begin(), order.end());
+
+		_eigenValues.resize(_nbAxes);
+		_coordinates.assign(_nbBanks * _nbAxes, 0);
+		for(size_t a=0; a<_nbAxes; a++){
+			size_t c = order[a].second;
+			_eigenValues[a] = eigenValues[c];
+			double scale = sqrt(max(eigenValues[c], 0.0));
+			for(size_t i=0; i<_nbBanks; i++){
+				double value = 0;
+				for(size_t r=0; r<nbVectors; r++) value += basis[i*nbVectors + r] * eigenVectors[r*nbVectors + c];
+				_coordinates[i*_nbAxes + a] = value * scale;
+			}
+		}
+
+		//The trace of B is the sum of all its eigenvalues
+		_trace = _nbBanks * _mean / 2;
+	}
+
+	/** Coordinates of the banks: one row per bank, one column per axis */
+	void writeCoordinates(const string& filename){
+
+		string str;
+		for(size_t a=0; a<_nbAxes; a++) str += ";PC" + SimkaAlgorithm<>::toString(a+1);
+		str += "\n";
+		for(size_t i=0; i<_nbBanks; i++){
+			str += _matrix._bankNames[i];
+			for(size_t a=0; a<_nbAxes; a++) str += ";" + Stringify::format("%g", _coordinates[i*_nbAxes + a]);
+			str += "\n";
+		}
+		writeFile(filename, str);
+	}
+
+	/** Eigenvalue of each axis and its percentage of the total variance */
+	void writeEigenValues(const string& filename){
+
+		string str = "axis;eigenvalue;percentage\n";
+		for(size_t a=0; a<_nbAxes; a++){
+			double percentage = _trace > 0 ? 100 * _eigenValues[a] / _trace : 0;
+			str += "PC" + SimkaAlgorithm<>::toString(a+1) + ";" + Stringify::format("%g", _eigenValues[a]) + ";" + Stringify::format("%g", percentage) + "\n";
+		}
+		writeFile(filename, str);
+	}
+
+private:
+
+	void writeFile(const string& filename, const string& str){
+		IFile* file = System::file().newFile(filename, "w");
+		file->fwrite(str.c_str(), str.size(), 1);
+		file->flush();
+		delete file;
+	}
+
+	void multiplySquaredDistances(const vector<double>& vectors, size_t nbVectors, vector<double>& result){
+
+		size_t nbThreads = _dispatcher->getExecutionUnitsNumber();
+		vector<vector<double> > results(nbThreads);
+
+		vector<ICommand*> cmds;
+		for(size_t t=0; t<nbThreads; t++){
+			cmds.push_back(new SimkaSquaredDistanceProductCommand(_matrix, vectors, nbVectors, t, nbThreads, results[t]));
+		}
+		_dispatcher->dispatchCommands(cmds, 0);
+		for(size_t t=0; t<cmds.size(); t++) delete cmds[t];
+
+		result.swap(results[0]);
+		for(size_t t=1; t<nbThreads; t++){
+			for(size_t i=0; i<result.size(); i++) result[i] += results[t][i];
+		}
+	}
+
+	/** B X = -1/2 (D^2 X - r 1'X - 1 r'X + m 1 1'X), r the row means of D^2 and m their mean */
+	void multiplyCentered(const vector<double>& vectors, size_t nbVectors, vector<double>& result){
+
+		multiplySquaredDistances(vectors, nbVectors, result);
+
+		vector<double> sums(nbVectors, 0);
+		vector<double> rowMeanSums(nbVectors, 0);
+		for(size_t i=0; i<_nbBanks; i++){
+			for(size_t c=0; c<nbVectors; c++){
+				sums[c] += vectors[i*nbVectors + c];
+				rowMeanSums[c] += _rowMeans[i] * vectors[i*nbVectors + c];
+			}
+		}
+
+		for(size_t i=0; i<_nbBanks; i++){
+			for(size_t c=0; c<nbVectors; c++){
+				double& value = result[i*nbVectors + c];
+				value = -0.5 * (value - _rowMeans[i] * sums[c] - rowMeanSums[c] + _mean * sums[c]);
+			}
+		}
+	}
+
+	/** Modified Gram-Schmidt on the columns, a column in the span of the previous ones is set to 0 */
+	void orthonormalize(vector<double>& vectors, size_t nbVectors){
+
+		for(size_t c=0; c<nbVectors; c++){
+
+			for(size_t p=0; p<c; p++){
+				double dot = 0;
+				for(size_t i=0; i<_nbBanks; i++) dot += vectors[i*nbVectors + c] * vectors[i*nbVectors + p];
+				for(size_t i=0; i<_nbBanks; i++) vectors[i*nbVectors + c] -= dot * vectors[i*nbVectors + p];
+			}
+
+			double norm = 0;
+			for(size_t i=0; i<_nbBanks; i++) norm += vectors[i*nbVectors + c] * vectors[i*nbVectors + c];
+			norm = sqrt(norm);
+			for(size_t i=0; i<_nbBanks; i++) vectors[i*nbVectors + c] = norm > 1e-12 ? vectors[i*nbVectors + c] / norm : 0;
+		}
+	}
+
+	/** Eigen decomposition of a small symmetric matrix (cyclic Jacobi), the eigenvectors are the columns of vectors */
+	void jacobi(vector<double> matrix, size_t n, vector<double>& values, vector<double>& vectors){
+
+		vector<double>& a = matrix;
+		vectors.assign(n * n, 0);
+		for(size_t i=0; i<n; i++) vectors[i*n + i] = 1;
+
+		for(size_t sweep=0; sweep<SIMKA_ANALYZE_JACOBI_MAX_SWEEPS; sweep++){
+
+			double offDiagonal = 0;
+			for(size_t p=0; p<n; p++)
+				for(size_t q=p+1; q<n; q++)
+					offDiagonal += a[p*n + q] * a[p*n + q];
+			if(offDiagonal < 1e-22) break;
+
+			for(size_t p=0; p<n; p++){
+				for(size_t q=p+1; q<n; q++){
+
+					if(fabs(a[p*n + q]) < 1e-300) continue;
+
+					double theta = (a[q*n + q] - a[p*n + p]) / (2 * a[p*n + q]);
+					double t = (theta >= 0 ? 1 : -1) / (fabs(theta) + sqrt(theta*theta + 1));
+					double c = 1 / sqrt(t*t + 1);
+					double s = t * c;
+
+					for(size_t k=0; k<n; k++){
+						double akp = a[k*n + p];
+						double akq = a[k*n + q];
+						a[k*n + p] = c*akp - s*akq;
+						a[k*n + q] = s*akp + c*akq;
+					}
+					for(size_t k=0; k<n; k++){
+						double apk = a[p*n + k];
+						double aqk = a[q*n + k];
+						a[p*n + k] = c*apk - s*aqk;
+						a[q*n + k] = s*apk + c*aqk;
+					}
+					for(size_t k=0; k<n; k++){
+						double vkp = vectors[k*n + p];
+						double vkq = vectors[k*n + q];
+						vectors[k*n + p] = c*vkp - s*vkq;
+						vectors[k*n + q] = s*vkp + c*vkq;
+					}
+				}
+			}
+		}
+
+		values.resize(n);
+		for(size_t i=0; i<n; i++) values[i] = a[i*n + i];
+	}
+
+	const SimkaCondensedMatrix& _matrix;
+	IDispatcher* _dispatcher;
+	size_t _nbBanks;
+	size_t _nbAxes;
+	vector<double> _rowMeans;
+	double _mean;
+	double _trace;
+	vector<double> _eigenValues;
+	vector<double> _coordinates;
+};
+
+
+
+
+
+class SimkaAnalyze : public Tool
+{
+public:
+
+	SimkaAnalyze () : Tool ("SimkaAnalyze")
+    {
+        getParser()->push_back (new OptionOneParam (STR_URI_INPUT,   "distance matrix of simka (.csv.gz), or simka output dir to analyze all its matrices", true));
+        getParser()->push_back (new OptionOneParam (STR_URI_OUTPUT,   "output dir", true));
+        getParser()->push_back (new OptionNoParam (STR_SIMKA_ANALYZE_TREE,   "hierarchical clustering, written as a Newick tree: hclust_<distance>.newick", false));
+        getParser()->push_back (new OptionOneParam (STR_SIMKA_ANALYZE_LINKAGE,   "linkage of the clustering: ward (as the visualization scripts, R hclust ward.D2) or average (UPGMA)", false, "ward"));
+        getParser()->push_back (new OptionNoParam (STR_SIMKA_ANALYZE_PCOA,   "principal coordinates analysis: pcoa_<distance>.csv and pcoa_<distance>_eigenvalues.csv", false));
+        getParser()->push_back (new OptionOneParam (STR_SIMKA_ANALYZE_PCOA_AXES,   "nb axes of the PCoA", false, "3"));
+    }
+
+    void execute ()
+    {
+    	string input = getInput()->getStr(STR_URI_INPUT);
+    	string outputDir = getInput()->getStr(STR_URI_OUTPUT);
+    	bool computeTree = getInput()->get(STR_SIMKA_ANALYZE_TREE) != 0;
+    	bool computePcoa = getInput()->get(STR_SIMKA_ANALYZE_PCOA) != 0;
+    	size_t nbAxes = getInput()->getInt(STR_SIMKA_ANALYZE_PCOA_AXES);
+    	string linkageName = getInput()->getStr(STR_SIMKA_ANALYZE_LINKAGE);
+
+    	SimkaHclust::Linkage linkage;
+    	if(linkageName == "ward") linkage = SimkaHclust::WARD;
+    	else if(linkageName == "average") linkage = SimkaHclust::AVERAGE;
+    	else{
+    		cout << "Error: unknown linkage " << linkageName << " (ward or average)" << endl;
+    		exit(1);
+    	}
+
+    	if(!computeTree && !computePcoa){
+    		computeTree = true;
+    		computePcoa = true;
+    	}
+
+    	//The asymmetric matrices are skipped, as by the visualization scripts
+    	vector<string> filenames;
+    	string suffix = ".csv.gz";
+    	if(input.size() <= suffix.size() || input.compare(input.size() - suffix.size(), suffix.size(), suffix) != 0){
+    		vector<string> names = System::file().listdir(input);
+    		sort(names.begin(), names.end());
+    		for(size_t i=0; i<names.size(); i++){
+    			const string& name = names[i];
+    			if(name.compare(0, 4, "mat_") != 0 || name.find("_asym") != string::npos) continue;
+    			if(name.size() <= suffix.size() || name.compare(name.size() - suffix.size(), suffix.size(), suffix) != 0) continue;
+    			filenames.push_back(input + "/" + name);
+    		}
+    	}
+    	else{
+    		filenames.push_back(input);
+    	}
+
+    	System::file().mkdir(outputDir, -1);
+    	if(computeTree) cout << "Clustering: " << (linkage == SimkaHclust::WARD ? "ward (R hclust ward.D2)" : "average linkage (UPGMA)") << endl;
+
+    	for(size_t i=0; i<filenames.size(); i++){
+
+    		string name = System::file().getBaseName(filenames[i]);
+    		if(name.size() > suffix.size() && name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0) name = name.substr(0, name.size() - suffix.size());
+    		if(name.compare(0, 4, "mat_") == 0) name = name.substr(4);
+
+    		cout << name << endl;
+
+    		SimkaCondensedMatrix matrix;
+    		if(!matrix.load(filenames[i])){
+    			cout << "Error: can't open matrix " << filenames[i] << endl;
+    			exit(1);
+    		}
+
+    		//The PCoA is computed first, the clustering updates the matrix in place
+    		if(computePcoa){
+    			SimkaPcoa pcoa(matrix, nbAxes, getDispatcher());
+    			pcoa.execute();
+    			pcoa.writeCoordinates(outputDir + "/pcoa_" + name + ".csv");
+    			pcoa.writeEigenValues(outputDir + "/pcoa_" + name + "_eigenvalues.csv");
+    		}
+
+    		if(computeTree){
+    			SimkaHclust hclust(matrix, linkage);
+    			hclust.execute();
+    			string newick = hclust.toNewick();
+
+    			IFile* file = System::file().newFile(outputDir + "/hclust_" + name + ".newick", "w");
+    			file->fwrite(newick.c_str(), newick.size(), 1);
+    			file->flush();
+    			delete file;
+    		}
+    	}
+    }
+};
+
+
+int main (int argc, char* argv[])
+{
+    try
+    {
+    	SimkaAnalyze().run (argc, argv);
+    }
+    catch (Exception& e)
+    {
+        std::cout << "EXCEPTION: " << e.getMessage() << std::endl;
+        return EXIT_FAILURE;
+    }
+}
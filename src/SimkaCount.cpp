@@ -20,6 +20,11 @@
 
 #include "SimkaPotara.hpp"
 #include "minikc/MiniKC.hpp"
+#include <zlib.h>
+#include <gatb/bank/impl/BankComposite.hpp>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 //#include <gatb/gatb_core.hpp>
 
 // We use the required packages
@@ -35,33 +40,1015 @@ using namespace std;
 
 
 
-template<typename Filter> class SimkaPotaraBankFiltered : public BankDelegate
+#define SIMKA_SUBSAMPLE_BLOCK_SIZE 1048576 //Bytes of an input file sampled at once with -subsample-mode block
+#define SIMKA_GZ_CHUNK_SIZE 4194304 //Bytes of gzip input decompressed at once by a thread
+#define SIMKA_GZ_QUEUE_SIZE 16 //Chunks of gzip input decompressed ahead of the counting
+#define SIMKA_GZ_MAX_THREADS 8 //Threads decompressing a bgzip input
+
+static bool isBgzfHeader(const unsigned char* header, size_t size){
+	return size >= 18 && header[0] == 0x1f && header[1] == 0x8b && header[2] == 8 && (header[3] & 4) &&
+			header[10] == 6 && header[11] == 0 && header[12] == 'B' && header[13] == 'C' && header[14] == 2 && header[15] == 0;
+}
+
+static u_int64_t getBgzfBlockSize(const unsigned char* header){
+	return (header[16] | (header[17] << 8)) + 1;
+}
+
+/** Appends to data the decompressed content of a BGZF block */
+static bool inflateBgzfBlock(const unsigned char* block, u_int64_t blockSize, string& data){
+
+	u_int32_t size = block[blockSize-4] | (block[blockSize-3] << 8) | (block[blockSize-2] << 16) | ((u_int32_t)block[blockSize-1] << 24);
+	if(size == 0) return true;
+
+	size_t start = data.size();
+	data.resize(start + size);
+
+	z_stream stream;
+	memset(&stream, 0, sizeof(stream));
+	if(inflateInit2(&stream, -15) != Z_OK) return false;
+	stream.next_in = (Bytef*) &block[18];
+	stream.avail_in = blockSize - 18 - 8;
+	stream.next_out = (Bytef*) &data[start];
+	stream.avail_out = size;
+	int ret = inflate(&stream, Z_FINISH);
+	inflateEnd(&stream);
+
+	return ret == Z_STREAM_END;
+}
+
+/** Uniform subsample of the reads of a fasta/fastq file, uncompressed or BGZF (block gzip). The file is split in
+ * blocks of SIMKA_SUBSAMPLE_BLOCK_SIZE bytes, chosen uniformly at random, and only the chosen blocks are read: the
+ * reads starting in a block are kept, after a resynchronization on the first read boundary of the block.
+ * In a BGZF file, the reads of a block are those of the BGZF blocks starting in it.
+ * Plain gzip files can't be seeked, they are not seekable for the sampler. */
+class SimkaBlockSampler
 {
 public:
 
-	Iterator<Sequence>* _it;
+	SimkaBlockSampler(const string& filename) : _isBgzf(false), _isSeekable(false), _isFastq(false), _fileSize(0) {
 
-	SimkaPotaraBankFiltered (IBank* ref, const Filter& filter, u_int64_t maxReads, size_t nbDatasets) : BankDelegate (ref), _filter(filter)  {
-		//_nbReadsPerDataset = nbReadsPerDataset;
-		_maxReads = maxReads;
-		_nbDatasets = nbDatasets;
+		_file = fopen(filename.c_str(), "rb");
+		if(_file == 0) return;
+
+		fseeko(_file, 0, SEEK_END);
+		_fileSize = ftello(_file);
+
+		unsigned char header[18];
+		fseeko(_file, 0, SEEK_SET);
+		size_t size = fread(header, 1, 18, _file);
+
+		string data;
+		if(size >= 2 && header[0] == 0x1f && header[1] == 0x8b){
+			u_int64_t blockSize;
+			_isBgzf = isBgzfHeader(header, size) && readBgzfBlock(0, data, blockSize);
+		}
+		else{
+			data = string((char*)header, size);
+		}
+
+		//The first read gives the format, other files are read as usual
+		_isFastq = data.size() > 0 && data[0] == '@';
+		_isSeekable = data.size() > 0 && (data[0] == '>' || data[0] == '@');
+	}
+
+	~SimkaBlockSampler(){
+		if(_file != 0) fclose(_file);
+	}
+
+	bool isSeekable() const { return _isSeekable; }
+	bool isFastq() const { return _isFastq; }
+
+	/** Writes to output the reads of a fraction of the blocks of the file. Selection sampling (Knuth, algorithm S),
+	 * the blocks are read in the order of the file. Returns the number of reads written. */
+	u_int64_t sample(double fraction, u_int64_t seed, FILE* output){
+
+		u_int64_t nbBlocks = (_fileSize + SIMKA_SUBSAMPLE_BLOCK_SIZE - 1) / SIMKA_SUBSAMPLE_BLOCK_SIZE;
+		u_int64_t nbSampledBlocks = ceil(fraction * nbBlocks);
+		nbSampledBlocks = max(min(nbSampledBlocks, nbBlocks), (u_int64_t)1);
+
+		u_int64_t nbReads = 0;
+		for(u_int64_t b=0; b<nbBlocks && nbSampledBlocks>0; b++){
+
+			seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+			double r = (seed >> 11) * (1.0 / 9007199254740992.0);
+
+			if(r * (nbBlocks - b) < nbSampledBlocks){
+				nbReads += sampleBlock(b, output);
+				nbSampledBlocks -= 1;
+			}
+		}
+
+		return nbReads;
+	}
+
+private:
+
+	u_int64_t sampleBlock(u_int64_t blockId, FILE* output){
+
+		u_int64_t blockStart = blockId * SIMKA_SUBSAMPLE_BLOCK_SIZE;
+		_blockEnd = blockStart + SIMKA_SUBSAMPLE_BLOCK_SIZE;
+		_buffer.clear();
+		_bufferPos = 0;
+		_blockLimit = 0;
+
+		if(blockId == 0)
+			_nextOffset = 0;
+		else if(_isBgzf)
+			_nextOffset = findBgzfBlock(blockStart);
+		else
+			_nextOffset = blockStart - 1; //A read starting right at the block start follows the last byte of the previous block
+
+		if(_nextOffset >= _blockEnd || !load()) return 0;
+
+		size_t begin, end;
+		if(blockId > 0 && !nextLine(begin, end)) return 0;
+		if(!findRead()) return 0;
+
+		u_int64_t nbReads = 0;
+		while(isInBlock()){
+
+			//Lines of the reads already written are dropped
+			if(_bufferPos > SIMKA_SUBSAMPLE_BLOCK_SIZE){
+				_buffer.erase(0, _bufferPos);
+				_blockLimit = (_blockLimit > _bufferPos) ? _blockLimit - _bufferPos : 0;
+				_bufferPos = 0;
+			}
+
+			if(_isFastq){
+				for(size_t i=0; i<4 && nextLine(begin, end); i++) writeLine(begin, end, output);
+			}
+			else{
+				if(!nextLine(begin, end)) break;
+				writeLine(begin, end, output);
+				char c;
+				while(peekChar(c) && c != '>' && nextLine(begin, end)){
+					writeLine(begin, end, output);
+				}
+			}
+
+			nbReads += 1;
+		}
+
+		return nbReads;
+	}
+
+	/** Moves to the first read starting at or after the current line */
+	bool findRead(){
+
+		size_t begin, end;
+		while(isInBlock()){
+
+			size_t pos = _bufferPos;
+			if(!_isFastq){
+				if(_buffer[_bufferPos] == '>') return true;
+			}
+			else if(_buffer[_bufferPos] == '@'){
+				//A quality line can start with '@' too: the header is followed by a sequence, a '+' line and a quality of the same size
+				size_t begins[4], ends[4];
+				size_t i = 0;
+				while(i < 4 && nextLine(begins[i], ends[i])) i += 1;
+				_bufferPos = pos;
+				if(i == 4 && _buffer[begins[2]] == '+' && ends[1]-begins[1] == ends[3]-begins[3]) return true;
+			}
+
+			if(!nextLine(begin, end)) return false;
+		}
+
+		return false;
+	}
+
+	/** Character at the current position, loads the next data if needed */
+	bool peekChar(char& c){
+		while(_bufferPos >= _buffer.size()){
+			if(!load()) return false;
+		}
+		c = _buffer[_bufferPos];
+		return true;
+	}
+
+	/** The current position is a read of the sampled block */
+	bool isInBlock(){
+		char c;
+		return peekChar(c) && _bufferPos < _blockLimit;
+	}
+
+	bool nextLine(size_t& begin, size_t& end){
+
+		size_t from = _bufferPos;
+		while(true){
+			size_t eol = _buffer.find('\n', from);
+			if(eol != string::npos){
+				begin = _bufferPos;
+				end = eol;
+				_bufferPos = eol + 1;
+				return true;
+			}
+			from = _buffer.size();
+			if(!load()){
+				if(_bufferPos >= _buffer.size()) return false;
+				begin = _bufferPos;
+				end = _buffer.size();
+				_bufferPos = end;
+				return true;
+			}
+		}
+	}
+
+	void writeLine(size_t begin, size_t end, FILE* output){
+		if(end > begin && _buffer[end-1] == '\r') end -= 1;
+		fwrite(_buffer.data() + begin, 1, end - begin, output);
+		fputc('\n', output);
+	}
+
+	/** Appends the next data of the file to the buffer: SIMKA_SUBSAMPLE_BLOCK_SIZE bytes, or a BGZF block */
+	bool load(){
+
+		if(_nextOffset >= _fileSize) return false;
+
+		size_t start = _buffer.size();
+
+		if(_isBgzf){
+			string data;
+			u_int64_t blockSize;
+			if(!readBgzfBlock(_nextOffset, data, blockSize)) return false;
+			_buffer += data;
+			if(_nextOffset < _blockEnd) _blockLimit = _buffer.size();
+			_nextOffset += blockSize;
+		}
+		else{
+			size_t size = min((u_int64_t)SIMKA_SUBSAMPLE_BLOCK_SIZE, _fileSize - _nextOffset);
+			_buffer.resize(start + size);
+			fseeko(_file, _nextOffset, SEEK_SET);
+			size = fread(&_buffer[start], 1, size, _file);
+			_buffer.resize(start + size);
+			if(size == 0) return false;
+			if(_nextOffset < _blockEnd) _blockLimit = start + min((u_int64_t)size, _blockEnd - _nextOffset);
+			_nextOffset += size;
+		}
+
+		return true;
+	}
+
+	bool readBgzfBlock(u_int64_t offset, string& data, u_int64_t& blockSize){
+
+		unsigned char header[18];
+		fseeko(_file, offset, SEEK_SET);
+		if(fread(header, 1, 18, _file) != 18 || !isBgzfHeader(header, 18)) return false;
+
+		blockSize = getBgzfBlockSize(header);
+		if(blockSize < 26) return false;
+
+		vector<unsigned char> compressed(blockSize);
+		fseeko(_file, offset, SEEK_SET);
+		if(fread(&compressed[0], 1, blockSize, _file) != blockSize) return false;
+
+		data.clear();
+		return inflateBgzfBlock(&compressed[0], blockSize, data);
+	}
+
+	/** Offset of the first BGZF block starting at or after offset (BGZF blocks are at most 64 KB) */
+	u_int64_t findBgzfBlock(u_int64_t offset){
+
+		vector<unsigned char> window(65536 + 18);
+		fseeko(_file, offset, SEEK_SET);
+		size_t size = fread(&window[0], 1, window.size(), _file);
+
+		for(size_t i=0; i+18<=size; i++){
+			if(!isBgzfHeader(&window[i], 18)) continue;
+			string data;
+			u_int64_t blockSize;
+			if(readBgzfBlock(offset + i, data, blockSize)) return offset + i;
+		}
+
+		return _fileSize;
+	}
+
+	FILE* _file;
+	bool _isBgzf;
+	bool _isSeekable;
+	bool _isFastq;
+	u_int64_t _fileSize;
+
+	//Reading of a sampled block
+	string _buffer; //data of the file from the block start, decompressed for BGZF
+	size_t _bufferPos;
+	size_t _blockLimit; //the reads starting before this position of the buffer are in the block
+	u_int64_t _blockEnd;
+	u_int64_t _nextOffset; //file offset of the next data to load
+};
+
+
+/** Next occurrence of c in [begin, end), or end. Compares 16 characters at once with SSE2 */
+static inline const char* simkaFindChar(const char* begin, const char* end, char c){
+#ifdef __SSE2__
+	__m128i pattern = _mm_set1_epi8(c);
+	while(begin + 16 <= end){
+		int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)begin), pattern));
+		if(mask != 0) return begin + __builtin_ctz(mask);
+		begin += 16;
+	}
+#endif
+	while(begin < end && *begin != c) begin += 1;
+	return begin;
+}
+
+/** Splits fasta or fastq data in reads. The comment of each read is copied, its sequence is given as a reference
+ * into the parsed buffer, or as a copy without line breaks if it spans several lines. The qualities are not kept. */
+class SimkaReadParser
+{
+public:
+
+	SimkaReadParser(const string& filename, bool isFastq) : _filename(filename), _isFastq(isFastq), _end(0) {}
+
+	void setFastq(bool isFastq){ _isFastq = isFastq; }
+
+	/** Parses the read starting at pos into seq and moves pos after it. Returns false if there is no complete read
+	 * in [pos, end). If isLast is false, the data continue after end and a read ending at end is incomplete. */
+	bool next(const char*& pos, const char* end, bool isLast, Sequence& seq){
+		_end = end;
+		const char* p = pos;
+		if(!(_isFastq ? nextFastq(p, isLast, seq) : nextFasta(p, isLast, seq))) return false;
+		pos = p;
+		return true;
+	}
+
+private:
+
+	const char* lineEnd(const char* pos){ return simkaFindChar(pos, _end, '\n'); }
+	const char* nextLine(const char* pos){ pos = lineEnd(pos); return pos < _end ? pos + 1 : _end; }
+	const char* trimCR(const char* begin, const char* end){ return (end > begin && end[-1] == '\r') ? end - 1 : end; }
+
+	void setComment(Sequence& seq, const char* begin){
+		seq._comment.assign(begin + 1, trimCR(begin + 1, lineEnd(begin)) - (begin + 1));
+	}
+
+	/** Points the sequence to [begin, end), or to a copy without line breaks if the sequence has several lines */
+	void setSequence(Sequence& seq, const char* begin, const char* end){
+
+		const char* firstLineEnd = lineEnd(begin);
+		if(firstLineEnd >= end - 1){
+			seq.getData().setRef((char*)begin, trimCR(begin, min(firstLineEnd, end)) - begin);
+			return;
+		}
+
+		_buffer.clear();
+		while(begin < end){
+			const char* e = min(lineEnd(begin), end);
+			_buffer.append(begin, trimCR(begin, e) - begin);
+			begin = e + 1;
+		}
+		seq.getData().setRef((char*)_buffer.data(), _buffer.size());
+	}
+
+	bool nextFasta(const char*& pos, bool isLast, Sequence& seq){
+
+		while(pos < _end && *pos != '>') pos = nextLine(pos);
+		if(pos >= _end) return false;
+
+		const char* sequenceStart = nextLine(pos);
+
+		//'>' can only start a line, sequences don't contain it
+		const char* recordEnd = sequenceStart;
+		while(true){
+			recordEnd = simkaFindChar(recordEnd, _end, '>');
+			if(recordEnd == _end || recordEnd[-1] == '\n') break;
+			recordEnd += 1;
+		}
+		if(recordEnd == _end && !isLast) return false;
+
+		setComment(seq, pos);
+		setSequence(seq, sequenceStart, recordEnd);
+		pos = recordEnd;
+		return true;
 	}
 
+	bool nextFastq(const char*& pos, bool isLast, Sequence& seq){
+
+		while(pos < _end && (*pos == '\n' || *pos == '\r')) pos += 1;
+		if(pos >= _end) return false;
+
+		if(*pos != '@'){
+			cout << "Error: malformed fastq file " << _filename << endl;
+			exit(1);
+		}
+
+		const char* sequenceStart = nextLine(pos);
+
+		const char* sequenceEnd = sequenceStart;
+		u_int64_t sequenceSize = 0;
+		while(sequenceEnd < _end && *sequenceEnd != '+'){
+			const char* e = lineEnd(sequenceEnd);
+			sequenceSize += trimCR(sequenceEnd, e) - sequenceEnd;
+			sequenceEnd = e < _end ? e + 1 : _end;
+		}
+		if(lineEnd(sequenceEnd) == _end && !isLast) return false;
+
+		//The quality may span several lines and start with '@', its size is the one of the sequence
+		const char* recordEnd = nextLine(sequenceEnd);
+		u_int64_t qualitySize = 0;
+		while(recordEnd < _end && qualitySize < sequenceSize){
+			const char* e = lineEnd(recordEnd);
+			if(e == _end && !isLast) return false;
+			qualitySize += trimCR(recordEnd, e) - recordEnd;
+			recordEnd = e < _end ? e + 1 : _end;
+		}
+		if(qualitySize < sequenceSize && !isLast) return false;
 
-	~SimkaPotaraBankFiltered(){
-		delete _it;
+		setComment(seq, pos);
+		setSequence(seq, sequenceStart, sequenceEnd);
+		pos = recordEnd;
+		return true;
+	}
+
+	string _filename;
+	bool _isFastq;
+	const char* _end;
+	string _buffer;
+};
+
+/** Iterator of SimkaBankMmap, the reads are parsed from the mapping of the file */
+class SimkaBankMmapIterator : public Iterator<Sequence>
+{
+public:
+
+	SimkaBankMmapIterator(const string& filename, char* data, u_int64_t size, bool isFastq)
+	: _parser(filename, isFastq), _data(data), _end(data + size), _pos(data), _isDone(true), _index(0) {}
+
+	void first(){
+		_pos = _data;
+		_index = 0;
+		next();
+	}
+
+	void next(){
+		_isDone = !_parser.next(_pos, _end, true, *_item);
+		if(!_isDone) _item->setIndex(_index++);
+	}
+
+	bool isDone(){ return _isDone; }
+
+	/** Bytes of the file read so far */
+	u_int64_t getOffset() const { return _pos - _data; }
+
+private:
+
+	SimkaReadParser _parser;
+	const char* _data;
+	const char* _end;
+	const char* _pos;
+	bool _isDone;
+	size_t _index;
+};
+
+/** True if the file is a fasta or fastq file, uncompressed or gzip, given by its first character */
+static bool getInputFormat(const string& filename, bool& isGz, bool& isFastq){
+
+	FILE* file = fopen(filename.c_str(), "rb");
+	if(file == 0) return false;
+	unsigned char magic[2];
+	isGz = fread(magic, 1, 2, file) == 2 && magic[0] == 0x1f && magic[1] == 0x8b;
+	fclose(file);
+
+	gzFile gzfile = gzopen(filename.c_str(), "rb");
+	if(gzfile == 0) return false;
+	int c = gzgetc(gzfile);
+	gzclose(gzfile);
+
+	isFastq = (c == '@');
+	return c == '>' || c == '@';
+}
+
+/** Bank of an uncompressed fasta or fastq file read through a read-only memory mapping of the file, instead of the
+ * buffered line reader of BankFasta */
+class SimkaBankMmap : public AbstractBank
+{
+public:
+
+	SimkaBankMmap(const string& filename, bool isFastq) : _filename(filename), _data(0), _size(0), _isFastq(isFastq) {
+
+		int fd = open(filename.c_str(), O_RDONLY);
+		struct stat st;
+		if(fd < 0 || fstat(fd, &st) != 0){
+			cout << "Error: can't open input file " << filename << endl;
+			exit(1);
+		}
+
+		_size = st.st_size;
+		if(_size > 0){
+			void* data = mmap(0, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if(data == MAP_FAILED){
+				cout << "Error: can't map input file " << filename << endl;
+				exit(1);
+			}
+			_data = (char*) data;
+			madvise(_data, _size, MADV_SEQUENTIAL);
+		}
+		close(fd);
+	}
+
+	~SimkaBankMmap(){
+		if(_data != 0) munmap(_data, _size);
+	}
+
+	std::string getId(){ return _filename; }
+
+	int64_t getNbItems(){ return -1; }
+
+	void insert(const Sequence& item){ throw Exception("SimkaBankMmap: can't insert in an input file"); }
+
+	void flush(){}
+
+	u_int64_t getSize(){ return _size; }
+
+	void remove(){}
+
+	Iterator<Sequence>* iterator(){ return new SimkaBankMmapIterator(_filename, _data, _size, _isFastq); }
+
+	/** Same estimation as BankFasta: the first reads of the file are extrapolated to the size of the file */
+	void estimate(u_int64_t& number, u_int64_t& totalSize, u_int64_t& maxSize){
+
+		number = 0;
+		totalSize = 0;
+		maxSize = 0;
+
+		SimkaBankMmapIterator it(_filename, _data, _size, _isFastq);
+		for(it.first(); !it.isDone() && number < getEstimateThreshold(); it.next()){
+			u_int64_t size = it.item().getDataSize();
+			number += 1;
+			totalSize += size;
+			maxSize = max(maxSize, size);
+		}
+
+		if(!it.isDone() && it.getOffset() > 0){
+			double scale = (double)_size / it.getOffset();
+			number = number * scale;
+			totalSize = totalSize * scale;
+		}
+	}
+
+private:
+
+	string _filename;
+	char* _data;
+	u_int64_t _size;
+	bool _isFastq;
+};
+
+/** Reads an input file ahead of its parsing, in background threads. The BGZF blocks are inflated in parallel by
+ * nbThreads threads, the other gzip files (single or concatenated members) by a single thread. The data are given in
+ * order by chunks of about SIMKA_GZ_CHUNK_SIZE bytes, up to SIMKA_GZ_QUEUE_SIZE chunks are ready ahead.
+ * Streams (named pipes, or commands given as '<command') are read once from the start, gzip or not. */
+class SimkaInputReader
+{
+public:
+
+	SimkaInputReader(const string& filename, size_t nbThreads)
+	: _filename(filename), _isCommand(false), _isGz(false), _isBgzf(false), _in(SIMKA_GZ_CHUNK_SIZE), _isNewMember(false), _isStreamEnd(false), _chunks(SIMKA_GZ_QUEUE_SIZE), _isFilled(SIMKA_GZ_QUEUE_SIZE, false),
+	  _nbChunks(0), _nextChunk(0), _isEnd(false), _stop(false) {
+
+		bool isStream = SimkaDatasetInfo::isStream(filename);
+		_isCommand = (filename[0] == '<');
+		_file = _isCommand ? popen(filename.substr(1).c_str(), "r") : fopen(filename.c_str(), "rb");
+		if(_file == 0){
+			cout << "Error: can't open input " << filename << endl;
+			exit(1);
+		}
+
+		//The first bytes give the format, a stream can't be read again: they stay in the input buffer
+		memset(&_stream, 0, sizeof(_stream));
+		size_t size = fread(&_in[0], 1, 18, _file);
+		_isGz = size >= 2 && _in[0] == 0x1f && _in[1] == 0x8b;
+		_isBgzf = !isStream && isBgzfHeader(&_in[0], size);
+
+		if(_isBgzf){
+			fseeko(_file, 0, SEEK_SET);
+		}
+		else{
+			nbThreads = 1;
+			_stream.next_in = &_in[0];
+			_stream.avail_in = size;
+			if(_isGz) inflateInit2(&_stream, 15 + 16);
+		}
+
+		pthread_mutex_init(&_readMutex, NULL);
+		pthread_mutex_init(&_mutex, NULL);
+		pthread_cond_init(&_chunkFilled, NULL);
+		pthread_cond_init(&_chunkFreed, NULL);
+
+		_threads.resize(nbThreads);
+		for(size_t i=0; i<nbThreads; i++){
+			pthread_create(&_threads[i], NULL, &SimkaInputReader::run, this);
+		}
+	}
+
+	/** Stops the reading threads, also when the file is not read until its end (-max-reads) */
+	~SimkaInputReader(){
+
+		pthread_mutex_lock(&_mutex);
+		_stop = true;
+		pthread_cond_broadcast(&_chunkFreed);
+		pthread_mutex_unlock(&_mutex);
+
+		for(size_t i=0; i<_threads.size(); i++){
+			pthread_join(_threads[i], NULL);
+		}
+
+		if(_isGz && !_isBgzf) inflateEnd(&_stream);
+		pthread_cond_destroy(&_chunkFilled);
+		pthread_cond_destroy(&_chunkFreed);
+		pthread_mutex_destroy(&_mutex);
+		pthread_mutex_destroy(&_readMutex);
+
+		if(_isCommand){
+			//A command stopped before the end of its output exits on a broken pipe
+			int status = pclose(_file);
+			if(_isEnd && status != 0){
+				cout << "Error: input command " << _filename.substr(1) << " failed" << endl;
+				exit(1);
+			}
+		}
+		else{
+			fclose(_file);
+		}
+	}
+
+	/** Next chunk of the decompressed file. Returns false at the end of the file */
+	bool nextChunk(string& chunk){
+
+		pthread_mutex_lock(&_mutex);
+
+		size_t slot = _nextChunk % SIMKA_GZ_QUEUE_SIZE;
+		while(!_isFilled[slot] && !(_isEnd && _nextChunk >= _nbChunks)){
+			pthread_cond_wait(&_chunkFilled, &_mutex);
+		}
+
+		bool isFilled = _isFilled[slot];
+		if(isFilled){
+			chunk.swap(_chunks[slot]);
+			_isFilled[slot] = false;
+			_nextChunk += 1;
+			pthread_cond_broadcast(&_chunkFreed);
+		}
+
+		pthread_mutex_unlock(&_mutex);
+		return isFilled;
+	}
+
+private:
+
+	static void* run(void* arg){
+		((SimkaInputReader*) arg)->work();
+		return NULL;
+	}
+
+	void work(){
+
+		string compressed;
+		while(true){
+
+			pthread_mutex_lock(&_mutex);
+			bool stop = _stop;
+			pthread_mutex_unlock(&_mutex);
+			if(stop) return;
+
+			//The file is read in order, the chunks are numbered as they are read
+			string data;
+			pthread_mutex_lock(&_readMutex);
+			u_int64_t chunkId = _nbChunks;
+			bool isRead = _isBgzf ? readBgzfBlocks(compressed) : (_isGz ? inflateChunk(data) : readChunk(data));
+			if(isRead) _nbChunks += 1;
+			pthread_mutex_unlock(&_readMutex);
+
+			if(!isRead){
+				pthread_mutex_lock(&_mutex);
+				_isEnd = true;
+				pthread_cond_broadcast(&_chunkFilled);
+				pthread_mutex_unlock(&_mutex);
+				return;
+			}
+
+			if(_isBgzf){
+				for(size_t pos=0; pos<compressed.size(); ){
+					u_int64_t blockSize = getBgzfBlockSize((const unsigned char*) &compressed[pos]);
+					if(!inflateBgzfBlock((const unsigned char*) &compressed[pos], blockSize, data)){
+						cout << "Error: corrupted gzip file " << _filename << endl;
+						exit(1);
+					}
+					pos += blockSize;
+				}
+			}
+
+			pthread_mutex_lock(&_mutex);
+			while(chunkId >= _nextChunk + SIMKA_GZ_QUEUE_SIZE && !_stop){
+				pthread_cond_wait(&_chunkFreed, &_mutex);
+			}
+			if(_stop){
+				pthread_mutex_unlock(&_mutex);
+				return;
+			}
+			_chunks[chunkId % SIMKA_GZ_QUEUE_SIZE].swap(data);
+			_isFilled[chunkId % SIMKA_GZ_QUEUE_SIZE] = true;
+			pthread_cond_broadcast(&_chunkFilled);
+			pthread_mutex_unlock(&_mutex);
+		}
+	}
+
+	/** Reads the next BGZF blocks, up to about SIMKA_GZ_CHUNK_SIZE decompressed bytes */
+	bool readBgzfBlocks(string& compressed){
+
+		compressed.clear();
+		u_int64_t size = 0;
+		unsigned char header[18];
+
+		while(size < SIMKA_GZ_CHUNK_SIZE){
+
+			size_t headerSize = fread(header, 1, 18, _file);
+			if(headerSize == 0) break;
+			if(!isBgzfHeader(header, headerSize) || getBgzfBlockSize(header) < 26){
+				cout << "Error: corrupted bgzip file " << _filename << endl;
+				exit(1);
+			}
+
+			u_int64_t blockSize = getBgzfBlockSize(header);
+			size_t start = compressed.size();
+			compressed.resize(start + blockSize);
+			memcpy(&compressed[start], header, 18);
+			if(fread(&compressed[start + 18], 1, blockSize - 18, _file) != blockSize - 18){
+				cout << "Error: truncated bgzip file " << _filename << endl;
+				exit(1);
+			}
+
+			const unsigned char* footer = (const unsigned char*) &compressed[start + blockSize - 4];
+			size += footer[0] | (footer[1] << 8) | (footer[2] << 16) | ((u_int32_t)footer[3] << 24);
+		}
+
+		return !compressed.empty();
+	}
+
+	/** Inflates the next SIMKA_GZ_CHUNK_SIZE bytes of a gzip stream, the members of a concatenated file follow each other */
+	bool inflateChunk(string& data){
+
+		data.resize(SIMKA_GZ_CHUNK_SIZE);
+		size_t size = 0;
+
+		while(size < data.size() && !_isStreamEnd){
+
+			if(_stream.avail_in == 0){
+				_stream.avail_in = fread(&_in[0], 1, _in.size(), _file);
+				_stream.next_in = &_in[0];
+				if(_stream.avail_in == 0) break;
+			}
+
+			_stream.next_out = (Bytef*) &data[size];
+			_stream.avail_out = data.size() - size;
+			int ret = inflate(&_stream, Z_NO_FLUSH);
+			size = data.size() - _stream.avail_out;
+
+			if(ret == Z_STREAM_END){
+				inflateReset(&_stream);
+				_isNewMember = true;
+			}
+			else if(ret == Z_OK){
+				_isNewMember = false;
+			}
+			else if(_isNewMember){
+				//Trailing garbage after the last member is ignored, as gzip does
+				_isStreamEnd = true;
+				break;
+			}
+			else{
+				cout << "Error: corrupted gzip file " << _filename << endl;
+				exit(1);
+			}
+		}
+
+		data.resize(size);
+		return size > 0;
+	}
+
+	/** Reads the next SIMKA_GZ_CHUNK_SIZE bytes of an uncompressed stream */
+	bool readChunk(string& data){
+
+		data.resize(SIMKA_GZ_CHUNK_SIZE);
+		size_t size = _stream.avail_in;
+		memcpy(&data[0], _stream.next_in, size);
+		_stream.avail_in = 0;
+
+		size += fread(&data[size], 1, data.size() - size, _file);
+		data.resize(size);
+		return size > 0;
+	}
+
+	string _filename;
+	FILE* _file;
+	bool _isCommand;
+	bool _isGz;
+	bool _isBgzf;
+	z_stream _stream; //its input holds the first bytes of a stream
+	vector<unsigned char> _in;
+	bool _isNewMember;
+	bool _isStreamEnd;
+
+	vector<pthread_t> _threads;
+	pthread_mutex_t _readMutex; //reading of the file
+	pthread_mutex_t _mutex; //queue of chunks
+	pthread_cond_t _chunkFilled;
+	pthread_cond_t _chunkFreed;
+	vector<string> _chunks;
+	vector<bool> _isFilled;
+	u_int64_t _nbChunks; //chunks read from the file
+	u_int64_t _nextChunk; //next chunk given to the reader
+	bool _isEnd;
+	bool _stop;
+};
+
+/** Iterator of SimkaBankGz and SimkaBankStream, parses the chunks of a SimkaInputReader. A read cut at the end of a
+ * chunk is completed with the next chunk. The format is given by the first character of the data. A file is read
+ * again from its start by each call to first(), a stream can only be read once. */
+class SimkaInputReaderIterator : public Iterator<Sequence>
+{
+public:
+
+	SimkaInputReaderIterator(const string& filename, size_t nbThreads)
+	: _filename(filename), _nbThreads(nbThreads), _isStream(SimkaDatasetInfo::isStream(filename)), _isStarted(false), _parser(filename, false), _reader(0), _pos(0), _isLast(false), _isFormatSet(false), _isDone(true), _index(0) {}
+
+	~SimkaInputReaderIterator(){
+		delete _reader;
+	}
+
+	void first(){
+
+		//Opening a stream again would run its command again, or wait for another writer of the named pipe
+		if(_isStream && _isStarted){
+			cout << "Error: input stream " << _filename << " can't be read twice (the counting needs several passes over the data)" << endl;
+			exit(1);
+		}
+		_isStarted = true;
+
+		delete _reader;
+		_reader = new SimkaInputReader(_filename, _nbThreads);
+		_buffer.clear();
+		_pos = 0;
+		_isLast = false;
+		_isFormatSet = false;
+		_index = 0;
+		next();
+	}
+
+	void next(){
+
+		while(true){
+
+			const char* pos = _buffer.data() + _pos;
+			if(_parser.next(pos, _buffer.data() + _buffer.size(), _isLast, *_item)){
+				_pos = pos - _buffer.data();
+				_item->setIndex(_index++);
+				_isDone = false;
+				return;
+			}
+
+			//The reading threads are stopped as soon as the data end
+			if(_isLast){
+				_isDone = true;
+				delete _reader;
+				_reader = 0;
+				return;
+			}
+
+			_buffer.erase(0, _pos);
+			_pos = 0;
+			if(_reader->nextChunk(_chunk))
+				_buffer.append(_chunk);
+			else
+				_isLast = true;
+
+			if(!_isFormatSet && _buffer.size() > 0){
+				if(_buffer[0] != '>' && _buffer[0] != '@'){
+					cout << "Error: input " << _filename << " is not a fasta or fastq file" << endl;
+					exit(1);
+				}
+				_parser.setFastq(_buffer[0] == '@');
+				_isFormatSet = true;
+			}
+		}
+	}
+
+	bool isDone(){ return _isDone; }
+
+private:
+
+	string _filename;
+	size_t _nbThreads;
+	bool _isStream;
+	bool _isStarted;
+	SimkaReadParser _parser;
+	SimkaInputReader* _reader;
+	string _buffer;
+	string _chunk;
+	size_t _pos;
+	bool _isLast;
+	bool _isFormatSet;
+	bool _isDone;
+	size_t _index;
+};
+
+/** Bank of a gzip fasta or fastq file, decompressed in background threads. The estimations are the ones of GATB. */
+class SimkaBankGz : public BankDelegate
+{
+public:
+
+	SimkaBankGz(const string& filename, size_t nbThreads)
+	: BankDelegate(Bank::open(filename)), _filename(filename), _nbThreads(nbThreads) {}
+
+	Iterator<Sequence>* iterator(){ return new SimkaInputReaderIterator(_filename, _nbThreads); }
+
+private:
+
+	string _filename;
+	size_t _nbThreads;
+};
+
+/** Bank of a named pipe or of the output of a command ('<command'), which can be read only once. Its estimations
+ * are the sizes of the manifest of the input (declared with -stream-reads or averaged over the other datasets). */
+class SimkaBankStream : public AbstractBank
+{
+public:
+
+	SimkaBankStream(const string& filename) : _filename(filename), _isRead(false) {}
+
+	std::string getId(){ return _filename; }
+
+	int64_t getNbItems(){ return -1; }
+
+	void insert(const Sequence& item){ throw Exception("SimkaBankStream: can't insert in an input stream"); }
+
+	void flush(){}
+
+	u_int64_t getSize(){ return 0; }
+
+	void remove(){}
+
+	void estimate(u_int64_t& number, u_int64_t& totalSize, u_int64_t& maxSize){
+		number = 0;
+		totalSize = 0;
+		maxSize = 0;
+	}
+
+	Iterator<Sequence>* iterator(){
+		if(_isRead){
+			cout << "Error: input stream " << _filename << " can't be read twice (the counting needs several passes over the data)" << endl;
+			exit(1);
+		}
+		_isRead = true;
+		return new SimkaInputReaderIterator(_filename, 1);
+	}
+
+private:
+
+	string _filename;
+	bool _isRead;
+};
+
+template<typename Filter> class SimkaPotaraBankFiltered : public BankDelegate
+{
+public:
+
+	SimkaPotaraBankFiltered (IBank* ref, const Filter& filter, u_int64_t maxReads, size_t nbDatasets, const SimkaDatasetInfo& info, bool concurrentInput) : BankDelegate (ref), _filter(filter), _info(info)  {
+		//_nbReadsPerDataset = nbReadsPerDataset;
+		_maxReads = maxReads;
+		_nbDatasets = nbDatasets;
+		_concurrentInput = concurrentInput;
 	}
 
     Iterator<Sequence>* iterator ()
     {
 
-        _it = _ref->iterator ();
+        //The input iterators are released with the returned iterator, which stops their reading threads
+        Iterator<Sequence>* it = _ref->iterator ();
         //std::vector<Iterator<Sequence>*> iterators = it->getComposition();
-        return new SimkaInputIterator<Sequence, Filter> (_it, _nbDatasets, _maxReads, _filter);
+        if(_concurrentInput && it->getComposition().size() > 1)
+        	return new SimkaConcurrentInputIterator<Sequence, Filter> (it, _nbDatasets, _maxReads, _filter);
+        return new SimkaInputIterator<Sequence, Filter> (it, _nbDatasets, _maxReads, _filter);
     	//return filterIt;
 
     }
 
+    /** The estimates of the input scan of simka, the files are not read again */
+    void estimate (u_int64_t& number, u_int64_t& totalSize, u_int64_t& maxSize){
+    	if(!_info._isValid){
+    		_ref->estimate(number, totalSize, maxSize);
+    		return;
+    	}
+    	number = _info._nbReads;
+    	totalSize = _info._totalSize;
+    	maxSize = _info._maxSize;
+    }
+
+    int64_t estimateNbItems (){
+    	if(!_info._isValid) return _ref->estimateNbItems();
+    	return _info._nbReads;
+    }
+
 private:
 
 	//vector<u_int64_t> _nbReadsPerDataset;
@@ -70,6 +1057,8 @@ private:
     u_int64_t _nbReadToProcess;
     size_t _datasetId;
     size_t _nbDatasets;
+    SimkaDatasetInfo _info;
+    bool _concurrentInput;
 };
 
 
@@ -88,8 +1077,17 @@ public:
         getParser()->push_back (new OptionOneParam (STR_SIMKA_MIN_READ_SIZE,   "bank name", true));
         getParser()->push_back (new OptionOneParam (STR_SIMKA_MIN_READ_SHANNON_INDEX,   "bank name", true));
         getParser()->push_back (new OptionOneParam (STR_SIMKA_MAX_READS,   "bank name", true));
+        getParser()->push_back (new OptionOneParam (STR_SIMKA_SUBSAMPLE_MODE,   "reads kept by -max-reads: first or block", false, "first"));
+        getParser()->push_back (new OptionNoParam (STR_SIMKA_CONCURRENT_INPUT,   "read the files of a dataset at the same time", false));
+        getParser()->push_back (new OptionNoParam (STR_SIMKA_KEEP_TMP_FILES,   "keep the reads sampled by -subsample-mode block in the temp dir of the job", false));
+        getParser()->push_back (new OptionOneParam (STR_SIMKA_SKETCH_SCALE,   "keep about 1 kmer out of this number (FracMinHash)", false, "1"));
         getParser()->push_back (new OptionOneParam ("-nb-datasets",   "bank name", true));
         getParser()->push_back (new OptionOneParam ("-nb-partitions",   "bank name", true));
+        getParser()->push_back (new OptionOneParam ("-batch-file",   "datasets counted by the job, one per line: index name nb-datasets", false));
+        getParser()->push_back (new OptionOneParam ("-count-cache-entry",   "entry of the dataset in the count cache, restored if it exists, created otherwise", false));
+        getParser()->push_back (new OptionOneParam (STR_SIMKA_MULTI_KMER_SIZE,   "other kmer sizes counted from the same reads, comma separated", false));
+        getParser()->push_back (new OptionOneParam (STR_SIMKA_MULTI_ABUNDANCE_MIN,   "abundance thresholds of the kmer counts written in the finish signal, the one of the run first, comma separated", false));
+        getParser()->push_back (new OptionOneParam (STR_SIMKA_BOOTSTRAP,   "nb bootstrap replicates of the run, the read blocks and the kmer counts of the replicates are counted if it is not 0", false, "0"));
         //getParser()->push_back (new OptionOneParam ("-nb-cores",   "bank name", true));
         //getParser()->push_back (new OptionOneParam ("-max-memory",   "bank name", true));
 
@@ -115,8 +1113,17 @@ public:
     	size_t nbPartitions =   getInput()->getInt("-nb-partitions");
     	CountNumber abundanceMin =   getInput()->getInt(STR_KMER_ABUNDANCE_MIN);
     	CountNumber abundanceMax =   getInput()->getInt(STR_KMER_ABUNDANCE_MAX);
-
-    	Parameter params(*this, kmerSize, outputDir, bankName, minReadSize, minReadShannonIndex, maxReads, nbDatasets, nbPartitions, abundanceMin, abundanceMax, bankIndex);
+    	string batchFilename = getInput()->get("-batch-file") ? getInput()->getStr("-batch-file") : "";
+    	string subsampleMode = getInput()->getStr(STR_SIMKA_SUBSAMPLE_MODE);
+    	bool concurrentInput = getInput()->get(STR_SIMKA_CONCURRENT_INPUT) != 0;
+    	string cacheEntryDir = getInput()->get("-count-cache-entry") ? getInput()->getStr("-count-cache-entry") : "";
+    	u_int64_t sketchScale = getInput()->getInt(STR_SIMKA_SKETCH_SCALE);
+
+    	Parameter params(*this, kmerSize, outputDir, bankName, minReadSize, minReadShannonIndex, maxReads, nbDatasets, nbPartitions, abundanceMin, abundanceMax, bankIndex, batchFilename, subsampleMode, concurrentInput, cacheEntryDir, sketchScale);
+    	if(getInput()->get(STR_SIMKA_MULTI_KMER_SIZE)) SimkaAlgorithm<>::parseKmerSizes(getInput()->getStr(STR_SIMKA_MULTI_KMER_SIZE), params.multiKmerSizes);
+    	if(getInput()->get(STR_SIMKA_MULTI_ABUNDANCE_MIN)) SimkaAlgorithm<>::parseAbundanceMins(getInput()->getStr(STR_SIMKA_MULTI_ABUNDANCE_MIN), params.abundanceMins);
+    	params.nbBootstraps = getInput()->getInt(STR_SIMKA_BOOTSTRAP);
+    	params.keepTmpFiles = getInput()->get(STR_SIMKA_KEEP_TMP_FILES) != 0;
 
         Integer::apply<Functor,Parameter> (kmerSize, params);
 
@@ -154,8 +1161,8 @@ public:
 
     struct Parameter
     {
-        Parameter (SimkaCount& tool, size_t kmerSize, string outputDir, string bankName, size_t minReadSize, double minReadShannonIndex, u_int64_t maxReads, size_t nbDatasets, size_t nbPartitions, CountNumber abundanceMin, CountNumber abundanceMax, size_t bankIndex) :
-        	tool(tool), kmerSize(kmerSize), outputDir(outputDir), bankName(bankName), minReadSize(minReadSize), minReadShannonIndex(minReadShannonIndex), maxReads(maxReads), nbDatasets(nbDatasets), nbPartitions(nbPartitions), abundanceMin(abundanceMin), abundanceMax(abundanceMax), bankIndex(bankIndex)  {}
+        Parameter (SimkaCount& tool, size_t kmerSize, string outputDir, string bankName, size_t minReadSize, double minReadShannonIndex, u_int64_t maxReads, size_t nbDatasets, size_t nbPartitions, CountNumber abundanceMin, CountNumber abundanceMax, size_t bankIndex, string batchFilename, string subsampleMode, bool concurrentInput, string cacheEntryDir, u_int64_t sketchScale) :
+        	tool(tool), kmerSize(kmerSize), outputDir(outputDir), bankName(bankName), minReadSize(minReadSize), minReadShannonIndex(minReadShannonIndex), maxReads(maxReads), nbDatasets(nbDatasets), nbPartitions(nbPartitions), abundanceMin(abundanceMin), abundanceMax(abundanceMax), bankIndex(bankIndex), batchFilename(batchFilename), subsampleMode(subsampleMode), concurrentInput(concurrentInput), cacheEntryDir(cacheEntryDir), sketchScale(sketchScale)  {}
         SimkaCount& tool;
         //size_t datasetId;
         size_t kmerSize;
@@ -169,6 +1176,26 @@ public:
         CountNumber abundanceMin;
         CountNumber abundanceMax;
         size_t bankIndex;
+        string batchFilename; //empty if the job counts a single dataset
+        string subsampleMode;
+        bool concurrentInput;
+        string cacheEntryDir; //empty if there is no count cache
+        u_int64_t sketchScale;
+        vector<size_t> multiKmerSizes; //other kmer sizes counted by the job (-multi-kmer-size)
+        string readsFilename; //local copy of the reads kept by the filters, empty if the dataset is read from its files
+        vector<u_int64_t> abundanceMins; //-multi-abundance-min: thresholds of the kmer counts of the finish signal, the one of the run first
+        size_t nbBootstraps; //-bootstrap: the read blocks and the kmer counts of the replicates are also counted if it is not 0
+        bool keepTmpFiles; //-keep-tmp: the reads sampled by -subsample-mode block are not removed
+    };
+
+    /** A dataset counted by the job */
+    struct CountBank
+    {
+    	CountBank (size_t index, const string& name, size_t nbDatasets) : index(index), name(name), nbDatasets(nbDatasets) {}
+    	size_t index;
+    	string name;
+    	size_t nbDatasets;
+    	SimkaDatasetInfo info; //from the manifest of the input, invalid if the dataset is not in it
     };
 
     template<size_t span> struct Functor  {
@@ -177,184 +1204,637 @@ public:
         typedef typename Kmer<span>::Count Count;
         typedef typename SimkaCompressedProcessor<span>::Kmer_BankId_Count Kmer_BankId_Count;
 
+        struct RunItem{
+        	Type _kmer;
+        	size_t _run;
+        	RunItem(const Type& kmer, size_t run) : _kmer(kmer), _run(run) {}
+        };
+        struct RunItemComp { bool operator() (const RunItem& l, const RunItem& r) { return (r._kmer < l._kmer); } } ;
+
     	void operator ()  (Parameter p){
 
+			vector<CountBank> banks;
+			if(p.batchFilename.empty())
+				banks.push_back(CountBank(p.bankIndex, p.bankName, p.nbDatasets));
+			else
+				readBatch(p.batchFilename, banks);
 
-			IProperties* props = p.tool.getInput();
-			vector<string> outInfo;
+			map<string, SimkaDatasetInfo> datasetInfos;
+			SimkaDatasetInfo::readManifest(p.outputDir + "/input_manifest", datasetInfos);
+			for(size_t b=0; b<banks.size(); b++){
+				if(datasetInfos.find(banks[b].name) != datasetInfos.end()) banks[b].info = datasetInfos[banks[b].name];
+			}
 
+			Configuration config;
+			Repartitor* repartitor = new Repartitor();
+			LOCAL(repartitor);
 
+			{
+				Storage* storage = StorageFactory(STORAGE_FILE).load (SimkaAlgorithm<>::getJobConfigDir(p.outputDir));
+				LOCAL (storage);
+				config.load(storage->getGroup(""));
+				repartitor->load(storage->getGroup(""));
+			}
 
-			IBank* bank = Bank::open(p.outputDir + "/input/" + p.bankName);
-			LOCAL(bank);
+			if(!p.cacheEntryDir.empty() && SimkaCountCache::hasEntry(p.cacheEntryDir)){
+				restoreCountCache(p, banks[0]);
+				return;
+			}
 
-			/*
-			u_int64_t nbSeqs = 1;
-	        IBank* sampleBank = new SimkaBankSample(bank, nbSeqs);
-			SortingCountAlgorithm<span> sortingCount (sampleBank, props);
-			SimkaNullProcessor<span>* proc = new SimkaNullProcessor<span>();
-			sortingCount.addProcessor (proc);
-			sortingCount.execute();
-			Configuration config = sortingCount.getConfig();
-			//_nbPartitions = _maxJobMerge;
-			config._nb_partitions = p.nbPartitions;
+			string tempDir = p.outputDir + "/temp/" + p.bankName;
+			System::file().mkdir(tempDir, -1);
+
+			//-multi-kmer-size: the dataset is read and filtered once into a local copy, counted for the other kmer sizes first.
+			//The finish signal of the kmer size of the run is written last, it means that every kmer size is counted.
+			if(!p.multiKmerSizes.empty()){
+				p.readsFilename = tempDir + "/reads.fasta";
+				copyReads(p, banks[0], p.readsFilename);
+
+				for(size_t k=0; k<p.multiKmerSizes.size(); k++){
+
+					Parameter multiParams(p);
+					multiParams.kmerSize = p.multiKmerSizes[k];
+					multiParams.outputDir = SimkaAlgorithm<>::getMultiKmerTempDir(p.outputDir, multiParams.kmerSize);
+					multiParams.multiKmerSizes.clear();
+
+					SimkaRunDescriptor descriptor;
+					if(!descriptor.load(multiParams.outputDir + "/run.bin")){
+						cout << "Error: no configuration for kmer size " << multiParams.kmerSize << " in " << multiParams.outputDir << endl;
+						exit(1);
+					}
+					multiParams.nbPartitions = descriptor._nbPartitions;
+			    	for(size_t i=0; i<multiParams.nbPartitions; i++){
+			    		System::file().mkdir(multiParams.outputDir + "/solid/part_" + Stringify::format("%i", i), -1);
+			    	}
+
+					Integer::apply<Functor,Parameter> (multiParams.kmerSize, multiParams);
+				}
+			}
 
-			uint64_t memoryUsageCachedItems;
-			config._nb_cached_items_per_core_per_part = 1 << 8; // cache at least 256 items (128 here, then * 2 in the next while loop)
-			do
-			{
-				config._nb_cached_items_per_core_per_part *= 2;
-				memoryUsageCachedItems = 1LL * config._nb_cached_items_per_core_per_part *config._nb_partitions * config._nbCores * sizeof(Type);
+			vector<vector<string> > outInfos(banks.size());
+			vector<vector<u_int64_t> > nbDistinctKmerPerParts(banks.size(), vector<u_int64_t>(p.nbPartitions, 0));
+
+			if(banks.size() == 1){
+				//The files of a previous count may be hard links to the count cache, they are not overwritten
+				vector<string> outputFilenames;
+		    	for(size_t i=0; i<p.nbPartitions; i++){
+		    		outputFilenames.push_back(getPartitionFilename(p, i, Stringify::format("%i", banks[0].index)));
+		    		if(System::file().doesExist(outputFilenames[i])) System::file().remove(outputFilenames[i]);
+		    	}
+				countBank(p, config, repartitor, banks[0], outputFilenames, true, outInfos[0], nbDistinctKmerPerParts[0]);
+			}
+			else{
+
+				//The datasets of the batch are counted one after the other in sorted runs (raw binary files),
+				//the runs of a partition are then merged in a single count file carrying the kmers of every dataset
+				vector<vector<string> > runFilenames(p.nbPartitions);
+				for(size_t b=0; b<banks.size(); b++){
+
+					vector<string> outputFilenames;
+			    	for(size_t i=0; i<p.nbPartitions; i++){
+			    		string runFilename = tempDir + "/__b__" + Stringify::format("%i", b) + "_" + Stringify::format("%i", i) + ".bin";
+			    		outputFilenames.push_back(runFilename);
+			    		runFilenames[i].push_back(runFilename);
+			    	}
+
+					countBank(p, config, repartitor, banks[b], outputFilenames, false, outInfos[b], nbDistinctKmerPerParts[b]);
+				}
+
+				string batchId = Stringify::format("%i", banks[0].index) + "-" + Stringify::format("%i", banks.back().index);
+		    	for(size_t i=0; i<p.nbPartitions; i++){
+		    		mergeRuns(runFilenames[i], getPartitionFilename(p, i, batchId));
+		    	}
 			}
-			while (memoryUsageCachedItems < config._max_memory * MBYTE / 10);
-			*/
 
+			if(!p.multiKmerSizes.empty()) System::file().remove(p.readsFilename);
+			System::file().rmdir(tempDir);
+
+			//The finish signals are written once the count files of the job are complete
+			for(size_t b=0; b<banks.size(); b++){
+
+				string contents = "";
+				for(size_t i=0; i<nbDistinctKmerPerParts[b].size(); i++){
+					contents += Stringify::format("%llu", nbDistinctKmerPerParts[b][i]) + "\n";
+				}
+				string nbKmerPerPartFilename = p.outputDir + "/kmercount_per_partition/" + banks[b].name + ".txt";
+				if(System::file().doesExist(nbKmerPerPartFilename)) System::file().remove(nbKmerPerPartFilename);
+				IFile* nbKmerPerPartFile = System::file().newFile(nbKmerPerPartFilename, "w");
+				nbKmerPerPartFile->fwrite(contents.c_str(), contents.size(), 1);
+				nbKmerPerPartFile->flush();
+				delete nbKmerPerPartFile;
+
+				writeFinishSignal(p, banks[b].name, outInfos[b]);
+			}
+
+			if(!p.cacheEntryDir.empty()){
+				vector<string> partitionFilenames;
+		    	for(size_t i=0; i<p.nbPartitions; i++){
+		    		partitionFilenames.push_back(getPartitionFilename(p, i, Stringify::format("%i", banks[0].index)));
+		    	}
+				SimkaCountCache::store(p.cacheEntryDir, p.outputDir, banks[0].name, banks[0].index, partitionFilenames);
+			}
+		}
+
+		/** The count files of the cache are tagged with the index of the dataset in the run that counted it,
+		 * they are rewritten with the index of this run */
+		void restoreCountCache(Parameter& p, const CountBank& countBank){
+
+			for(size_t i=0; i<p.nbPartitions; i++){
+
+				string cacheFilename = SimkaCountCache::getPartitionFilename(p.cacheEntryDir, i);
+				string outputFilename = getPartitionFilename(p, i, Stringify::format("%i", countBank.index));
+				if(System::file().doesExist(outputFilename)) System::file().remove(outputFilename);
+
+				if(SimkaCountCache::getBankIndex(p.cacheEntryDir) == countBank.index){
+					SimkaCountCache::linkFile(cacheFilename, outputFilename);
+					SimkaCountCache::linkIndex(cacheFilename, outputFilename);
+					continue;
+				}
+
+				IterableGzFile<Kmer_BankId_Count>* cacheFile = new IterableGzFile<Kmer_BankId_Count>(cacheFilename, 10000);
+				Iterator<Kmer_BankId_Count>* it = cacheFile->iterator();
+				Bag<Kmer_BankId_Count>* cachedBag = new BagCache<Kmer_BankId_Count>(new BagGzBlockFile<Kmer_BankId_Count>(outputFilename), 10000);
+
+				for(it->first(); !it->isDone(); it->next()){
+					Kmer_BankId_Count item = it->item();
+					item._bankId = countBank.index;
+					cachedBag->insert(item);
+				}
+
+				cachedBag->flush();
+				delete cachedBag;
+				delete it;
+				delete cacheFile;
+			}
+
+			SimkaCountCache::restoreInfo(p.cacheEntryDir, p.outputDir, countBank.name);
+		}
+
+		/** Count file of a partition, id is the index of the dataset, or first-last for a batch of datasets */
+		string getPartitionFilename(Parameter& p, size_t partitionId, const string& id){
+			return p.outputDir + "/solid/part_" + Stringify::format("%i", partitionId) + "/__p__" + id + ".gz";
+		}
+
+		/** Count file of a partition for a read block of -bootstrap, in the dir of the block in the partition dir */
+		string getBlockPartitionFilename(Parameter& p, size_t partitionId, size_t block, const string& id){
+			string blockDir = p.outputDir + "/solid/part_" + Stringify::format("%i", partitionId) + "/" + SimkaBootstrap::getCountsId(block);
+			System::file().mkdir(blockDir, -1);
+			return blockDir + "/__p__" + id + ".gz";
+		}
+
+		/** The batch file lists the datasets of the job, one per line: index name nb-datasets */
+		void readBatch(const string& batchFilename, vector<CountBank>& banks){
+
+			ifstream file(batchFilename.c_str());
+			string line;
+			while(getline(file, line)){
+				if(line == "") continue;
+				stringstream lineStream(line);
+				size_t index;
+				string name;
+				size_t nbDatasets;
+				lineStream >> index >> name >> nbDatasets;
+				banks.push_back(CountBank(index, name, nbDatasets));
+			}
+			file.close();
+
+			if(banks.empty()){
+				cout << "Error: no dataset in batch file " << batchFilename << endl;
+				exit(1);
+			}
+		}
+
+		void countBank(Parameter& p, Configuration& config, Repartitor* repartitor, const CountBank& countBank, const vector<string>& outputFilenames, bool isGz, vector<string>& outInfo, vector<u_int64_t>& nbDistinctKmerPerParts){
+
+			//A stream is read once: if the sorting count needs several passes over the reads, or if the reads are split
+			//in the blocks of -bootstrap after the counting, they are copied first
+			string readsFilename = p.readsFilename;
+			if(readsFilename.empty() && hasStream(p, countBank) && ((p.kmerSize > 15 && config._nb_passes > 1) || p.nbBootstraps > 0)){
+				readsFilename = p.outputDir + "/temp/" + p.bankName + "/reads_" + countBank.name + ".fasta";
+				copyReads(p, countBank, readsFilename);
+			}
+
+			vector<string> sampleFilenames;
+			IBank* filteredBank = readsFilename.empty() ? openFilteredBank(p, countBank, sampleFilenames) : new BankFasta(readsFilename);
+			LOCAL(filteredBank);
 
 			vector<u_int64_t> nbKmerPerParts(p.nbPartitions, 0);
-			vector<u_int64_t> nbDistinctKmerPerParts(p.nbPartitions, 0);
 			vector<u_int64_t> chordNiPerParts(p.nbPartitions, 0);
+			vector<u_int64_t> abundanceMinCountsPerParts(p.nbPartitions * p.abundanceMins.size() * 3, 0);
 
+			u_int64_t nbReads = countReads(p, config, repartitor, filteredBank, countBank.index, p.abundanceMin, p.abundanceMax, outputFilenames, isGz, nbKmerPerParts, nbDistinctKmerPerParts, chordNiPerParts, abundanceMinCountsPerParts);
 
-			Configuration config;
-			{
-				Repartitor* repartitor = new Repartitor();
-				LOCAL(repartitor);
-
-				{
-					Storage* storage = StorageFactory(STORAGE_HDF5).load (p.outputDir + "/" + "config.h5");
-					LOCAL (storage);
-					config.load(storage->getGroup(""));
-					repartitor->load(storage->getGroup(""));
+			u_int64_t nbDistinctKmers = 0;
+			u_int64_t nbKmers = 0;
+			u_int64_t chord_N2 = 0;
+			for(size_t i=0; i<p.nbPartitions; i++){
+				nbDistinctKmers += nbDistinctKmerPerParts[i];
+				nbKmers += nbKmerPerParts[i];
+				chord_N2 += chordNiPerParts[i];
+			}
+
+			//-multi-abundance-min: the count files have the kmers of the lowest threshold, the counts of the finish signal
+			//are those of the threshold of the run, followed by a line per other threshold: threshold distinct kmers chord_N2
+			vector<u_int64_t> abundanceMinCounts(p.abundanceMins.size() * 3, 0);
+			for(size_t i=0; i<p.nbPartitions; i++){
+				for(size_t j=0; j<abundanceMinCounts.size(); j++){
+					abundanceMinCounts[j] += abundanceMinCountsPerParts[i*abundanceMinCounts.size() + j];
 				}
+			}
+			if(!p.abundanceMins.empty()){
+				nbDistinctKmers = abundanceMinCounts[0];
+				nbKmers = abundanceMinCounts[1];
+				chord_N2 = abundanceMinCounts[2];
+			}
+
+			outInfo.push_back(Stringify::format("%llu", nbReads));
+			outInfo.push_back(Stringify::format("%llu", nbDistinctKmers));
+			outInfo.push_back(Stringify::format("%llu", nbKmers));
+			outInfo.push_back(Stringify::format("%llu", chord_N2));
+			for(size_t i=1; i<p.abundanceMins.size(); i++){
+				outInfo.push_back(Stringify::format("%llu %llu %llu %llu", p.abundanceMins[i], abundanceMinCounts[i*3], abundanceMinCounts[i*3+1], abundanceMinCounts[i*3+2]));
+			}
 
-				//config._abundanceUserNb = 1;
-				//config._abundance.clear();
-				//CountRange range(props->getInt(STR_KMER_ABUNDANCE_MIN), 100000);
-				//config._abundance.push_back(range);
+			if(p.nbBootstraps > 0) countBlocks(p, config, repartitor, countBank, filteredBank, nbReads, outInfo);
 
-				/*
-				vector<size_t> cacheIndexes;
-				cacheIndexes.resize(p.nbPartitions);
-				vector<vector<Count> > caches;
-	        	caches.resize(p.nbPartitions);
-		    	for(size_t i=0; i<p.nbPartitions; i++){
-		    		caches[i].resize(NB_COUNT_CACHE);
-		    		cacheIndexes[i] = 0;
-		    	}
-				 */
+#ifdef TRACK_DISK_USAGE
+			string command = "du -sh " +  p.outputDir;
+			system(command.c_str());
+#endif
+
+	    	for(size_t i=0; i<sampleFilenames.size() && !p.keepTmpFiles; i++){
+	    		System::file().remove(sampleFilenames[i]);
+	    	}
+
+	    	if(readsFilename != p.readsFilename) System::file().remove(readsFilename);
+		}
+
+		/** Counts the kmers of the reads of bank in the count files of the partitions, with the bank id bankIndex, returns
+		 * the number of reads */
+		u_int64_t countReads(Parameter& p, Configuration& config, Repartitor* repartitor, IBank* bank, size_t bankIndex, CountNumber abundanceMin, CountNumber abundanceMax,
+				const vector<string>& outputFilenames, bool isGz,
+				vector<u_int64_t>& nbKmerPerParts, vector<u_int64_t>& nbDistinctKmerPerParts, vector<u_int64_t>& chordNiPerParts, vector<u_int64_t>& abundanceMinCountsPerParts){
+
+			IProperties* props = p.tool.getInput();
+
+			vector<Bag<Kmer_BankId_Count>* > cachedBags;
+	    	for(size_t i=0; i<p.nbPartitions; i++){
+				Bag<Kmer_BankId_Count>* bag;
+				if(isGz)
+					bag = new BagGzBlockFile<Kmer_BankId_Count>(outputFilenames[i]);
+				else
+					bag = new BagFile<Kmer_BankId_Count>(outputFilenames[i]);
+				cachedBags.push_back(new BagCache<Kmer_BankId_Count>(bag, 10000));
+	    	}
+
+			SimkaCompressedProcessor<span>* proc = new SimkaCompressedProcessor<span>(cachedBags, nbKmerPerParts, nbDistinctKmerPerParts, chordNiPerParts, abundanceMin, abundanceMax, bankIndex, SimkaSketch<span>::getThreshold(p.sketchScale), p.abundanceMins, abundanceMinCountsPerParts);
+
+			u_int64_t nbReads = 0;
+
+			if(p.kmerSize <= 15){
+				MiniKC<span> miniKc(props, p.kmerSize, bank, *repartitor, proc);
+				miniKc.execute();
+
+				nbReads = miniKc._nbReads;
+			}
+			else{
+				std::vector<ICountProcessor<span>* > procs;
+				procs.push_back(proc);
+				SortingCountAlgorithm<span> algo (bank, config, repartitor,
+						procs,
+						props);
+
+				algo.execute();
+
+				nbReads = algo.getInfo()->getInt("seq_number");
+			}
+
+	    	for(size_t i=0; i<p.nbPartitions; i++){
+	    		delete cachedBags[i];
+	    	}
+
+	    	return nbReads;
+		}
+
+		/** -bootstrap: the reads are split in the read blocks of SimkaBootstrap, the kmers of each block are counted
+		 * without abundance threshold in the count files solid/part_<j>/b<block>/__p__<dataset>.gz, with the bank id
+		 * SimkaBootstrap::getBlockBankId. The finish signal has a line per replicate: r<replicate> distinct kmers chord_N2 */
+		void countBlocks(Parameter& p, Configuration& config, Repartitor* repartitor, const CountBank& countBank, IBank* filteredBank, u_int64_t nbReads, vector<string>& outInfo){
+
+			string tempDir = p.outputDir + "/temp/" + p.bankName;
+
+			vector<string> blockFilenames;
+			vector<BankFasta*> blockBanks;
+			for(size_t b=0; b<SIMKA_BOOTSTRAP_NB_BLOCKS; b++){
+				blockFilenames.push_back(tempDir + "/block_" + countBank.name + "_" + Stringify::format("%i", b) + ".fasta");
+				if(System::file().doesExist(blockFilenames[b])) System::file().remove(blockFilenames[b]);
+				blockBanks.push_back(new BankFasta(blockFilenames[b]));
+			}
+
+			vector<u_int64_t> nbBlockReads(SIMKA_BOOTSTRAP_NB_BLOCKS, 0);
+			u_int64_t readIndex = 0;
+
+			Iterator<Sequence>* it = filteredBank->iterator();
+			LOCAL(it);
+			for(it->first(); !it->isDone(); it->next()){
+				size_t block = SimkaBootstrap::getBlock(readIndex, nbReads);
+				blockBanks[block]->insert(it->item());
+				nbBlockReads[block] += 1;
+				readIndex += 1;
+			}
 
-				//string outputDir = p.outputDir + "/solid/" + p.bankName;
-				//System::file().mkdir(outputDir, -1);
-				vector<Bag<Kmer_BankId_Count>* > bags;
-				vector<Bag<Kmer_BankId_Count>* > cachedBags;
+			for(size_t b=0; b<SIMKA_BOOTSTRAP_NB_BLOCKS; b++){
+				blockBanks[b]->flush();
+				delete blockBanks[b];
+			}
+
+			vector<vector<string> > partitionFilenames(p.nbPartitions);
+
+			for(size_t b=0; b<SIMKA_BOOTSTRAP_NB_BLOCKS; b++){
+
+				vector<string> outputFilenames;
 		    	for(size_t i=0; i<p.nbPartitions; i++){
-					string outputFilename = p.outputDir + "/solid/part_" + Stringify::format("%i", i) + "/__p__" + Stringify::format("%i", p.bankIndex) + ".gz";
-					Bag<Kmer_BankId_Count>* bag = new BagGzFile<Kmer_BankId_Count>(outputFilename);
-					Bag<Kmer_BankId_Count>* cachedBag = new BagCache<Kmer_BankId_Count>(bag, 10000);
-					cachedBags.push_back(cachedBag);
-					//BagCache bagCache(*bag, 10000);
-		        	bags.push_back(bag);
+		    		outputFilenames.push_back(getBlockPartitionFilename(p, i, b, Stringify::format("%i", countBank.index)));
+		    		if(System::file().doesExist(outputFilenames[i])) System::file().remove(outputFilenames[i]);
 		    	}
 
+				//A block without reads has no count files
+				if(nbBlockReads[b] > 0){
+					vector<u_int64_t> nbKmerPerParts(p.nbPartitions, 0);
+					vector<u_int64_t> nbDistinctKmerPerParts(p.nbPartitions, 0);
+					vector<u_int64_t> chordNiPerParts(p.nbPartitions, 0);
+					vector<u_int64_t> abundanceMinCountsPerParts;
 
-				string tempDir = p.outputDir + "/temp/" + p.bankName;
-				System::file().mkdir(tempDir, -1);
-				//cout << i << endl;
-				//string outputDir = p.outputDir + "/comp_part" + to_string(p.datasetId) + "/";
+					IBank* blockBank = new BankFasta(blockFilenames[b]);
+					LOCAL(blockBank);
+					countReads(p, config, repartitor, blockBank, SimkaBootstrap::getBlockBankId(countBank.index, b), 0, (CountNumber)-1, outputFilenames, true,
+							nbKmerPerParts, nbDistinctKmerPerParts, chordNiPerParts, abundanceMinCountsPerParts);
 
-				//cout << "\tinput: " << p.outputDir + "/input/" + p.bankName << endl;
+					for(size_t i=0; i<p.nbPartitions; i++) partitionFilenames[i].push_back(outputFilenames[i]);
+				}
+				System::file().remove(blockFilenames[b]);
+			}
 
-				SimkaSequenceFilter sequenceFilter(p.minReadSize, p.minReadShannonIndex);
-				IBank* filteredBank = new SimkaPotaraBankFiltered<SimkaSequenceFilter>(bank, sequenceFilter, p.maxReads, p.nbDatasets);
-				// = new SimkaPotaraBankFiltered(bank)
-				LOCAL(filteredBank);
-				//LOCAL(bank);
+			//The kmer counts of each replicate, for its thresholded abundances
+			vector<u_int64_t> replicateCounts(p.nbBootstraps * 3, 0);
+			for(size_t i=0; i<p.nbPartitions; i++){
+				countReplicates(p, partitionFilenames[i], replicateCounts);
+			}
 
-				//Storage* solidStorage = 0:
-				//string solidsName = p.outputDir + "/solid/" +  p.bankName + ".h5";
-				//bool autoDelete = false; // (solidsName == "none") || (solidsName == "null");
-				//solidStorage = StorageFactory(STORAGE_HDF5).create (solidsName, true, autoDelete);
-				//LOCAL(solidStorage);
+			for(size_t r=0; r<p.nbBootstraps; r++){
+				outInfo.push_back(SimkaBootstrap::getReplicateId(r) + Stringify::format(" %llu %llu %llu", replicateCounts[r*3], replicateCounts[r*3+1], replicateCounts[r*3+2]));
+			}
+		}
+
+		/** Adds the distinct kmers, kmers and chord_N2 of each replicate of -bootstrap in the block count files of a
+		 * partition to replicateCounts (3 counters per replicate). The sorted count files are merged, the abundance of
+		 * a kmer in a replicate is the sum of its block counts weighted by the draws of the blocks. */
+		void countReplicates(Parameter& p, const vector<string>& blockFilenames, vector<u_int64_t>& replicateCounts){
+
+			vector<vector<u_int64_t> > weights(p.nbBootstraps);
+			for(size_t r=0; r<p.nbBootstraps; r++) SimkaBootstrap::getWeights(r, weights[r]);
+
+			vector<IterableGzFile<Kmer_BankId_Count>* > files;
+			vector<Iterator<Kmer_BankId_Count>* > its;
+			std::priority_queue< RunItem, vector<RunItem>, RunItemComp > pq;
+
+			for(size_t i=0; i<blockFilenames.size(); i++){
+				IterableGzFile<Kmer_BankId_Count>* file = new IterableGzFile<Kmer_BankId_Count>(blockFilenames[i], 10000);
+				Iterator<Kmer_BankId_Count>* it = file->iterator();
+				it->first();
+				if(!it->isDone()) pq.push(RunItem(it->item()._type, i));
+				files.push_back(file);
+				its.push_back(it);
+			}
 
-				SimkaCompressedProcessor<span>* proc = new SimkaCompressedProcessor<span>(cachedBags, nbKmerPerParts, nbDistinctKmerPerParts, chordNiPerParts, p.abundanceMin, p.abundanceMax, p.bankIndex);
+			vector<u_int64_t> blockCounts(SIMKA_BOOTSTRAP_NB_BLOCKS, 0);
 
-				u_int64_t nbReads = 0;
+			while(!pq.empty()){
 
-				if(p.kmerSize <= 15){
-					MiniKC<span> miniKc(p.tool.getInput(), p.kmerSize, filteredBank, *repartitor, proc);
-					miniKc.execute();
+				Type kmer = pq.top()._kmer;
+				blockCounts.assign(SIMKA_BOOTSTRAP_NB_BLOCKS, 0);
 
-					nbReads = miniKc._nbReads;
+				while(!pq.empty() && pq.top()._kmer == kmer){
+					size_t run = pq.top()._run; pq.pop();
+					const Kmer_BankId_Count& item = its[run]->item();
+					blockCounts[item._bankId % SIMKA_BOOTSTRAP_NB_BLOCKS] += item._count;
+					its[run]->next();
+					if(!its[run]->isDone()) pq.push(RunItem(its[run]->item()._type, run));
 				}
-				else{
-					//SimkaCompressedProcessor<span>* proc = new SimkaCompressedProcessor<span>(bags, caches, cacheIndexes, p.abundanceMin, p.abundanceMax);
-					std::vector<ICountProcessor<span>* > procs;
-					procs.push_back(proc);
-					SortingCountAlgorithm<span> algo (filteredBank, config, repartitor,
-							procs,
-							props);
 
-					algo.execute();
+				for(size_t r=0; r<p.nbBootstraps; r++){
+					u_int64_t abundance = 0;
+					for(size_t b=0; b<SIMKA_BOOTSTRAP_NB_BLOCKS; b++) abundance += weights[r][b] * blockCounts[b];
+					if(abundance == 0 || abundance < p.abundanceMin || abundance > p.abundanceMax) continue;
+					replicateCounts[r*3] += 1;
+					replicateCounts[r*3+1] += abundance;
+					replicateCounts[r*3+2] += abundance * abundance;
+				}
+			}
+
+			for(size_t i=0; i<files.size(); i++){
+				delete its[i];
+				delete files[i];
+			}
+		}
+
+		/** True if a file of the dataset is a named pipe or a command */
+		bool hasStream(Parameter& p, const CountBank& countBank){
+
+			vector<string> filenames;
+			readInputFilenames(p.outputDir + "/input/" + countBank.name, filenames);
+
+			for(size_t i=0; i<filenames.size(); i++){
+				if(SimkaDatasetInfo::isStream(filenames[i])) return true;
+			}
+			return false;
+		}
+
+		/** Reads of the dataset kept by -max-reads and the read filters */
+		IBank* openFilteredBank(Parameter& p, const CountBank& countBank, vector<string>& sampleFilenames){
+
+			string bankFilename = p.outputDir + "/input/" + countBank.name;
+			if(p.subsampleMode == "block" && p.maxReads > 0) bankFilename = subsampleBank(p, countBank, sampleFilenames);
+
+			IBank* bank = openBank(bankFilename, p.tool.getInput()->getInt(STR_NB_CORES));
+			SimkaSequenceFilter sequenceFilter(p.minReadSize, p.minReadShannonIndex);
+			return new SimkaPotaraBankFiltered<SimkaSequenceFilter>(bank, sequenceFilter, p.maxReads, countBank.nbDatasets, countBank.info, p.concurrentInput);
+		}
+
+		/** Local copy of the filtered reads of the dataset, counted for each kmer size of -multi-kmer-size */
+		void copyReads(Parameter& p, const CountBank& countBank, const string& readsFilename){
+
+			vector<string> sampleFilenames;
+			IBank* filteredBank = openFilteredBank(p, countBank, sampleFilenames);
+			LOCAL(filteredBank);
+
+			if(System::file().doesExist(readsFilename)) System::file().remove(readsFilename);
+			BankFasta readsBank(readsFilename);
+
+			Iterator<Sequence>* it = filteredBank->iterator();
+			LOCAL(it);
+			for(it->first(); !it->isDone(); it->next()){
+				readsBank.insert(it->item());
+			}
+			readsBank.flush();
+
+	    	for(size_t i=0; i<sampleFilenames.size() && !p.keepTmpFiles; i++){
+	    		System::file().remove(sampleFilenames[i]);
+	    	}
+		}
+
+		/** The input file of a dataset lists its files, one per line */
+		void readInputFilenames(const string& inputFilename, vector<string>& filenames){
+			ifstream inputFile(inputFilename.c_str());
+			string line;
+			while(getline(inputFile, line)){
+				if(line != "") filenames.push_back(line);
+			}
+			inputFile.close();
+		}
+
+		/** The fasta/fastq files of a dataset are read through a memory mapping if uncompressed, and decompressed
+		 * in background threads if gzip. Streams are read once, the other files by the banks of GATB. */
+		IBank* openBank(const string& inputFilename, size_t nbCores){
+
+			vector<string> filenames;
+			readInputFilenames(inputFilename, filenames);
+			if(filenames.empty()) return Bank::open(inputFilename);
+
+			//The decompression threads run along the counting threads, a quarter of the cores is enough to feed them
+			size_t nbGzThreads = min(max(nbCores / 4, (size_t)1), (size_t)SIMKA_GZ_MAX_THREADS);
+
+			vector<IBank*> banks;
+			for(size_t i=0; i<filenames.size(); i++){
+
+				//A stream is not opened before the counting, its first bytes would be lost
+				bool isGz, isFastq;
+				if(SimkaDatasetInfo::isStream(filenames[i]))
+					banks.push_back(new SimkaBankStream(filenames[i]));
+				else if(!getInputFormat(filenames[i], isGz, isFastq))
+					banks.push_back(Bank::open(filenames[i]));
+				else if(isGz)
+					banks.push_back(new SimkaBankGz(filenames[i], nbGzThreads));
+				else
+					banks.push_back(new SimkaBankMmap(filenames[i], isFastq));
+			}
 
-					nbReads = algo.getInfo()->getInt("seq_number");
+			return new BankComposite(banks);
+		}
+
+		/** -subsample-mode block: the reads of blocks of the input files chosen uniformly at random are written to
+		 * temporary files, which are counted instead of the dataset. The blocks hold about -max-reads reads.
+		 * Returns the input file of the dataset if its files can't be sampled (plain gzip files...). */
+		string subsampleBank(Parameter& p, const CountBank& countBank, vector<string>& sampleFilenames){
+
+			string inputFilename = p.outputDir + "/input/" + countBank.name;
+
+			vector<string> filenames;
+			readInputFilenames(inputFilename, filenames);
+
+			for(size_t i=0; i<filenames.size(); i++){
+				if(SimkaDatasetInfo::isStream(filenames[i])){
+					cout << "Subsample: " << countBank.name << " is a stream, its first reads are used" << endl;
+					return inputFilename;
 				}
+				SimkaBlockSampler sampler(filenames[i]);
+				if(!sampler.isSeekable()){
+					cout << "Subsample: " << filenames[i] << " can't be sampled by blocks (only uncompressed or bgzip fasta/fastq files), the first reads of " << countBank.name << " are used" << endl;
+					return inputFilename;
+				}
+			}
+
+			u_int64_t nbReads = countBank.info._nbReads;
+			if(!countBank.info._isValid){
+				IBank* bank = openBank(inputFilename, p.tool.getInput()->getInt(STR_NB_CORES));
+				LOCAL(bank);
+				nbReads = bank->estimateNbItems();
+			}
+
+			//-max-reads reads are taken from each paired file
+			double fraction = nbReads > 0 ? (double)(p.maxReads * countBank.nbDatasets) / nbReads : 1;
+			if(fraction >= 1) return inputFilename;
+
+			//The seed depends on the dataset only, the same reads are sampled by every run
+			u_int64_t seed = 14695981039346656037ULL;
+			for(size_t i=0; i<countBank.name.size(); i++){
+				seed ^= (unsigned char)countBank.name[i];
+				seed *= 1099511628211ULL;
+			}
 
+			string tempDir = p.outputDir + "/temp/" + p.bankName + "/";
+			string sampleInputContents = "";
+			u_int64_t nbSampledReads = 0;
 
-				u_int64_t nbDistinctKmers = 0;
-				u_int64_t nbKmers = 0;
-				u_int64_t chord_N2 = 0;
-				for(size_t i=0; i<p.nbPartitions; i++){
-					nbDistinctKmers += nbDistinctKmerPerParts[i];
-					nbKmers += nbKmerPerParts[i];
-					chord_N2 += chordNiPerParts[i];
+			for(size_t i=0; i<filenames.size(); i++){
+
+				SimkaBlockSampler sampler(filenames[i]);
+				string sampleFilename = tempDir + "__s__" + Stringify::format("%i", countBank.index) + "_" + Stringify::format("%i", i) + (sampler.isFastq() ? ".fastq" : ".fasta");
+				sampleFilenames.push_back(sampleFilename);
+
+				FILE* output = fopen(sampleFilename.c_str(), "wb");
+				if(output == 0){
+					cout << "Error: can't create subsample file " << sampleFilename << endl;
+					exit(1);
 				}
-				//cout << nbDistinctKmers << endl;
+				nbSampledReads += sampler.sample(fraction, seed + i, output);
+				fclose(output);
 
-				//cout << "CHECK NB READS PER DATASET:  " << nbReads << endl;
-				outInfo.push_back(Stringify::format("%llu", nbReads));
-				outInfo.push_back(Stringify::format("%llu", nbDistinctKmers));
-				outInfo.push_back(Stringify::format("%llu", nbKmers));
-				outInfo.push_back(Stringify::format("%llu", chord_N2));
+				sampleInputContents += sampleFilename + "\n";
+			}
 
+			sampleInputContents.erase(sampleInputContents.size()-1);
+			string sampleInputFilename = tempDir + "__s__" + Stringify::format("%i", countBank.index);
+			IFile* sampleInputFile = System::file().newFile(sampleInputFilename, "w");
+			sampleInputFile->fwrite(sampleInputContents.c_str(), sampleInputContents.size(), 1);
+			sampleInputFile->flush();
+			delete sampleInputFile;
+			sampleFilenames.push_back(sampleInputFilename);
 
+			cout << "Subsample: " << nbSampledReads << " reads sampled by blocks from " << countBank.name << " (estimated " << nbReads << " reads)" << endl;
 
-#ifdef TRACK_DISK_USAGE
-				string command = "du -sh " +  p.outputDir;
-				system(command.c_str());
-#endif
+			return sampleInputFilename;
+		}
 
-				System::file().rmdir(tempDir);
+		/** Merge the sorted runs of the datasets of a batch in a single count file */
+		void mergeRuns(const vector<string>& runFilenames, const string& outputFilename){
 
-		    	for(size_t i=0; i<p.nbPartitions; i++){
-		    		//bags[i]->flush();
-		    		//cachedBags[i]->flush();
-		    		delete cachedBags[i];
-		    		//delete bags[i];
-		    	}
+			vector<IterableFile<Kmer_BankId_Count>* > runs;
+			vector<Iterator<Kmer_BankId_Count>* > its;
+			std::priority_queue< RunItem, vector<RunItem>, RunItemComp > pq;
 
-		    	//delete proc;
+			for(size_t i=0; i<runFilenames.size(); i++){
+				IterableFile<Kmer_BankId_Count>* run = new IterableFile<Kmer_BankId_Count>(runFilenames[i], 10000);
+				Iterator<Kmer_BankId_Count>* it = run->iterator();
+				it->first();
+				if(!it->isDone()) pq.push(RunItem(it->item()._type, i));
+				runs.push_back(run);
+				its.push_back(it);
 			}
 
-			string contents = "";
-			for(size_t i=0; i<nbDistinctKmerPerParts.size(); i++){
-				contents += Stringify::format("%llu", nbDistinctKmerPerParts[i]) + "\n";
+			Bag<Kmer_BankId_Count>* cachedBag = new BagCache<Kmer_BankId_Count>(new BagGzBlockFile<Kmer_BankId_Count>(outputFilename), 10000);
+
+			while(!pq.empty()){
+				size_t run = pq.top()._run; pq.pop();
+				cachedBag->insert(its[run]->item());
+				its[run]->next();
+				if(!its[run]->isDone()) pq.push(RunItem(its[run]->item()._type, run));
 			}
-			IFile* nbKmerPerPartFile = System::file().newFile(p.outputDir + "/kmercount_per_partition/" + p.bankName + ".txt", "w");
-			nbKmerPerPartFile->fwrite(contents.c_str(), contents.size(), 1);
-			nbKmerPerPartFile->flush();
-			delete nbKmerPerPartFile;
 
+			cachedBag->flush();
+			delete cachedBag;
 
-			//cout << "heo" << endl;
-			//delete config;
-			//cout << "heo" << endl;
-			writeFinishSignal(p, outInfo);
-			//cout << "heo" << endl;
+			for(size_t i=0; i<runs.size(); i++){
+				delete its[i];
+				delete runs[i];
+				System::file().remove(runFilenames[i]);
+			}
 		}
 
-		void writeFinishSignal(Parameter& p, const vector<string>& outInfo){
+		void writeFinishSignal(Parameter& p, const string& bankName, const vector<string>& outInfo){
 
-			string finishFilename = p.outputDir + "/count_synchro/" +  p.bankName + ".ok";
+			string finishFilename = p.outputDir + "/count_synchro/" +  bankName + ".ok";
+			if(System::file().doesExist(finishFilename)) System::file().remove(finishFilename);
 			IFile* file = System::file().newFile(finishFilename, "w");
 			string contents = "";
 
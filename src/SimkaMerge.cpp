@@ -20,6 +20,7 @@
 
 
 #include <gatb/gatb_core.hpp>
+#include <sys/resource.h>
 #include <SimkaAlgorithm.hpp>
 #include <SimkaDistance.hpp>
 
@@ -33,7 +34,10 @@ using namespace gatb::core::system::impl;
 
 
 #define MERGE_BUFFER_SIZE 1000
-#define SIMKA_MERGE_MAX_FILE_USED 200
+#define SIMKA_MERGE_MAX_FILE_USED 200 //Used if the limit of open files of the process is unknown
+#define SIMKA_MERGE_RESERVED_FILES 64 //Open files kept for the rest of the process (logs, stats...)
+#define SIMKA_MERGE_FILE_CACHE 10000 //Kmers cached per opened run
+#define SIMKA_MERGE_GZ_MEMORY (64*1024) //Memory used by zlib per opened gz file
 
 
 
@@ -52,12 +56,16 @@ struct sortItem_Size_Filename_ID{
 
 	u_int64_t _size;
 	size_t _datasetID;
+	string _filename;
+	bool _isTemporary; //file created by the pre-merge of this job
 
 	sortItem_Size_Filename_ID(){}
 
-	sortItem_Size_Filename_ID(u_int64_t size, size_t datasetID){
+	sortItem_Size_Filename_ID(u_int64_t size, size_t datasetID, const string& filename, bool isTemporary){
 		_size = size;
 		_datasetID = datasetID;
+		_filename = filename;
+		_isTemporary = isTemporary;
 	}
 };
 
@@ -100,7 +108,7 @@ public:
 	SimkaCountProcessorSimple<span>* _processor;
 
 	vector<Type> _bufferKmers;
-	vector<CountVector> _bufferCounts;
+	vector<SparseCountVector> _bufferCounts;
 
     /** Constructor. */
     DistanceCommand (
@@ -134,7 +142,7 @@ public:
     //void add(Type& kmer, CountVector& counts){
     //	_bufferIndex +=
     //}
-    void setup(size_t bufferIndex, vector<Type>& bufferKmers, vector<CountVector>& bufferCounts){
+    void setup(size_t bufferIndex, vector<Type>& bufferKmers, vector<SparseCountVector>& bufferCounts){
 
     	//cout << "hey  " << bufferIndex << endl;
     	_bufferIndex = bufferIndex;
@@ -169,7 +177,7 @@ public:
 
 struct Parameter
 {
-    Parameter (IProperties* props, string inputFilename, string outputDir, size_t partitionId, size_t kmerSize, double minShannonIndex, bool computeSimpleDistances, bool computeComplexDistances, size_t nbCores) : props(props), inputFilename(inputFilename), outputDir(outputDir), partitionId(partitionId), kmerSize(kmerSize), minShannonIndex(minShannonIndex), computeSimpleDistances(computeSimpleDistances), computeComplexDistances(computeComplexDistances), nbCores(nbCores) {}
+    Parameter (IProperties* props, string inputFilename, string outputDir, size_t partitionId, size_t kmerSize, double minShannonIndex, bool computeSimpleDistances, bool computeComplexDistances, size_t nbCores, size_t maxMemory, size_t tileSize, size_t tileId, size_t nbMergedPartitions, size_t rangeId, size_t nbRanges, size_t firstNewBank, size_t nbReferenceBanks) : props(props), inputFilename(inputFilename), outputDir(outputDir), partitionId(partitionId), kmerSize(kmerSize), minShannonIndex(minShannonIndex), computeSimpleDistances(computeSimpleDistances), computeComplexDistances(computeComplexDistances), nbCores(nbCores), maxMemory(maxMemory), tileSize(tileSize), tileId(tileId), nbMergedPartitions(nbMergedPartitions), rangeId(rangeId), nbRanges(nbRanges), firstNewBank(firstNewBank), nbReferenceBanks(nbReferenceBanks) {}
     IProperties* props;
     string inputFilename;
     string outputDir;
@@ -179,6 +187,19 @@ struct Parameter
     bool computeSimpleDistances;
     bool computeComplexDistances;
     size_t nbCores;
+    size_t maxMemory;
+    size_t tileSize; //0 if the statistics are not tiled
+    size_t tileId;
+    size_t nbMergedPartitions; //partitions partitionId to partitionId+nbMergedPartitions-1 are merged by the job
+    size_t rangeId; //kmer range of the partition merged by the job, if the partition is split in nbRanges
+    size_t nbRanges;
+    size_t firstNewBank; //incremental run: only the pairs of the banks from firstNewBank are computed (0: all the pairs)
+    size_t nbReferenceBanks; //query run: only the pairs of a reference (the first nbReferenceBanks banks) and a query are computed
+    vector<u_int64_t> abundanceMins; //-multi-abundance-min: the statistics are computed for each threshold, the one of the run first
+    size_t nbBootstraps; //-bootstrap: the statistics are also computed for each replicate if it is not 0
+    u_int64_t abundanceMin; //-bootstrap: abundance thresholds of the kmers of the replicates
+    u_int64_t abundanceMax;
+    size_t maxFanIn; //testing: maximum number of runs merged at once (0: from the limits of the job)
 };
 
 
@@ -253,7 +274,7 @@ public:
 		return _it->item()._type;
 	}
 
-	u_int16_t getBankId(){
+	bankIdType getBankId(){
 		return _it->item()._bankId;
 	}
 
@@ -267,8 +288,8 @@ public:
 	//	return _nbKmers;
 	//}
 
-	u_int16_t _bankId;
-	u_int16_t _partitionId;
+	bankIdType _bankId;
+	u_int32_t _partitionId;
     Iterator<Kmer_BankId_Count>* _it;
     //u_int64_t _nbKmers;
 };
@@ -279,49 +300,73 @@ class SimkaCounterBuilderMerge
 public:
 
     /** Constructor.
+     * \param[in] abundancePerBank : sparse abundance vector filled for the current kmer
      * \param[in] nbBanks : number of banks parsed during kmer counting.
      */
-	SimkaCounterBuilderMerge (CountVector& abundancePerBank)  :  _abundancePerBank(abundancePerBank)  {}
+	SimkaCounterBuilderMerge (SparseCountVector& abundancePerBank, size_t nbBanks)  :
+		_abundancePerBank(abundancePerBank), _nbBanks(nbBanks), _kmerStamp(nbBanks, 0), _bankPosition(nbBanks, 0), _currentStamp(0), _isSorted(true)  {}
 
     /** Get the number of banks.
      * \return the number of banks. */
-    size_t size() const  { return _abundancePerBank.size(); }
+    size_t size() const  { return _nbBanks; }
 
     /** Initialization of the counting for the current kmer. This method should be called
-     * when a kmer is seen for the first time.
+     * when a kmer is seen for the first time. Only the banks seen for the previous kmer are cleared.
      * \param[in] idxBank : bank index where the new current kmer has been found. */
     void init (size_t idxBank, CountNumber abundance)
     {
-        for (size_t k=0; k<_abundancePerBank.size(); k++)  { _abundancePerBank[k]=0; }
-        _abundancePerBank [idxBank]= abundance;
+    	_abundancePerBank.clear();
+    	_currentStamp += 1;
+    	_isSorted = true;
+        increase(idxBank, abundance);
     }
 
     /** Increase the abundance of the current kmer for the provided bank index.
      * \param[in] idxBank : index of the bank */
-    void increase (size_t idxBank, CountNumber abundance)  {  _abundancePerBank [idxBank] += abundance;  }
+    void increase (size_t idxBank, CountNumber abundance)
+    {
+    	if(_kmerStamp[idxBank] == _currentStamp){
+    		_abundancePerBank[_bankPosition[idxBank]].second += abundance;
+    		return;
+    	}
 
-    /** Set the abundance of the current kmer for the provided bank index.
-     * \param[in] idxBank : index of the bank */
-    //void set (CountNumber val, size_t idxBank=0)  {  _abundancePerBank [idxBank] = val;  }
+    	if(!_abundancePerBank.empty() && _abundancePerBank.back().first > idxBank)
+    		_isSorted = false;
 
-    /** Get the abundance of the current kmer for the provided bank index.
-     * \param[in] idxBank : index of the bank
-     * \return the abundance of the current kmer for the given bank. */
-    //CountNumber operator[] (size_t idxBank) const  { return _abundancePerBank[idxBank]; }
+    	_kmerStamp[idxBank] = _currentStamp;
+    	_bankPosition[idxBank] = _abundancePerBank.size();
+    	_abundancePerBank.push_back(BankIdCount(idxBank, abundance));
+    }
 
-    /** */
-    //const CountVector& get () const { return _abundancePerBank; }
+    /** Get the abundances of the current kmer, sorted by bank index (distances are accumulated
+     * for ordered pairs of banks). Must be called once the kmer is complete, before next init. */
+    const SparseCountVector& get ()
+    {
+    	if(!_isSorted){
+    		sort(_abundancePerBank.begin(), _abundancePerBank.end());
+    		_isSorted = true;
+    	}
+    	return _abundancePerBank;
+    }
 
     void print(const string& kmer){
 		cout << kmer << ": ";
-    	for(size_t i=0; i<size(); i++){
-    		cout << _abundancePerBank[i] << " ";
+    	for(size_t i=0; i<_abundancePerBank.size(); i++){
+    		cout << _abundancePerBank[i].first << ":" << _abundancePerBank[i].second << " ";
     	}
     	cout << endl;
     }
 
 private:
-    CountVector& _abundancePerBank;
+    SparseCountVector& _abundancePerBank;
+    size_t _nbBanks;
+
+    //_kmerStamp[bank] == _currentStamp when the bank has already been seen for the current kmer,
+    //its entry is then at _bankPosition[bank] in _abundancePerBank
+    vector<u_int64_t> _kmerStamp;
+    vector<u_int32_t> _bankPosition;
+    u_int64_t _currentStamp;
+    bool _isSorted;
 };
 
 
@@ -635,8 +680,141 @@ public:
 
 
 
+/** Kmers [_start, _end) merged by a job, when a large partition is split in several jobs */
 template<size_t span>
-class DiskBasedMergeSort
+struct KmerRange
+{
+	typedef typename Kmer<span>::Type Type;
+
+	KmerRange() : _hasStart(false), _hasEnd(false), _isEmpty(false) {}
+
+	bool isBefore(const Type& kmer) const { return _hasStart && kmer < _start; }
+	bool isAfter(const Type& kmer) const { return _isEmpty || (_hasEnd && !(kmer < _end)); }
+
+	bool _hasStart;
+	Type _start;
+	bool _hasEnd;
+	Type _end;
+	bool _isEmpty;
+};
+
+
+/** Reader of a sorted run of kmer counts, from the gzip member at offset for the count files (gz), from the start
+ * for the runs written by the pre-merge (raw binary files) */
+template<class Item>
+class SimkaKmerRunIterator : public Iterator<Item>
+{
+public:
+
+	SimkaKmerRunIterator(const string& filename, size_t cacheItemsNb, bool isGz, u_int64_t offset) :
+		_filename(filename), _cacheItemsNb(cacheItemsNb), _isGz(isGz), _offset(offset), _gz(0), _file(0), _pos(0), _nbItems(0), _isDone(true)
+	{
+		_items = new Item[_cacheItemsNb];
+	}
+
+	~SimkaKmerRunIterator(){
+		closeFile();
+		delete[] _items;
+	}
+
+	void first(){
+
+		closeFile();
+
+		if(_isGz){
+			int fd = open(_filename.c_str(), O_RDONLY);
+			if(fd < 0 || lseek(fd, _offset, SEEK_SET) < 0 || (_gz = gzdopen(fd, "rb")) == 0){
+				cout << "Error: can't read kmer counts " << _filename << endl;
+				exit(1);
+			}
+			gzbuffer(_gz, SIMKA_MERGE_GZ_MEMORY);
+		}
+		else{
+			_file = fopen(_filename.c_str(), "rb");
+			if(_file == 0){
+				cout << "Error: can't read kmer counts " << _filename << endl;
+				exit(1);
+			}
+		}
+
+		_pos = 0;
+		_nbItems = 0;
+		_isDone = false;
+		next();
+	}
+
+	void next(){
+
+		if(_pos == _nbItems){
+
+			size_t nbBytes = 0;
+			if(_gz){
+				int nbRead = gzread(_gz, _items, _cacheItemsNb*sizeof(Item));
+				if(nbRead > 0) nbBytes = nbRead;
+			}
+			else{
+				nbBytes = fread(_items, 1, _cacheItemsNb*sizeof(Item), _file);
+			}
+
+			_pos = 0;
+			_nbItems = nbBytes / sizeof(Item);
+			if(_nbItems == 0){
+				_isDone = true;
+				return;
+			}
+		}
+
+		*this->_item = _items[_pos];
+		_pos += 1;
+	}
+
+	bool isDone(){
+		return _isDone;
+	}
+
+private:
+
+	void closeFile(){
+		if(_gz) gzclose(_gz);
+		if(_file) fclose(_file);
+		_gz = 0;
+		_file = 0;
+	}
+
+	string _filename;
+	size_t _cacheItemsNb;
+	bool _isGz;
+	u_int64_t _offset;
+	gzFile _gz;
+	FILE* _file;
+	Item* _items;
+	size_t _pos;
+	size_t _nbItems;
+	bool _isDone;
+};
+
+
+/** Open a sorted run of kmer counts. Count files are gz compressed, the runs written by the pre-merge are raw binary files.
+ * A count file with a block index is read from the gzip member of the first kmer of the range, instead of from its start. */
+template<class Item, size_t span>
+Iterator<Item>* openKmerRun(const string& filename, const KmerRange<span>& range){
+
+	bool isGz = filename.size() > 3 && filename.compare(filename.size()-3, 3, ".gz") == 0;
+
+	u_int64_t offset = 0;
+	if(isGz && range._hasStart){
+		SimkaGzBlockIndex<Item> index;
+		if(index.load(filename)) offset = index.getOffset(range._start);
+	}
+
+	return new SimkaKmerRunIterator<Item>(filename, SIMKA_MERGE_FILE_CACHE, isGz, offset);
+}
+
+
+/** Merge of a group of sorted runs into a single sorted run (raw binary file). The groups of a pre-merge level
+ * are independent commands, dispatched on the cores of the merge job. */
+template<size_t span>
+class DiskBasedMergeSort : public gatb::core::tools::dp::ICommand
 {
 
 public:
@@ -668,25 +846,19 @@ public:
 
 	struct kxpcomp { bool operator() (kxp& l, kxp& r) { return (r._type < l._type); } } ;
 
-	string _outputDir;
 	string _outputFilename;
-	vector<size_t>& _datasetIds;
+	vector<sortItem_Size_Filename_ID> _inputs;
 	size_t _partitionId;
-	Bag<Kmer_BankId_Count>* _outputGzFile;
-	Bag<Kmer_BankId_Count>* _cachedBag;
-
+	KmerRange<span> _range;
 
 
-    DiskBasedMergeSort(size_t mergeId, const string& outputDir, vector<size_t>& datasetIds, size_t partitionId):
-    	_datasetIds(datasetIds)
+	/** Merge the kmers of range of the input runs into outputFilename. Temporary inputs (runs of a previous level)
+	 * are removed after the merge, the count files are kept, they may be shared with other jobs. */
+    DiskBasedMergeSort(const string& outputFilename, const vector<sortItem_Size_Filename_ID>& inputs, size_t partitionId, const KmerRange<span>& range):
+    	_inputs(inputs), _range(range)
     {
-    	_outputDir = outputDir;
     	_partitionId = partitionId;
-
-    	_outputFilename = _outputDir + "/solid/part_" + Stringify::format("%i", partitionId) + "/__p__" + Stringify::format("%i", mergeId) + ".gz.temp";
-    	_outputGzFile = new BagGzFile<Kmer_BankId_Count>(_outputFilename);
-    	_cachedBag = new BagCache<Kmer_BankId_Count>(_outputGzFile, 10000);
-
+    	_outputFilename = outputFilename;
     }
 
     ~DiskBasedMergeSort(){
@@ -694,51 +866,17 @@ public:
 
     void execute(){
 
-		vector<IterableGzFile<Kmer_BankId_Count>* > partitions;
 		vector<StorageIt<span>*> its;
 
-		size_t _nbBanks = _datasetIds.size();
+		size_t _nbBanks = _inputs.size();
 
 		for(size_t i=0; i<_nbBanks; i++){
-			//cout << _datasetIds[i] << endl;
-			string filename = _outputDir + "/solid/part_" +  Stringify::format("%i", _partitionId) + "/__p__" + Stringify::format("%i", _datasetIds[i]) + ".gz";
-			//cout << "\t\t" << filename << endl;
-			IterableGzFile<Kmer_BankId_Count>* partition = new IterableGzFile<Kmer_BankId_Count>(filename, 10000);
-			partitions.push_back(partition);
-			its.push_back(new StorageIt<span>(partition->iterator(), i, _partitionId));
-			//nbKmers += partition->estimateNbItems();
-
-			//size_t currentPart = 0;
-			//ifstream file((_outputDir + "/kmercount_per_partition/" +  _datasetIds[i] + ".txt").c_str());
-			//while(getline(file, line)){
-			//	if(line == "") continue;
-			//	if(currentPart == _partitionId){
-			//		//cout << stoull(line) << endl;
-			//		nbKmers += strtoull(line.c_str(), NULL, 10);
-			//		break;
-			//	}
-			//	currentPart += 1;
-			//}
-			//file.close();
+			its.push_back(new StorageIt<span>(openKmerRun<Kmer_BankId_Count>(_inputs[i]._filename, _range), i, _partitionId));
 		}
 
-		//u_int64_t progressStep = nbKmers / 1000;
-		//_progress = new ProgressSynchro (
-		//	createIteratorListener (nbKmers, "Merging kmers"),
-		//	System::thread().newSynchronizer());
-		//_progress->init ();
-
+		string tempFilename = _outputFilename + ".temp";
+		Bag<Kmer_BankId_Count>* cachedBag = new BagCache<Kmer_BankId_Count>(new BagFile<Kmer_BankId_Count>(tempFilename), SIMKA_MERGE_FILE_CACHE);
 
-
-		//_nbDistinctKmers = 0;
-		//_nbSharedDistinctKmers = 0;
-		//u_int64_t nbKmersProcessed = 0;
-		//size_t nbBankThatHaveKmer = 0;
-		//u_int16_t best_p = 0;
-		Type previous_kmer;
-		//CountVector abundancePerBank;
-		//abundancePerBank.resize(_nbBanks, 0);
-		//SimkaCounterBuilderMerge* solidCounter = new SimkaCounterBuilderMerge(abundancePerBank);;
 		std::priority_queue< kxp, vector<kxp>,kxpcomp > pq;
 		StorageIt<span>* bestIt;
 
@@ -751,19 +889,16 @@ public:
 		//fill the  priority queue with the first elems
 		for (size_t ii=0; ii<_nbBanks; ii++)
 		{
-			//pq.push(Kmer_BankId_Count(ii,its[ii]->value()));
+			while(!its[ii]->_it->isDone() && _range.isBefore(its[ii]->value())) its[ii]->next();
+			if(its[ii]->_it->isDone()) continue;
 			pq.push(kxp(its[ii]->value(), its[ii]->getBankId(), its[ii]->abundance(), its[ii]));
 		}
 
-		if (pq.size() != 0) // everything empty, no kmer at all
+		if (pq.size() != 0 && !_range.isAfter(pq.top()._type)) // everything empty, no kmer at all
 		{
 			//get first pointer
 			bestIt = pq.top()._it; pq.pop();
-			_cachedBag->insert(Kmer_BankId_Count(bestIt->value(), bestIt->getBankId(), bestIt->abundance()));
-			//best_p = get<1>(pq.top()) ; pq.pop();
-			//previous_kmer = bestIt->value();
-			//solidCounter->init (bestIt->getBankId(), bestIt->abundance());
-			//nbBankThatHaveKmer = 1;
+			cachedBag->insert(Kmer_BankId_Count(bestIt->value(), bestIt->getBankId(), bestIt->abundance()));
 
 			while(1){
 
@@ -775,51 +910,38 @@ public:
 					}
 
 					//otherwise get new best
-					//best_p = get<1>(pq.top()) ; pq.pop();
 					bestIt = pq.top()._it; pq.pop();
 				}
+				else{
+					pq.push(kxp(bestIt->value(), bestIt->getBankId(), bestIt->abundance(), bestIt)); //push new val of this pointer in pq, will be counted later
+			    	bestIt = pq.top()._it; pq.pop();
+				}
 
-				pq.push(kxp(bestIt->value(), bestIt->getBankId(), bestIt->abundance(), bestIt)); //push new val of this pointer in pq, will be counted later
-
-		    	bestIt = pq.top()._it; pq.pop();
-		    	_cachedBag->insert(Kmer_BankId_Count(bestIt->value(), bestIt->getBankId(), bestIt->abundance()));
-		    	//cout << bestIt->value().toString(31) << " " << bestIt->getBankId() <<  " "<< bestIt->abundance() << endl;
-				//bestIt = get<3>(pq.top()); pq.pop();
-
-
-				//pq.push(kxp(bestIt->value(), bestIt->getBankId(), bestIt->abundance(), bestIt));
+				//Kmers come out sorted, the next ones are after the range too
+				if(_range.isAfter(bestIt->value())) break;
 
+		    	cachedBag->insert(Kmer_BankId_Count(bestIt->value(), bestIt->getBankId(), bestIt->abundance()));
 			}
-
-
-	    	//_outputGzFile->insert(Kmer_BankId_Count(bestIt->value(), bestIt->getBankId(), bestIt->abundance()));
-	    	//cout << bestIt->value().toString(31) << " " << bestIt->getBankId() <<  " "<< bestIt->abundance() << endl;
-		}
-
-		for(size_t i=0; i<partitions.size(); i++){
-			delete partitions[i];
 		}
 
 		for(size_t i=0; i<its.size(); i++){
 			delete its[i];
 		}
 
-
-		_cachedBag->flush();
-    	delete _cachedBag;
+		cachedBag->flush();
+    	delete cachedBag;
 
 		for(size_t i=0; i<_nbBanks; i++){
-			//cout << _datasetIds[i] << endl;
-			string filename = _outputDir + "/solid/part_" +  Stringify::format("%i", _partitionId) + "/__p__" + Stringify::format("%i", _datasetIds[i]) + ".gz";
-			System::file().remove(filename);
+			if(_inputs[i]._isTemporary){
+				System::file().remove(_inputs[i]._filename);
+			}
 		}
 
-		string newOutputFilename = _outputFilename;
-		newOutputFilename.erase(_outputFilename.size()-5, 5);
-    	System::file().rename(_outputFilename, newOutputFilename); //remove .temp at the end of new merged file
-    	//_outputFilename = newOutputFilename;
+    	System::file().rename(tempFilename, _outputFilename); //remove .temp at the end of new merged file
     }
 
+	void use () {}
+	void forget () {}
 };
 
 
@@ -946,70 +1068,139 @@ public:
 
 		removeStorage(p);
 
-		_partitionId = p.partitionId;
-
 		createDatasetIdList(p);
 		_nbBanks = _datasetIds.size();
 
+		//In tiled mode, only the pairs of one tile are computed, from the count files of the banks of the tile
+		_isTiled = p.tileSize > 0;
+		_tile = _isTiled ? SimkaTile(p.tileId, p.tileSize, _nbBanks) : SimkaTile(_nbBanks);
+		_jobId = SimkaMergeJob(p.partitionId, p.nbMergedPartitions, p.rangeId, p.nbRanges).getId();
+		if(_isTiled) _jobId += "_" + Stringify::format("%i", p.tileId);
+		_hasForeignBanks = false;
+
+		//In an incremental run, the pairs of the previous banks are in the statistics of the previous runs
+		_firstNewBank = p.firstNewBank;
+		if(_firstNewBank > 0){
+			_tile = SimkaTile(0, _nbBanks, _firstNewBank, _nbBanks);
+			_jobId = "add" + Stringify::format("%i", _firstNewBank) + "_" + _jobId;
+		}
+
+		//In a query run, the pairs of the references and the queries are a single rectangle, the kmers of the
+		//references only are skipped as in an incremental run
+		_nbReferenceBanks = p.nbReferenceBanks;
+		if(_nbReferenceBanks > 0){
+			_firstNewBank = _nbReferenceBanks;
+			_tile = SimkaTile(0, _nbReferenceBanks, _nbReferenceBanks, _nbBanks);
+			_jobId = "query" + Stringify::format("%i", _nbReferenceBanks) + "_" + _jobId;
+		}
+
+		if(!_countIndex.load(p.outputDir + "/kmercount_per_partition/index.bin") || _countIndex.getNbBanks() != _nbBanks){
+			cout << "Error: can't load the kmer count index " << p.outputDir << "/kmercount_per_partition/index.bin" << endl;
+			exit(1);
+		}
+
+		//-multi-abundance-min: the count files have the kmers of the lowest threshold, there are statistics for each
+		//threshold. -bootstrap: the statistics of the run are followed by the ones of each replicate.
+		//The memory of the job is shared by all the statistics.
+		_abundanceMins = p.abundanceMins;
+		_firstBootstrapStats = max((size_t)1, _abundanceMins.size());
+		_isBootstrapMerge = false;
+		_replicateWeights.resize(p.nbBootstraps);
+		for(size_t r=0; r<p.nbBootstraps; r++) SimkaBootstrap::getWeights(r, _replicateWeights[r]);
+		size_t nbStats = _firstBootstrapStats + p.nbBootstraps;
+		bool isSparse = SimkaStatistics::isSparse(_tile, p.computeSimpleDistances, p.computeComplexDistances, p.maxMemory / nbStats);
+
+		for(size_t i=0; i<nbStats; i++){
+			SimkaStatistics* stats = new SimkaStatistics(_nbBanks, p.computeSimpleDistances, p.computeComplexDistances, p.outputDir, _datasetIds, isSparse, _tile);
+			if(i >= _firstBootstrapStats) stats->loadBankCounts(p.outputDir, _datasetIds, SimkaBootstrap::getReplicateId(i - _firstBootstrapStats));
+			else if(i > 0) stats->loadBankCounts(p.outputDir, _datasetIds, SimkaAlgorithm<>::toString(_abundanceMins[i]));
+			_statsSets.push_back(stats);
+			_processorSets.push_back(new SimkaCountProcessorSimple<span> (stats, _nbBanks, p.kmerSize, _abundanceThreshold, SUM, false, p.minShannonIndex));
+		}
+		setStats(0);
+
+		//Small partitions are grouped in a single job, their statistics are summed
+		for(size_t i=0; i<p.nbMergedPartitions; i++){
+			mergePartition(p, p.partitionId + i);
+		}
+
+		for(size_t i=0; i<nbStats; i++){
+			setStats(i);
+			_processor->end();
+			saveStats(getStatsDir(p, i));
+
+			delete _statsSets[i];
+			delete _processorSets[i];
+		}
+
+		//Peak memory of the job in its log, ru_maxrss is in KB on linux
+		struct rusage usage;
+		if(getrusage(RUSAGE_SELF, &usage) == 0) cout << "Peak memory: " << usage.ru_maxrss / 1024 << " MB" << endl;
+
+		writeFinishSignal(p);
+	}
+
+	/** Merge the count files of a partition, or the kmers of one of its ranges if the partition is split in several jobs */
+	void mergePartition(Parameter& p, size_t partitionId){
+
+		_partitionId = partitionId;
+
 		string partDir = p.outputDir + "/solid/part_" + Stringify::format("%i", _partitionId) + "/";
 		vector<string> filenames = System::file().listdir(partDir);
 		//cout << filenames.size() << endl;
 		vector<string> partFilenames;
 		vector<sortItem_Size_Filename_ID> filenameSizes;
 
-		for(size_t i=0; i<filenames.size(); i++){
-			if(filenames[i].find("__p__") != std::string::npos){
+		//The range bounds are computed on the largest count file, chosen among all the count files of the partition
+		//so that every range and tile job of the partition gets the same bounds
+		string refFilename = "";
+		u_int64_t refSize = 0;
+		size_t refDatasetId = 0;
+		size_t refLastDatasetId = 0;
 
+		//A dataset counted again by another job must not be merged twice
+		vector<pair<size_t, size_t> > fileDatasets;
 
-				string id = string(filenames[i]);
-				id.erase(0, 5);
-				std::string::size_type pos = id.find(".gz");
-				id.erase(pos, 3);
+		for(size_t i=0; i<filenames.size(); i++){
+			size_t datasetId;
+			size_t lastDatasetId;
+			if(SimkaAlgorithm<>::parseCountFilename(filenames[i], datasetId, lastDatasetId)){
 
-				size_t datasetId = atoll(id.c_str());
+				fileDatasets.push_back(pair<size_t, size_t>(datasetId, lastDatasetId));
 				//cout << filenames[i] << " " << datasetId << endl;
 
-				filenameSizes.push_back(sortItem_Size_Filename_ID(getFileSize(partDir+filenames[i]), datasetId));
+				u_int64_t size = datasetId < _nbBanks ? _countIndex.getFileSize(datasetId, _partitionId) : 0;
+				if(refFilename == "" || size > refSize || (size == refSize && filenames[i] < refFilename)){
+					refFilename = filenames[i];
+					refSize = size;
+					refDatasetId = datasetId;
+					refLastDatasetId = lastDatasetId;
+				}
+
+				if(!_tile.hasBanks(datasetId, lastDatasetId)) continue;
+				if(_isTiled && lastDatasetId > datasetId) _hasForeignBanks = true;
+
+				filenameSizes.push_back(sortItem_Size_Filename_ID(size, datasetId, partDir+filenames[i], false));
 				//cout << filenames[i] << " " << size << endl;
 				//cout << filenames[i] << endl;
 			}
 		}
 
-		//cout << "mettre un while ici" << endl;
-		while(filenameSizes.size() > SIMKA_MERGE_MAX_FILE_USED){
-
-			//cout << "Start merging pass" << endl;
-			sort(filenameSizes.begin(),filenameSizes.end(),sortFileBySize);
-
-			vector<size_t> mergeDatasetIds;
-			vector<size_t> toRemoveItem;
-
-
-			for(size_t i=0; i<SIMKA_MERGE_MAX_FILE_USED; i++){
-				sortItem_Size_Filename_ID sfi = filenameSizes[i];
-				mergeDatasetIds.push_back(sfi._datasetID);
-				//datasetIndex += 1;
-				//if(datasetIndex >= _nbBanks) break;
-
-				//cout << mergeDatasetIds[i] << endl;
-				//cout << "First val must never be greater than second:   " << i << "  " << _nbBanks << endl;
-				//cout << "\t" << get<1>(sfi) << endl;
+		sort(fileDatasets.begin(), fileDatasets.end());
+		for(size_t i=1; i<fileDatasets.size(); i++){
+			if(fileDatasets[i].first <= fileDatasets[i-1].second){
+				cout << "Error: dataset " << fileDatasets[i].first << " is in several count files of " << partDir << endl;
+				exit(1);
 			}
+		}
 
-			for(size_t i=0; i<mergeDatasetIds.size(); i++){
-				filenameSizes.erase(filenameSizes.begin());
-			}
-
-			size_t mergedId = mergeDatasetIds[0];
-			DiskBasedMergeSort<span> diskBasedMergeSort(mergedId, p.outputDir, mergeDatasetIds, _partitionId);
-			diskBasedMergeSort.execute();
-
-			filenameSizes.push_back(sortItem_Size_Filename_ID(getFileSize(diskBasedMergeSort._outputFilename), mergedId));
-
-			//cout << "\tmerged id: " <<  mergedId << endl;
-			//cout << "\tremainging files: " << filenameSizes.size() << endl;
+		_range = KmerRange<span>();
+		if(p.nbRanges > 1 && refFilename != ""){
+			computeKmerRange(p, partDir + refFilename, refDatasetId, refLastDatasetId);
 		}
 
+		preMerge(p, partDir, filenameSizes);
+
 		//cout << filenameSizes.size() << endl;
 		//for(size_t i=0; i<filenameSizes.size(); i++){
 		//	cout << filenameSizes[i].first << endl;
@@ -1064,9 +1255,6 @@ public:
 
 		//createProcessor(p);
 
-		//PARALLEL line to remove
-		_stats = new SimkaStatistics(_nbBanks, p.computeSimpleDistances, p.computeComplexDistances, p.outputDir, _datasetIds);
-		_processor = new SimkaCountProcessorSimple<span> (_stats, _nbBanks, p.kmerSize, _abundanceThreshold, SUM, false, p.minShannonIndex);
 		//_processor->use();
 
 
@@ -1074,32 +1262,48 @@ public:
 
 
 
+		mergeRuns(filenameSizes);
+
+		//-bootstrap: the count files of the read blocks of all the datasets are merged together, in the same kmer range,
+		//each kmer gets the counts of all the blocks of the datasets to build the abundances of the replicates
+		if(p.nbBootstraps > 0){
+
+			vector<sortItem_Size_Filename_ID> blockFilenameSizes;
+
+			for(size_t b=0; b<SIMKA_BOOTSTRAP_NB_BLOCKS; b++){
+
+				string blockDir = partDir + SimkaBootstrap::getCountsId(b) + "/";
+				vector<string> blockFilenames = System::file().listdir(blockDir);
+
+				for(size_t i=0; i<blockFilenames.size(); i++){
+					size_t datasetId;
+					size_t lastDatasetId;
+					if(!SimkaAlgorithm<>::parseCountFilename(blockFilenames[i], datasetId, lastDatasetId)) continue;
+					if(!_tile.hasBanks(datasetId, lastDatasetId)) continue;
+					blockFilenameSizes.push_back(sortItem_Size_Filename_ID(getFileSize(blockDir+blockFilenames[i]), datasetId, blockDir+blockFilenames[i], false));
+				}
+			}
+
+			_isBootstrapMerge = true;
+			preMerge(p, partDir, blockFilenameSizes);
+			mergeRuns(blockFilenameSizes);
+			_isBootstrapMerge = false;
+		}
+	}
+
+	/** Merges the sorted runs of kmer counts of the partition, each kmer is inserted with its counts in the banks.
+	 * The temporary runs are removed. */
+	void mergeRuns(vector<sortItem_Size_Filename_ID>& filenameSizes){
+
 		string line;
-		vector<IterableGzFile<Kmer_BankId_Count>* > partitions;
 		vector<StorageIt<span>*> its;
 		u_int64_t nbKmers = 0;
 
     	for(size_t i=0; i<filenameSizes.size(); i++){
-    		size_t datasetId = filenameSizes[i]._datasetID;
-    		string filename = p.outputDir + "/solid/part_" + Stringify::format("%i", p.partitionId) + "/__p__" + Stringify::format("%i", datasetId) + ".gz";
+    		string filename = filenameSizes[i]._filename;
     		//cout << filename << endl;
-    		IterableGzFile<Kmer_BankId_Count>* partition = new IterableGzFile<Kmer_BankId_Count>(filename, 10000);
-    		partitions.push_back(partition);
-    		its.push_back(new StorageIt<span>(partition->iterator(), i, _partitionId));
+    		its.push_back(new StorageIt<span>(openKmerRun<Kmer_BankId_Count>(filename, _range), i, _partitionId));
     		//nbKmers += partition->estimateNbItems();
-
-    		size_t currentPart = 0;
-	    	ifstream file((p.outputDir + "/kmercount_per_partition/" +  _datasetIds[i] + ".txt").c_str());
-			while(getline(file, line)){
-				if(line == "") continue;
-				if(currentPart == _partitionId){
-					//cout << stoull(line) << endl;
-					nbKmers += strtoull(line.c_str(), NULL, 10);
-					break;
-				}
-				currentPart += 1;
-			}
-			file.close();
     	}
 
 
@@ -1164,12 +1368,10 @@ public:
 		_nbDistinctKmers = 0;
 		_nbSharedDistinctKmers = 0;
 		u_int64_t nbKmersProcessed = 0;
-		size_t nbBankThatHaveKmer = 0;
-		u_int16_t best_p = 0;
+		bankIdType best_p = 0;
 		Type previous_kmer;
-	    CountVector abundancePerBank;
-		abundancePerBank.resize(_nbBanks, 0);
-		SimkaCounterBuilderMerge* solidCounter = new SimkaCounterBuilderMerge(abundancePerBank);;
+	    SparseCountVector abundancePerBank;
+		SimkaCounterBuilderMerge* solidCounter = new SimkaCounterBuilderMerge(abundancePerBank, _isBootstrapMerge ? _nbBanks * SIMKA_BOOTSTRAP_NB_BLOCKS : _nbBanks);
 		std::priority_queue< kxp, vector<kxp>,kxpcomp > pq;
 
     	StorageIt<span>* bestIt;
@@ -1183,17 +1385,18 @@ public:
 	    for (size_t ii=0; ii<its.size(); ii++)
 	    {
 	    	//pq.push(Kmer_BankId_Count(ii,its[ii]->value()));
+	    	while(!its[ii]->_it->isDone() && _range.isBefore(its[ii]->value())) its[ii]->next();
+	    	if(its[ii]->_it->isDone()) continue;
 	    	pq.push(kxp(its[ii]->value(), its[ii]->getBankId(), its[ii]->abundance(), its[ii]));
 	    }
 
-	    if (pq.size() != 0) // everything empty, no kmer at all
+	    if (pq.size() != 0 && !_range.isAfter(pq.top()._type)) // everything empty, no kmer at all
 	    {
 	        //get first pointer
 	    	bestIt = pq.top()._it; pq.pop();
 	        //best_p = get<1>(pq.top()) ; pq.pop();
 	        previous_kmer = bestIt->value();
 	        solidCounter->init (bestIt->getBankId(), bestIt->abundance());
-	        nbBankThatHaveKmer = 1;
 
 			while(1){
 
@@ -1222,6 +1425,8 @@ public:
 					//if new best is diff, this is the end of this kmer
 					if(bestIt->value()!=previous_kmer )
 					{
+						//Kmers come out sorted, the next ones are after the range too
+						if(_range.isAfter(bestIt->value())) break;
 
 						//nbKmersProcessed += nbBankThatHaveKmer;
 						//if(nbKmersProcessed > progressStep){
@@ -1237,46 +1442,30 @@ public:
 						//}
 						//cout << endl;
 
-						insert(previous_kmer, abundancePerBank, nbBankThatHaveKmer);
+						insert(previous_kmer, solidCounter->get());
 						//if(nbBankThatHaveKmer > 1)
 						//	_processor->process (_partitionId, previous_kmer, abundancePerBank);
 						//this->insert (previous_kmer, solidCounter);
 
 						solidCounter->init (bestIt->getBankId(), bestIt->abundance());
-						nbBankThatHaveKmer = 1;
 						previous_kmer = bestIt->value();
 					}
 					else
 					{
 						solidCounter->increase (bestIt->getBankId(), bestIt->abundance());
-						nbBankThatHaveKmer += 1;
 					}
 				}
 				else
 				{
 					//cout << "increase" << endl;
 					solidCounter->increase (bestIt->getBankId(), bestIt->abundance());
-					nbBankThatHaveKmer += 1;
 				}
 			}
 
-			insert(previous_kmer, abundancePerBank, nbBankThatHaveKmer);
+			insert(previous_kmer, solidCounter->get());
 	    }
 
 
-		_processor->end();
-
-		//cout << "lala" << endl;
-		for(size_t i=0; i<partitions.size(); i++){
-			delete partitions[i];
-		}
-
-
-		saveStats(p);
-
-
-		delete _stats;
-		delete _processor;
 		//for(size_t i=0; i<its.size(); i++){
 		//	delete its[i];
 		//}
@@ -1299,12 +1488,241 @@ public:
 			delete its[i];
 		}
 
-		writeFinishSignal(p);
+		for(size_t i=0; i<filenameSizes.size(); i++){
+			if(filenameSizes[i]._isTemporary) System::file().remove(filenameSizes[i]._filename);
+		}
+
 		//_progress->finish();
+	}
+
+	/** Bounds of the range rangeId: the kmers at the quantiles rangeId/nbRanges and (rangeId+1)/nbRanges of the
+	 * reference count file. A quantile beyond the end of the file is an infinite bound. With a block index, the
+	 * quantiles are rounded to the first kmers of the gzip members, the file is not read. */
+	void computeKmerRange(Parameter& p, const string& refFilename, size_t firstDatasetId, size_t lastDatasetId){
+
+		bool searchStart = p.rangeId > 0;
+		bool searchEnd = p.rangeId+1 < p.nbRanges;
+
+		SimkaGzBlockIndex<Kmer_BankId_Count> index;
+		if(index.load(refFilename) && index._firstItems.size() >= p.nbRanges){
+
+			size_t nbBlocks = index._firstItems.size();
+			size_t startBlock = (nbBlocks * p.rangeId) / p.nbRanges;
+			size_t endBlock = (nbBlocks * (p.rangeId+1)) / p.nbRanges;
+
+			if(searchStart){
+				_range._hasStart = true;
+				_range._start = index._firstItems[startBlock]._type;
+			}
+			if(searchEnd){
+				_range._hasEnd = true;
+				_range._end = index._firstItems[endBlock]._type;
+			}
+
+			return;
+		}
+
+		u_int64_t nbItems = 0;
+		for(size_t i=firstDatasetId; i<=lastDatasetId && i<_nbBanks; i++){
+			nbItems += _countIndex.getNbKmers(i, _partitionId);
+		}
+
+		u_int64_t startPos = (nbItems * p.rangeId) / p.nbRanges;
+		u_int64_t endPos = (nbItems * (p.rangeId+1)) / p.nbRanges;
+
+		Iterator<Kmer_BankId_Count>* it = openKmerRun<Kmer_BankId_Count>(refFilename, KmerRange<span>());
+
+		u_int64_t pos = 0;
+		for(it->first(); !it->isDone(); it->next()){
+			if(searchStart && pos == startPos){
+				_range._hasStart = true;
+				_range._start = it->item()._type;
+			}
+			if(searchEnd && pos == endPos){
+				_range._hasEnd = true;
+				_range._end = it->item()._type;
+				break;
+			}
+			pos += 1;
+		}
 
+		if(searchStart && !_range._hasStart) _range._isEmpty = true;
+
+		delete it;
 	}
 
-	void insert(const Type& kmer, const CountVector& counts, size_t nbBankThatHaveKmer){
+	/** Maximum number of runs merged at once by each of nbThreads threads, from the limit of open files
+	 * of the process and the memory of the merge job */
+	size_t getMaxFanIn(Parameter& p, size_t nbThreads){
+
+		u_int64_t maxFiles = SIMKA_MERGE_MAX_FILE_USED;
+
+		struct rlimit limit;
+		if(getrlimit(RLIMIT_NOFILE, &limit) == 0){
+			if(limit.rlim_cur == RLIM_INFINITY)
+				maxFiles = (u_int64_t)-1;
+			else if(limit.rlim_cur > 2*SIMKA_MERGE_RESERVED_FILES)
+				maxFiles = limit.rlim_cur - SIMKA_MERGE_RESERVED_FILES;
+			else
+				maxFiles = limit.rlim_cur / 2;
+		}
+
+		u_int64_t memoryPerFile = SIMKA_MERGE_FILE_CACHE*sizeof(Kmer_BankId_Count) + SIMKA_MERGE_GZ_MEMORY;
+		u_int64_t maxFilesMemory = ((u_int64_t)p.maxMemory*MBYTE) / memoryPerFile;
+
+		//One file per thread is the output run
+		u_int64_t maxFanIn = min(maxFiles, maxFilesMemory) / nbThreads;
+		if(maxFanIn > 2) maxFanIn -= 1;
+		if(p.maxFanIn > 0) maxFanIn = min(maxFanIn, (u_int64_t)p.maxFanIn);
+
+		return max(maxFanIn, (u_int64_t)2);
+	}
+
+	/** While there are more runs than the final merge can open, the smallest runs are merged by groups.
+	 * The groups of a level are independent and merged in parallel. Merged runs are raw binary files,
+	 * they are faster to write and read again than gz files. */
+	void preMerge(Parameter& p, const string& partDir, vector<sortItem_Size_Filename_ID>& runs){
+
+		size_t nbThreads = max(p.nbCores, (size_t)1);
+		size_t maxFinalFanIn = getMaxFanIn(p, 1);
+		size_t maxFanIn = getMaxFanIn(p, nbThreads);
+		size_t level = 0;
+
+		while(runs.size() > maxFinalFanIn){
+
+			sort(runs.begin(), runs.end(), sortFileBySize);
+
+			//Smallest number of runs to merge so that the remaining runs fit in the final merge
+			size_t nbMergedRuns = runs.size();
+			for(size_t k=2; k<runs.size(); k++){
+				if(runs.size() - k + (k + maxFanIn - 1) / maxFanIn <= maxFinalFanIn){
+					nbMergedRuns = k;
+					break;
+				}
+			}
+			size_t nbGroups = (nbMergedRuns + maxFanIn - 1) / maxFanIn;
+
+			//Runs are dealt by size to the groups, so that the groups are balanced
+			vector<vector<sortItem_Size_Filename_ID> > groups(nbGroups);
+			for(size_t i=0; i<nbMergedRuns; i++){
+				groups[i % nbGroups].push_back(runs[i]);
+			}
+			runs.erase(runs.begin(), runs.begin() + nbMergedRuns);
+
+			vector<ICommand*> cmds;
+			vector<string> filenames;
+			for(size_t g=0; g<nbGroups; g++){
+				string filename = partDir + "__m__" + _jobId + "_" + Stringify::format("%i", level) + "_" + Stringify::format("%i", g) + ".bin";
+				filenames.push_back(filename);
+				cmds.push_back(new DiskBasedMergeSort<span>(filename, groups[g], _partitionId, _range));
+			}
+
+			getDispatcher()->dispatchCommands(cmds, 0);
+
+			for(size_t g=0; g<nbGroups; g++){
+				delete cmds[g];
+				runs.push_back(sortItem_Size_Filename_ID(getFileSize(filenames[g]), groups[g][0]._datasetID, filenames[g], true));
+			}
+
+			level += 1;
+		}
+
+		if(level > 0) cout << "Pre-merge: " << level << " levels" << endl;
+	}
+
+	void insert(const Type& kmer, const SparseCountVector& counts){
+
+		if(_isBootstrapMerge){
+			insertReplicates(kmer, counts);
+			return;
+		}
+
+		//-multi-abundance-min: the kmer is added to the statistics of each threshold, with its counts above the threshold
+		if(!_abundanceMins.empty()){
+			for(size_t i=0; i<_abundanceMins.size(); i++){
+				setStats(i);
+				const SparseCountVector& abundanceMinCounts = getAbundanceMinCounts(counts, _abundanceMins[i]);
+				if(!abundanceMinCounts.empty()) insertBanks(kmer, abundanceMinCounts);
+			}
+		}
+		else{
+			setStats(0);
+			insertBanks(kmer, counts);
+		}
+	}
+
+	void setStats(size_t statsId){
+		_stats = _statsSets[statsId];
+		_processor = _processorSets[statsId];
+	}
+
+	/** Stats dir of the statistics statsId: the ones of the run, then the other thresholds, then the replicates */
+	string getStatsDir(Parameter& p, size_t statsId){
+		if(statsId >= _firstBootstrapStats) return SimkaAlgorithm<>::getBootstrapStatsDir(p.outputDir, statsId - _firstBootstrapStats);
+		if(statsId > 0) return SimkaAlgorithm<>::getAbundanceMinStatsDir(p.outputDir, _abundanceMins[statsId]);
+		return p.outputDir + "/stats/";
+	}
+
+	/** -bootstrap: the kmer is added to the statistics of each replicate. The counts are those of the read blocks, sorted
+	 * by dataset then block: the abundance of a dataset in a replicate is the sum of the counts of its blocks weighted
+	 * by the draws of the blocks, it is kept if it passes the abundance thresholds of the run. */
+	void insertReplicates(const Type& kmer, const SparseCountVector& counts){
+
+		for(size_t r=0; r<_replicateWeights.size(); r++){
+
+			const vector<u_int64_t>& weights = _replicateWeights[r];
+			_replicateCounts.clear();
+
+			size_t i = 0;
+			while(i < counts.size()){
+
+				size_t datasetId = counts[i].first / SIMKA_BOOTSTRAP_NB_BLOCKS;
+				u_int64_t abundance = 0;
+				for(; i < counts.size() && counts[i].first / SIMKA_BOOTSTRAP_NB_BLOCKS == datasetId; i++){
+					abundance += weights[counts[i].first % SIMKA_BOOTSTRAP_NB_BLOCKS] * counts[i].second;
+				}
+
+				if(abundance == 0 || abundance < p.abundanceMin || abundance > p.abundanceMax) continue;
+				_replicateCounts.push_back(BankIdCount(datasetId, abundance));
+			}
+
+			if(_replicateCounts.empty()) continue;
+			setStats(_firstBootstrapStats + r);
+			insertBanks(kmer, _replicateCounts);
+		}
+	}
+
+	/** The counts of a kmer that reach abundanceMin, they are copied only if some of them are filtered */
+	const SparseCountVector& getAbundanceMinCounts(const SparseCountVector& counts, u_int64_t abundanceMin){
+
+		size_t i = 0;
+		while(i < counts.size() && counts[i].second >= abundanceMin) i += 1;
+		if(i == counts.size()) return counts;
+
+		_abundanceMinCounts.clear();
+		for(i=0; i<counts.size(); i++){
+			if(counts[i].second >= abundanceMin) _abundanceMinCounts.push_back(counts[i]);
+		}
+		return _abundanceMinCounts;
+	}
+
+	void insertBanks(const Type& kmer, const SparseCountVector& counts){
+
+		//The count files of several datasets may carry banks outside of the tile
+		if(_hasForeignBanks){
+			_tileCounts.clear();
+			for(size_t i=0; i<counts.size(); i++){
+				if(_tile.hasBank(counts[i].first)) _tileCounts.push_back(counts[i]);
+			}
+			if(_tileCounts.empty()) return;
+			insertTile(kmer, _tileCounts);
+		}
+		else{
+			insertTile(kmer, counts);
+		}
+	}
+
+	void insertTile(const Type& kmer, const SparseCountVector& counts){
 
 		//cout << kmer.toString(31) << endl;
 		//for(size_t i=0; i<counts.size(); i++){
@@ -1312,11 +1730,20 @@ public:
 		//}
 		//cout << endl;
 
-		_stats->_nbDistinctKmers += 1;
+		size_t nbBankThatHaveKmer = counts.size();
+
+		if(_firstNewBank > 0){
+			insertNew(kmer, counts);
+			return;
+		}
+
+		//A tile only reads the count files of its banks, it can't tell if a kmer is also seen by another tile.
+		//These counters are only computed without tiles.
+		if(!_isTiled) _stats->_nbDistinctKmers += 1;
 
 		if(_computeComplexDistances || nbBankThatHaveKmer > 1){
 
-			if(nbBankThatHaveKmer > 1){
+			if(nbBankThatHaveKmer > 1 && !_isTiled){
 				_stats->_nbSharedKmers += 1;
 			}
 
@@ -1325,41 +1752,36 @@ public:
 		}
 	}
 
-	void createDatasetIdList(Parameter& p){
-
-		string datasetIdFilename = p.outputDir + "/" + "datasetIds";
-		IFile* inputFile = System::file().newFile(datasetIdFilename, "rb");
-		//IFile* bankFile = System::file().newFile(_banksInputFilename, "wb");
-
-		inputFile->seeko(0, SEEK_END);
-		u_int64_t size = inputFile->tell();
-		inputFile->seeko(0, SEEK_SET);
-		char buffer2[size];
-		inputFile->fread(buffer2, size, size);
-		string fileContents(buffer2, size);
-
-		string line;
-		string linePart;
-		vector<string> linePartList;
-		stringstream fileContentsStream(fileContents);
-
-		//string bankFileContents = "";
+	/** Incremental run: the kmers of the previous banks only are skipped, their pairs did not change. Complex distances
+	 * also use the kmers missing from a bank, the pairs of a previous bank and a new bank need them all. */
+	void insertNew(const Type& kmer, const SparseCountVector& counts){
 
-		//u_int64_t lineIndex = 0;
+		size_t nbBankThatHaveKmer = counts.size();
+		size_t nbPreviousBanks = 0;
+		while(nbPreviousBanks < nbBankThatHaveKmer && counts[nbPreviousBanks].first < _firstNewBank) nbPreviousBanks += 1;
 
-		while(getline(fileContentsStream, line)){
+		if(nbPreviousBanks == nbBankThatHaveKmer && !_computeComplexDistances) return;
+		//Query run: the pairs of two queries are not computed
+		if(_nbReferenceBanks > 0 && nbPreviousBanks == 0 && !_computeComplexDistances) return;
 
-			if(line == "") continue;
+		//Kmers new to the run, and kmers shared for the first time
+		if(nbPreviousBanks == 0) _stats->_nbDistinctKmers += 1;
+		if(nbBankThatHaveKmer > 1 && nbPreviousBanks <= 1 && nbPreviousBanks < nbBankThatHaveKmer) _stats->_nbSharedKmers += 1;
 
-			_datasetIds.push_back(line);
+		if(_computeComplexDistances || nbBankThatHaveKmer > 1){
+			_processor->process(_partitionId, kmer, counts);
 		}
+	}
 
-		//bankFileContents.erase(bankFileContents.size()-1);
-		//bankFileContents.pop_back(); // "remove last /n
+	void createDatasetIdList(Parameter& p){
 
-		//bankFile->fwrite(bankFileContents.c_str(), bankFileContents.size(), 1);
+		SimkaRunDescriptor descriptor;
+		if(!descriptor.load(p.outputDir + "/run.bin")){
+			cout << "Error: can't load the run descriptor " << p.outputDir << "/run.bin" << endl;
+			exit(1);
+		}
 
-		delete inputFile;
+		_datasetIds = descriptor._datasetIds;
 	}
 
 	void createProcessor(Parameter& p){
@@ -1448,9 +1870,9 @@ public:
 
 	}*/
 
-	void saveStats(Parameter& p){
+	void saveStats(const string& statsDir){
 
-		string filename = p.outputDir + "/stats/part_" + SimkaAlgorithm<>::toString(p.partitionId) + ".gz";
+		string filename = statsDir + "/part_" + _jobId + ".gz";
 
 		_stats->save(filename); //storage->getGroup(""));
 
@@ -1470,7 +1892,7 @@ public:
 	}
 
 	void writeFinishSignal(Parameter& p){
-		string finishFilename = p.outputDir + "/merge_synchro/" +  SimkaAlgorithm<>::toString(p.partitionId) + ".ok";
+		string finishFilename = p.outputDir + "/merge_synchro/" +  _jobId + ".ok";
 		IFile* file = System::file().newFile(finishFilename, "w");
 		delete file;
 	}
@@ -1485,6 +1907,23 @@ private:
 	pair<size_t, size_t> _abundanceThreshold;
 	vector<string> _datasetIds;
 	size_t _partitionId;
+	bool _isTiled;
+	SimkaTile _tile;
+	size_t _firstNewBank;
+	size_t _nbReferenceBanks;
+	bool _hasForeignBanks;
+	SparseCountVector _tileCounts;
+	vector<u_int64_t> _abundanceMins;
+	size_t _firstBootstrapStats;
+	bool _isBootstrapMerge; //true while the count files of the read blocks of -bootstrap are merged
+	vector<vector<u_int64_t> > _replicateWeights; //draws of each read block by each replicate of -bootstrap
+	SparseCountVector _replicateCounts;
+	vector<SimkaStatistics*> _statsSets; //the statistics of the run, of the other thresholds and of the replicates
+	vector<SimkaCountProcessorSimple<span>*> _processorSets;
+	SparseCountVector _abundanceMinCounts;
+	string _jobId;
+	KmerRange<span> _range;
+	SimkaCountIndex _countIndex;
 	//vector<ICountProcessor<span>*> _processors;
 
 	IteratorListener* _progress;
@@ -1537,6 +1976,18 @@ public:
         getParser()->push_back (new OptionOneParam ("-partition-id",   "bank name", true));
         getParser()->push_back (new OptionOneParam ("-nb-cores",   "bank name", true));
         getParser()->push_back (new OptionOneParam ("-max-memory",   "bank name", true));
+        getParser()->push_back (new OptionOneParam ("-tile-size",   "nb banks per block of the tiled statistics (0: not tiled)", false, "0"));
+        getParser()->push_back (new OptionOneParam ("-tile-id",   "tile of the statistics computed by this job", false, "0"));
+        getParser()->push_back (new OptionOneParam ("-nb-merged-partitions",   "nb consecutive partitions merged by this job", false, "1"));
+        getParser()->push_back (new OptionOneParam ("-range-id",   "kmer range of the partition merged by this job", false, "0"));
+        getParser()->push_back (new OptionOneParam ("-nb-ranges",   "nb kmer ranges of the partition", false, "1"));
+        getParser()->push_back (new OptionOneParam ("-first-new-bank",   "incremental run: first bank added since the previous run", false, "0"));
+        getParser()->push_back (new OptionOneParam ("-nb-reference-banks",   "query run: nb reference banks, the first ones (0: not a query run)", false, "0"));
+        getParser()->push_back (new OptionOneParam (STR_SIMKA_MULTI_ABUNDANCE_MIN,   "abundance thresholds of the statistics, the one of the run first, comma separated", false));
+        getParser()->push_back (new OptionOneParam (STR_SIMKA_BOOTSTRAP,   "nb bootstrap replicates of the run, the statistics of the replicates are computed if it is not 0", false, "0"));
+        getParser()->push_back (new OptionOneParam (STR_KMER_ABUNDANCE_MIN,   "min abundance of the kmers of the bootstrap replicates", false, "0"));
+        getParser()->push_back (new OptionOneParam (STR_KMER_ABUNDANCE_MAX,   "max abundance of the kmers of the bootstrap replicates", false, "999999999"));
+        getParser()->push_back (new OptionOneParam ("-max-fan-in",   "max nb of runs merged at once, for testing the pre-merge levels (0: from the open files and memory limits)", false, "0", false));
         getParser()->push_back (new OptionOneParam (STR_SIMKA_MIN_KMER_SHANNON_INDEX,   "bank name", true));
 
         getParser()->push_back (new OptionNoParam (STR_SIMKA_COMPUTE_ALL_SIMPLE_DISTANCES.c_str(), "compute simple distances"));
@@ -1555,8 +2006,21 @@ public:
     	double minShannonIndex =   getInput()->getDouble(STR_SIMKA_MIN_KMER_SHANNON_INDEX);
     	bool computeSimpleDistances =   getInput()->get(STR_SIMKA_COMPUTE_ALL_SIMPLE_DISTANCES);
     	bool computeComplexDistances =   getInput()->get(STR_SIMKA_COMPUTE_ALL_COMPLEX_DISTANCES);
-
-    	Parameter params(getInput(), inputFilename, outputDir, partitionId, kmerSize, minShannonIndex, computeSimpleDistances, computeComplexDistances, nbCores);
+    	size_t maxMemory =  getInput()->getInt("-max-memory");
+    	size_t tileSize =  getInput()->getInt("-tile-size");
+    	size_t tileId =  getInput()->getInt("-tile-id");
+    	size_t nbMergedPartitions =  getInput()->getInt("-nb-merged-partitions");
+    	size_t rangeId =  getInput()->getInt("-range-id");
+    	size_t nbRanges =  getInput()->getInt("-nb-ranges");
+    	size_t firstNewBank =  getInput()->getInt("-first-new-bank");
+    	size_t nbReferenceBanks =  getInput()->getInt("-nb-reference-banks");
+
+    	Parameter params(getInput(), inputFilename, outputDir, partitionId, kmerSize, minShannonIndex, computeSimpleDistances, computeComplexDistances, nbCores, maxMemory, tileSize, tileId, nbMergedPartitions, rangeId, nbRanges, firstNewBank, nbReferenceBanks);
+    	if(getInput()->get(STR_SIMKA_MULTI_ABUNDANCE_MIN)) SimkaAlgorithm<>::parseAbundanceMins(getInput()->getStr(STR_SIMKA_MULTI_ABUNDANCE_MIN), params.abundanceMins);
+    	params.nbBootstraps = getInput()->getInt(STR_SIMKA_BOOTSTRAP);
+    	params.abundanceMin = getInput()->getInt(STR_KMER_ABUNDANCE_MIN);
+    	params.abundanceMax = getInput()->getInt(STR_KMER_ABUNDANCE_MAX);
+    	params.maxFanIn = getInput()->getInt("-max-fan-in");
 
         Integer::apply<Functor,Parameter> (kmerSize, params);
 
@@ -33,12 +33,24 @@ SimkaPotara::SimkaPotara(const string& execFilename)  : Tool ("Simka")
 
 	Simka::createOptionsParser(getParser());
 
+    getParser()->getParser("kmer")->push_back (new OptionOneParam (STR_SIMKA_MULTI_KMER_SIZE, "other kmer sizes computed in the same run, comma separated (ex: 31,41). The samples are read once for all the kmer sizes, the results of a kmer size are in <out>/k<size>", false));
+    getParser()->getParser("kmer")->push_back (new OptionOneParam (STR_SIMKA_MULTI_ABUNDANCE_MIN, "other abundance thresholds computed in the same run, comma separated (ex: 1,5). The samples are counted and merged once for all the thresholds, the results of a threshold are in <out>/t<threshold>", false));
+    getParser()->getParser("distance")->push_back (new OptionOneParam (STR_SIMKA_BOOTSTRAP, "nb bootstrap replicates of the read blocks. The abundances of the replicates are sums of the counts of the read blocks they draw, their matrices are in <out>/bootstrap/b<replicate> and the 95% intervals of the distances in <out>/bootstrap", false, "0"));
+    getParser()->getParser("distance")->push_back (new OptionOneParam (STR_SIMKA_OUTPUT_KNN, "only output the K nearest samples of each sample, as edge lists (edges_*.csv.gz) instead of the distance matrices", false, "0"));
+    getParser()->getParser("distance")->push_back (new OptionOneParam (STR_SIMKA_OUTPUT_MAX_DISTANCE, "only output the pairs of samples with a distance lower or equal to this value, as edge lists (edges_*.csv.gz) instead of the distance matrices", false));
+
 	//Kmer parser
     IOptionsParser* coreParser = getParser()->getParser("core");
 
     //clusterParser->push_back (new OptionNoParam (STR_SIMKA_CLUSTER_MODE, "enable cluster mode. All cluster args below must be set", false));
     coreParser->push_back (new OptionOneParam (STR_SIMKA_NB_JOB_COUNT, "maximum number of simultaneous counting jobs (a higher value improve execution time but increase temporary disk usage)", false));
     coreParser->push_back (new OptionOneParam (STR_SIMKA_NB_JOB_MERGE, "maximum number of simultaneous merging jobs (1 job = 1 core)", false));
+    coreParser->push_back (new OptionOneParam (STR_SIMKA_COUNT_BATCH_SIZE, "maximum number of small datasets counted by the same counting job (reduces the number of processes and files for numerous small datasets)", false));
+    coreParser->push_back (new OptionOneParam (STR_SIMKA_COUNT_CACHE, "directory of count outputs shared by the runs, the datasets already counted with the same parameters are not counted again (disables -count-batch)", false));
+    coreParser->push_back (new OptionOneParam (STR_SIMKA_REFERENCE, "temporary dir of a simka run on reference datasets done with -keep-tmp: only the distances between the input datasets and the references are computed (rectangular matrices)", false));
+    coreParser->push_back (new OptionOneParam (STR_SIMKA_TILE_SIZE, "split the statistics of the pairs of datasets in tiles of this number of datasets, each merging job then computes a single tile (default: only if the statistics don't fit in memory)", false));
+    coreParser->push_back (new OptionOneParam (STR_SIMKA_MERGE_RANGES, "split every partition in this number of kmer ranges merged by separate merging jobs (default: only the partitions much larger than the average)", false));
+    coreParser->push_back (new OptionOneParam (STR_SIMKA_MERGE_MAX_FAN_IN, "max number of count files merged at once by a merging job, for testing the pre-merge levels (default: from the open files and memory limits)", false, "", false));
 
 
     IOptionsParser* clusterParser = new OptionsParser ("cluster");
@@ -37,10 +37,21 @@
 //#define CLUSTER
 //#define SERIAL
 #define SLEEP_TIME_SEC 1
+#define SIMKA_MERGE_SPLIT_FACTOR 2 //Partitions with more kmers than SIMKA_MERGE_SPLIT_FACTOR times the average are split in kmer ranges
+#define SIMKA_CONFIG_SAMPLE_READS 1000000 //Reads sampled over all the datasets to compute the repartition of the minimizers
+#define SIMKA_CONFIG_MIN_SAMPLE_READS 100 //Minimum number of reads sampled per dataset
+#define SIMKA_COUNT_BATCH_MAX_SIZE 100000000 //Maximum size (bytes) of the input files of the datasets counted by the same job
 
 const string STR_SIMKA_CLUSTER_MODE = "-cluster";
 const string STR_SIMKA_NB_JOB_COUNT = "-max-count";
 const string STR_SIMKA_NB_JOB_MERGE = "-max-merge";
+const string STR_SIMKA_TILE_SIZE = "-tile-size";
+const string STR_SIMKA_MERGE_RANGES = "-merge-ranges";
+const string STR_SIMKA_MERGE_MAX_FAN_IN = "-merge-max-fan-in";
+const string STR_SIMKA_COUNT_BATCH_SIZE = "-count-batch";
+const string STR_SIMKA_COUNT_CACHE = "-count-cache";
+const string STR_SIMKA_REFERENCE = "-reference";
+const string STR_SIMKA_MULTI_KMER_SIZE = "-multi-kmer-size";
 const string STR_SIMKA_JOB_COUNT_COMMAND = "-count-cmd";
 const string STR_SIMKA_JOB_MERGE_COMMAND = "-merge-cmd";
 const string STR_SIMKA_JOB_COUNT_FILENAME = "-count-file";
@@ -77,6 +88,58 @@ private:
 
 
 
+/** Sample of a composite bank made of the first reads of each of its banks, so that every dataset
+ * is represented in the sample used to compute the repartition of the minimizers */
+class SimkaBankStratifiedSample : public BankDelegate
+{
+public:
+
+	SimkaBankStratifiedSample (IBank* ref, u_int64_t nbReadsPerBank) : BankDelegate (ref)  {
+		_nbReadsPerBank = nbReadsPerBank;
+	}
+
+	~SimkaBankStratifiedSample(){
+		for(size_t i=0; i<_its.size(); i++) delete _its[i];
+	}
+
+    Iterator<Sequence>* iterator ()
+    {
+        Iterator<Sequence>* it = _ref->iterator ();
+        _its.push_back(it);
+
+        std::vector<Iterator<Sequence>*> iterators = it->getComposition();
+        std::vector<Iterator<Sequence>*> truncIts;
+        for(size_t i=0; i<iterators.size(); i++){
+        	truncIts.push_back(new TruncateIterator<Sequence>(*iterators[i], _nbReadsPerBank));
+        }
+
+    	return new CompositeIterator<Sequence>(truncIts);
+    }
+
+    void estimate (u_int64_t& number, u_int64_t& totalSize, u_int64_t& maxSize){
+
+    	_ref->estimate(number, totalSize, maxSize);
+
+    	u_int64_t maxReads = _nbReadsPerBank * _ref->getCompositionNb();
+    	if(number > maxReads){
+    		totalSize = totalSize * ((double)maxReads / (double)number);
+    		number = maxReads;
+    	}
+    }
+
+    int64_t estimateNbItems (){
+    	u_int64_t number, totalSize, maxSize;
+    	estimate(number, totalSize, maxSize);
+    	return number;
+    }
+
+private:
+    u_int64_t _nbReadsPerBank;
+    vector<Iterator<Sequence>*> _its;
+};
+
+
+
 template<size_t span>
 class SimkaNullProcessor : public CountProcessorAbstract<span>{
 
@@ -118,6 +181,23 @@ private:
 
 
 
+/** Bank whose size estimate is given, for the configuration of datasets that can't be read twice */
+class SimkaBankEstimated : public BankDelegate
+{
+public:
+
+	SimkaBankEstimated (IBank* ref, const SimkaDatasetInfo& info) : BankDelegate (ref), _info(info) {}
+
+    void estimate (u_int64_t& number, u_int64_t& totalSize, u_int64_t& maxSize){
+    	number = _info._nbReads;
+    	totalSize = _info._totalSize;
+    	maxSize = _info._maxSize;
+    }
+
+private:
+    SimkaDatasetInfo _info;
+};
+
 class SimkaBankTemp : public BankDelegate
 {
 public:
@@ -199,6 +279,17 @@ public:
 };
 
 
+/** Run of another kmer size of -multi-kmer-size */
+struct SimkaPotaraMultiKmerParameter
+{
+	SimkaPotaraMultiKmerParameter (IProperties* options, const string& execFilename, bool isConfigOnly) : _options(options), _execFilename(execFilename), _isConfigOnly(isConfigOnly) {}
+	IProperties* _options;
+	string _execFilename;
+	bool _isConfigOnly;
+};
+
+template<size_t span> struct SimkaPotaraMultiKmerFunctor;
+
 template<size_t span>
 class SimkaPotaraAlgorithm : public SimkaAlgorithm<span>{
 public:
@@ -211,10 +302,12 @@ public:
 	{
 
 		_isClusterMode = false;
+		_countBatchSize = 1;
 
 		//cout << "lala" << endl;
 		//cout << _execDir << endl;
 
+		_execFilename = execFilename;
 		_execDir = System::file().getRealPath(execFilename);
 		_execDir = System::file().getDirectory(_execDir) + "/";
 
@@ -249,6 +342,20 @@ public:
 
 	void execute(){
 
+		if(!configure()) return;
+
+		//-multi-kmer-size: the other kmer sizes are configured in their own dirs before the counting, the count jobs of the run
+		//count every kmer size. The other kmer sizes are then merged, their datasets are already counted.
+		executeMultiKmer(true);
+
+		run();
+
+		executeMultiKmer(false);
+	}
+
+	/** Steps of the run before the counting, false if the run stops there (-preview) */
+	bool configure(){
+
 		parseArgs();
 
 		setup();
@@ -257,11 +364,29 @@ public:
 
 		SimkaAlgorithm<span>::computeMaxReads();
 
+		if(this->_isPreview){
+			SimkaAlgorithm<span>::computePreview();
+			return false;
+		}
+
+		if(_isIncremental) loadPreviousRun();
+		if(_referenceDir != "") loadReference();
+
 		createConfig();
 
+		if(_referenceDir != "") linkReference();
+
+		writeRunDescriptor();
+
+		return true;
+	}
+
+	void run(){
 
 		count();
 
+		createCountIndex();
+
 		printCountInfo();
 
 		merge();
@@ -299,7 +424,11 @@ public:
 
 			command = "rm " + this->_outputDirTemp + "/config.h5";
 			system(command.c_str());
-			command = "rm " + this->_outputDirTemp + "/datasetIds";
+			command = "rm -rf " + SimkaAlgorithm<>::getJobConfigDir(this->_outputDirTemp);
+			system(command.c_str());
+			command = "rm " + this->_outputDirTemp + "/config.key";
+			system(command.c_str());
+			command = "rm " + this->_outputDirTemp + "/run.bin";
 			system(command.c_str());
 			//cout << command << endl;
 			//System::file().rmdir(this->_outputDirTemp);
@@ -320,6 +449,88 @@ public:
 
 		SimkaAlgorithm<span>::parseArgs();
 
+		if(this->_options->get(STR_SIMKA_COUNT_BATCH_SIZE) && this->_options->getInt(STR_SIMKA_COUNT_BATCH_SIZE) > 1){
+			_countBatchSize = this->_options->getInt(STR_SIMKA_COUNT_BATCH_SIZE);
+		}
+
+		_subsampleMode = this->_options->get(STR_SIMKA_SUBSAMPLE_MODE) ? this->_options->getStr(STR_SIMKA_SUBSAMPLE_MODE) : "first";
+		if(_subsampleMode != "first" && _subsampleMode != "block"){
+			cout << "Error: " << STR_SIMKA_SUBSAMPLE_MODE << " must be first or block" << endl;
+			exit(1);
+		}
+
+		_concurrentInput = this->_options->get(STR_SIMKA_CONCURRENT_INPUT) != 0;
+
+		//The count job of a dataset counts all the kmer sizes from a single read of the dataset
+		_multiKmerSizes.clear();
+		if(this->_options->get(STR_SIMKA_MULTI_KMER_SIZE)) SimkaAlgorithm<>::parseKmerSizes(this->_options->getStr(STR_SIMKA_MULTI_KMER_SIZE), _multiKmerSizes);
+		_multiKmerSizes.erase(std::remove(_multiKmerSizes.begin(), _multiKmerSizes.end(), this->_kmerSize), _multiKmerSizes.end());
+		if(!_multiKmerSizes.empty()){
+			if(this->_options->get(STR_SIMKA_COUNT_CACHE) || this->_options->get(STR_SIMKA_REFERENCE) || this->_options->get(STR_SIMKA_INCREMENTAL)){
+				cout << "Error: " << STR_SIMKA_MULTI_KMER_SIZE << " can't be used with " << STR_SIMKA_COUNT_CACHE << ", " << STR_SIMKA_REFERENCE << " or " << STR_SIMKA_INCREMENTAL << endl;
+				exit(1);
+			}
+			_countBatchSize = 1;
+		}
+
+		//The datasets are counted with the lowest threshold, the statistics of every threshold are computed by the same merge
+		_abundanceMins.clear();
+		if(this->_options->get(STR_SIMKA_MULTI_ABUNDANCE_MIN)) SimkaAlgorithm<>::parseAbundanceMins(this->_options->getStr(STR_SIMKA_MULTI_ABUNDANCE_MIN), _abundanceMins);
+		_abundanceMins.erase(std::remove(_abundanceMins.begin(), _abundanceMins.end(), (u_int64_t)this->_abundanceThreshold.first), _abundanceMins.end());
+		if(!_abundanceMins.empty()){
+			if(this->_options->get(STR_SIMKA_COUNT_CACHE) || this->_options->get(STR_SIMKA_REFERENCE) || this->_options->get(STR_SIMKA_INCREMENTAL)){
+				cout << "Error: " << STR_SIMKA_MULTI_ABUNDANCE_MIN << " can't be used with " << STR_SIMKA_COUNT_CACHE << ", " << STR_SIMKA_REFERENCE << " or " << STR_SIMKA_INCREMENTAL << endl;
+				exit(1);
+			}
+		}
+
+		//The read blocks of the replicates are counted by the count jobs of the run, a dataset per job
+		_nbBootstraps = this->_options->getInt(STR_SIMKA_BOOTSTRAP);
+		if(_nbBootstraps > SIMKA_BOOTSTRAP_MAX){
+			cout << "Error: " << STR_SIMKA_BOOTSTRAP << " is limited to " << SIMKA_BOOTSTRAP_MAX << " replicates" << endl;
+			exit(1);
+		}
+		if(_nbBootstraps > 0){
+			if(!_abundanceMins.empty() || this->_options->get(STR_SIMKA_COUNT_CACHE) || this->_options->get(STR_SIMKA_REFERENCE) || this->_options->get(STR_SIMKA_INCREMENTAL)){
+				cout << "Error: " << STR_SIMKA_BOOTSTRAP << " can't be used with " << STR_SIMKA_MULTI_ABUNDANCE_MIN << ", " << STR_SIMKA_COUNT_CACHE << ", " << STR_SIMKA_REFERENCE << " or " << STR_SIMKA_INCREMENTAL << endl;
+				exit(1);
+			}
+			_countBatchSize = 1;
+		}
+
+		//Edge lists instead of the matrices, the intervals of -bootstrap are computed from the full matrices of the replicates
+		_outputNbNeighbors = this->_options->getInt(STR_SIMKA_OUTPUT_KNN);
+		_outputMaxDistance = this->_options->get(STR_SIMKA_OUTPUT_MAX_DISTANCE) ? this->_options->getDouble(STR_SIMKA_OUTPUT_MAX_DISTANCE) : -1;
+		if(this->_options->get(STR_SIMKA_OUTPUT_MAX_DISTANCE) && _outputMaxDistance < 0){
+			cout << "Error: " << STR_SIMKA_OUTPUT_MAX_DISTANCE << " must be positive" << endl;
+			exit(1);
+		}
+		if((_outputNbNeighbors > 0 || _outputMaxDistance >= 0) && _nbBootstraps > 0){
+			cout << "Error: " << STR_SIMKA_OUTPUT_KNN << " and " << STR_SIMKA_OUTPUT_MAX_DISTANCE << " can't be used with " << STR_SIMKA_BOOTSTRAP << endl;
+			exit(1);
+		}
+
+		//Every dataset has its own count files in the cache, they are not counted in batches
+		_countCacheDir = this->_options->get(STR_SIMKA_COUNT_CACHE) ? this->_options->getStr(STR_SIMKA_COUNT_CACHE) : "";
+		if(_countCacheDir != ""){
+			System::file().mkdir(_countCacheDir, -1);
+			_countBatchSize = 1;
+		}
+
+		//The temporary files of a run are the starting point of the next incremental run
+		_isIncremental = this->_options->get(STR_SIMKA_INCREMENTAL) != 0;
+		if(_isIncremental) this->_keepTmpFiles = true;
+		_nbPreviousBanks = 0;
+
+		_referenceDir = this->_options->get(STR_SIMKA_REFERENCE) ? this->_options->getStr(STR_SIMKA_REFERENCE) : "";
+		_nbReferenceBanks = 0;
+		//The -out-tmp of the reference run, or its simka_output_temp dir
+		if(_referenceDir != "" && System::file().doesExist(_referenceDir + "/simka_output_temp/run.bin")) _referenceDir += "/simka_output_temp";
+		if(_referenceDir != "" && _isIncremental){
+			cout << "Error: " << STR_SIMKA_REFERENCE << " and " << STR_SIMKA_INCREMENTAL << " can't be used together" << endl;
+			exit(1);
+		}
+
 		if(this->_options->get(STR_SIMKA_JOB_COUNT_FILENAME) || this->_options->get(STR_SIMKA_JOB_MERGE_FILENAME) || this->_options->get(STR_SIMKA_JOB_COUNT_COMMAND) || this->_options->get(STR_SIMKA_JOB_MERGE_COMMAND)){
 			_isClusterMode = true;
 			_jobCountFilename = this->_options->getStr(STR_SIMKA_JOB_COUNT_FILENAME);
@@ -338,25 +549,8 @@ public:
 
 
 
-			IFile* inputFile = System::file().newFile(_jobCountFilename, "rb");
-			inputFile->seeko(0, SEEK_END);
-			u_int64_t size = inputFile->tell();
-			inputFile->seeko(0, SEEK_SET);
-			char buffer2[size];
-			inputFile->fread(buffer2, size, size);
-			string fileContents(buffer2, size);
-			_jobCountContents = fileContents;
-			delete inputFile;
-
-			inputFile = System::file().newFile(_jobMergeFilename, "rb");
-			inputFile->seeko(0, SEEK_END);
-			size = inputFile->tell();
-			inputFile->seeko(0, SEEK_SET);
-			char buffer3[size];
-			inputFile->fread(buffer3, size, size);
-			string fileContents2(buffer3, size);
-			_jobMergeContents = fileContents2;
-			delete inputFile;
+			_jobCountContents = readFile(_jobCountFilename);
+			_jobMergeContents = readFile(_jobMergeFilename);
 
 
 		}
@@ -414,27 +608,182 @@ public:
 		SimkaAlgorithm<span>::setup();
 
 		createDirs();
-		layoutInputFilename();
 
 	}
 
-	void layoutInputFilename(){
+	/** Contents of a small text file (job templates) */
+	string readFile(const string& filename){
+		ifstream file(filename.c_str(), ios::in | ios::binary);
+		stringstream contents;
+		contents << file.rdbuf();
+		file.close();
+		return contents.str();
+	}
+
+	/** Incremental run: the datasets of the previous run (the last one whose stats were computed) must be the first
+	 * datasets of the input, in the same order, and be counted with the same parameters. Otherwise all the datasets
+	 * are computed again. */
+	void loadPreviousRun(){
+
+		string statsListFilename = this->_outputDirTemp + "/stats/stats_files.txt";
+		ifstream file(statsListFilename.c_str());
+		SimkaRunDescriptor descriptor;
+		size_t nbBanks = 0;
+		bool computeSimpleDistances = false;
+		bool computeComplexDistances = false;
+		string countKey;
+		string reason = "";
+
+		if(!descriptor.load(this->_outputDirTemp + "/run.bin") || !System::file().doesExist(this->_outputDirTemp + "/config.h5") ||
+				!(file >> nbBanks >> computeSimpleDistances >> computeComplexDistances >> countKey)){
+			reason = "no previous run kept in " + this->_outputDirTemp;
+		}
+		else if(nbBanks > this->_nbBanks || nbBanks > descriptor._datasetIds.size()){
+			reason = "datasets were removed since the previous run";
+		}
+		else{
+			for(size_t i=0; i<nbBanks; i++){
+				if(descriptor._datasetIds[i] != this->_bankNames[i]){
+					reason = "the datasets of the previous run must be the first ones of the input, in the same order";
+					break;
+				}
+			}
+		}
 
-		//SimkaAlgorithm<span>::layoutInputFilename();
+		if(reason == "" && (descriptor._kmerSize != this->_kmerSize || descriptor._abundanceMin != this->_abundanceThreshold.first ||
+				descriptor._abundanceMax != this->_abundanceThreshold.second || descriptor._minReadSize != this->_minReadSize ||
+				descriptor._minReadShannonIndex != this->_minReadShannonIndex || descriptor._minKmerShannonIndex != this->_minKmerShannonIndex ||
+				descriptor._sketchScale != this->_sketchScale ||
+				computeSimpleDistances != this->_computeSimpleDistances || computeComplexDistances != this->_computeComplexDistances)){
+			reason = "parameters changed since the previous run";
+		}
 
-		string datasetIdFilename = this->_outputDirTemp + "/" + "datasetIds";
-		IFile* datasetIdFile = System::file().newFile(datasetIdFilename, "wb");
+		//-max-reads 0 is the number of reads estimated by the previous run
+		if(reason == "" && this->_options->getInt(STR_SIMKA_MAX_READS) == 0){
+			this->_maxNbReads = descriptor._maxReads;
+			cout << "Incremental run: reads per sample used up to " << this->_maxNbReads << " (estimated by the previous run)" << endl;
+		}
+		if(reason == "" && (u_int64_t)this->_maxNbReads != descriptor._maxReads){
+			reason = "-max-reads changed since the previous run";
+		}
 
-		for(size_t i=0; i<this->_bankNames.size(); i++){
-			string bankName = this->_bankNames[i];
+		if(reason == "" && countKey != getConfigKey(nbBanks, false)){
+			reason = "input files of the previous datasets changed";
+		}
+
+		if(reason != ""){
+			cout << "Incremental run: " << reason << ", computing all the datasets" << endl << endl;
+			_isIncremental = false;
+			return;
+		}
+
+		string filename;
+		SimkaTile tile;
+		while(file >> filename >> tile._rowStart >> tile._rowEnd >> tile._colStart >> tile._colEnd){
+			_previousStatsFiles.push_back(pair<string, SimkaTile>(filename, tile));
+		}
+		file.close();
+
+		_nbPreviousBanks = nbBanks;
+		cout << "Incremental run: " << (this->_nbBanks - _nbPreviousBanks) << " datasets added to the " << _nbPreviousBanks << " datasets of the previous run" << endl << endl;
+	}
+
+	/** Query run: the datasets of the reference run (kept with -keep-tmp) are the first datasets of the run, followed
+	 * by the queries of the input. They must be counted with the same parameters, the references are not counted again. */
+	void loadReference(){
+
+		SimkaRunDescriptor descriptor;
+		if(!descriptor.load(_referenceDir + "/run.bin") || !System::file().doesExist(_referenceDir + "/config.h5") ||
+				!System::file().doesExist(_referenceDir + "/kmercount_per_partition/index.bin")){
+			cout << "Error: no complete simka run in reference dir " << _referenceDir << " (the reference run must be done with -keep-tmp)" << endl;
+			exit(1);
+		}
+
+		if(descriptor._kmerSize != this->_kmerSize || descriptor._abundanceMin != this->_abundanceThreshold.first ||
+				descriptor._abundanceMax != this->_abundanceThreshold.second || descriptor._minReadSize != this->_minReadSize ||
+				descriptor._minReadShannonIndex != this->_minReadShannonIndex || descriptor._minKmerShannonIndex != this->_minKmerShannonIndex ||
+				descriptor._sketchScale != this->_sketchScale){
+			cout << "Error: the k-mer size, abundance thresholds, read filters and sketch scale must be the ones of the reference run" << endl;
+			exit(1);
+		}
+
+		//-max-reads 0 is the number of reads estimated by the reference run
+		if(this->_options->getInt(STR_SIMKA_MAX_READS) == 0) this->_maxNbReads = descriptor._maxReads;
+		if((u_int64_t)this->_maxNbReads != descriptor._maxReads){
+			cout << "Error: -max-reads must be the one of the reference run (" << descriptor._maxReads << ")" << endl;
+			exit(1);
+		}
 
-			string bankIdLine = bankName + '\n';
-			datasetIdFile->fwrite(bankIdLine.c_str(), bankIdLine.size(), 1);
+		set<string> referenceIds(descriptor._datasetIds.begin(), descriptor._datasetIds.end());
+		for(size_t i=0; i<this->_nbBanks; i++){
+			if(referenceIds.find(this->_bankNames[i]) != referenceIds.end()){
+				cout << "Error: query dataset " << this->_bankNames[i] << " has the id of a reference dataset" << endl;
+				exit(1);
+			}
+		}
+
+		map<string, SimkaDatasetInfo> referenceInfos;
+		SimkaDatasetInfo::readManifest(_referenceDir + "/input_manifest", referenceInfos);
+
+		_nbReferenceBanks = descriptor._datasetIds.size();
+		vector<SimkaDatasetInfo> infos;
+		for(size_t i=0; i<_nbReferenceBanks; i++) infos.push_back(referenceInfos[descriptor._datasetIds[i]]);
+
+		this->_bankNames.insert(this->_bankNames.begin(), descriptor._datasetIds.begin(), descriptor._datasetIds.end());
+		this->_nbBankPerDataset.insert(this->_nbBankPerDataset.begin(), _nbReferenceBanks, 1);
+		this->_datasetInfos.insert(this->_datasetInfos.begin(), infos.begin(), infos.end());
+		this->_isStreamDataset.insert(this->_isStreamDataset.begin(), _nbReferenceBanks, false);
+		this->_nbBanks = this->_bankNames.size();
+
+		cout << "Query run: " << (this->_nbBanks - _nbReferenceBanks) << " query datasets against the " << _nbReferenceBanks << " datasets of " << _referenceDir << endl << endl;
+	}
+
+	/** The counts of the references are hard links to the files of the reference run, with the same dataset indexes */
+	void linkReference(){
+
+		for(size_t i=0; i<_nbReferenceBanks; i++){
+			string countFilename = this->_outputDirTemp + "/count_synchro/" + this->_bankNames[i] + ".ok";
+			if(System::file().doesExist(countFilename)) continue;
+			SimkaCountCache::linkFile(_referenceDir + "/kmercount_per_partition/" + this->_bankNames[i] + ".txt", this->_outputDirTemp + "/kmercount_per_partition/" + this->_bankNames[i] + ".txt");
+			SimkaCountCache::linkFile(_referenceDir + "/count_synchro/" + this->_bankNames[i] + ".ok", countFilename);
+		}
+
+		for(size_t j=0; j<_nbPartitions; j++){
+
+			string partDir = "/solid/part_" + SimkaAlgorithm<>::toString(j) + "/";
+			System::file().mkdir(this->_outputDirTemp + partDir, -1);
+			vector<string> filenames = System::file().listdir(_referenceDir + partDir);
+
+			for(size_t f=0; f<filenames.size(); f++){
+				if(filenames[f].find("__p__") != 0) continue;
+				if(System::file().doesExist(this->_outputDirTemp + partDir + filenames[f])) continue;
+				SimkaCountCache::linkFile(_referenceDir + partDir + filenames[f], this->_outputDirTemp + partDir + filenames[f]);
+			}
 		}
+	}
 
-		datasetIdFile->flush();
-		delete datasetIdFile;
+	/** Pairs of datasets of the statistics: the references and the queries in a query run, all the pairs otherwise */
+	SimkaTile getStatsTile(){
+		if(_nbReferenceBanks > 0) return SimkaTile(0, _nbReferenceBanks, _nbReferenceBanks, this->_nbBanks);
+		return SimkaTile(this->_nbBanks);
+	}
 
+	/** The parameters of the run and the dataset ids, mapped by the merge jobs */
+	void writeRunDescriptor(){
+
+		SimkaRunDescriptor descriptor;
+		descriptor._kmerSize = this->_kmerSize;
+		descriptor._nbPartitions = _nbPartitions;
+		descriptor._abundanceMin = this->_abundanceThreshold.first;
+		descriptor._abundanceMax = this->_abundanceThreshold.second;
+		descriptor._maxReads = this->_maxNbReads;
+		descriptor._minReadSize = this->_minReadSize;
+		descriptor._minReadShannonIndex = this->_minReadShannonIndex;
+		descriptor._minKmerShannonIndex = this->_minKmerShannonIndex;
+		descriptor._sketchScale = this->_sketchScale;
+		descriptor._datasetIds = this->_bankNames;
+
+		descriptor.write(this->_outputDirTemp + "/run.bin");
 	}
 
 
@@ -460,6 +809,12 @@ public:
 		System::file().mkdir(this->_outputDirTemp + "/count_synchro/", -1);
 		System::file().mkdir(this->_outputDirTemp + "/merge_synchro/", -1);
 		System::file().mkdir(this->_outputDirTemp + "/stats/", -1);
+		for(size_t i=0; i<_abundanceMins.size(); i++){
+			System::file().mkdir(SimkaAlgorithm<>::getAbundanceMinStatsDir(this->_outputDirTemp, _abundanceMins[i]), -1);
+		}
+		for(size_t i=0; i<_nbBootstraps; i++){
+			System::file().mkdir(SimkaAlgorithm<>::getBootstrapStatsDir(this->_outputDirTemp, i), -1);
+		}
 		System::file().mkdir(this->_outputDirTemp + "/job_count/", -1);
 		System::file().mkdir(this->_outputDirTemp + "/job_merge/", -1);
 		System::file().mkdir(this->_outputDirTemp + "/kmercount_per_partition/", -1);
@@ -516,6 +871,33 @@ public:
 		_maxJobCount = min(_maxJobCount, maxCores);
 		_maxJobMerge = min(_maxJobMerge, maxCores);
 
+		//Each merge job holds the statistics of every pair of datasets. If a single job does not fit in memory,
+		//the pairs are split in tiles of _tileSize x _tileSize datasets and each job computes a single tile
+		u_int64_t memoryPerMergeJob = SimkaStatistics::getDenseMemoryMB(getStatsTile(), this->_computeSimpleDistances, this->_computeComplexDistances);
+		if(_nbReferenceBanks > 0){
+			_tileSize = 0;
+		}
+		else if(this->_options->get(STR_SIMKA_TILE_SIZE)){
+			_tileSize = this->_options->getInt(STR_SIMKA_TILE_SIZE);
+		}
+		else if(memoryPerMergeJob > maxMemory){
+			_tileSize = SimkaStatistics::getTileSize(maxMemory / _maxJobMerge, this->_computeSimpleDistances, this->_computeComplexDistances);
+		}
+		else{
+			_tileSize = 0;
+		}
+		if(_tileSize >= this->_nbBanks) _tileSize = 0;
+		_nbMergeRanges = this->_options->get(STR_SIMKA_MERGE_RANGES) ? this->_options->getInt(STR_SIMKA_MERGE_RANGES) : 0;
+		_mergeMaxFanIn = this->_options->get(STR_SIMKA_MERGE_MAX_FAN_IN) ? this->_options->getInt(STR_SIMKA_MERGE_MAX_FAN_IN) : 0;
+		_nbTiles = (_tileSize > 0) ? SimkaTile::getNbTiles(this->_nbBanks, _tileSize) : 1;
+
+		//Without tiles, don't run more jobs than the memory can hold
+		if(_tileSize == 0 && !this->_options->get(STR_SIMKA_NB_JOB_MERGE) && memoryPerMergeJob > 0 && memoryPerMergeJob <= maxMemory){
+			_maxJobMerge = min(_maxJobMerge, (size_t)(maxMemory / memoryPerMergeJob));
+		}
+		_maxJobMerge = max(_maxJobMerge, (size_t)1);
+		_memoryPerMergeJob = maxMemory / _maxJobMerge;
+
 		_coresPerJob = maxCores / _maxJobCount;
 		_coresPerJob = max((size_t)1, _coresPerJob);
 
@@ -528,7 +910,8 @@ public:
 		cout << endl;
 		cout << "Maximum ressources used by Simka: " << endl;
 		cout << "\t - " << _maxJobCount << " simultaneous processes for counting the kmers (per job: " << _coresPerJob << " cores, " << _memoryPerJob << " MB memory)" << endl;
-		cout << "\t - " << _maxJobMerge << " simultaneous processes for merging the kmer counts (per job: " << _coresPerMergeJob << " cores, memory undefined)" << endl;
+		cout << "\t - " << _maxJobMerge << " simultaneous processes for merging the kmer counts (per job: " << _coresPerMergeJob << " cores, " << _memoryPerMergeJob << " MB memory)" << endl;
+		if(_tileSize > 0) cout << "\t - statistics split in " << _nbTiles << " tiles of " << _tileSize << " x " << _tileSize << " datasets" << endl;
 		cout << endl;
 
 
@@ -550,7 +933,33 @@ public:
 
 
 
+		//The config is reused by the next runs as long as the input datasets and the parameters don't change
 		string filename = this->_outputDirTemp + "/" + "config.h5";
+		string keyFilename = this->_outputDirTemp + "/" + "config.key";
+		string configKey = getConfigKey(this->_nbBanks, true);
+
+		//A query run counts its datasets with the config of the reference run, the kmers are in the same partitions
+		string referenceConfigFilename = _referenceDir + "/config.h5";
+		if(_referenceDir != "") configKey = SimkaCountCache::getHash(configKey + " " + SimkaCountCache::getFileHash(referenceConfigFilename));
+
+		//An incremental run keeps the config of the previous run, its datasets were checked by loadPreviousRun
+		if(!_isIncremental && System::file().doesExist(filename) && System::file().doesExist(keyFilename)){
+			string previousKey;
+			ifstream keyFile(keyFilename.c_str());
+			getline(keyFile, previousKey);
+			keyFile.close();
+
+			if(previousKey != configKey){
+				cout << "\tinput datasets or parameters changed, computing config and counting again" << endl;
+				System::file().remove(filename);
+				clearCounts();
+			}
+		}
+
+		if(_referenceDir != "" && !System::file().doesExist(filename)){
+			SimkaCountCache::linkFile(referenceConfigFilename, filename);
+		}
+
 		if(System::file().doesExist(filename)){
 
 		    try{
@@ -568,10 +977,16 @@ public:
 				repartitor->load(storage->getGroup(""));
 				delete repartitor;
 
+				writeJobConfig(storage);
+				writeConfigKey(keyFilename, configKey);
 				return;
 		    }
 		    catch (Exception& e)
 		    {
+		    	if(_referenceDir != ""){
+		    		cout << "Error: can't open the config of the reference run " << referenceConfigFilename << endl;
+		    		exit(1);
+		    	}
 		    	cout << "\tcan't open config, computing it again" << endl;
 		    	System::file().remove(filename);
 		    	createConfig();
@@ -582,6 +997,9 @@ public:
 		this->_options->setInt(STR_MAX_MEMORY, _memoryPerJob - _memoryPerJob/3);
 		this->_options->setInt(STR_NB_CORES, _coresPerJob);
 
+		string cacheIdFilename = this->_outputDirTemp + "/config.cache";
+		if(System::file().doesExist(cacheIdFilename)) System::file().remove(cacheIdFilename);
+
 	    Storage* storage = 0;
         storage = StorageFactory(STORAGE_HDF5).create (filename, true, false);
         LOCAL (storage);
@@ -590,79 +1008,44 @@ public:
 
 
 
+    	//The number of partitions is given by the largest dataset, from the size estimates of the input scan,
+    	//the configuration is computed for the largest one only
         size_t chosenBankId = 0;
-    	SimkaSequenceFilter dummyFilter(0, 0);
-    	//vector<SimkaBankFiltered<SimkaSequenceFilter>*> banksToDelete;
-
-    	string inputDir = this->_outputDirTemp + "/input/";
-    	u_int64_t maxPart = 0;
+        u_int64_t chosenNbKmers = 0;
     	for (size_t i=0; i<this->_nbBanks; i++){
+    		u_int64_t nbKmers = getEstimatedKmers(i);
+    		if(nbKmers > chosenNbKmers){
+    			chosenBankId = i;
+    			chosenNbKmers = nbKmers;
+    		}
+    	}
 
-    		IBank* bank = Bank::open(inputDir + this->_bankNames[i]);
+    	u_int64_t maxPart = 0;
+    	{
+    		IBank* bank = openConfigBank(chosenBankId);
     		LOCAL(bank);
 
-    		//size_t nbBank_ = bank->getCompositionNb();
-    		SimkaBankTemp* simkaBank = new SimkaBankTemp(bank, this->_maxNbReads*this->_nbBankPerDataset[i]);
-    		//banksToDelete.push_back(simkaBank);
+    		SimkaBankTemp* simkaBank = new SimkaBankTemp(bank, this->_maxNbReads*this->_nbBankPerDataset[chosenBankId]);
     		ConfigurationAlgorithm<span> testConfig(simkaBank, this->_options);
     		testConfig.execute();
 
-    		size_t part = testConfig.getConfiguration()._nb_partitions;
-    		if(part > maxPart){
-    			maxPart = part;
-    			chosenBankId = i;
-    		}
-
-    		//delete simkaBank;
-/*
-    		u_int64_t nbReads = bank->estimateNbItems();
-    		nbReads /= _nbBankPerDataset[i];
-    		totalReads += nbReads;
-    		if(nbReads < minReads){
-    			minReads = nbReads;
-    			//_smallerBankId = _bankNames[i];
-    		}
-    		if(nbReads > maxReads){
-    			maxReads = nbReads;
-    			_largerBankId = _bankNames[i];
-    		}*/
-
+    		maxPart = testConfig.getConfiguration()._nb_partitions;
     	}
 
 
-    	//maxPart += 2;
-    	//for(size_t i=0; i<banksToDelete.size(); i++)
-    	//	delete banksToDelete[i];
-
-
-
 		this->_options->setInt(STR_MAX_MEMORY, _memoryPerJob);
 
+		//The repartition of the minimizers is computed on a sample of reads of every dataset
     	IBank* inputbank = Bank::open(this->_banksInputFilename);
     	LOCAL(inputbank);
+    	u_int64_t nbSampleReadsPerBank = max((u_int64_t)SIMKA_CONFIG_SAMPLE_READS / this->_nbBanks, (u_int64_t)SIMKA_CONFIG_MIN_SAMPLE_READS);
+    	IBank* sampleBank = new SimkaBankStratifiedSample(inputbank, nbSampleReadsPerBank);
+    	LOCAL(sampleBank);
 
-		IBank* bank = Bank::open(this->_outputDirTemp + "/input/" + this->_bankNames[chosenBankId]);
+		IBank* bank = openConfigBank(chosenBankId);
 		LOCAL(bank);
 
-		//IBank* bank = Bank::open(_outputDirTemp + "/input/" + _bankNames[0]);
-		//LOCAL(inputbank);
-
-        //bank->finalize();
-
-		//u_int64_t nbSeqs = 1;
-        //IBank* sampleBank = new SimkaBankSample(bank, nbSeqs);
-		//SortingCountAlgorithm<span> sortingCount (sampleBank, this->_options);
-
-		//SimkaNullProcessor<span>* proc = new SimkaNullProcessor<span>();
-
-		//sortingCount.addProcessor (proc);
-
-		// We launch the algorithm
-		//sortingCount.execute();
-
-		//Configuration config = sortingCount.getConfig();
-
-		ConfigurationAlgorithm<span> testConfig1(inputbank, this->_options);
+		ConfigurationAlgorithm<span> testConfig1(sampleBank, this->_options);
 		testConfig1.execute();
 		Configuration config1 = testConfig1.getConfiguration();
 
@@ -686,14 +1069,38 @@ public:
 		_nbPartitions = max((size_t)maxPart, (size_t)_maxJobMerge);
 		//_nbPartitions = max(_nbPartitions, (size_t)32);
 
+		//With a count cache, the runs share the repartition of the minimizers of the cache as long as it has enough
+		//partitions, so that the count files of a dataset are the same in every run
+		string cacheConfigFilename = getCountCacheConfigFilename();
+		bool isCacheConfig = false;
+		if(cacheConfigFilename != "" && System::file().doesExist(cacheConfigFilename)){
+			Storage* cacheStorage = StorageFactory(STORAGE_HDF5).load (cacheConfigFilename);
+			LOCAL (cacheStorage);
+			Configuration cacheConfig;
+			cacheConfig.load(cacheStorage->getGroup(""));
+
+			if(cacheConfig._nb_partitions >= maxPart){
+				_nbPartitions = cacheConfig._nb_partitions;
+				Repartitor repartitor;
+				repartitor.load(cacheStorage->getGroup(""));
+				repartitor.save(storage->getGroup(""));
+				isCacheConfig = true;
+			}
+			else{
+				cout << "	the config of the count cache has too few partitions, the counts of this run are not shared" << endl;
+			}
+		}
+
 		cout << "Nb partitions: " << _nbPartitions << " partitions" << endl << endl << endl;
 		//_nbPartitions = max((int)_nbPartitions, (int)30);
 
 		config1._nb_partitions = _nbPartitions;
 		config2._nb_partitions = _nbPartitions;
 
-        RepartitorAlgorithm<span> repart (inputbank, storage->getGroup(""), config1);
-        repart.execute ();
+        if(!isCacheConfig){
+        	RepartitorAlgorithm<span> repart (sampleBank, storage->getGroup(""), config1);
+        	repart.execute ();
+        }
 
 
 		uint64_t memoryUsageCachedItems;
@@ -738,6 +1145,13 @@ public:
 
 
 		config2.save(storage->getGroup(""));
+		writeJobConfig(storage);
+		writeConfigKey(keyFilename, configKey);
+
+		if(cacheConfigFilename != ""){
+			if(!isCacheConfig) isCacheConfig = writeCountCacheConfig(cacheConfigFilename, config2, storage);
+			if(isCacheConfig) writeConfigKey(cacheIdFilename, SimkaCountCache::getFileHash(cacheConfigFilename));
+		}
 		//sortingCount.getRepartitor()->save(storage->getGroup(""));
 		//delete sampleBank;
 
@@ -747,35 +1161,281 @@ public:
 		//sampleBank->forget();
 	}
 
+	/** Key of the configuration, from the first nbBanks input datasets (files and sizes) and the parameters of the
+	 * configuration. Without the resources of the jobs, it is the key of the counts of the datasets. */
+	/** Abundance thresholds of -multi-abundance-min, the one of the run first */
+	string getAbundanceMinsStr(){
+		string str = SimkaAlgorithm<>::toString(this->_abundanceThreshold.first);
+		for(size_t i=0; i<_abundanceMins.size(); i++){
+			str += "," + SimkaAlgorithm<>::toString(_abundanceMins[i]);
+		}
+		return str;
+	}
+
+	/** The kmers of the count files are those of the lowest threshold, the merge filters them for the other ones */
+	u_int64_t getCountAbundanceMin(){
+		u_int64_t abundanceMin = this->_abundanceThreshold.first;
+		for(size_t i=0; i<_abundanceMins.size(); i++){
+			abundanceMin = min(abundanceMin, _abundanceMins[i]);
+		}
+		return abundanceMin;
+	}
+
+	string getConfigKey(size_t nbBanks, bool withResources){
+
+		string key = "";
+		key += "k" + SimkaAlgorithm<>::toString(this->_kmerSize);
+		if(withResources){
+			key += " m" + SimkaAlgorithm<>::toString(_memoryPerJob);
+			key += " c" + SimkaAlgorithm<>::toString(_coresPerJob);
+			key += " p" + SimkaAlgorithm<>::toString(_maxJobMerge);
+		}
+		key += " r" + SimkaAlgorithm<>::toString(this->_maxNbReads);
+		if(_subsampleMode != "first") key += " " + _subsampleMode;
+		if(this->_sketchScale > 1) key += " f" + SimkaAlgorithm<>::toString(this->_sketchScale);
+		if(!_abundanceMins.empty()) key += " a" + getAbundanceMinsStr();
+		//The finish signals of the counts have the kmer counts of each replicate
+		if(_nbBootstraps > 0) key += " b" + SimkaAlgorithm<>::toString(_nbBootstraps) + "x" + SimkaAlgorithm<>::toString(SIMKA_BOOTSTRAP_NB_BLOCKS);
+		if(this->_options->get(STR_MINIMIZER_SIZE)) key += " " + this->_options->getStr(STR_MINIMIZER_SIZE);
+		if(this->_options->get(STR_MINIMIZER_TYPE)) key += " " + this->_options->getStr(STR_MINIMIZER_TYPE);
+		if(this->_options->get(STR_REPARTITION_TYPE)) key += " " + this->_options->getStr(STR_REPARTITION_TYPE);
+		key += "\n";
+
+		//The signatures of the input scan cover the paths, sizes and modification times of the files
+		for(size_t i=0; i<nbBanks; i++){
+			key += this->_bankNames[i] + ":" + SimkaAlgorithm<>::toString(this->_nbBankPerDataset[i]) + " " + this->_datasetInfos[i]._signature + "\n";
+		}
+
+		//FNV-1a hash of the key
+		u_int64_t hash = 14695981039346656037ULL;
+		for(size_t i=0; i<key.size(); i++){
+			hash ^= (unsigned char)key[i];
+			hash *= 1099511628211ULL;
+		}
+
+		return Stringify::format("%llx", (unsigned long long)hash);
+	}
+
+	/** Config shared by the runs of the count cache, for the kmer size and the minimizers. Empty if there is no cache. */
+	string getCountCacheConfigFilename(){
+
+		if(_countCacheDir == "") return "";
+
+		string key = "k" + SimkaAlgorithm<>::toString(this->_kmerSize);
+		if(this->_options->get(STR_MINIMIZER_SIZE)) key += " " + this->_options->getStr(STR_MINIMIZER_SIZE);
+		if(this->_options->get(STR_MINIMIZER_TYPE)) key += " " + this->_options->getStr(STR_MINIMIZER_TYPE);
+		if(this->_options->get(STR_REPARTITION_TYPE)) key += " " + this->_options->getStr(STR_REPARTITION_TYPE);
+
+		return _countCacheDir + "/config_" + SimkaCountCache::getHash(key) + ".h5";
+	}
+
+	/** Copy of the config and of the repartition of the minimizers loaded by the count jobs. It is a plain file storage,
+	 * the jobs don't open the HDF5 config. */
+	void writeJobConfig(Storage* storage){
+
+		Configuration config;
+		config.load(storage->getGroup(""));
+		Repartitor repartitor;
+		repartitor.load(storage->getGroup(""));
+
+		Storage* jobStorage = StorageFactory(STORAGE_FILE).create (SimkaAlgorithm<>::getJobConfigDir(this->_outputDirTemp), true, false);
+		LOCAL (jobStorage);
+		config.save(jobStorage->getGroup(""));
+		repartitor.save(jobStorage->getGroup(""));
+	}
+
+	/** The first run of a cache gives its config to the next ones. Returns false if another run did it meanwhile. */
+	bool writeCountCacheConfig(const string& cacheConfigFilename, Configuration& config, Storage* storage){
+
+		Repartitor repartitor;
+		repartitor.load(storage->getGroup(""));
+
+		//The runs sharing the cache may be on several hosts, the name of the temporary config is unique on the file system
+		string tempFilename = cacheConfigFilename.substr(0, cacheConfigFilename.size()-3) + ".temp_XXXXXX.h5";
+		int fd = mkstemps(&tempFilename[0], 3);
+		if(fd < 0){
+			cout << "Error: can't create a temporary config in " << System::file().getDirectory(cacheConfigFilename) << endl;
+			exit(1);
+		}
+		close(fd);
+
+		{
+			Storage* cacheStorage = StorageFactory(STORAGE_HDF5).create (tempFilename, true, false);
+			LOCAL (cacheStorage);
+			config.save(cacheStorage->getGroup(""));
+			repartitor.save(cacheStorage->getGroup(""));
+		}
+
+		//link doesn't replace the config of another run
+		bool isWritten = link(tempFilename.c_str(), cacheConfigFilename.c_str()) == 0;
+		System::file().remove(tempFilename);
+		return isWritten;
+	}
+
+	/** Entry of a dataset in the count cache: the count parameters, the files of the dataset and the config of the run.
+	 * Empty if there is no cache or if the dataset is streamed. */
+	string getCountCacheEntryDir(size_t bankId){
+
+		if(_countCacheDir == "" || this->_isStreamDataset[bankId]) return "";
+
+		string key = "k" + SimkaAlgorithm<>::toString(this->_kmerSize);
+		key += " a" + SimkaAlgorithm<>::toString(this->_abundanceThreshold.first) + "-" + SimkaAlgorithm<>::toString(this->_abundanceThreshold.second);
+		key += " l" + SimkaAlgorithm<>::toString(this->_minReadSize) + " s" + Stringify::format("%f", this->_minReadShannonIndex);
+		key += " r" + SimkaAlgorithm<>::toString(this->_maxNbReads) + " " + _subsampleMode;
+		key += " f" + SimkaAlgorithm<>::toString(this->_sketchScale);
+		key += " n" + SimkaAlgorithm<>::toString(this->_nbBankPerDataset[bankId]) + " " + this->_datasetInfos[bankId]._signature;
+		key += " " + _countCacheConfigId;
+
+		return SimkaCountCache::getEntryDir(_countCacheDir, SimkaCountCache::getHash(key));
+	}
+
+	/** A dataset of the cache counted with the same index is linked in the temp dir, without a count job */
+	void restoreCountCache(size_t bankId, const string& entryDir){
+
+		for(size_t j=0; j<_nbPartitions; j++){
+			string filename = this->_outputDirTemp + "/solid/part_" + SimkaAlgorithm<>::toString(j) + "/__p__" + SimkaAlgorithm<>::toString(bankId) + ".gz";
+			SimkaCountCache::linkFile(SimkaCountCache::getPartitionFilename(entryDir, j), filename);
+			SimkaCountCache::linkIndex(SimkaCountCache::getPartitionFilename(entryDir, j), filename);
+		}
+
+		removeMergeSynchro();
+		SimkaCountCache::restoreInfo(entryDir, this->_outputDirTemp, this->_bankNames[bankId]);
+	}
+
+	void writeConfigKey(const string& keyFilename, const string& configKey){
+		IFile* file = System::file().newFile(keyFilename, "w");
+		string contents = configKey + "\n";
+		file->fwrite(contents.c_str(), contents.size(), 1);
+		file->flush();
+		delete file;
+	}
+
+	/** Remove the counts and the merges of a previous run, they don't match a new config */
+	void clearCounts(){
+
+		string command = "rm -rf " + this->_outputDirTemp + "/solid/ " + this->_outputDirTemp + "/count_synchro/ " + this->_outputDirTemp + "/merge_synchro/ ";
+		command += this->_outputDirTemp + "/stats/ " + this->_outputDirTemp + "/kmercount_per_partition/";
+		system(command.c_str());
+
+		createDirs();
+	}
+
+	/** The merges of the other kmer sizes (-multi-kmer-size) are removed too, their datasets are counted by the same jobs */
 	void removeMergeSynchro(){
 
-	    for (size_t i=0; i<this->_bankNames.size(); i++){
-			string finishFilename = this->_outputDirTemp + "/merge_synchro/" +  this->_bankNames[i] + ".ok";
-			if(System::file().doesExist(finishFilename)) System::file().remove(finishFilename);
-	    }
+		vector<string> outputDirs(1, this->_outputDirTemp);
+		for(size_t k=0; k<_multiKmerSizes.size(); k++){
+			outputDirs.push_back(SimkaAlgorithm<>::getMultiKmerTempDir(this->_outputDirTemp, _multiKmerSizes[k]));
+		}
+
+		for(size_t d=0; d<outputDirs.size(); d++){
+		    for (size_t i=0; i<this->_bankNames.size(); i++){
+				string finishFilename = outputDirs[d] + "/merge_synchro/" +  this->_bankNames[i] + ".ok";
+				if(System::file().doesExist(finishFilename)) System::file().remove(finishFilename);
+		    }
+		}
 	}
 
-	void printCountInfo(){
+	/** Runs of the other kmer sizes of -multi-kmer-size, results in <out>/k<size> and temporary files in <out-tmp>/k<size>.
+	 * They are configured first (isConfigOnly) with the input manifest of the run, then run once the run is finished. */
+	void executeMultiKmer(bool isConfigOnly){
 
-		char * pEnd;
-		vector<u_int64_t> kmerPerParts(_nbPartitions, 0);
+		for(size_t k=0; k<_multiKmerSizes.size(); k++){
 
+			string kmerSizeStr = SimkaAlgorithm<>::toString(_multiKmerSizes[k]);
 
-		for(size_t i=0; i<this->_bankNames.size(); i++){
-			//cout << filename << endl;
+			IProperties* options = this->_options->clone();
+			options->setInt(STR_KMER_SIZE, _multiKmerSizes[k]);
+			options->setStr(STR_URI_OUTPUT, this->_outputDir + "/k" + kmerSizeStr);
+			options->setStr(STR_URI_OUTPUT_TMP, SimkaAlgorithm<>::getMultiKmerOutputTmp(this->_outputDirTemp, _multiKmerSizes[k]));
+			options->setStr(STR_SIMKA_MULTI_KMER_SIZE, "");
+
+			if(isConfigOnly){
+				string outputDirTemp = SimkaAlgorithm<>::getMultiKmerTempDir(this->_outputDirTemp, _multiKmerSizes[k]);
+				System::file().mkdir(SimkaAlgorithm<>::getMultiKmerOutputTmp(this->_outputDirTemp, _multiKmerSizes[k]), -1);
+				System::file().mkdir(outputDirTemp, -1);
+				SimkaCountCache::linkFile(this->_outputDirTemp + "/input_manifest", outputDirTemp + "/input_manifest");
+			}
+
+			if(this->_options->getInt(STR_VERBOSE) != 0){
+				cout << endl << (isConfigOnly ? "Configuring" : "Merging") << " kmer size " << kmerSizeStr << endl;
+			}
+
+			SimkaPotaraMultiKmerParameter params(options, _execFilename, isConfigOnly);
+			Integer::apply<SimkaPotaraMultiKmerFunctor, SimkaPotaraMultiKmerParameter> (_multiKmerSizes[k], params);
+
+			delete options;
+		}
+	}
+
+	/** The counts of the datasets and the sizes of their count files are gathered in a single binary index,
+	 * once all the datasets are counted. Merge jobs map the index instead of reading the count file of every dataset. */
+	void createCountIndex(){
+
+		size_t nbBanks = this->_bankNames.size();
+		vector<u_int64_t> nbKmers(nbBanks*_nbPartitions, 0);
+		vector<u_int64_t> fileSizes(nbBanks*_nbPartitions, 0);
+
+		for(size_t i=0; i<nbBanks; i++){
 
 			string line;
-			size_t currentPart = 0;
 			ifstream file((this->_outputDirTemp + "/kmercount_per_partition/" +  this->_bankNames[i] + ".txt").c_str());
 			size_t j = 0;
 			while(getline(file, line)){
 				if(line == "") continue;
-				kmerPerParts[j] += strtoull(line.c_str(), NULL, 10);
+				if(j < _nbPartitions) nbKmers[i*_nbPartitions+j] = strtoull(line.c_str(), NULL, 10);
 				j += 1;
 			}
 			file.close();
     	}
 
+		for(size_t j=0; j<_nbPartitions; j++){
+
+			string partDir = this->_outputDirTemp + "/solid/part_" + SimkaAlgorithm<>::toString(j) + "/";
+			vector<string> filenames = System::file().listdir(partDir);
+
+			for(size_t f=0; f<filenames.size(); f++){
+				size_t datasetId, lastDatasetId;
+				if(!SimkaAlgorithm<>::parseCountFilename(filenames[f], datasetId, lastDatasetId)) continue;
+				if(datasetId < nbBanks) fileSizes[datasetId*_nbPartitions+j] = System::file().getSize(partDir + filenames[f]);
+			}
+		}
+
+		SimkaCountIndex::write(this->_outputDirTemp + "/kmercount_per_partition/index.bin", nbBanks, _nbPartitions, nbKmers, fileSizes);
+
+		if(!_countIndex.load(this->_outputDirTemp + "/kmercount_per_partition/index.bin")){
+			cout << "Error: can't load the kmer count index" << endl;
+			exit(1);
+		}
+	}
+
+	/** Number of distinct kmers of each partition, summed over the datasets */
+	vector<u_int64_t> getKmerPerParts(){
+
+		vector<u_int64_t> kmerPerParts(_nbPartitions, 0);
+		for(size_t j=0; j<_nbPartitions; j++){
+			kmerPerParts[j] = _countIndex.getNbKmers(j);
+		}
+
+		return kmerPerParts;
+	}
+
+	/** Number of kmers merged by a merge job, the weight of the job in the merge progress */
+	u_int64_t getMergeJobKmers(const SimkaMergeJob& mergeJob){
+
+		u_int64_t nbKmers = 0;
+		for(size_t j=mergeJob._partitionId; j<mergeJob._partitionId+mergeJob._nbPartitions; j++){
+			nbKmers += _countIndex.getNbKmers(j);
+		}
+
+		//Empty jobs still count in the progress
+		return nbKmers / mergeJob._nbRanges + 1;
+	}
+
+	void printCountInfo(){
+
+		vector<u_int64_t> kmerPerParts = getKmerPerParts();
+
 		cout << endl << endl << "Kmer repartition" << endl;
 		for(size_t i=0; i<kmerPerParts.size(); i++){
 			cout <<  "\t" << i << ":\t" << kmerPerParts[i] << endl;
@@ -783,6 +1443,176 @@ public:
 		cout << endl << endl;
 	}
 
+	/** Bank of a dataset for the configuration. Streams can't be read before the count job: they are replaced by the
+	 * largest dataset stored in files, with the declared size of the stream */
+	IBank* openConfigBank(size_t bankId){
+
+		string inputDir = this->_outputDirTemp + "/input/";
+		if(!this->_isStreamDataset[bankId]) return Bank::open(inputDir + this->_bankNames[bankId]);
+
+		size_t fileBankId = this->_nbBanks;
+		for (size_t i=0; i<this->_nbBanks; i++){
+			if(this->_isStreamDataset[i]) continue;
+			if(fileBankId == this->_nbBanks || getEstimatedKmers(i) > getEstimatedKmers(fileBankId)) fileBankId = i;
+		}
+
+		if(fileBankId == this->_nbBanks){
+			cout << "Error: at least one dataset must be stored in files to configure the count (datasets read from a command or a named pipe can be read only once)" << endl;
+			exit(1);
+		}
+
+		return new SimkaBankEstimated(Bank::open(inputDir + this->_bankNames[fileBankId]), this->_datasetInfos[bankId]);
+	}
+
+	/** Total size of the input files of a dataset */
+	u_int64_t getDatasetSize(size_t bankId){
+		return this->_datasetInfos[bankId]._fileSize;
+	}
+
+	/** Number of kmers of the reads of a dataset used by simka (-max-reads), from the estimates of the input scan */
+	u_int64_t getEstimatedKmers(size_t bankId){
+
+		const SimkaDatasetInfo& info = this->_datasetInfos[bankId];
+		u_int64_t number = info._nbReads;
+		u_int64_t totalSize = info._totalSize;
+
+		u_int64_t maxReads = this->_maxNbReads*this->_nbBankPerDataset[bankId];
+		if(maxReads > 0 && maxReads < number){
+			totalSize = totalSize * ((double)maxReads / (double)number);
+			number = maxReads;
+		}
+
+		u_int64_t kmerOverlap = number * (this->_kmerSize-1);
+		return (totalSize > kmerOverlap) ? totalSize - kmerOverlap : 0;
+	}
+
+	/** Small consecutive datasets are counted by the same job, which writes a single count file per partition
+	 * for all of them. Datasets already counted are not batched again. */
+	void createCountBatches(){
+
+		_countBatches.clear();
+
+		size_t first = 0;
+		size_t nbDatasets = 0;
+		u_int64_t batchSize = 0;
+
+		for(size_t i=0; i<this->_bankNames.size(); i++){
+
+			bool isCounted = System::file().doesExist(this->_outputDirTemp + "/count_synchro/" +  this->_bankNames[i] + ".ok");
+			u_int64_t size = (_countBatchSize > 1 && !isCounted) ? getDatasetSize(i) : 0;
+
+			if(nbDatasets > 0 && (isCounted || nbDatasets >= _countBatchSize || batchSize + size > SIMKA_COUNT_BATCH_MAX_SIZE)){
+				_countBatches.push_back(pair<size_t, size_t>(first, first+nbDatasets-1));
+				nbDatasets = 0;
+			}
+
+			if(isCounted){
+				_countBatches.push_back(pair<size_t, size_t>(i, i));
+				continue;
+			}
+
+			if(nbDatasets == 0){
+				first = i;
+				batchSize = 0;
+			}
+			nbDatasets += 1;
+			batchSize += size;
+		}
+
+		if(nbDatasets > 0) _countBatches.push_back(pair<size_t, size_t>(first, first+nbDatasets-1));
+	}
+
+	/** A count file holds the kmers of all the datasets of its count job. If one of them is counted again, maybe in another
+	 * batch, the file is removed and its other datasets are counted again too, otherwise their kmers would be merged twice. */
+	void removeStaleCountFiles(){
+
+		size_t nbBanks = this->_bankNames.size();
+		vector<bool> isCounted(nbBanks);
+		bool isAllCounted = true;
+		for(size_t i=0; i<nbBanks; i++){
+			isCounted[i] = System::file().doesExist(this->_outputDirTemp + "/count_synchro/" +  this->_bankNames[i] + ".ok");
+			if(!isCounted[i]) isAllCounted = false;
+		}
+		if(isAllCounted) return;
+
+		vector<string> outputDirs(1, this->_outputDirTemp);
+		for(size_t k=0; k<_multiKmerSizes.size(); k++){
+			outputDirs.push_back(SimkaAlgorithm<>::getMultiKmerTempDir(this->_outputDirTemp, _multiKmerSizes[k]));
+		}
+
+		vector<string> filenames;
+		vector<pair<size_t, size_t> > fileDatasets;
+		for(size_t d=0; d<outputDirs.size(); d++){
+			for(size_t j=0; j<_nbPartitions; j++){
+				//-bootstrap: the count files of the read blocks are in the dirs of the blocks in the partition dir
+				vector<string> partDirs(1, outputDirs[d] + "/solid/part_" + SimkaAlgorithm<>::toString(j) + "/");
+				for(size_t b=0; _nbBootstraps > 0 && b<SIMKA_BOOTSTRAP_NB_BLOCKS; b++){
+					partDirs.push_back(partDirs[0] + SimkaBootstrap::getCountsId(b) + "/");
+				}
+
+				for(size_t k=0; k<partDirs.size(); k++){
+					vector<string> partFilenames = System::file().listdir(partDirs[k]);
+					for(size_t f=0; f<partFilenames.size(); f++){
+						size_t first;
+						size_t last;
+						if(!SimkaAlgorithm<>::parseCountFilename(partFilenames[f], first, last)) continue;
+						filenames.push_back(partDirs[k] + partFilenames[f]);
+						fileDatasets.push_back(pair<size_t, size_t>(first, min(last, nbBanks-1)));
+					}
+				}
+			}
+		}
+
+		//A dataset of a removed file may have another count file too
+		vector<bool> isRemoved(filenames.size(), false);
+		bool isChanged = true;
+		while(isChanged){
+			isChanged = false;
+			for(size_t f=0; f<filenames.size(); f++){
+				if(isRemoved[f]) continue;
+				bool isStale = false;
+				for(size_t i=fileDatasets[f].first; i<=fileDatasets[f].second; i++){
+					if(!isCounted[i]) isStale = true;
+				}
+				if(!isStale) continue;
+
+				isRemoved[f] = true;
+				isChanged = true;
+				for(size_t i=fileDatasets[f].first; i<=fileDatasets[f].second; i++) isCounted[i] = false;
+			}
+		}
+
+		for(size_t f=0; f<filenames.size(); f++){
+			if(!isRemoved[f]) continue;
+			System::file().remove(filenames[f]);
+			if(System::file().doesExist(filenames[f] + ".idx")) System::file().remove(filenames[f] + ".idx");
+		}
+
+		for(size_t d=0; d<outputDirs.size(); d++){
+			for(size_t i=0; i<nbBanks; i++){
+				string finishFilename = outputDirs[d] + "/count_synchro/" +  this->_bankNames[i] + ".ok";
+				if(!isCounted[i] && System::file().doesExist(finishFilename)) System::file().remove(finishFilename);
+			}
+		}
+	}
+
+	/** The datasets of a count job of several datasets are listed in a batch file, one per line: index name nb-datasets */
+	string createBatchFile(size_t first, size_t last){
+
+		string batchFilename = this->_outputDirTemp + "/job_count/batch_" + SimkaAlgorithm<>::toString(first) + ".txt";
+		string contents = "";
+		for(size_t i=first; i<=last; i++){
+			contents += SimkaAlgorithm<>::toString(i) + " " + this->_bankNames[i] + " " + SimkaAlgorithm<>::toString(this->_nbBankPerDataset[i]) + "\n";
+		}
+
+		IFile* file = System::file().newFile(batchFilename, "w");
+		file->fwrite(contents.c_str(), contents.size(), 1);
+		file->flush();
+		delete file;
+
+		return batchFilename;
+	}
+
 	void count(){
 
 		cout << endl << "Counting k-mers... (log files are " + this->_outputDirTemp + "/log/count_*)" << endl;
@@ -799,18 +1629,52 @@ public:
 			System::thread().newSynchronizer());
 		_progress->init ();
 
+		removeStaleCountFiles();
+		createCountBatches();
+
+		//The counts of the run match the cache if its config is the config of the cache
+		if(_countCacheDir != ""){
+			string cacheIdFilename = this->_outputDirTemp + "/config.cache";
+			_countCacheConfigId = "";
+			if(System::file().doesExist(cacheIdFilename)){
+				ifstream cacheIdFile(cacheIdFilename.c_str());
+				getline(cacheIdFile, _countCacheConfigId);
+				cacheIdFile.close();
+			}
+			if(_countCacheConfigId == "") _countCacheConfigId = SimkaCountCache::getFileHash(this->_outputDirTemp + "/config.h5");
+		}
+
+		//A job is finished when the finish signal of its last dataset exists
 		vector<string> filenameQueue;
 		vector<string> filenameQueueToRemove;
+		map<string, size_t> nbDatasetsPerJob;
 		size_t nbJobs = 0;
 
-	    for (size_t i=0; i<this->_bankNames.size(); i++){
+	    for (size_t b=0; b<_countBatches.size(); b++){
+
+	    	size_t i = _countBatches[b].first;
+	    	size_t last = _countBatches[b].second;
+	    	size_t nbDatasets = last - i + 1;
 
 			string logFilename = this->_outputDirTemp + "/log/count_" + this->_bankNames[i] + ".txt";
 
-			string finishFilename = this->_outputDirTemp + "/count_synchro/" +  this->_bankNames[i] + ".ok";
+			string finishFilename = this->_outputDirTemp + "/count_synchro/" +  this->_bankNames[last] + ".ok";
+			if(last < _nbReferenceBanks){
+				_progress->inc(nbDatasets);
+				continue;
+			}
 			if(System::file().doesExist(finishFilename)){
+				_progress->inc(nbDatasets);
+				cout << "\t" << this->_bankNames[last] << " already counted (remove file " << finishFilename << " to count again)" << endl;
+				continue;
+			}
+
+			//The cached counts of another index are copied with the index of the run by the count job
+			string cacheEntryDir = (nbDatasets == 1) ? getCountCacheEntryDir(i) : "";
+			if(cacheEntryDir != "" && SimkaCountCache::hasEntry(cacheEntryDir) && SimkaCountCache::getBankIndex(cacheEntryDir) == i){
+				restoreCountCache(i, cacheEntryDir);
 				_progress->inc(1);
-				cout << "\t" << this->_bankNames[i] << " already counted (remove file " << finishFilename << " to count again)" << endl;
+				cout << "\t" << this->_bankNames[i] << " restored from the count cache" << endl;
 				continue;
 			}
 			//else{
@@ -827,19 +1691,33 @@ public:
 			command += " " + string(STR_MAX_MEMORY) + " " + SimkaAlgorithm<>::toString(_memoryPerJob);
 			command += " " + string(STR_NB_CORES) + " " + SimkaAlgorithm<>::toString(_coresPerJob);
 			command += " " + string(STR_URI_INPUT) + " dummy ";
-			command += " " + string(STR_KMER_ABUNDANCE_MIN) + " " + SimkaAlgorithm<>::toString(this->_abundanceThreshold.first);
+			command += " " + string(STR_KMER_ABUNDANCE_MIN) + " " + SimkaAlgorithm<>::toString(getCountAbundanceMin());
 			command += " " + string(STR_KMER_ABUNDANCE_MAX) + " " + SimkaAlgorithm<>::toString(this->_abundanceThreshold.second);
 			command += " " + string(STR_SIMKA_MIN_READ_SIZE) + " " + SimkaAlgorithm<>::toString(this->_minReadSize);
 			command += " " + string(STR_SIMKA_MIN_READ_SHANNON_INDEX) + " " + Stringify::format("%f", this->_minReadShannonIndex);
 			command += " " + string(STR_SIMKA_MAX_READS) + " " + SimkaAlgorithm<>::toString(this->_maxNbReads);
+			command += " " + string(STR_SIMKA_SUBSAMPLE_MODE) + " " + _subsampleMode;
+			if(_concurrentInput) command += " " + string(STR_SIMKA_CONCURRENT_INPUT);
+			if(this->_options->get(STR_SIMKA_KEEP_TMP_FILES)) command += " " + string(STR_SIMKA_KEEP_TMP_FILES);
+			if(this->_sketchScale > 1) command += " " + string(STR_SIMKA_SKETCH_SCALE) + " " + SimkaAlgorithm<>::toString(this->_sketchScale);
+			if(!_abundanceMins.empty()) command += " " + string(STR_SIMKA_MULTI_ABUNDANCE_MIN) + " " + getAbundanceMinsStr();
+			if(_nbBootstraps > 0) command += " " + string(STR_SIMKA_BOOTSTRAP) + " " + SimkaAlgorithm<>::toString(_nbBootstraps);
+			for(size_t k=0; k<_multiKmerSizes.size(); k++){
+				command += (k == 0) ? " " + string(STR_SIMKA_MULTI_KMER_SIZE) + " " : string(",");
+				command += SimkaAlgorithm<>::toString(_multiKmerSizes[k]);
+			}
 			command += " -nb-partitions " + SimkaAlgorithm<>::toString(_nbPartitions);
+			if(nbDatasets > 1) command += " -batch-file " + createBatchFile(i, last);
+			if(cacheEntryDir != "") command += " -count-cache-entry " + cacheEntryDir;
 			//command += " -verbose " + Stringify::format("%d", this->_options->getInt(STR_VERBOSE));
 			command += " >> " + logFilename + " 2>&1";
 
-			filenameQueue.push_back(this->_bankNames[i]);
+			filenameQueue.push_back(this->_bankNames[last]);
+			nbDatasetsPerJob[this->_bankNames[last]] = nbDatasets;
 			System::file().mkdir(tempDir, -1);
 
 			string str = "Counting dataset " + SimkaAlgorithm<>::toString(i) + "\n";
+			if(nbDatasets > 1) str = "Counting datasets " + SimkaAlgorithm<>::toString(i) + " to " + SimkaAlgorithm<>::toString(last) + "\n";
 			str += "\t" + command + "\n\n\n";
 			system(("echo \"" + str + "\" > " + logFilename).c_str());
 
@@ -889,7 +1767,7 @@ public:
 							isJobAvailbale = true;
 							nbJobs -= 1;
 							//cout << "job finished" << endl;
-							_progress->inc(1);
+							_progress->inc(nbDatasetsPerJob[filenameQueue[j]]);
 						}
 					}
 
@@ -905,7 +1783,7 @@ public:
 						nanosleep((const struct timespec[]){{0, 100000000L}}, NULL);
 					}
 
-					if(i >= this->_bankNames.size()) break;
+					if(b >= _countBatches.size()) break;
 				}
 			}
 
@@ -923,7 +1801,7 @@ public:
 					filenameQueueToRemove.push_back(filenameQueue[j]);
 					isJobAvailbale = true;
 					nbJobs -= 1;
-					_progress->inc(1);
+					_progress->inc(nbDatasetsPerJob[filenameQueue[j]]);
 				}
 			}
 
@@ -943,16 +1821,130 @@ public:
 	    delete _progress;
 	}
 
+	/** The merge time is the time of the largest job. A partition much larger than the average is split in kmer ranges
+	 * merged by separate jobs, consecutive small partitions are merged by the same job, so that every job has about
+	 * the average number of kmers. With -merge-ranges, every partition is split in that number of ranges. */
+	void createMergeJobs(){
+
+		vector<u_int64_t> kmerPerParts = getKmerPerParts();
+		u_int64_t nbKmers = 0;
+		for(size_t i=0; i<_nbPartitions; i++) nbKmers += kmerPerParts[i];
+		u_int64_t meanKmers = max(nbKmers / _nbPartitions, (u_int64_t)1);
+
+		_mergeJobs.clear();
+		size_t nbSplitPartitions = 0;
+		size_t nbFoldedPartitions = 0;
+
+		size_t i = 0;
+		while(i < _nbPartitions){
+
+			if(_nbMergeRanges > 1){
+				for(size_t r=0; r<_nbMergeRanges; r++){
+					_mergeJobs.push_back(SimkaMergeJob(i, 1, r, _nbMergeRanges));
+				}
+				nbSplitPartitions += 1;
+				i += 1;
+				continue;
+			}
+
+			if(kmerPerParts[i] > SIMKA_MERGE_SPLIT_FACTOR*meanKmers){
+				size_t nbRanges = (kmerPerParts[i] + meanKmers - 1) / meanKmers;
+				for(size_t r=0; r<nbRanges; r++){
+					_mergeJobs.push_back(SimkaMergeJob(i, 1, r, nbRanges));
+				}
+				nbSplitPartitions += 1;
+				i += 1;
+				continue;
+			}
+
+			size_t nbPartitions = 1;
+			u_int64_t jobKmers = kmerPerParts[i];
+			while(i+nbPartitions < _nbPartitions && jobKmers + kmerPerParts[i+nbPartitions] <= meanKmers){
+				jobKmers += kmerPerParts[i+nbPartitions];
+				nbPartitions += 1;
+			}
+			if(nbPartitions > 1) nbFoldedPartitions += nbPartitions;
+
+			_mergeJobs.push_back(SimkaMergeJob(i, nbPartitions, 0, 1));
+			i += nbPartitions;
+		}
+
+		if(nbSplitPartitions > 0 || nbFoldedPartitions > 0){
+			cout << "Merge jobs: " << _mergeJobs.size() << " (" << nbSplitPartitions << " partitions split in kmer ranges, " << nbFoldedPartitions << " small partitions grouped)" << endl;
+		}
+	}
+
+	/** Name of the stats and synchro files of a merge job, and of its tile in tiled mode. The jobs of an incremental
+	 * run compute the pairs of the new datasets, they are named apart from the jobs of the previous runs. */
+	string getMergeJobId(const SimkaMergeJob& mergeJob, size_t tileId){
+		string id = mergeJob.getId();
+		if(_isIncremental || _nbReferenceBanks > 0) return getMergeJobPrefix() + id;
+		if(_tileSize > 0) id += "_" + SimkaAlgorithm<>::toString(tileId);
+		return id;
+	}
+
+	/** Pairs of datasets computed by the merge jobs of a tile */
+	SimkaTile getMergeJobTile(size_t tileId){
+		if(_isIncremental) return SimkaTile(0, this->_nbBanks, _nbPreviousBanks, this->_nbBanks);
+		if(_nbReferenceBanks > 0) return getStatsTile();
+		if(_tileSize > 0) return SimkaTile(tileId, _tileSize, this->_nbBanks);
+		return SimkaTile(this->_nbBanks);
+	}
+
+	/** Statistics are not tiled in an incremental or a query run, their pairs are a single rectangle */
+	size_t getNbMergeTiles(){
+		return (_isIncremental || _nbReferenceBanks > 0) ? 1 : _nbTiles;
+	}
+
+	/** The merge jobs of an incremental or a query run are named by their first new dataset or their number of references */
+	string getMergeJobPrefix(){
+		if(_isIncremental) return "add" + SimkaAlgorithm<>::toString(_nbPreviousBanks) + "_";
+		if(_nbReferenceBanks > 0) return "query" + SimkaAlgorithm<>::toString(_nbReferenceBanks) + "_";
+		return "";
+	}
+
+	/** The merges of another run don't match the counts of this run, they are done again */
+	void removeOtherMergeSynchro(){
+
+		string synchroDir = this->_outputDirTemp + "/merge_synchro/";
+		string prefix = getMergeJobPrefix();
+		vector<string> filenames = System::file().listdir(synchroDir);
+
+		for(size_t i=0; i<filenames.size(); i++){
+			if(filenames[i].size() < 3 || filenames[i].substr(filenames[i].size()-3) != ".ok") continue;
+			if(filenames[i].find(prefix) != 0) System::file().remove(synchroDir + filenames[i]);
+		}
+	}
+
 	void merge(){
 
+		if(_isIncremental && _nbPreviousBanks == this->_nbBanks){
+			cout << endl << "No dataset added since the previous run" << endl;
+			return;
+		}
+
+		createMergeJobs();
+
+		if(_isIncremental || _nbReferenceBanks > 0) removeOtherMergeSynchro();
+		size_t nbTiles = getNbMergeTiles();
+
 
 
 
 
 		cout << endl << "Merging k-mer counts and computing distances... (log files are " + this->_outputDirTemp + "/log/merge_*)" << endl;
 
+		//The progress of the merge is weighted by the kmers of the jobs
+		u_int64_t nbMergedKmers = 0;
+		map<string, u_int64_t> nbKmersPerJob;
+	    for (size_t i=0; i<_mergeJobs.size()*nbTiles; i++){
+	    	string datasetId = getMergeJobId(_mergeJobs[i / nbTiles], i % nbTiles);
+	    	nbKmersPerJob[datasetId] = getMergeJobKmers(_mergeJobs[i / nbTiles]);
+	    	nbMergedKmers += nbKmersPerJob[datasetId];
+	    }
+
 		_progress = new ProgressSynchro (
-			this->createIteratorListener (_nbPartitions, "Merging datasets"),
+			this->createIteratorListener (nbMergedKmers, "Merging datasets"),
 			System::thread().newSynchronizer());
 		_progress->init ();
 
@@ -960,17 +1952,19 @@ public:
 		vector<string> filenameQueueToRemove;
 		size_t nbJobs = 0;
 
-	    for (size_t i=0; i<_nbPartitions; i++){
-
+	    //One job per merge job of the partitions, or per merge job and tile of the statistics in tiled mode
+	    for (size_t i=0; i<_mergeJobs.size()*nbTiles; i++){
 
+	    	const SimkaMergeJob& mergeJob = _mergeJobs[i / nbTiles];
+	    	size_t tileId = i % nbTiles;
 
-	    	string datasetId = SimkaAlgorithm<>::toString(i);
+	    	string datasetId = getMergeJobId(mergeJob, tileId);
 			string finishFilename = this->_outputDirTemp + "/merge_synchro/" +  datasetId + ".ok";
 
 			string logFilename = this->_outputDirTemp + "/log/merge_" + datasetId + ".txt";
 
 			if(System::file().doesExist(finishFilename)){
-				_progress->inc(1);
+				_progress->inc(nbKmersPerJob[datasetId]);
 				cout << "\t" << datasetId << " already merged (remove file " << finishFilename << " to merge again)" << endl;
 			}
 			else{
@@ -986,13 +1980,36 @@ public:
 				command += " " + string(STR_KMER_SIZE) + " " + SimkaAlgorithm<>::toString(this->_kmerSize);
 				command += " " + string(STR_URI_INPUT) + " " + this->_inputFilename;
 				command += " " + string("-out-tmp-simka") + " " + this->_outputDirTemp;
-				command += " -partition-id " + SimkaAlgorithm<>::toString(i);
-				command += " " + string(STR_MAX_MEMORY) + " " + SimkaAlgorithm<>::toString(this->_maxMemory / this->_nbCores);
+				command += " -partition-id " + SimkaAlgorithm<>::toString(mergeJob._partitionId);
+				if(mergeJob._nbPartitions > 1) command += " -nb-merged-partitions " + SimkaAlgorithm<>::toString(mergeJob._nbPartitions);
+				if(mergeJob._nbRanges > 1){
+					command += " -range-id " + SimkaAlgorithm<>::toString(mergeJob._rangeId);
+					command += " -nb-ranges " + SimkaAlgorithm<>::toString(mergeJob._nbRanges);
+				}
+				if(_isIncremental){
+					command += " -first-new-bank " + SimkaAlgorithm<>::toString(_nbPreviousBanks);
+				}
+				else if(_nbReferenceBanks > 0){
+					command += " -nb-reference-banks " + SimkaAlgorithm<>::toString(_nbReferenceBanks);
+				}
+				else if(_tileSize > 0){
+					command += " -tile-size " + SimkaAlgorithm<>::toString(_tileSize);
+					command += " -tile-id " + SimkaAlgorithm<>::toString(tileId);
+				}
+				command += " " + string(STR_MAX_MEMORY) + " " + SimkaAlgorithm<>::toString(_memoryPerMergeJob);
 				command += " " + string(STR_NB_CORES) + " " + SimkaAlgorithm<>::toString(_coresPerMergeJob);
 				command += " " + string(STR_SIMKA_MIN_KMER_SHANNON_INDEX) + " " + Stringify::format("%f", this->_minKmerShannonIndex);
+				if(_mergeMaxFanIn > 0) command += " -max-fan-in " + SimkaAlgorithm<>::toString(_mergeMaxFanIn);
 				command += " -verbose " + Stringify::format("%d", this->_options->getInt(STR_VERBOSE));
 				if(this->_computeSimpleDistances) command += " " + string(STR_SIMKA_COMPUTE_ALL_SIMPLE_DISTANCES);
 				if(this->_computeComplexDistances) command += " " + string(STR_SIMKA_COMPUTE_ALL_COMPLEX_DISTANCES);
+				if(!_abundanceMins.empty()) command += " " + string(STR_SIMKA_MULTI_ABUNDANCE_MIN) + " " + getAbundanceMinsStr();
+				//-bootstrap: the thresholds are applied to the abundances of the replicates by the merge
+				if(_nbBootstraps > 0){
+					command += " " + string(STR_SIMKA_BOOTSTRAP) + " " + SimkaAlgorithm<>::toString(_nbBootstraps);
+					command += " " + string(STR_KMER_ABUNDANCE_MIN) + " " + SimkaAlgorithm<>::toString(this->_abundanceThreshold.first);
+					command += " " + string(STR_KMER_ABUNDANCE_MAX) + " " + SimkaAlgorithm<>::toString(this->_abundanceThreshold.second);
+				}
 				command += " >> " + logFilename + " 2>&1";
 				//SimkaDistanceParam distanceParams(this->_options);
 				//if(distanceParams._computeBrayCurtis) command += " " + STR_SIMKA_DISTANCE_BRAYCURTIS + " ";
@@ -1002,13 +2019,13 @@ public:
 				//if(distanceParams._computeKulczynski) command += " " + STR_SIMKA_DISTANCE_KULCZYNSKI + " ";
 
 
-				string str = "Merging partition " + SimkaAlgorithm<>::toString(i) + "\n";
+				string str = "Merging partition " + datasetId + "\n";
 				str += "\t" + command + "\n\n\n";
 				system(("echo \"" + str + "\" > " + logFilename).c_str());
 
 
 				if(_isClusterMode){
-					string jobFilename = this->_outputDirTemp + "/job_merge/job_merge_" + SimkaAlgorithm<>::toString(i) + ".bash";
+					string jobFilename = this->_outputDirTemp + "/job_merge/job_merge_" + datasetId + ".bash";
 					IFile* jobFile = System::file().newFile(jobFilename.c_str(), "w");
 					system(("chmod 755 " + jobFilename).c_str());
 					string jobCommand = _jobMergeContents + '\n' + '\n';
@@ -1040,7 +2057,7 @@ public:
 							filenameQueueToRemove.push_back(filenameQueue[j]);
 							isJobAvailbale = true;
 							nbJobs -= 1;
-							_progress->inc(1);
+							_progress->inc(nbKmersPerJob[filenameQueue[j]]);
 						}
 					}
 
@@ -1072,7 +2089,7 @@ public:
 					filenameQueueToRemove.push_back(filenameQueue[j]);
 					isJobAvailbale = true;
 					nbJobs -= 1;
-					_progress->inc(1);
+					_progress->inc(nbKmersPerJob[filenameQueue[j]]);
 				}
 			}
 
@@ -1121,26 +2138,127 @@ public:
 
 	}*/
 
+	/** Stats files of the pairs of datasets and their pairs: the ones of the previous runs in an incremental run,
+	 * then the ones of the merge jobs of this run */
+	vector<pair<string, SimkaTile> > getStatsFiles(){
+
+		vector<pair<string, SimkaTile> > statsFiles;
+		if(_isIncremental) statsFiles = _previousStatsFiles;
+		if(_isIncremental && _nbPreviousBanks == this->_nbBanks) return statsFiles;
+
+		for(size_t tileId=0; tileId<getNbMergeTiles(); tileId++){
+			for(size_t i=0; i<_mergeJobs.size(); i++){
+				statsFiles.push_back(pair<string, SimkaTile>("part_" + getMergeJobId(_mergeJobs[i], tileId) + ".gz", getMergeJobTile(tileId)));
+			}
+		}
+
+		return statsFiles;
+	}
+
+	/** The stats files of the run, for the next incremental run. The header is the number of datasets, the distances
+	 * and the key of the counts the stats were computed for. Written once the stats are complete. */
+	void writeStatsFiles(const vector<pair<string, SimkaTile> >& statsFiles){
+
+		string contents = SimkaAlgorithm<>::toString(this->_nbBanks) + " " + (this->_computeSimpleDistances ? "1" : "0") + " " + (this->_computeComplexDistances ? "1" : "0");
+		contents += " " + getConfigKey(this->_nbBanks, false) + "\n";
+
+		for(size_t i=0; i<statsFiles.size(); i++){
+			const SimkaTile& tile = statsFiles[i].second;
+			contents += statsFiles[i].first + " " + SimkaAlgorithm<>::toString(tile._rowStart) + " " + SimkaAlgorithm<>::toString(tile._rowEnd);
+			contents += " " + SimkaAlgorithm<>::toString(tile._colStart) + " " + SimkaAlgorithm<>::toString(tile._colEnd) + "\n";
+		}
+
+		string filename = this->_outputDirTemp + "/stats/stats_files.txt";
+		IFile* file = System::file().newFile(filename + ".temp", "w");
+		file->fwrite(contents.c_str(), contents.size(), 1);
+		file->flush();
+		delete file;
+		System::file().rename(filename + ".temp", filename);
+	}
+
 	void stats(){
 		cout << endl << "Computing stats..." << endl;
+
+		vector<pair<string, SimkaTile> > statsFiles = getStatsFiles();
+
+		if(_nbReferenceBanks > 0){
+			statsQuery(statsFiles);
+			return;
+		}
+
+		stats(statsFiles, this->_outputDirTemp + "/stats/", this->_outputDir, "");
+
+		//The matrices of the other thresholds of -multi-abundance-min are in <out>/t<threshold>
+		for(size_t i=0; i<_abundanceMins.size(); i++){
+			string outputDir = this->_outputDir + "/t" + SimkaAlgorithm<>::toString(_abundanceMins[i]);
+			System::file().mkdir(outputDir, -1);
+			cout << "Computing stats of abundance threshold " << _abundanceMins[i] << "..." << endl;
+			stats(statsFiles, SimkaAlgorithm<>::getAbundanceMinStatsDir(this->_outputDirTemp, _abundanceMins[i]), outputDir, SimkaAlgorithm<>::toString(_abundanceMins[i]));
+		}
+
+		if(_nbBootstraps > 0) statsBootstrap(statsFiles);
+
+		writeStatsFiles(statsFiles);
+	}
+
+	/** The matrices of the replicates of -bootstrap are in <out>/bootstrap/b<replicate>, the intervals of the distances
+	 * over the replicates in <out>/bootstrap. The statistics of the replicates are computed by the merge jobs. */
+	void statsBootstrap(const vector<pair<string, SimkaTile> >& statsFiles){
+
+		string bootstrapDir = this->_outputDir + "/bootstrap/";
+		System::file().mkdir(bootstrapDir, -1);
+		cout << "Computing stats of " << _nbBootstraps << " bootstrap replicates..." << endl;
+
+		vector<string> replicateDirs;
+		for(size_t i=0; i<_nbBootstraps; i++){
+			replicateDirs.push_back(bootstrapDir + "b" + SimkaAlgorithm<>::toString(i));
+			System::file().mkdir(replicateDirs[i], -1);
+			stats(statsFiles, SimkaAlgorithm<>::getBootstrapStatsDir(this->_outputDirTemp, i), replicateDirs[i], SimkaBootstrap::getReplicateId(i));
+		}
+
+		vector<string> filenames = System::file().listdir(replicateDirs[0]);
+		string suffix = ".csv.gz";
+		for(size_t i=0; i<filenames.size(); i++){
+			const string& filename = filenames[i];
+			if(filename.compare(0, 4, "mat_") != 0 || filename.size() <= suffix.size() || filename.compare(filename.size() - suffix.size(), suffix.size(), suffix) != 0) continue;
+			SimkaMatrixIntervals::write(this->_outputDir, replicateDirs, bootstrapDir, filename.substr(0, filename.size() - suffix.size()), this->_bankNames, SIMKA_BOOTSTRAP_CONFIDENCE);
+		}
+	}
+
+	/** Matrices of the stats files of statsDir. countsId is the id of the kmer counts of the banks for another threshold or
+	 * a replicate, empty for the counts of the run. */
+	void stats(const vector<pair<string, SimkaTile> >& statsFiles, const string& statsDir, const string& outputDir, const string& countsId){
+
+		if(_tileSize > 0){
+			statsTiled(statsFiles, statsDir, outputDir, countsId, _tileSize);
+			return;
+		}
+
+		//The edge lists are written row by row, the full matrix is not needed: the rows are computed by blocks whose
+		//pairs fit in memory
+		if(_outputNbNeighbors > 0 || _outputMaxDistance >= 0){
+			size_t tileSize = SimkaStatistics::getTileSize(this->_maxMemory, this->_computeSimpleDistances, this->_computeComplexDistances);
+			size_t blockSize = max(tileSize * tileSize / this->_nbBanks, (size_t)1);
+			statsTiled(statsFiles, statsDir, outputDir, countsId, min(blockSize, this->_nbBanks));
+			return;
+		}
 		//cout << this->_nbBanks << endl;
 
 		//u_int64_t nbKmers = 0;
 
 		//SimkaDistanceParam distanceParams(this->_options);
-		SimkaStatistics mainStats(this->_nbBanks, this->_computeSimpleDistances, this->_computeComplexDistances, this->_outputDirTemp, this->_bankNames);
+		bool isSparse = SimkaStatistics::isSparse(SimkaTile(this->_nbBanks), this->_computeSimpleDistances, this->_computeComplexDistances, this->_maxMemory);
+		SimkaStatistics mainStats(this->_nbBanks, this->_computeSimpleDistances, this->_computeComplexDistances, this->_outputDirTemp, this->_bankNames, isSparse);
+		if(countsId != "") mainStats.loadBankCounts(this->_outputDirTemp, this->_bankNames, countsId);
 
-		for(size_t i=0; i<_nbPartitions; i++){
+		for(size_t i=0; i<statsFiles.size(); i++){
 
-			string filename = this->_outputDirTemp + "/stats/part_" + SimkaAlgorithm<>::toString(i) + ".gz";
+			string filename = statsDir + statsFiles[i].first;
 			//Storage* storage = StorageFactory(STORAGE_HDF5).load (this->_outputDirTemp + "/stats/part_" + SimkaAlgorithm<>::toString(i) + ".stats");
 			//LOCAL (storage);
 
-			SimkaStatistics stats(this->_nbBanks, this->_computeSimpleDistances, this->_computeComplexDistances, this->_outputDirTemp, this->_bankNames);
-			stats.load(filename);
-
-			//cout << stats._nbDistinctKmers << "   " << stats._nbKmers << endl;
-			mainStats += stats;
+			//Partition stats are summed while they are read, only one pair table is kept in memory
+			mainStats.load(filename);
 
 			//nbKmers += stats._nbKmers;
 		}
@@ -1151,7 +2269,7 @@ public:
 		//for(size_t i=0; i<this->_nbBanks; i++){
 		//	cout << mainStats._nbSolidDistinctKmersPerBank[i] << endl;
 		//}
-		mainStats.outputMatrix(this->_outputDir, this->_bankNames);
+		mainStats.outputMatrix(outputDir, this->_bankNames, _outputNbNeighbors, _outputMaxDistance);
 
 #//ifdef PRINT_STATS
 		if(this->_options->getInt(STR_VERBOSE) != 0) mainStats.print();
@@ -1159,6 +2277,58 @@ public:
 	}
 
 
+	//The matrices of a query run have a row per query and a column per reference, only these pairs are in memory
+	void statsQuery(const vector<pair<string, SimkaTile> >& statsFiles){
+
+		SimkaTile tile = getStatsTile();
+		bool isSparse = SimkaStatistics::isSparse(tile, this->_computeSimpleDistances, this->_computeComplexDistances, this->_maxMemory);
+		SimkaStatistics queryStats(this->_nbBanks, this->_computeSimpleDistances, this->_computeComplexDistances, this->_outputDirTemp, this->_bankNames, isSparse, tile);
+
+		for(size_t i=0; i<statsFiles.size(); i++){
+			queryStats.load(this->_outputDirTemp + "/stats/" + statsFiles[i].first);
+		}
+
+		SimkaMatrixOutput output(this->_outputDir, this->_bankNames, this->_computeSimpleDistances, this->_computeComplexDistances, 0, _nbReferenceBanks, _outputNbNeighbors, _outputMaxDistance);
+		output.writeRows(queryStats, _nbReferenceBanks, this->_nbBanks);
+
+		if(this->_options->getInt(STR_VERBOSE) != 0) queryStats.print();
+	}
+
+	//The matrices are written by blocks of blockSize rows (the tile size if the statistics are tiled). The statistics of
+	//the pairs of a block are loaded from the files that have the block, so that the pairs of a single block of rows
+	//are in memory.
+	void statsTiled(const vector<pair<string, SimkaTile> >& statsFiles, const string& statsDir, const string& outputDir, const string& countsId, size_t blockSize){
+
+		SimkaStatistics blockStats(this->_nbBanks, this->_computeSimpleDistances, this->_computeComplexDistances, this->_outputDirTemp, this->_bankNames, true);
+		if(countsId != "") blockStats.loadBankCounts(this->_outputDirTemp, this->_bankNames, countsId);
+		SimkaMatrixOutput output(outputDir, this->_bankNames, this->_computeSimpleDistances, this->_computeComplexDistances, 0, this->_nbBanks, _outputNbNeighbors, _outputMaxDistance);
+
+		size_t nbBlocks = SimkaTile::getNbBlocks(this->_nbBanks, blockSize);
+
+		for(size_t block=0; block<nbBlocks; block++){
+
+			size_t blockStart = block * blockSize;
+			size_t blockEnd = min(this->_nbBanks, blockStart + blockSize);
+
+			//The kmer counters of a file are loaded once, with its first block, and summed over the blocks
+			blockStats.clearPairs();
+			blockStats.setBlock(blockStart, blockEnd);
+
+			for(size_t i=0; i<statsFiles.size(); i++){
+
+				const SimkaTile& tile = statsFiles[i].second;
+				if(!tile.hasBlock(blockStart, blockEnd)) continue;
+
+				bool isFirstBlock = min(tile._rowStart, tile._colStart) / blockSize == block;
+				blockStats.load(statsDir + statsFiles[i].first, isFirstBlock);
+			}
+
+			output.writeRows(blockStats, blockStart, blockEnd);
+		}
+
+		if(this->_options->getInt(STR_VERBOSE) != 0) blockStats.print(_tileSize > 0);
+	}
+
 	//u_int64_t _maxMemory;
 	//size_t _nbCores;
 	size_t _memoryPerJob;
@@ -1178,10 +2348,34 @@ public:
     //u_int64_t _maxNbReads;
 	//IBank* _sampleBank;
 
+    string _execFilename;
     string _execDir;
     bool _isClusterMode;
 	size_t _maxJobCount;
 	size_t _maxJobMerge;
+	size_t _countBatchSize; //maximum number of datasets counted by the same job
+	string _subsampleMode; //reads kept by -max-reads: first or block
+	bool _concurrentInput; //the files of a dataset are read at the same time by the count jobs
+	bool _isIncremental; //only the pairs of the datasets added since the previous run are merged
+	string _countCacheDir; //count outputs shared by the runs, empty if there is no cache
+	string _countCacheConfigId; //hash of the config the counts of the run are computed with
+	string _referenceDir; //temp dir of the reference run in a query run, empty otherwise
+	vector<size_t> _multiKmerSizes; //other kmer sizes of the run (-multi-kmer-size)
+	vector<u_int64_t> _abundanceMins; //other abundance thresholds of the run (-multi-abundance-min)
+	size_t _nbBootstraps; //bootstrap replicates of the run (-bootstrap)
+	size_t _outputNbNeighbors; //neighbors per dataset of the edge lists (-output-knn), 0 if not limited
+	double _outputMaxDistance; //maximum distance of the edge lists (-output-max-distance), negative if not limited
+	size_t _nbReferenceBanks; //the references are the first datasets of a query run, 0 if it is not a query run
+	size_t _nbPreviousBanks; //datasets of the previous run in an incremental run, they are the first ones of the input
+	vector<pair<string, SimkaTile> > _previousStatsFiles; //stats files of the previous runs and their pairs of datasets
+	vector<pair<size_t, size_t> > _countBatches; //first and last dataset of each count job
+	size_t _memoryPerMergeJob;
+	size_t _tileSize; //0 if the statistics are not tiled
+	size_t _nbMergeRanges; //0 if only the partitions much larger than the average are split in kmer ranges
+	size_t _mergeMaxFanIn; //testing: max nb of count files merged at once by the merge jobs (0: from their limits)
+	vector<SimkaMergeJob> _mergeJobs;
+	SimkaCountIndex _countIndex;
+	size_t _nbTiles;
 	string _jobCountFilename;
 	string _jobMergeFilename;
 	string _jobCountCommand;
@@ -1205,6 +2399,15 @@ public:
 
 
 
+template<size_t span> struct SimkaPotaraMultiKmerFunctor  {  void operator ()  (SimkaPotaraMultiKmerParameter p)
+{
+	SimkaPotaraAlgorithm<span> simkaAlgorithm (p._options, p._execFilename);
+	if(p._isConfigOnly)
+		simkaAlgorithm.configure();
+	else
+		simkaAlgorithm.execute();
+}};
+
 class SimkaPotara : public Tool{
 
 public:
@@ -28,6 +28,7 @@ IOptionsParser* Simka::createOptionsParser (IOptionsParser* parent)
 
 	//Main parser
     parser->push_front (new OptionNoParam (STR_SIMKA_COMPUTE_DATA_INFO, "compute (and display) information before running Simka, such as the number of reads per dataset", false));
+    parser->push_front (new OptionNoParam (STR_SIMKA_INCREMENTAL, "only count and compare the samples added at the end of the input since the previous run with the same -out-tmp (implies -keep-tmp)", false));
     parser->push_front (new OptionNoParam (STR_SIMKA_KEEP_TMP_FILES, "keep temporary files", false));
     parser->push_front (new OptionOneParam (STR_URI_OUTPUT_TMP, "output directory for temporary files", true));
     parser->push_front (new OptionOneParam (STR_URI_OUTPUT, "output directory for result files (distance matrices)", false, "./simka_results"));
@@ -56,6 +57,8 @@ IOptionsParser* Simka::createOptionsParser (IOptionsParser* parent)
     IOptionsParser* distanceParser = new OptionsParser ("distance");
     distanceParser->push_back (new OptionNoParam (STR_SIMKA_COMPUTE_ALL_SIMPLE_DISTANCES, "compute all simple distances (Chord, Hellinger...)", false));
     distanceParser->push_back (new OptionNoParam (STR_SIMKA_COMPUTE_ALL_COMPLEX_DISTANCES, "compute all complex distances (Jensen-Shannon...)", false));
+    distanceParser->push_back (new OptionNoParam (STR_SIMKA_PREVIEW, "only compute an approximate presence-absence Jaccard distance matrix from a MinHash sketch of the first reads of each sample (mat_preview_presenceAbsence_jaccard), without counting the samples", false));
+    distanceParser->push_back (new OptionOneParam (STR_SIMKA_PREVIEW_SIZE, "number of kmers of the sketches of -preview", false, "1000"));
 
 
 	//Kmer parser
@@ -75,11 +78,15 @@ IOptionsParser* Simka::createOptionsParser (IOptionsParser* parent)
     //kmerParser->getParser (STR_SOLIDITY_KIND)->setHelp("TODO");
     //kmerParser->push_back (new OptionNoParam (STR_SIMKA_SOLIDITY_PER_DATASET.c_str(), "do not take into consideration multi-counting when determining solid kmers", false ));
     kmerParser->push_back (new OptionOneParam (STR_SIMKA_MIN_KMER_SHANNON_INDEX.c_str(), "minimal Shannon index a kmer should have to be kept. Float in [0,2]", false, "0" ));
+    kmerParser->push_back (new OptionOneParam (STR_SIMKA_SKETCH_SCALE.c_str(), "keep about 1 kmer out of this number, the same kmers in every sample (FracMinHash): faster, approximate distances. 1: all the kmers", false, "1" ));
 
 
     //Read filter parser
     IOptionsParser* readParser = new OptionsParser ("read");
     readParser->push_back (new OptionOneParam (STR_SIMKA_MAX_READS.c_str(), "maximum number of reads per sample to process. Can be -1: use all reads. Can be 0: estimate it", false, "-1" ));
+    readParser->push_back (new OptionOneParam (STR_SIMKA_SUBSAMPLE_MODE.c_str(), "reads processed with -max-reads: first (the first reads of each sample) or block (reads of blocks chosen uniformly at random in uncompressed or bgzip fasta/fastq files)", false, "first" ));
+    readParser->push_back (new OptionOneParam (STR_SIMKA_STREAM_READS.c_str(), "number of reads of the samples read from a command or a named pipe, used to configure the count. Can be 0: mean of the other samples", false, "0" ));
+    readParser->push_back (new OptionNoParam (STR_SIMKA_CONCURRENT_INPUT.c_str(), "read the files of a sample at the same time (paired files, multi-lane samples...)", false));
     readParser->push_back (new OptionOneParam (STR_SIMKA_MIN_READ_SIZE.c_str(), "minimal size a read should have to be kept", false, "0" ));
     readParser->push_back (new OptionOneParam (STR_SIMKA_MIN_READ_SHANNON_INDEX.c_str(), "minimal Shannon index a read should have to be kept. Float in [0,2]", false, "0" ));
 
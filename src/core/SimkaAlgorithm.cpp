@@ -195,6 +195,7 @@ void SimkaAlgorithm<span>::parseArgs() {
 
 	//read filter
 	_maxNbReads = _options->getInt(STR_SIMKA_MAX_READS);
+	_streamNbReads = _options->getInt(STR_SIMKA_STREAM_READS);
 	_minReadSize = _options->getInt(STR_SIMKA_MIN_READ_SIZE);
 	_minReadShannonIndex = _options->getDouble(STR_SIMKA_MIN_READ_SHANNON_INDEX);
 	_minReadShannonIndex = std::max(_minReadShannonIndex, 0.0);
@@ -204,6 +205,10 @@ void SimkaAlgorithm<span>::parseArgs() {
 	_minKmerShannonIndex = std::max(_minKmerShannonIndex, 0.0);
 	_minKmerShannonIndex = std::min(_minKmerShannonIndex, 2.0);
 
+	_sketchScale = _options->get(STR_SIMKA_SKETCH_SCALE) ? std::max(_options->getInt(STR_SIMKA_SKETCH_SCALE), (int64_t)1) : 1;
+	_isPreview = _options->get(STR_SIMKA_PREVIEW) != 0;
+	_previewSize = _options->get(STR_SIMKA_PREVIEW_SIZE) ? std::max(_options->getInt(STR_SIMKA_PREVIEW_SIZE), (int64_t)1) : 1000;
+
 	if(!System::file().doesExist(_inputFilename)){
 		cerr << "ERROR: Input filename does not exist" << endl;
 		exit(1);
@@ -266,6 +271,32 @@ void SimkaAlgorithm<span>::layoutInputFilename(){
 
 	while(getline(inputFile, line)){
 
+		//"ID: < command": the reads of the dataset are the output of the command, which can contain spaces
+		size_t commandPos = line.find('<');
+		if(commandPos != string::npos && line.find(':') < commandPos){
+
+			string bankId = line.substr(0, line.find(':'));
+			bankId.erase(std::remove(bankId.begin(),bankId.end(),' '),bankId.end());
+			string command = line.substr(commandPos+1);
+			command.erase(0, command.find_first_not_of(' '));
+			if(command == ""){
+				cout << "Error: empty command for dataset " << bankId << endl;
+				exit(1);
+			}
+
+			string subBankContents = "<" + command;
+			IFile* subBankFile = System::file().newFile(inputDir + bankId, "wb");
+			subBankFile->fwrite(subBankContents.c_str(), subBankContents.size(), 1);
+			subBankFile->flush();
+			delete subBankFile;
+
+			_nbBankPerDataset.push_back(1);
+			_isStreamDataset.push_back(true);
+			_bankNames.push_back(bankId);
+			lineIndex += 1;
+			continue;
+		}
+
 		line.erase(std::remove(line.begin(),line.end(),' '),line.end());
 		if(line == "") continue;
 
@@ -291,6 +322,7 @@ void SimkaAlgorithm<span>::layoutInputFilename(){
 		IFile* subBankFile = System::file().newFile(subBankFilename, "wb");
 		//cout << subBankFile->getPath() << endl;
 		string subBankContents = "";
+		bool isStream = false;
 		_nbBankPerDataset.push_back(linepartPairedDatasets.size());
 
 		for(size_t i=0; i<linepartPairedDatasets.size(); i++){
@@ -309,14 +341,13 @@ void SimkaAlgorithm<span>::layoutInputFilename(){
 
 			for(size_t i=0; i<linepartDatasets.size(); i++){
 				string filename = linepartDatasets[i];
-				if(filename.at(0) == '/'){
-					subBankContents +=  filename + "\n";
-				}
-				else{
+				if(filename.at(0) != '/'){
 					string dir = System::file().getRealPath(_inputFilename);
 					dir = System::file().getDirectory(dir);
-					subBankContents +=  dir + "/" + filename + "\n";
+					filename = dir + "/" + filename;
 				}
+				subBankContents +=  filename + "\n";
+				isStream = isStream || SimkaDatasetInfo::isStream(filename);
 			}
 
 		}
@@ -326,9 +357,11 @@ void SimkaAlgorithm<span>::layoutInputFilename(){
 		subBankFile->flush();
 		delete subBankFile;
 
-		bankFileContents += inputDir + "/" + bankId + "\n";
+		//Streams can be read only once, by the count job: they are not sampled for the configuration
+		if(!isStream) bankFileContents += inputDir + "/" + bankId + "\n";
 		lineIndex += 1;
 
+		_isStreamDataset.push_back(isStream);
 		_bankNames.push_back(bankId);
 
 
@@ -337,7 +370,7 @@ void SimkaAlgorithm<span>::layoutInputFilename(){
 
 	inputFile.close();
 
-	bankFileContents.erase(bankFileContents.size()-1);
+	if(bankFileContents != "") bankFileContents.erase(bankFileContents.size()-1);
 	bankFile->fwrite(bankFileContents.c_str(), bankFileContents.size(), 1);
 	bankFile->flush();
 	delete bankFile;
@@ -351,22 +384,107 @@ void SimkaAlgorithm<span>::layoutInputFilename(){
 }
 
 
+/** Checks the datasets and estimates their size. Each dataset is opened once, by a few threads at once since
+ * the input is usually on network storage. Datasets whose files didn't change since the previous run are
+ * taken from the manifest of the input. */
 template<size_t span>
-bool SimkaAlgorithm<span>::isInputValid(){
+void SimkaAlgorithm<span>::scanInput(){
 
 	string inputDir = _outputDirTemp + "/input/";
+	string manifestFilename = _outputDirTemp + "/input_manifest";
+
+	map<string, SimkaDatasetInfo> cachedInfos;
+	SimkaDatasetInfo::readManifest(manifestFilename, cachedInfos);
+
+	_datasetInfos.assign(_nbBanks, SimkaDatasetInfo());
+	vector<size_t> bankIdsToScan;
+	vector<size_t> streamBankIds;
 
 	for (size_t i=0; i<_nbBanks; i++){
 
-		try{
-			IBank* bank = Bank::open(inputDir + _bankNames[i]);
-			LOCAL(bank);
+		u_int64_t fileSize;
+		string signature = SimkaDatasetInfo::getSignature(inputDir + _bankNames[i], fileSize);
+
+		if(_isStreamDataset[i]){
+			_datasetInfos[i]._signature = signature;
+			streamBankIds.push_back(i);
+			continue;
+		}
+
+		map<string, SimkaDatasetInfo>::iterator it = cachedInfos.find(_bankNames[i]);
+		if(it != cachedInfos.end() && it->second._isValid && it->second._signature == signature){
+			_datasetInfos[i] = it->second;
+			continue;
 		}
-		catch (Exception& e){
+
+		_datasetInfos[i]._signature = signature;
+		_datasetInfos[i]._fileSize = fileSize;
+		bankIdsToScan.push_back(i);
+	}
+
+	if(!bankIdsToScan.empty()){
+
+		size_t nbThreads = min(min((size_t)_nbCores, (size_t)SIMKA_SCAN_MAX_THREADS), bankIdsToScan.size());
+		nbThreads = max(nbThreads, (size_t)1);
+
+		vector<ICommand*> cmds;
+		for(size_t t=0; t<nbThreads; t++){
+			cmds.push_back(new SimkaScanCommand(inputDir, _bankNames, bankIdsToScan, t, nbThreads, _datasetInfos));
+		}
+		Dispatcher(nbThreads).dispatchCommands(cmds, 0);
+		for(size_t t=0; t<cmds.size(); t++) delete cmds[t];
+	}
+
+	//Streams are not opened before the count job: their size is declared (-stream-reads) or taken from the datasets stored in files
+	if(!streamBankIds.empty()){
+
+		u_int64_t nbReads = 0;
+		u_int64_t nbReadsPerFile = 0;
+		u_int64_t totalSize = 0;
+		u_int64_t maxSize = 0;
+		size_t nbFileBanks = 0;
+		for (size_t i=0; i<_nbBanks; i++){
+			if(_isStreamDataset[i] || !_datasetInfos[i]._isValid) continue;
+			nbReads += _datasetInfos[i]._nbReads;
+			nbReadsPerFile += _datasetInfos[i]._nbReads / _nbBankPerDataset[i];
+			totalSize += _datasetInfos[i]._totalSize;
+			maxSize = max(maxSize, _datasetInfos[i]._maxSize);
+			nbFileBanks += 1;
+		}
+
+		u_int64_t readSize = (nbReads > 0) ? totalSize / nbReads : SIMKA_STREAM_DEFAULT_READ_SIZE;
+		if(maxSize == 0) maxSize = readSize;
+		u_int64_t streamNbReads = _streamNbReads;
+		if(streamNbReads == 0) streamNbReads = (nbFileBanks > 0) ? nbReadsPerFile / nbFileBanks : SIMKA_STREAM_DEFAULT_READS;
+
+		for(size_t i=0; i<streamBankIds.size(); i++){
+			SimkaDatasetInfo& info = _datasetInfos[streamBankIds[i]];
+			info._isValid = true;
+			info._nbReads = streamNbReads * _nbBankPerDataset[streamBankIds[i]];
+			info._totalSize = info._nbReads * readSize;
+			info._maxSize = maxSize;
+		}
+	}
+
+	if(!bankIdsToScan.empty() || !streamBankIds.empty()){
+		SimkaDatasetInfo::writeManifest(manifestFilename, _bankNames, _datasetInfos);
+	}
+
+	if(_options->getInt(STR_VERBOSE) != 0){
+		cout << "Input datasets checked: " << bankIdsToScan.size() << " opened, " << streamBankIds.size() << " streamed, " << (_nbBanks - bankIdsToScan.size() - streamBankIds.size()) << " unchanged since the previous run" << endl << endl;
+	}
+}
+
+template<size_t span>
+bool SimkaAlgorithm<span>::isInputValid(){
+
+	if(_datasetInfos.size() != _nbBanks) scanInput();
+
+	for (size_t i=0; i<_nbBanks; i++){
+		if(!_datasetInfos[i]._isValid){
 			cerr << "ERROR: Can't open dataset: " << _bankNames[i] << endl;
 			return false;
 		}
-
 	}
 
 	return true;
@@ -376,8 +494,6 @@ bool SimkaAlgorithm<span>::isInputValid(){
 template<size_t span>
 void SimkaAlgorithm<span>::computeMaxReads(){
 
-	string inputDir = _outputDirTemp + "/input/";
-
 	//if(_maxNbReads != 0){
 	//	return;
 	//}
@@ -396,12 +512,11 @@ void SimkaAlgorithm<span>::computeMaxReads(){
 
 	if(_maxNbReads == 0 || _options->get(STR_SIMKA_COMPUTE_DATA_INFO)){
 
-		for (size_t i=0; i<_nbBanks; i++){
+		if(_datasetInfos.size() != _nbBanks) scanInput();
 
-			IBank* bank = Bank::open(inputDir + _bankNames[i]);
-			LOCAL(bank);
+		for (size_t i=0; i<_nbBanks; i++){
 
-			u_int64_t nbReads = bank->estimateNbItems();
+			u_int64_t nbReads = _datasetInfos[i]._nbReads;
 			nbReads /= _nbBankPerDataset[i];
 			totalReads += nbReads;
 			if(nbReads < minReads){
@@ -444,6 +559,63 @@ void SimkaAlgorithm<span>::computeMaxReads(){
 
 }
 
+/** Approximate presence-absence Jaccard distances (-preview) from a bottom-s MinHash sketch of the first reads of
+ * each dataset. The sketches are kept in memory, the matrix is computed by blocks of rows with all the cores. */
+template<size_t span>
+void SimkaAlgorithm<span>::computePreview(){
+
+	for (size_t i=0; i<_nbBanks; i++){
+		if(_isStreamDataset[i]){
+			cout << "Error: " << STR_SIMKA_PREVIEW << " can't read the datasets given as a command or a named pipe (" << _bankNames[i] << ")" << endl;
+			exit(1);
+		}
+	}
+
+	//A -max-reads given by the user is followed, an estimated one (-max-reads 0) only lowers the default
+	u_int64_t maxReads = SIMKA_PREVIEW_DEFAULT_READS;
+	if(_options->getInt(STR_SIMKA_MAX_READS) > 0)
+		maxReads = _maxNbReads;
+	else if(_maxNbReads != 0)
+		maxReads = min((u_int64_t)_maxNbReads, (u_int64_t)SIMKA_PREVIEW_DEFAULT_READS);
+	size_t nbThreads = max(min((size_t)_nbCores, _nbBanks), (size_t)1);
+
+	if(_options->getInt(STR_VERBOSE) != 0){
+		cout << "Preview: sketches of " << _previewSize << " kmers from the first " << maxReads << " reads of each dataset" << endl;
+	}
+
+	vector<vector<u_int64_t> > sketches(_nbBanks);
+	vector<ICommand*> cmds;
+	for(size_t t=0; t<nbThreads; t++){
+		cmds.push_back(new SimkaPreviewSketchCommand<span>(_outputDirTemp + "/input/", _bankNames, _kmerSize, _previewSize, maxReads, _minReadSize, t, nbThreads, sketches));
+	}
+	Dispatcher(nbThreads).dispatchCommands(cmds, 0);
+	for(size_t t=0; t<cmds.size(); t++) delete cmds[t];
+
+	SimkaMatrixWriter writer(_outputDir, "mat_preview_presenceAbsence_jaccard", _bankNames, 0, _nbBanks);
+	size_t blockSize = nbThreads * SIMKA_PREVIEW_ROWS_PER_THREAD;
+	vector<vector<float> > rows;
+
+	for(size_t rowStart=0; rowStart<_nbBanks; rowStart+=blockSize){
+
+		rows.assign(min(blockSize, _nbBanks - rowStart), vector<float>());
+
+		cmds.clear();
+		for(size_t t=0; t<nbThreads; t++){
+			cmds.push_back(new SimkaPreviewDistanceCommand(sketches, _previewSize, rowStart, t, nbThreads, rows));
+		}
+		Dispatcher(nbThreads).dispatchCommands(cmds, 0);
+		for(size_t t=0; t<cmds.size(); t++) delete cmds[t];
+
+		for(size_t r=0; r<rows.size(); r++){
+			writer.writeRow(rowStart + r, rows[r]);
+		}
+	}
+
+	if(_options->getInt(STR_VERBOSE) != 0){
+		cout << "Preview matrix: " << _outputDir << "/mat_preview_presenceAbsence_jaccard.csv.gz" << endl << endl;
+	}
+}
+
 /*
 
 template<size_t span>
@@ -24,21 +24,47 @@
 #include <gatb/gatb_core.hpp>
 #include <gatb/kmer/impl/RepartitionAlgorithm.hpp>
 #include<stdio.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <pthread.h>
+#include <deque>
+#include <set>
 
 //#define PRINT_STATS
 //#define CHI2_TEST
 //#define SIMKA_POTARA
-//#define BOOTSTRAP
-#define MAX_BOOTSTRAP 50
-#define NB_BOOTSTRAP 45
 //#define SIMKA_FUSION
 //#define MULTI_PROCESSUS
 //#define MULTI_DISK
 //#define SIMKA_MIN
+#define SIMKA_SCAN_MAX_THREADS 16 //Maximum number of datasets opened at once when checking the input
+#define SIMKA_INPUT_MAX_THREADS 8 //Maximum number of files of a dataset read at once with -concurrent-input
+#define SIMKA_INPUT_BATCH_SIZE 1024 //Reads passed at once from a reading thread to the counting with -concurrent-input
+#define SIMKA_INPUT_QUEUE_SIZE 64 //Batches of reads read ahead with -concurrent-input
+#define SIMKA_STREAM_DEFAULT_READS 10000000 //Declared number of reads of streamed datasets when no dataset is stored in files
+#define SIMKA_STREAM_DEFAULT_READ_SIZE 150
+#define SIMKA_PREVIEW_DEFAULT_READS 1000000 //Reads per dataset sketched by -preview when -max-reads doesn't limit them
+#define SIMKA_PREVIEW_ROWS_PER_THREAD 64 //Rows of the preview matrix computed by a thread before the rows are written
+#define SIMKA_BOOTSTRAP_MAX 1000 //Maximum number of replicates of -bootstrap
+#define SIMKA_BOOTSTRAP_CONFIDENCE 0.95 //Confidence level of the intervals of the -bootstrap replicates
+#define SIMKA_BOOTSTRAP_NB_BLOCKS 20 //Read blocks of each dataset resampled by the replicates of -bootstrap
+#define SIMKA_COUNT_BLOCK_ITEMS 4096 //Kmer counts per gzip member of a count file, the merge jobs of kmer ranges seek to the members
 #include "SimkaDistance.hpp"
 
 const string STR_SIMKA_SOLIDITY_PER_DATASET = "-solidity-single";
 const string STR_SIMKA_MAX_READS = "-max-reads";
+const string STR_SIMKA_SUBSAMPLE_MODE = "-subsample-mode";
+const string STR_SIMKA_CONCURRENT_INPUT = "-concurrent-input";
+const string STR_SIMKA_STREAM_READS = "-stream-reads";
+const string STR_SIMKA_SKETCH_SCALE = "-sketch-scale";
+const string STR_SIMKA_MULTI_ABUNDANCE_MIN = "-multi-abundance-min";
+const string STR_SIMKA_BOOTSTRAP = "-bootstrap";
+const string STR_SIMKA_OUTPUT_KNN = "-output-knn";
+const string STR_SIMKA_OUTPUT_MAX_DISTANCE = "-output-max-distance";
+const string STR_SIMKA_PREVIEW = "-preview";
+const string STR_SIMKA_PREVIEW_SIZE = "-preview-size";
 const string STR_SIMKA_MIN_READ_SIZE = "-min-read-size";
 const string STR_SIMKA_MIN_READ_SHANNON_INDEX = "-read-shannon-index";
 const string STR_SIMKA_MIN_KMER_SHANNON_INDEX = "-kmer-shannon-index";
@@ -46,6 +72,7 @@ const string STR_KMER_PER_READ = "-kmer-per-read";
 const string STR_SIMKA_COMPUTE_ALL_SIMPLE_DISTANCES= "-simple-dist";
 const string STR_SIMKA_COMPUTE_ALL_COMPLEX_DISTANCES = "-complex-dist";
 const string STR_SIMKA_KEEP_TMP_FILES = "-keep-tmp";
+const string STR_SIMKA_INCREMENTAL = "-incremental";
 const string STR_SIMKA_COMPUTE_DATA_INFO = "-data-info";
 
 enum SIMKA_SOLID_KIND{
@@ -55,7 +82,12 @@ enum SIMKA_SOLID_KIND{
 
 
 
-typedef u_int16_t bankIdType;
+typedef u_int32_t bankIdType;
+
+/** Sparse abundance vector of a kmer: one (bank index, abundance) entry for each bank
+ * that contains the kmer, sorted by increasing bank index. */
+typedef pair<bankIdType, CountNumber> BankIdCount;
+typedef vector<BankIdCount> SparseCountVector;
 
 
 
@@ -149,9 +181,13 @@ private:
 
     //vector<size_t> _banksOks;
 
-    vector<u_int16_t> _sharedBanks;
+    vector<bankIdType> _sharedBanks;
+
+    //Dense abundances of the current kmer, only filled for the metrics that need the banks
+    //which do not contain the kmer (complex distances, chi2 test). Entries are reset to 0 after use.
+    CountVector _denseCounts;
 
-	typedef std::pair<double, CountVector> chi2val_Abundances;
+	typedef std::pair<double, SparseCountVector> chi2val_Abundances;
 	struct _chi2ValueSorterFunction { bool operator() (chi2val_Abundances l,chi2val_Abundances r) { return r.first < l.first; } } ;
 	std::priority_queue< chi2val_Abundances, vector<chi2val_Abundances>, _chi2ValueSorterFunction> _chi2ValueSorter;
 	size_t _maxChi2Values;
@@ -179,6 +215,11 @@ public:
     	_nbKmerCounted = 0;
     	//isAbundanceThreshold = _abundanceThreshold.first > 1 || _abundanceThreshold.second < 1000000;
 
+    	if(_stats->_computeComplexDistances)
+    		_denseCounts.resize(_nbBanks, 0);
+		#ifdef CHI2_TEST
+    		_denseCounts.resize(_nbBanks, 0);
+		#endif
 
     }
 
@@ -189,7 +230,7 @@ public:
 			size_t nbValues = _chi2ValueSorter.size();
 			for(size_t i=0; i<nbValues; i++){
 				double val = _chi2ValueSorter.top().first;
-				CountVector counts = _chi2ValueSorter.top().second;
+				SparseCountVector counts = _chi2ValueSorter.top().second;
 
 
 				//cout << val << endl;
@@ -205,7 +246,7 @@ public:
 		#endif
     }
 
-    void process (size_t partId, const typename Kmer<span>::Type& kmer, const CountVector& counts){
+    void process (size_t partId, const typename Kmer<span>::Type& kmer, const SparseCountVector& counts){
 
     	//cout << kmer.toString(_kmerSize) << endl;
     	//for(size_t i=0; i<counts.size(); i++){
@@ -220,13 +261,13 @@ public:
 
     	for(size_t i=0; i<counts.size(); i++){
 
-    		CountNumber abundance = counts[i];
+    		CountNumber abundance = counts[i].second;
     		//_nbKmerCounted += abundance;
     		//_stats._speciesAbundancePerDataset[i].push_back(abundance);
 
     		//cout << counts[i] << " ";
     		_stats->_nbKmers += abundance;
-    		_stats->_nbKmersPerBank[i] += abundance;
+    		_stats->_nbKmersPerBank[counts[i].first] += abundance;
     		_totalAbundance += abundance;
     	}
 #endif
@@ -244,11 +285,16 @@ public:
 
     	_totalAbundance = 0;
     	for(size_t i=0; i<counts.size(); i++){
-    		_totalAbundance += counts[i];
+    		_totalAbundance += counts[i].second;
+    		_denseCounts[counts[i].first] = counts[i].second;
+    	}
+
+    	for(size_t i=0; i<_denseCounts.size(); i++){
+    		X2j += pow((_denseCounts[i]/_totalAbundance - _stats->_datasetNbReads[i]/_stats->_totalReads), 2) / (_stats->_datasetNbReads[i] / (_stats->_totalReads*_totalAbundance));
     	}
 
     	for(size_t i=0; i<counts.size(); i++){
-    		X2j += pow((counts[i]/_totalAbundance - _stats->_datasetNbReads[i]/_stats->_totalReads), 2) / (_stats->_datasetNbReads[i] / (_stats->_totalReads*_totalAbundance));
+    		_denseCounts[counts[i].first] = 0;
     	}
 
     	//std::chi_squared_distribution<double> distribution(_nbBanks-1);
@@ -271,13 +317,13 @@ public:
     	if(_chi2ValueSorter.size() > _maxChi2Values){
 
         	if(X2j > _chi2ValueSorter.top().first){
-            	_chi2ValueSorter.push(pair<double, CountVector>(X2j, counts));
+            	_chi2ValueSorter.push(pair<double, SparseCountVector>(X2j, counts));
         		_chi2ValueSorter.pop();
         	}
 
     	}
     	else{
-        	_chi2ValueSorter.push(pair<double, CountVector>(X2j, counts));
+        	_chi2ValueSorter.push(pair<double, SparseCountVector>(X2j, counts));
     	}
 
 
@@ -346,67 +392,73 @@ public:
     	//_stats->_nbSolidKmers += 1;
     }
 
-    void updateDistance(const CountVector& counts){
-		_sharedBanks.clear();
-
-		for(size_t i=0; i<counts.size(); i++)
-			if(counts[i]) _sharedBanks.push_back(i);
+    void updateDistance(const SparseCountVector& counts){
 
 		updateDistanceDefault(counts);
 
-    	if(_stats->_computeSimpleDistances)
-    		updateDistanceSimple(counts);
+    	if(_stats->_computeComplexDistances){
 
-    	if(_stats->_computeComplexDistances)
-    		updateDistanceComplex(counts);
-    }
+    		//Complex distances also iterate over the banks that do not contain the kmer
+    		_sharedBanks.clear();
+    		for(size_t i=0; i<counts.size(); i++){
+    			_sharedBanks.push_back(counts[i].first);
+    			_denseCounts[counts[i].first] = counts[i].second;
+    		}
+
+    		updateDistanceComplex(_denseCounts);
 
-	void updateDistanceDefault(const CountVector& counts){
+    		for(size_t i=0; i<counts.size(); i++)
+    			_denseCounts[counts[i].first] = 0;
+    	}
+    }
 
+	void updateDistanceDefault(const SparseCountVector& counts){
 
-		for(size_t ii=0; ii<_sharedBanks.size(); ii++){
-			for(size_t jj=ii+1; jj<_sharedBanks.size(); jj++){
+		//Counts are sorted by bank id, the pairs outside of the tile of the statistics are skipped
+		const SimkaTile& tile = _stats->_tile;
 
-				u_int16_t i = _sharedBanks[ii];
-				u_int16_t j = _sharedBanks[jj];
-				size_t symetricIndex = j + ((_nbBanks-1)*i) - (i*(i-1)/2);
+		for(size_t ii=0; ii<counts.size(); ii++){
 
-				u_int64_t abundanceI = counts[i];
-				u_int64_t abundanceJ = counts[j];
+			bankIdType i = counts[ii].first;
+			if(i < tile._rowStart) continue;
+			if(i >= tile._rowEnd) break;
 
-				_stats->_matrixNbSharedKmers[i][j] += counts[i];
-				_stats->_matrixNbSharedKmers[j][i] += counts[j];
-				_stats->_matrixNbDistinctSharedKmers[symetricIndex] += 1;
+			for(size_t jj=ii+1; jj<counts.size(); jj++){
 
-				//cout << i << " " << j << "    " << (j + ((_nbBanks-1)*i) - (i*(i-1)/2)) << endl;
-				_stats->_brayCurtisNumerator[symetricIndex] += min(abundanceI, abundanceJ);
-			}
-		}
+				bankIdType j = counts[jj].first;
+				if(j < tile._colStart) continue;
+				if(j >= tile._colEnd) break;
 
-	}
+				u_int64_t pairId = _stats->getPairId(i, j);
 
+				u_int64_t abundanceI = counts[ii].second;
+				u_int64_t abundanceJ = counts[jj].second;
 
-	void updateDistanceSimple(const CountVector& counts){
+				SimkaPairCounts& pairCounts = _stats->_pairCounts[pairId];
+				pairCounts._nbSharedKmersI += abundanceI;
+				pairCounts._nbSharedKmersJ += abundanceJ;
+				pairCounts._nbDistinctSharedKmers += 1;
 
+				//cout << i << " " << j << "    " << pairId << endl;
+				pairCounts._brayCurtisNumerator += min(abundanceI, abundanceJ);
 
-		for(size_t ii=0; ii<_sharedBanks.size(); ii++){
-			for(size_t jj=ii+1; jj<_sharedBanks.size(); jj++){
+		    	if(_stats->_computeSimpleDistances)
+		    		updateDistanceSimple(pairId, abundanceI, abundanceJ);
+			}
+		}
 
-				u_int16_t i = _sharedBanks[ii];
-				u_int16_t j = _sharedBanks[jj];
+	}
 
-				u_int64_t abundanceI = counts[i];
-				u_int64_t abundanceJ = counts[j];
 
+	void updateDistanceSimple(u_int64_t pairId, u_int64_t abundanceI, u_int64_t abundanceJ){
 
-				//cout << _stats->_chord_sqrt_N2[i] << endl;
-				//_stats->_chord_NiNj[i][j] += abundanceI * abundanceJ;
-				_stats->_chord_NiNj[i][j] += abundanceI * abundanceJ;
-				_stats->_hellinger_SqrtNiNj[i][j] += sqrt(abundanceI * abundanceJ);
-				_stats->_kulczynski_minNiNj[i][j] += min(abundanceI, abundanceJ);
-			}
-		}
+		SimkaPairSimpleCounts& pairCounts = _stats->_pairSimpleCounts[pairId];
 
+		//cout << _stats->_chord_sqrt_N2[i] << endl;
+		//_stats->_chord_NiNj[i][j] += abundanceI * abundanceJ;
+		pairCounts._chord_NiNj += abundanceI * abundanceJ;
+		pairCounts._hellinger_SqrtNiNj += sqrt(abundanceI * abundanceJ);
+		pairCounts._kulczynski_minNiNj += min(abundanceI, abundanceJ);
 	}
 
 	void updateDistanceComplex(const CountVector& counts){
@@ -422,9 +474,11 @@ public:
 		double d1 = 0;
 		double d2 = 0;
 
-		for(size_t i=0; i<counts.size(); i++){
+		const SimkaTile& tile = _stats->_tile;
+
+		for(size_t i=tile._rowStart; i<tile._rowEnd; i++){
 			if(counts[i]){
-				for(size_t j=i+1; j<counts.size(); j++){
+				for(size_t j=max(i+1, tile._colStart); j<tile._colEnd; j++){
 
 					//In this loop we know that (abundanceI > 0)
 					double abundanceI = counts[i];
@@ -482,11 +536,12 @@ public:
 						d2 = 0;
 					}*/
 
-					_stats->_kullbackLeibler[i][j] += d1 + d2;
+					SimkaPairComplexCounts& pairCounts = _stats->_pairComplexCounts[_stats->getPairId(i, j)];
+					pairCounts._kullbackLeibler += d1 + d2;
 
-					_stats->_canberra[i][j] += abs(abundanceI - abundanceJ) / (abundanceI + abundanceJ);
+					pairCounts._canberra += abs(abundanceI - abundanceJ) / (abundanceI + abundanceJ);
 					//_stats->_brayCurtisNumerator[i][j] += abs(abundanceI - abundanceJ);
-					_stats->_whittaker_minNiNj[i][j] += abs((int)((u_int64_t)(abundanceI*_stats->_nbSolidKmersPerBank[j]) - (u_int64_t)(abundanceJ*_stats->_nbSolidKmersPerBank[i])));
+					pairCounts._whittaker_minNiNj += abs((int)((u_int64_t)(abundanceI*_stats->_nbSolidKmersPerBank[j]) - (u_int64_t)(abundanceJ*_stats->_nbSolidKmersPerBank[i])));
 
 					//cout << _stats->_nbSolidKmersPerBank[i] << endl;
 
@@ -499,8 +554,8 @@ public:
 
 				for(size_t jj=0; jj<_sharedBanks.size(); jj++){
 
-					u_int16_t j = _sharedBanks[jj];
-					if(i > j) continue;
+					bankIdType j = _sharedBanks[jj];
+					if(i > j || !tile.isCol(j)) continue;
 
 					double abundanceI = counts[i];
 					double abundanceJ = counts[j];
@@ -511,13 +566,14 @@ public:
 					xj = (double)abundanceJ / _stats->_nbSolidKmersPerBank[j];
 					d2 = xj * log((2*yX) / (xY + yX));
 
-					_stats->_kullbackLeibler[i][j] += d1 + d2;
+					SimkaPairComplexCounts& pairCounts = _stats->_pairComplexCounts[_stats->getPairId(i, j)];
+					pairCounts._kullbackLeibler += d1 + d2;
 
-					_stats->_canberra[i][j] += abs(abundanceI - abundanceJ) / (abundanceI + abundanceJ);
+					pairCounts._canberra += abs(abundanceI - abundanceJ) / (abundanceI + abundanceJ);
 					//_stats->_brayCurtisNumerator[i][j] += abs(abundanceI - abundanceJ);
 					//cout << _stats->_nbSolidKmersPerBank[i] << endl;
 
-					_stats->_whittaker_minNiNj[i][j] += abs((int)((u_int64_t)(abundanceI*_stats->_nbSolidKmersPerBank[j]) - (u_int64_t)(abundanceJ*_stats->_nbSolidKmersPerBank[i])));
+					pairCounts._whittaker_minNiNj += abs((int)((u_int64_t)(abundanceI*_stats->_nbSolidKmersPerBank[j]) - (u_int64_t)(abundanceJ*_stats->_nbSolidKmersPerBank[i])));
 
 				}
 			}
@@ -746,8 +802,8 @@ public:
 
 
 /********************************************************************************/
-/**
- *
+/** Reads of the paired parts of a dataset, one after the other. The files of a part are read in order, with
+ * -max-reads each part gives its first maxReads reads kept by the filter.
  */
 template <class Item, typename Filter> class SimkaInputIterator : public Iterator<Item>
 {
@@ -773,6 +829,11 @@ public:
 
 	}
 
+	/** Releases the input iterators, the ones left before their end by -max-reads stop reading */
+	~SimkaInputIterator(){
+		setMainref(0);
+	}
+
 
     bool isFinished(){
         if(_currentDataset == _nbDatasets){
@@ -817,90 +878,268 @@ public:
 
     void first()
     {
-
         _ref->first();
-
-        while (!_ref->isDone() && _filter(_ref->item())==false)
-                _ref->next();
-
-        _isDone = _ref->isDone();
-
-        if(!_isDone) *(this->_item) = _ref->item();
-
+        updateItem();
     }
 
 	void next(){
 
-
 		if(isFinished()){
 			_isDone = true;
 			return;
 		}
 
-		//cout << "haha" << endl;
+		//The paired part gave its maxReads reads
+		if(_maxReads && _nbReadProcessed >= _maxReads){
+			nextDataset();
+			return;
+		}
 
 		_ref->next();
+		updateItem();
+	}
+
+    /** \copydoc  Iterator::isDone */
+    bool isDone()  {  return _isDone;  }
+
+    /** \copydoc  Iterator::item */
+    Item& item ()  {  return *(this->_item);  }
+
+
+private:
+
+	/** Skips the reads rejected by the filter, and moves to the next file at the end of the current one */
+	void updateItem(){
+
 		while (!_ref->isDone() && _filter(_ref->item())==false) _ref->next();
 
 		_isDone = _ref->isDone();
+		if(_isDone){
+			if(!isFinished()) nextBank();
+			return;
+		}
 
-		//cout << "haha" << endl;
-		//if(!_isDone){
-			//cout << _currentBank << "  " << _isDone << endl;
+		*(this->_item) = _ref->item();
+		_nbReadProcessed += 1;
+	}
 
-		//}
+    bool            _isDone;
+    size_t _currentBank;
+    //vector<Iterator<Item>* > _refs;
+    Iterator<Item>* _ref;
+    size_t _nbBanks;
+    u_int64_t _maxReads;
+    Filter _filter;
+    u_int64_t _nbReadProcessed;
+    size_t _currentInternalBank;
+	size_t _currentDataset;
+	size_t _nbDatasets;
 
-		//cout << _nbReadProcessed << "  " << _currentBank << "    " << _nbBanks << "   " << _maxReads << endl;
+    Iterator<Item>* _mainref;
+    void setMainref (Iterator<Item>* mainref)  { SP_SETATTR(mainref); }
+};
 
 
-		if(_isDone){
-			if(isFinished()){
-				//cout << _nbReadProcessed << endl;
-				return;
+/** Gives the same reads as SimkaInputIterator, but the files of the dataset are read at the same time by background
+ * threads, which fill a bounded queue of reads. With -max-reads, the files of a paired part are read one after the
+ * other and the paired parts at the same time: each part gives its first maxReads reads. Otherwise each file is read
+ * on its own. The reads come in any order. */
+template <class Item, typename Filter> class SimkaConcurrentInputIterator : public Iterator<Item>
+{
+public:
+
+	SimkaConcurrentInputIterator(Iterator<Item>* refs, size_t nbBanks, u_int64_t maxReads, Filter filter)
+	:  _filter(filter), _maxReads(maxReads), _isDone(true), _batchPos(0), _nextStream(0), _nbRunningThreads(0), _stop(false), _mainref(0) {
+
+		setMainref(refs);
+
+		vector<Iterator<Item>*> its = _mainref->getComposition();
+		size_t nbFiles = its.size() / nbBanks;
+		for(size_t i=0; i<nbBanks; i++){
+			if(_maxReads){
+				_streams.push_back(vector<Iterator<Item>*>(its.begin() + i*nbFiles, its.begin() + (i+1)*nbFiles));
 			}
 			else{
-				//cout << _nbReadProcessed << endl;
-				nextBank();
-				if(isFinished()){
-					//cout << _nbReadProcessed << endl;
+				for(size_t j=0; j<nbFiles; j++) _streams.push_back(vector<Iterator<Item>*>(1, its[i*nbFiles + j]));
+			}
+		}
+
+		pthread_mutex_init(&_mutex, NULL);
+		pthread_cond_init(&_batchPushed, NULL);
+		pthread_cond_init(&_batchPopped, NULL);
+	}
+
+	~SimkaConcurrentInputIterator(){
+		stopThreads();
+		pthread_cond_destroy(&_batchPushed);
+		pthread_cond_destroy(&_batchPopped);
+		pthread_mutex_destroy(&_mutex);
+		setMainref(0);
+	}
+
+	void first(){
+
+		stopThreads();
+
+		_stop = false;
+		_nextStream = 0;
+		_nbRunningThreads = min(_streams.size(), (size_t)SIMKA_INPUT_MAX_THREADS);
+		_threads.resize(_nbRunningThreads);
+		for(size_t i=0; i<_threads.size(); i++){
+			pthread_create(&_threads[i], NULL, &SimkaConcurrentInputIterator::run, this);
+		}
+
+		_batch.clear();
+		_batchPos = 0;
+		fill();
+	}
+
+	void next(){
+		_batchPos += 1;
+		fill();
+	}
+
+	bool isDone(){ return _isDone; }
+
+	Item& item(){ return _batch[_batchPos]; }
+
+private:
+
+	static void* run(void* arg){
+		((SimkaConcurrentInputIterator*) arg)->readStreams();
+		return NULL;
+	}
+
+	/** Reading thread: reads the streams not read yet by the other threads */
+	void readStreams(){
+
+		//The filter is not thread safe
+		Filter filter = _filter;
+
+		while(true){
+
+			pthread_mutex_lock(&_mutex);
+			if(_stop || _nextStream >= _streams.size()){
+				_nbRunningThreads -= 1;
+				pthread_cond_broadcast(&_batchPushed);
+				pthread_mutex_unlock(&_mutex);
+				return;
+			}
+			size_t stream = _nextStream;
+			_nextStream += 1;
+			pthread_mutex_unlock(&_mutex);
+
+			readStream(_streams[stream], filter);
+		}
+	}
+
+	void readStream(const vector<Iterator<Item>*>& its, Filter& filter){
+
+		//The reads are assigned to the items of the batch, which copies their data
+		vector<Item> batch(SIMKA_INPUT_BATCH_SIZE);
+		size_t batchSize = 0;
+		u_int64_t nbReads = 0;
+
+		for(size_t i=0; i<its.size(); i++){
+			for(its[i]->first(); !its[i]->isDone(); its[i]->next()){
+
+				if(!filter(its[i]->item())) continue;
+
+				batch[batchSize] = its[i]->item();
+				batchSize += 1;
+				nbReads += 1;
+
+				if(_maxReads && nbReads >= _maxReads){
+					push(batch, batchSize);
 					return;
 				}
+
+				if(batchSize == batch.size() && !push(batch, batchSize)) return;
 			}
 		}
-		else{
-			*(this->_item) = _ref->item();
-			_nbReadProcessed += 1;
+
+		push(batch, batchSize);
+	}
+
+	/** Returns false if the iteration is stopped */
+	bool push(vector<Item>& batch, size_t& batchSize){
+
+		if(batchSize == 0) return true;
+		batch.resize(batchSize);
+
+		pthread_mutex_lock(&_mutex);
+		while(_queue.size() >= SIMKA_INPUT_QUEUE_SIZE && !_stop){
+			pthread_cond_wait(&_batchPopped, &_mutex);
 		}
+		bool isPushed = !_stop;
+		if(isPushed){
+			_queue.push_back(vector<Item>());
+			_queue.back().swap(batch);
+			pthread_cond_broadcast(&_batchPushed);
+		}
+		pthread_mutex_unlock(&_mutex);
 
-		if(_maxReads && _nbReadProcessed >= _maxReads){
-			if(isFinished())
+		batch.resize(SIMKA_INPUT_BATCH_SIZE);
+		batchSize = 0;
+		return isPushed;
+	}
+
+	/** Moves to the next batch of reads if the current one is over */
+	void fill(){
+
+		while(_batchPos >= _batch.size()){
+
+			pthread_mutex_lock(&_mutex);
+			while(_queue.empty() && _nbRunningThreads > 0){
+				pthread_cond_wait(&_batchPushed, &_mutex);
+			}
+			bool isEmpty = _queue.empty();
+			if(!isEmpty){
+				_batch.swap(_queue.front());
+				_queue.pop_front();
+				pthread_cond_broadcast(&_batchPopped);
+			}
+			pthread_mutex_unlock(&_mutex);
+
+			if(isEmpty){
+				_isDone = true;
 				return;
-			else
-				nextDataset();
+			}
+			_batchPos = 0;
 		}
 
+		_isDone = false;
 	}
 
-    /** \copydoc  Iterator::isDone */
-    bool isDone()  {  return _isDone;  }
-
-    /** \copydoc  Iterator::item */
-    Item& item ()  {  return *(this->_item);  }
+	void stopThreads(){
 
+		pthread_mutex_lock(&_mutex);
+		_stop = true;
+		pthread_cond_broadcast(&_batchPopped);
+		pthread_mutex_unlock(&_mutex);
 
-private:
+		for(size_t i=0; i<_threads.size(); i++){
+			pthread_join(_threads[i], NULL);
+		}
+		_threads.clear();
+		_queue.clear();
+	}
 
-    bool            _isDone;
-    size_t _currentBank;
-    //vector<Iterator<Item>* > _refs;
-    Iterator<Item>* _ref;
-    size_t _nbBanks;
-    u_int64_t _maxReads;
-    Filter _filter;
-    u_int64_t _nbReadProcessed;
-    size_t _currentInternalBank;
-	size_t _currentDataset;
-	size_t _nbDatasets;
+	Filter _filter;
+	u_int64_t _maxReads;
+	bool _isDone;
+	vector<vector<Iterator<Item>*> > _streams; //files read one after the other by a thread
+	vector<Item> _batch;
+	size_t _batchPos;
+
+	vector<pthread_t> _threads;
+	pthread_mutex_t _mutex;
+	pthread_cond_t _batchPushed;
+	pthread_cond_t _batchPopped;
+	deque<vector<Item> > _queue;
+	size_t _nextStream;
+	size_t _nbRunningThreads;
+	bool _stop;
 
     Iterator<Item>* _mainref;
     void setMainref (Iterator<Item>* mainref)  { SP_SETATTR(mainref); }
@@ -924,19 +1163,6 @@ struct SimkaSequenceFilter
 		_minShannonIndex = minShannonIndex;
 	}
 
-#ifdef BOOTSTRAP
-	vector<bool> _bootstraps;
-
-
-	void setBootstrap(vector<bool>& bootstraps){
-		_bootstraps = bootstraps;
-		//for(size_t i=0; i<_bootstraps.size(); i++)
-		//	cout << _bootstraps[i];
-		//cout << endl << endl;
-	}
-
-#endif
-
 	//void setMaxReads(u_int64_t maxReads){
 	//	_maxNbReads = maxReads;
 	//}
@@ -958,13 +1184,6 @@ struct SimkaSequenceFilter
 
 		//cout << seq.getIndex() << " " <<  _nbReadProcessed << endl;
 
-#ifdef BOOTSTRAP
-		int readPerBootstrap = _maxNbReads / MAX_BOOTSTRAP;
-		int bootstrapIndex = seq.getIndex() / readPerBootstrap;
-		if(!_bootstraps[bootstrapIndex]) return false;
-		//cout << bootstrapIndex << endl;
-#endif
-
 		if(!isReadSizeValid(seq))
 			return false;
 
@@ -1204,6 +1423,638 @@ private:
 
 
 
+/*********************************************************************
+* ** SimkaDatasetInfo
+*
+* Validity and size estimates of an input dataset. They are cached in the manifest of the input
+* (one line per dataset) and reused as long as the files of the dataset don't change.
+*********************************************************************/
+struct SimkaDatasetInfo{
+
+	SimkaDatasetInfo() : _isValid(false), _nbReads(0), _totalSize(0), _maxSize(0), _fileSize(0) {}
+
+	string _signature; //hash of the paths, sizes and modification times of the files of the dataset
+	bool _isValid;
+	u_int64_t _nbReads; //estimates of IBank::estimate
+	u_int64_t _totalSize;
+	u_int64_t _maxSize;
+	u_int64_t _fileSize; //total size of the files
+
+	/** Signature of the dataset described by a sub bank file of the input dir (one filename per line) */
+	static string getSignature(const string& subBankFilename, u_int64_t& fileSize){
+
+		u_int64_t hash = 14695981039346656037ULL;
+		fileSize = 0;
+
+		ifstream file(subBankFilename.c_str());
+		string line;
+		while(getline(file, line)){
+			if(line == "") continue;
+
+			struct stat st;
+			string key = line;
+			if(stat(line.c_str(), &st) == 0){
+				key += " " + Stringify::format("%llu", (unsigned long long)st.st_size) + " " + Stringify::format("%llu", (unsigned long long)st.st_mtime);
+				fileSize += st.st_size;
+			}
+			key += "\n";
+
+			//FNV-1a
+			for(size_t i=0; i<key.size(); i++){
+				hash ^= (unsigned char)key[i];
+				hash *= 1099511628211ULL;
+			}
+		}
+		file.close();
+
+		return Stringify::format("%llx", (unsigned long long)hash);
+	}
+
+	/** Streamed input (read once by the count job): a command ("<command") or a named pipe */
+	static bool isStream(const string& filename){
+		if(filename.empty()) return false;
+		if(filename[0] == '<') return true;
+		struct stat st;
+		return stat(filename.c_str(), &st) == 0 && S_ISFIFO(st.st_mode);
+	}
+
+	/** Manifest line: name signature valid nbReads totalSize maxSize fileSize */
+	static void readManifest(const string& filename, map<string, SimkaDatasetInfo>& infos){
+
+		ifstream file(filename.c_str());
+		string line;
+		while(getline(file, line)){
+			stringstream lineStream(line);
+			string name;
+			SimkaDatasetInfo info;
+			if(!(lineStream >> name >> info._signature >> info._isValid >> info._nbReads >> info._totalSize >> info._maxSize >> info._fileSize)) continue;
+			infos[name] = info;
+		}
+		file.close();
+	}
+
+	static void writeManifest(const string& filename, const vector<string>& names, const vector<SimkaDatasetInfo>& infos){
+
+		string contents = "";
+		for(size_t i=0; i<names.size(); i++){
+			const SimkaDatasetInfo& info = infos[i];
+			contents += names[i] + "\t" + info._signature + "\t" + (info._isValid ? "1" : "0");
+			contents += "\t" + Stringify::format("%llu", (unsigned long long)info._nbReads);
+			contents += "\t" + Stringify::format("%llu", (unsigned long long)info._totalSize);
+			contents += "\t" + Stringify::format("%llu", (unsigned long long)info._maxSize);
+			contents += "\t" + Stringify::format("%llu", (unsigned long long)info._fileSize) + "\n";
+		}
+
+		string tempFilename = filename + ".temp";
+		IFile* file = System::file().newFile(tempFilename, "w");
+		file->fwrite(contents.c_str(), contents.size(), 1);
+		file->flush();
+		delete file;
+		System::file().rename(tempFilename, filename);
+	}
+};
+
+/*********************************************************************
+* ** BagGzBlockFile
+*
+* Count file written as a series of gzip members of SIMKA_COUNT_BLOCK_ITEMS kmer counts, with an index
+* <file>.idx of the offset and of the first item of each member. The file is still read as a single gz
+* file, the merge job of a kmer range uses the index to start decompressing at the member of its first kmer.
+*********************************************************************/
+template <class Item>
+class BagGzBlockFile : public Bag<Item>, public gatb::core::system::SmartPointer
+{
+public:
+
+	BagGzBlockFile(const string& filename) : _filename(filename), _nbItems(0)
+	{
+		if(System::file().doesExist(getIndexFilename(filename))) System::file().remove(getIndexFilename(filename));
+
+		_fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if(_fd < 0){
+			cout << "Error: can't create count file " << filename << endl;
+			exit(1);
+		}
+
+		_items = new Item[SIMKA_COUNT_BLOCK_ITEMS];
+	}
+
+	/** The index is written once the last member is complete, a count file without index is read from its start */
+	~BagGzBlockFile(){
+		writeBlock();
+		close(_fd);
+		writeIndex();
+		delete[] _items;
+	}
+
+	void insert(const Item& item){
+		_items[_nbItems++] = item;
+		if(_nbItems == SIMKA_COUNT_BLOCK_ITEMS) writeBlock();
+	}
+
+	void insert(const std::vector<Item>& items, size_t length){
+		if(length == 0) length = items.size();
+		for(size_t i=0; i<length; i++) insert(items[i]);
+	}
+
+	void insert(const Item* items, size_t length){
+		for(size_t i=0; i<length; i++) insert(items[i]);
+	}
+
+	/** Members are written when full, the last one when the file is closed */
+	void flush(){}
+
+	static string getIndexFilename(const string& filename){
+		return filename + ".idx";
+	}
+
+private:
+
+	void writeBlock(){
+
+		if(_nbItems == 0) return;
+
+		off_t offset = lseek(_fd, 0, SEEK_CUR);
+		unsigned int nbBytes = _nbItems * sizeof(Item);
+
+		gzFile gz = gzdopen(dup(_fd), "wb");
+		bool isWritten = gz != 0 && gzwrite(gz, _items, nbBytes) == (int)nbBytes;
+		if(gz == 0 || gzclose(gz) != Z_OK || !isWritten){
+			cout << "Error: can't write count file " << _filename << endl;
+			exit(1);
+		}
+
+		_offsets.push_back(offset);
+		_firstItems.push_back(_items[0]);
+		_nbItems = 0;
+	}
+
+	/** Size of the count file, then the offset and the first item of each member */
+	void writeIndex(){
+
+		u_int64_t fileSize = System::file().getSize(_filename);
+		u_int64_t nbBlocks = _offsets.size();
+
+		string tempFilename = getIndexFilename(_filename) + ".temp";
+		IFile* file = System::file().newFile(tempFilename, "wb");
+		file->fwrite(&fileSize, sizeof(fileSize), 1);
+		file->fwrite(&nbBlocks, sizeof(nbBlocks), 1);
+		for(size_t i=0; i<_offsets.size(); i++){
+			file->fwrite(&_offsets[i], sizeof(u_int64_t), 1);
+			file->fwrite(&_firstItems[i], sizeof(Item), 1);
+		}
+		file->flush();
+		delete file;
+		System::file().rename(tempFilename, getIndexFilename(_filename));
+	}
+
+	string _filename;
+	int _fd;
+	Item* _items;
+	size_t _nbItems;
+	vector<u_int64_t> _offsets;
+	vector<Item> _firstItems;
+};
+
+/** Index of the gzip members of a count file written by BagGzBlockFile */
+template <class Item>
+struct SimkaGzBlockIndex{
+
+	/** False if the count file has no index, or if the index was written for another version of the file */
+	bool load(const string& filename){
+
+		_offsets.clear();
+		_firstItems.clear();
+
+		string indexFilename = BagGzBlockFile<Item>::getIndexFilename(filename);
+		if(!System::file().doesExist(indexFilename)) return false;
+
+		ifstream file(indexFilename.c_str(), ios::binary);
+		u_int64_t fileSize = 0;
+		u_int64_t nbBlocks = 0;
+		file.read((char*)&fileSize, sizeof(fileSize));
+		file.read((char*)&nbBlocks, sizeof(nbBlocks));
+		if(!file || fileSize != System::file().getSize(filename)) return false;
+
+		_offsets.resize(nbBlocks);
+		_firstItems.resize(nbBlocks);
+		for(size_t i=0; i<nbBlocks; i++){
+			file.read((char*)&_offsets[i], sizeof(u_int64_t));
+			file.read((char*)&_firstItems[i], sizeof(Item));
+		}
+
+		if(!file){
+			_offsets.clear();
+			_firstItems.clear();
+			return false;
+		}
+
+		return true;
+	}
+
+	/** Offset of the last member starting before kmer: the counts of kmer may begin at the end of the member before
+	 * the one it starts */
+	template<class Type>
+	u_int64_t getOffset(const Type& kmer) const {
+		u_int64_t offset = 0;
+		for(size_t i=0; i<_firstItems.size() && _firstItems[i]._type < kmer; i++) offset = _offsets[i];
+		return offset;
+	}
+
+	vector<u_int64_t> _offsets;
+	vector<Item> _firstItems;
+};
+
+/*********************************************************************
+* ** SimkaCountCache
+*
+* Count outputs of single datasets shared by the runs of a cache directory (-count-cache). An entry is a
+* directory named by the key of the dataset and of the count parameters, holding the count file of each
+* partition, the kmers per partition and the finish signal of the dataset. Entries are written in a
+* temporary directory and renamed once complete, the first run to finish a dataset creates its entry.
+*********************************************************************/
+struct SimkaCountCache{
+
+	static string getEntryDir(const string& cacheDir, const string& key){
+		return cacheDir + "/" + key;
+	}
+
+	static bool hasEntry(const string& entryDir){
+		return System::file().doesExist(entryDir + "/count.ok");
+	}
+
+	static string getPartitionFilename(const string& entryDir, size_t partitionId){
+		return entryDir + "/part_" + Stringify::format("%i", partitionId) + ".gz";
+	}
+
+	/** Index of the dataset in the run that created the entry, the kmers of the count files are tagged with it */
+	static size_t getBankIndex(const string& entryDir){
+		size_t bankIndex = (size_t)-1;
+		ifstream file((entryDir + "/bank_index").c_str());
+		file >> bankIndex;
+		file.close();
+		return bankIndex;
+	}
+
+	/** FNV-1a hash of a key */
+	static string getHash(const string& key){
+
+		u_int64_t hash = 14695981039346656037ULL;
+		for(size_t i=0; i<key.size(); i++){
+			hash ^= (unsigned char)key[i];
+			hash *= 1099511628211ULL;
+		}
+
+		return Stringify::format("%llx", (unsigned long long)hash);
+	}
+
+	/** FNV-1a hash of the contents of a file */
+	static string getFileHash(const string& filename){
+
+		u_int64_t hash = 14695981039346656037ULL;
+		ifstream file(filename.c_str(), ios::binary);
+		char buffer[4096];
+		while(file){
+			file.read(buffer, sizeof(buffer));
+			for(streamsize i=0; i<file.gcount(); i++){
+				hash ^= (unsigned char)buffer[i];
+				hash *= 1099511628211ULL;
+			}
+		}
+		file.close();
+
+		return Stringify::format("%llx", (unsigned long long)hash);
+	}
+
+	/** Hard link of a file, or copy when the cache is on another file system. The copy is written under a unique
+	 * temporary name and renamed, a reader never sees a partial file. */
+	static void linkFile(const string& filename, const string& linkFilename){
+
+		if(System::file().doesExist(linkFilename)) System::file().remove(linkFilename);
+		if(link(filename.c_str(), linkFilename.c_str()) == 0) return;
+
+		string tempFilename = linkFilename + ".temp_XXXXXX";
+		int fd = mkstemp(&tempFilename[0]);
+		if(fd < 0){
+			cout << "Error: can't create a copy of " << filename << " in " << System::file().getDirectory(linkFilename) << endl;
+			exit(1);
+		}
+		fchmod(fd, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+		close(fd);
+
+		ifstream src(filename.c_str(), ios::binary);
+		ofstream dst(tempFilename.c_str(), ios::binary);
+		if(src && src.peek() != ifstream::traits_type::eof()) dst << src.rdbuf();
+		bool isCopied = src.is_open() && dst.is_open();
+		src.close();
+		dst.close();
+
+		if(!isCopied || !dst || System::file().rename(tempFilename, linkFilename) != 0){
+			System::file().remove(tempFilename);
+			cout << "Error: can't copy " << filename << " to " << linkFilename << endl;
+			exit(1);
+		}
+	}
+
+	/** Block index of a count file linked with linkFile, if the count file has one */
+	static void linkIndex(const string& filename, const string& linkFilename){
+		string indexFilename = filename + ".idx";
+		if(System::file().doesExist(indexFilename)) linkFile(indexFilename, linkFilename + ".idx");
+	}
+
+	/** Kmers per partition and finish signal of the dataset in the temp dir of a run. The finish signal is written last. */
+	static void restoreInfo(const string& entryDir, const string& outputDir, const string& bankName){
+		linkFile(entryDir + "/kmercount.txt", outputDir + "/kmercount_per_partition/" + bankName + ".txt");
+		linkFile(entryDir + "/count.ok", outputDir + "/count_synchro/" + bankName + ".ok");
+	}
+
+	/** Creates the entry of a dataset counted in the temp dir of a run, from its count files (one per partition).
+	 * Nothing is done if another run created the entry meanwhile. */
+	static void store(const string& entryDir, const string& outputDir, const string& bankName, size_t bankIndex, const vector<string>& partitionFilenames){
+
+		//The runs sharing the cache may be on several hosts, the name of the temporary dir is unique on the file system
+		string tempDir = entryDir + ".temp_XXXXXX";
+		if(mkdtemp(&tempDir[0]) == 0){
+			cout << "Error: can't create a temporary entry in the count cache " << entryDir << endl;
+			exit(1);
+		}
+		chmod(tempDir.c_str(), S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH);
+
+		for(size_t i=0; i<partitionFilenames.size(); i++){
+			linkFile(partitionFilenames[i], getPartitionFilename(tempDir, i));
+			linkIndex(partitionFilenames[i], getPartitionFilename(tempDir, i));
+		}
+		linkFile(outputDir + "/kmercount_per_partition/" + bankName + ".txt", tempDir + "/kmercount.txt");
+
+		string contents = Stringify::format("%i", bankIndex) + "\n";
+		IFile* file = System::file().newFile(tempDir + "/bank_index", "w");
+		file->fwrite(contents.c_str(), contents.size(), 1);
+		file->flush();
+		delete file;
+
+		linkFile(outputDir + "/count_synchro/" + bankName + ".ok", tempDir + "/count.ok");
+
+		if(hasEntry(entryDir) || System::file().rename(tempDir, entryDir) != 0){
+			string command = "rm -rf " + tempDir;
+			system(command.c_str());
+		}
+	}
+};
+
+/** Opens the datasets threadId, threadId+nbThreads... of the list, once each, to check them and estimate their size */
+class SimkaScanCommand : public ICommand
+{
+public:
+
+	SimkaScanCommand(const string& inputDir, const vector<string>& bankNames, const vector<size_t>& bankIds, size_t threadId, size_t nbThreads, vector<SimkaDatasetInfo>& infos) :
+		_inputDir(inputDir), _bankNames(bankNames), _bankIds(bankIds), _infos(infos)
+	{
+		_threadId = threadId;
+		_nbThreads = nbThreads;
+	}
+
+	void execute(){
+
+		for(size_t i=_threadId; i<_bankIds.size(); i+=_nbThreads){
+
+			SimkaDatasetInfo& info = _infos[_bankIds[i]];
+
+			try{
+				IBank* bank = Bank::open(_inputDir + _bankNames[_bankIds[i]]);
+				LOCAL(bank);
+				bank->estimate(info._nbReads, info._totalSize, info._maxSize);
+				info._isValid = true;
+			}
+			catch (Exception& e){
+				info._isValid = false;
+			}
+		}
+	}
+
+	void use () {}
+	void forget () {}
+
+private:
+	string _inputDir;
+	const vector<string>& _bankNames;
+	const vector<size_t>& _bankIds;
+	vector<SimkaDatasetInfo>& _infos;
+	size_t _threadId;
+	size_t _nbThreads;
+};
+
+/** FracMinHash subsampling of the kmers (-sketch-scale): a kmer is kept if its hash is below 2^64/scale. The hash
+ * only depends on the kmer, the same kmers are kept in every dataset. */
+template<size_t span>
+struct SimkaSketch{
+
+    typedef typename Kmer<span>::Type  Type;
+
+    static u_int64_t getThreshold(u_int64_t scale){ return scale <= 1 ? (u_int64_t)-1 : (u_int64_t)-1 / scale; }
+
+    /** Murmur3 finalizer of the 64 bits words of the kmer */
+    static u_int64_t hash(const Type& kmer){
+
+    	size_t nbWords = Type::getSize() / 64;
+    	Type value = kmer;
+    	u_int64_t h = 0;
+
+    	for(size_t i=0; i<nbWords; i++){
+    		h ^= value.getVal();
+    		h ^= h >> 33;
+    		h *= 0xff51afd7ed558ccdULL;
+    		h ^= h >> 33;
+    		h *= 0xc4ceb9fe1a85ec53ULL;
+    		h ^= h >> 33;
+    		if(i+1 < nbWords) value = value >> 64;
+    	}
+
+    	return h;
+    }
+
+    static bool isKept(const Type& kmer, u_int64_t threshold){
+    	return threshold == (u_int64_t)-1 || hash(kmer) < threshold;
+    }
+};
+
+/** Bootstrap replicates of the reads (-bootstrap): the reads of each dataset are split in SIMKA_BOOTSTRAP_NB_BLOCKS
+ * blocks of consecutive reads, the count jobs count the kmers of each block without abundance threshold. A replicate
+ * draws SIMKA_BOOTSTRAP_NB_BLOCKS blocks with replacement: the abundance of a kmer in a dataset is the sum of its
+ * counts in the blocks weighted by the number of times they are drawn, the abundance thresholds are applied to this
+ * sum. The block b of every dataset is drawn together. */
+struct SimkaBootstrap{
+
+	/** Block of the read readIndex of a dataset of nbReads reads */
+	static size_t getBlock(u_int64_t readIndex, u_int64_t nbReads){
+		if(readIndex >= nbReads) return SIMKA_BOOTSTRAP_NB_BLOCKS-1;
+		return (readIndex * SIMKA_BOOTSTRAP_NB_BLOCKS) / nbReads;
+	}
+
+	/** Number of times each block is drawn by a replicate */
+	static void getWeights(size_t replicate, vector<u_int64_t>& weights){
+
+		weights.assign(SIMKA_BOOTSTRAP_NB_BLOCKS, 0);
+
+		for(size_t i=0; i<SIMKA_BOOTSTRAP_NB_BLOCKS; i++){
+			u_int64_t h = (u_int64_t)replicate * SIMKA_BOOTSTRAP_NB_BLOCKS + i + 1;
+			h *= 0x9e3779b97f4a7c15ULL;
+			h ^= h >> 33;
+			h *= 0xff51afd7ed558ccdULL;
+			h ^= h >> 33;
+			h *= 0xc4ceb9fe1a85ec53ULL;
+			h ^= h >> 33;
+			weights[h % SIMKA_BOOTSTRAP_NB_BLOCKS] += 1;
+		}
+	}
+
+	/** Bank id of the kmers of a block in its count files, the merge of the blocks tells the blocks of a dataset apart */
+	static size_t getBlockBankId(size_t dataset, size_t block){ return dataset * SIMKA_BOOTSTRAP_NB_BLOCKS + block; }
+
+	/** Id of a block: the dir of its count files in the partition dirs */
+	static string getCountsId(size_t block){ return "b" + Stringify::format("%i", block); }
+
+	/** Id of a replicate: its kmer counts in the finish signals of the counts and its stats dir */
+	static string getReplicateId(size_t replicate){ return "r" + Stringify::format("%i", replicate); }
+};
+
+
+/** Bottom-s MinHash sketches (-preview) of the datasets threadId, threadId+nbThreads... of the list: the s smallest
+ * hashes of the kmers of the first reads of each dataset, sorted */
+template<size_t span>
+class SimkaPreviewSketchCommand : public ICommand
+{
+public:
+
+    typedef typename Kmer<span>::ModelCanonical                             ModelCanonical;
+    typedef typename Kmer<span>::ModelCanonical::Iterator                   ModelIt;
+
+	SimkaPreviewSketchCommand(const string& inputDir, const vector<string>& bankNames, size_t kmerSize, size_t sketchSize, u_int64_t maxReads, size_t minReadSize,
+			size_t threadId, size_t nbThreads, vector<vector<u_int64_t> >& sketches) :
+		_inputDir(inputDir), _bankNames(bankNames), _sketches(sketches)
+	{
+		_kmerSize = kmerSize;
+		_sketchSize = sketchSize;
+		_maxReads = maxReads;
+		_minReadSize = minReadSize;
+		_threadId = threadId;
+		_nbThreads = nbThreads;
+	}
+
+	void execute(){
+
+		ModelCanonical model(_kmerSize);
+		ModelIt itKmer(model);
+
+		for(size_t i=_threadId; i<_bankNames.size(); i+=_nbThreads){
+
+			set<u_int64_t> sketch;
+
+			IBank* bank = Bank::open(_inputDir + _bankNames[i]);
+			LOCAL(bank);
+			Iterator<Sequence>* itSeq = bank->iterator();
+			LOCAL(itSeq);
+
+			u_int64_t nbReads = 0;
+			for(itSeq->first(); !itSeq->isDone() && (_maxReads == 0 || nbReads < _maxReads); itSeq->next()){
+
+				Sequence& seq = itSeq->item();
+				if(seq.getDataSize() < _minReadSize) continue;
+				nbReads += 1;
+
+				itKmer.setData(seq.getData());
+				for(itKmer.first(); !itKmer.isDone(); itKmer.next()){
+					u_int64_t hash = SimkaSketch<span>::hash(itKmer->value());
+					if(sketch.size() < _sketchSize){
+						sketch.insert(hash);
+					}
+					else if(hash < *sketch.rbegin() && sketch.insert(hash).second){
+						sketch.erase(--sketch.end());
+					}
+				}
+			}
+
+			_sketches[i].assign(sketch.begin(), sketch.end());
+		}
+	}
+
+	void use () {}
+	void forget () {}
+
+private:
+	string _inputDir;
+	const vector<string>& _bankNames;
+	vector<vector<u_int64_t> >& _sketches;
+	size_t _kmerSize;
+	size_t _sketchSize;
+	u_int64_t _maxReads; //0: all the reads
+	size_t _minReadSize;
+	size_t _threadId;
+	size_t _nbThreads;
+};
+
+/** Rows threadId, threadId+nbThreads... of a block of rows of the preview matrix, from the sketches */
+class SimkaPreviewDistanceCommand : public ICommand
+{
+public:
+
+	SimkaPreviewDistanceCommand(const vector<vector<u_int64_t> >& sketches, size_t sketchSize, size_t rowStart, size_t threadId, size_t nbThreads, vector<vector<float> >& rows) :
+		_sketches(sketches), _rows(rows)
+	{
+		_sketchSize = sketchSize;
+		_rowStart = rowStart;
+		_threadId = threadId;
+		_nbThreads = nbThreads;
+	}
+
+	/** Jaccard distance estimated on the s smallest hashes of the union of the two sketches */
+	static float distance(const vector<u_int64_t>& sketch1, const vector<u_int64_t>& sketch2, size_t sketchSize){
+
+		size_t i = 0;
+		size_t j = 0;
+		size_t nbUnion = 0;
+		size_t nbShared = 0;
+
+		while(nbUnion < sketchSize && i < sketch1.size() && j < sketch2.size()){
+			if(sketch1[i] == sketch2[j]){
+				nbShared += 1;
+				i += 1;
+				j += 1;
+			}
+			else if(sketch1[i] < sketch2[j]) i += 1;
+			else j += 1;
+			nbUnion += 1;
+		}
+		nbUnion += min(sketchSize - nbUnion, (sketch1.size() - i) + (sketch2.size() - j));
+
+		if(nbUnion == 0) return 1;
+		return 1 - nbShared / (float) nbUnion;
+	}
+
+	void execute(){
+
+		size_t nbBanks = _sketches.size();
+
+		for(size_t r=_threadId; r<_rows.size(); r+=_nbThreads){
+			size_t i = _rowStart + r;
+			_rows[r].resize(nbBanks);
+			for(size_t j=0; j<nbBanks; j++){
+				_rows[r][j] = (i == j) ? 0 : distance(_sketches[i], _sketches[j], _sketchSize);
+			}
+		}
+	}
+
+	void use () {}
+	void forget () {}
+
+private:
+	const vector<vector<u_int64_t> >& _sketches;
+	vector<vector<float> >& _rows;
+	size_t _sketchSize;
+	size_t _rowStart;
+	size_t _threadId;
+	size_t _nbThreads;
+};
+
 
 
 /*********************************************************************
@@ -1235,14 +2086,91 @@ public:
     	return string(buffer);
     }
 
+    /** Comma separated list of kmer sizes, without duplicates */
+    static void parseKmerSizes(const string& str, vector<size_t>& kmerSizes){
+    	stringstream stream(str);
+    	string kmerSizeStr;
+    	while(getline(stream, kmerSizeStr, ',')){
+    		if(kmerSizeStr == "") continue;
+    		size_t kmerSize = strtoul(kmerSizeStr.c_str(), NULL, 10);
+    		if(kmerSize == 0){
+    			cout << "Error: invalid kmer size " << kmerSizeStr << endl;
+    			exit(1);
+    		}
+    		if(std::find(kmerSizes.begin(), kmerSizes.end(), kmerSize) == kmerSizes.end()) kmerSizes.push_back(kmerSize);
+    	}
+    }
+
+    /** Comma separated list of abundance thresholds, without duplicates */
+    static void parseAbundanceMins(const string& str, vector<u_int64_t>& abundanceMins){
+    	stringstream stream(str);
+    	string abundanceStr;
+    	while(getline(stream, abundanceStr, ',')){
+    		if(abundanceStr == "") continue;
+    		char* end;
+    		u_int64_t abundanceMin = strtoull(abundanceStr.c_str(), &end, 10);
+    		if(*end != '\0'){
+    			cout << "Error: invalid abundance threshold " << abundanceStr << endl;
+    			exit(1);
+    		}
+    		if(std::find(abundanceMins.begin(), abundanceMins.end(), abundanceMin) == abundanceMins.end()) abundanceMins.push_back(abundanceMin);
+    	}
+    }
+
+    /** Stats dir of another threshold of -multi-abundance-min: <out-tmp>/stats/t<threshold> */
+    static string getAbundanceMinStatsDir(const string& outputDirTemp, u_int64_t abundanceMin){
+    	return outputDirTemp + "/stats/t" + toString(abundanceMin) + "/";
+    }
+
+    /** Stats dir of a replicate of -bootstrap: <out-tmp>/stats/r<replicate> */
+    static string getBootstrapStatsDir(const string& outputDirTemp, size_t replicate){
+    	return outputDirTemp + "/stats/" + SimkaBootstrap::getReplicateId(replicate) + "/";
+    }
+
+    /** Datasets of a count file: __p__<dataset>.gz, or __p__<first>-<last>.gz for the datasets counted by the same job.
+     * Other files of the partition dirs, as the block indexes __p__<id>.gz.idx, are not count files. */
+    static bool parseCountFilename(const string& filename, size_t& first, size_t& last){
+    	if(filename.find("__p__") != 0) return false;
+    	if(filename.size() < 8 || filename.compare(filename.size()-3, 3, ".gz") != 0) return false;
+    	string id = filename.substr(5, filename.size()-8);
+    	std::string::size_type pos;
+    	first = atoll(id.c_str());
+    	last = first;
+    	pos = id.find("-");
+    	if(pos != string::npos) last = atoll(id.substr(pos+1).c_str());
+    	return true;
+    }
+
+    /** -out-tmp of another kmer size of -multi-kmer-size: <out-tmp>/k<size>, a sibling of the temp dir
+     * <out-tmp>/simka_output_temp/ of the run */
+    static string getMultiKmerOutputTmp(const string& outputDirTemp, size_t kmerSize){
+    	string dir = outputDirTemp;
+    	while(dir.size() > 1 && dir[dir.size()-1] == '/') dir.erase(dir.size()-1);
+    	std::string::size_type pos = dir.rfind('/');
+    	string outputTmp = (pos == string::npos) ? "." : dir.substr(0, pos);
+    	return outputTmp + "/k" + toString(kmerSize);
+    }
+
+    /** Temp dir of another kmer size of -multi-kmer-size: <out-tmp>/k<size>/simka_output_temp/ */
+    static string getMultiKmerTempDir(const string& outputDirTemp, size_t kmerSize){
+    	return getMultiKmerOutputTmp(outputDirTemp, kmerSize) + "/simka_output_temp/";
+    }
+
+    /** Config and repartition of the minimizers loaded by the count jobs (file storage copy of config.h5) */
+    static string getJobConfigDir(const string& outputDirTemp){
+    	return outputDirTemp + "/config_jobs";
+    }
+
 protected:
 
 
     bool setup();
+    void scanInput();
     bool isInputValid();
     void parseArgs();
     bool createDirs();
     void computeMaxReads();
+    void computePreview();
 	void layoutInputFilename();
 	void createBank();
 	void count();
@@ -1287,6 +2215,12 @@ protected:
 
 	u_int64_t _totalKmers;
     vector<size_t> _nbBankPerDataset;
+    vector<SimkaDatasetInfo> _datasetInfos;
+    vector<bool> _isStreamDataset;
+    u_int64_t _streamNbReads;
+    u_int64_t _sketchScale; //1/fraction of the kmers kept by the count (FracMinHash), 1 if all the kmers are kept
+    bool _isPreview;
+    size_t _previewSize; //number of hashes of the sketches of -preview
 
 	string _largerBankId;
 	bool _computeSimpleDistances;
@@ -24,11 +24,15 @@
 
 
 
-SimkaStatistics::SimkaStatistics(size_t nbBanks, bool computeSimpleDistances, bool computeComplexDistances, const string& tmpDir, const vector<string>& datasetIds)
+SimkaStatistics::SimkaStatistics(size_t nbBanks, bool computeSimpleDistances, bool computeComplexDistances, const string& tmpDir, const vector<string>& datasetIds, bool isSparse, const SimkaTile& tile)
 {
 
 	_nbBanks = nbBanks;
-	_symetricDistanceMatrixSize = (_nbBanks*(_nbBanks+1))/2;
+	_tile = tile.isEmpty() ? SimkaTile(_nbBanks) : tile;
+	_blockStart = 0;
+	_blockEnd = _nbBanks;
+	_nbPairs = _tile.getNbPairs();
+	_isSparse = isSparse;
 	_computeSimpleDistances = computeSimpleDistances;
 	_computeComplexDistances = computeComplexDistances;
 
@@ -52,60 +56,15 @@ SimkaStatistics::SimkaStatistics(size_t nbBanks, bool computeSimpleDistances, bo
 	//_nbDistinctKmersSharedByBanksThreshold.resize(_nbBanks, 0);
 	//_nbKmersSharedByBanksThreshold.resize(_nbBanks, 0);
 
-	_matrixNbDistinctSharedKmers.resize(_symetricDistanceMatrixSize);
-	_matrixNbSharedKmers.resize(_nbBanks);
-	_brayCurtisNumerator.resize(_symetricDistanceMatrixSize);
-
-	for(size_t i=0; i<_nbBanks; i++){
-		//_matrixNbDistinctSharedKmers[i].resize(nbBanks, 0);
-		_matrixNbSharedKmers[i].resize(nbBanks, 0);
-		//_brayCurtisNumerator[i].resize(nbBanks, 0);
-		//_kullbackLeibler[i].resize(nbBanks, 0);
+	//In sparse mode, the pairs are allocated when they are seen for the first time
+	if(!_isSparse){
+		_pairCounts.resize(_nbPairs);
+		if(_computeSimpleDistances) _pairSimpleCounts.resize(_nbPairs);
+		if(_computeComplexDistances) _pairComplexCounts.resize(_nbPairs);
 	}
 
-
-
 	if(_computeSimpleDistances){
-		//_abundance_jaccard_intersection.resize(_nbBanks);
-		//for(size_t i=0; i<_nbBanks; i++){
-		//	_abundance_jaccard_intersection[i].resize(nbBanks, 0);
-		//}
-
-		_chord_NiNj.resize(_nbBanks);
 		_chord_sqrt_N2.resize(_nbBanks);
-		//_chord_N2j.resize(_nbBanks);
-		for(size_t i=0; i<_nbBanks; i++){
-			_chord_NiNj[i].resize(nbBanks, 0);
-			//_chord_N2i[i].resize(nbBanks, 0);
-			//_chord_N2j[i].resize(nbBanks, 0);
-		}
-
-		_hellinger_SqrtNiNj.resize(_nbBanks);
-		for(size_t i=0; i<_nbBanks; i++){
-			_hellinger_SqrtNiNj[i].resize(nbBanks, 0);
-		}
-
-		_kulczynski_minNiNj.resize(_nbBanks);
-		for(size_t i=0; i<_nbBanks; i++){
-			_kulczynski_minNiNj[i].resize(nbBanks, 0);
-		}
-	}
-
-	if(_computeComplexDistances){
-		_whittaker_minNiNj.resize(_nbBanks);
-		for(size_t i=0; i<_nbBanks; i++){
-			_whittaker_minNiNj[i].resize(nbBanks, 0);
-		}
-
-		_kullbackLeibler.resize(_nbBanks);
-		for(size_t i=0; i<_nbBanks; i++){
-			_kullbackLeibler[i].resize(nbBanks, 0);
-		}
-
-		_canberra.resize(_nbBanks);
-		for(size_t i=0; i<_nbBanks; i++){
-			_canberra[i].resize(nbBanks, 0);
-		}
 	}
 
 
@@ -152,11 +111,60 @@ SimkaStatistics::SimkaStatistics(size_t nbBanks, bool computeSimpleDistances, bo
 
 }
 
+void SimkaStatistics::loadBankCounts(const string& tmpDir, const vector<string>& datasetIds, const string& countsId){
+
+	for(size_t i=0; i<_nbBanks; i++){
+
+		string countFilename = tmpDir + "/count_synchro/" +  datasetIds[i] + ".ok";
+
+		string line;
+		ifstream file(countFilename.c_str());
+		bool isFound = false;
+		size_t lineIndex = 0;
+		while(getline(file, line)){
+			if(line == "") continue;
+			lineIndex += 1;
+			if(lineIndex <= 4) continue;
+
+			size_t pos = line.find(' ');
+			if(line.substr(0, pos) != countsId) continue;
+
+			char* str = (char*)line.c_str() + pos;
+			_nbSolidDistinctKmersPerBank[i] = strtoull(str, &str, 10);
+			_nbSolidKmersPerBank[i] = strtoull(str, &str, 10);
+			if(_computeSimpleDistances){
+				_chord_sqrt_N2[i] = sqrt(strtoull(str, &str, 10));
+			}
+			isFound = true;
+			break;
+		}
+		file.close();
+
+		if(!isFound){
+			cout << "Error: no kmer counts " << countsId << " in " << countFilename << endl;
+			exit(1);
+		}
+	}
+}
+
 
 SimkaStatistics& SimkaStatistics::operator+=  (const SimkaStatistics& other){
 
+	addKmerCounts(other);
 
+	size_t i, j;
+	for(u_int64_t pairId=0; pairId<other._pairCounts.size(); pairId++){
+		other.getPair(pairId, i, j);
+		addPair(i, j,
+			other._pairCounts[pairId],
+			other._computeSimpleDistances ? other._pairSimpleCounts[pairId] : _emptyPairSimpleCounts,
+			other._computeComplexDistances ? other._pairComplexCounts[pairId] : _emptyPairComplexCounts);
+	}
 
+	return *this;
+}
+
+void SimkaStatistics::addKmerCounts(const SimkaStatistics& other){
 
 	_nbKmers += other._nbKmers;
 	_nbDistinctKmers += other._nbDistinctKmers;
@@ -176,43 +184,90 @@ SimkaStatistics& SimkaStatistics::operator+=  (const SimkaStatistics& other){
 			//_chord_sqrt_N2[i] += other._chord_sqrt_N2[i];
 
 	}
+}
 
-	for(size_t i=0; i<_symetricDistanceMatrixSize; i++){
-		_brayCurtisNumerator[i] += other._brayCurtisNumerator[i];
-		_matrixNbDistinctSharedKmers[i] += other._matrixNbDistinctSharedKmers[i];
-	}
+void SimkaStatistics::addPair(size_t i, size_t j, const SimkaPairCounts& counts, const SimkaPairSimpleCounts& simpleCounts, const SimkaPairComplexCounts& complexCounts){
 
-	for(size_t i=0; i<_nbBanks; i++){
-		for(size_t j=0; j<_nbBanks; j++){
-			_matrixNbSharedKmers[i][j] += other._matrixNbSharedKmers[i][j];
-		}
-	}
+	if(_isSparse && counts.isEmpty() && simpleCounts.isEmpty() && complexCounts.isEmpty()) return;
+
+	u_int64_t pairId = getPairId(i, j);
 
+	SimkaPairCounts& pairCounts = _pairCounts[pairId];
+	pairCounts._nbDistinctSharedKmers += counts._nbDistinctSharedKmers;
+	pairCounts._nbSharedKmersI += counts._nbSharedKmersI;
+	pairCounts._nbSharedKmersJ += counts._nbSharedKmersJ;
+	pairCounts._brayCurtisNumerator += counts._brayCurtisNumerator;
 
 	if(_computeSimpleDistances){
-		for(size_t i=0; i<_nbBanks; i++){
-			for(size_t j=0; j<_nbBanks; j++){
-					_chord_NiNj[i][j] += other._chord_NiNj[i][j];
-					_hellinger_SqrtNiNj[i][j] += other._hellinger_SqrtNiNj[i][j];
-					_kulczynski_minNiNj[i][j] += other._kulczynski_minNiNj[i][j];
-			}
-		}
+		SimkaPairSimpleCounts& pairSimpleCounts = _pairSimpleCounts[pairId];
+		pairSimpleCounts._chord_NiNj += simpleCounts._chord_NiNj;
+		pairSimpleCounts._hellinger_SqrtNiNj += simpleCounts._hellinger_SqrtNiNj;
+		pairSimpleCounts._kulczynski_minNiNj += simpleCounts._kulczynski_minNiNj;
 	}
 
 	if(_computeComplexDistances){
-		for(size_t i=0; i<_nbBanks; i++){
-			for(size_t j=0; j<_nbBanks; j++){
-				_canberra[i][j] += other._canberra[i][j];
-				_whittaker_minNiNj[i][j] += other._whittaker_minNiNj[i][j];
-				_kullbackLeibler[i][j] += other._kullbackLeibler[i][j];
-			}
-		}
+		SimkaPairComplexCounts& pairComplexCounts = _pairComplexCounts[pairId];
+		pairComplexCounts._canberra += complexCounts._canberra;
+		pairComplexCounts._whittaker_minNiNj += complexCounts._whittaker_minNiNj;
+		pairComplexCounts._kullbackLeibler += complexCounts._kullbackLeibler;
 	}
+}
 
-	return *this;
+void SimkaStatistics::getPair(u_int64_t pairId, size_t& i, size_t& j) const {
+
+	if(_isSparse){
+		u_int64_t key = _pairIndex.getKey(pairId);
+		i = key / _nbBanks;
+		j = key % _nbBanks;
+		return;
+	}
+
+	if(!_tile.isDiagonal()){
+		i = _tile._rowStart + pairId / _tile.getNbCols();
+		j = _tile._colStart + pairId % _tile.getNbCols();
+		return;
+	}
+
+	//Inverse of getDensePairId: i is the last row starting at or before pairId
+	u_int64_t n = _tile.getNbRows();
+	i = (2*n - 1 - sqrtl((long double)(2*n-1)*(2*n-1) - 8*(long double)pairId)) / 2;
+	while(i > 0 && (u_int64_t)i*(2*n-i-1)/2 > pairId) i -= 1;
+	while((u_int64_t)(i+1)*(2*n-i-2)/2 <= pairId) i += 1;
+	j = pairId - (u_int64_t)i*(2*n-i-1)/2 + i + 1;
+
+	i += _tile._rowStart;
+	j += _tile._rowStart;
 }
 
-void SimkaStatistics::print(){
+u_int64_t SimkaStatistics::getPairSize(bool computeSimpleDistances, bool computeComplexDistances){
+
+	u_int64_t pairSize = sizeof(SimkaPairCounts);
+	if(computeSimpleDistances) pairSize += sizeof(SimkaPairSimpleCounts);
+	if(computeComplexDistances) pairSize += sizeof(SimkaPairComplexCounts);
+
+	return pairSize;
+}
+
+u_int64_t SimkaStatistics::getDenseMemoryMB(const SimkaTile& tile, bool computeSimpleDistances, bool computeComplexDistances){
+	return (tile.getNbPairs()*getPairSize(computeSimpleDistances, computeComplexDistances)) / MBYTE;
+}
+
+size_t SimkaStatistics::getTileSize(u_int64_t maxMemory, bool computeSimpleDistances, bool computeComplexDistances){
+
+	//A tile out of the diagonal holds tileSize x tileSize pairs
+	long double nbPairs = (long double)maxMemory * MBYTE / getPairSize(computeSimpleDistances, computeComplexDistances);
+	return max((size_t)sqrtl(nbPairs), (size_t)2);
+}
+
+void SimkaStatistics::clearPairs(){
+
+	vector<SimkaPairCounts>().swap(_pairCounts);
+	vector<SimkaPairSimpleCounts>().swap(_pairSimpleCounts);
+	vector<SimkaPairComplexCounts>().swap(_pairComplexCounts);
+	_pairIndex = SimkaPairIndex();
+}
+
+void SimkaStatistics::print(bool isTiled){
 
 	u_int64_t nbKmers = 0;
 	u_int64_t nbDistinctKmersAfterMerging = _nbDistinctKmers;
@@ -265,8 +320,10 @@ void SimkaStatistics::print(){
 	cout << "\t\tAverage:    " << meanReads << "    " << meanReads/1000000 << "M" << "    " << meanReads/1000000000 << "G" << endl;
 	cout << "\tKmers" << endl;
 	cout << "\t\tDistinct Kmers (before merging):    " << nbDistinctKmers << "    " << nbDistinctKmers/1000000 << "M" << "    " << nbDistinctKmers/1000000000 << "G" << endl;
-	cout << "\t\tDistinct Kmers (after merging):    " << nbDistinctKmersAfterMerging << "    " << nbDistinctKmersAfterMerging/1000000 << "M" << "    " << nbDistinctKmersAfterMerging/1000000000 << "G" << endl;
-	cout << "\t\tShared distinct Kmers:    " << nbSharedDistinctKmers << "    " << nbSharedDistinctKmers/1000000 << "M" << "    " << nbSharedDistinctKmers/1000000000 << "G" << endl;
+	if(!isTiled){
+		cout << "\t\tDistinct Kmers (after merging):    " << nbDistinctKmersAfterMerging << "    " << nbDistinctKmersAfterMerging/1000000 << "M" << "    " << nbDistinctKmersAfterMerging/1000000000 << "G" << endl;
+		cout << "\t\tShared distinct Kmers:    " << nbSharedDistinctKmers << "    " << nbSharedDistinctKmers/1000000 << "M" << "    " << nbSharedDistinctKmers/1000000000 << "G" << endl;
+	}
 	cout << "\t\tKmers:    " << nbKmers << "    " << nbKmers/1000000 << "M" << "    " << nbKmers/1000000000 << "G" << endl;
 	cout << "\t\tMean k-mer coverage: " << meanCoverage << endl;
 	//cout << "\t\tShared distinct kmers:    " << (int)((long double) nbSharedDistinctKmers / (long double)nbDistinctKmers * 100) << "%    " << nbSharedDistinctKmers << "    " << nbSharedDistinctKmers/1000000 << "M" << "    " << nbSharedDistinctKmers/1000000000 << "G" << endl;
@@ -341,7 +398,11 @@ void SimkaStatistics::print(){
    cout << endl << endl;
 }
 
-void SimkaStatistics::load(const string& filename){
+//The statistics of the file are added to the current ones (the per bank info are replaced).
+//Pairs are streamed from the file, so that a single pair matrix is in memory when summing the partitions.
+//The file may come from a previous run with less banks (incremental runs), its banks are the first ones.
+//The kmer counters are not added if loadKmerCounts is false (file already loaded for another block of rows).
+void SimkaStatistics::load(const string& filename, bool loadKmerCounts){
 
 
 	IterableGzFile<long double>* file = new IterableGzFile<long double>(filename);
@@ -349,53 +410,66 @@ void SimkaStatistics::load(const string& filename){
 	LOCAL(it);
 	it->first();
 
-	//_nbBanks = it->item(); it->next();
+	size_t nbBanks = it->item(); it->next();
+	if(nbBanks > _nbBanks){
+		cout << "Error: statistics of " << nbBanks << " datasets in " << filename << ", expected at most " << _nbBanks << endl;
+		exit(1);
+	}
+
 	_computeSimpleDistances = it->item(); it->next();
 	_computeComplexDistances = it->item(); it->next();
 	//cout << _computeSimpleDistances << "   " << _computeComplexDistances << endl;
-	_nbKmers = it->item(); it->next();
-	_nbErroneousKmers = it->item(); it->next();
-	_nbDistinctKmers = it->item(); it->next();
-	_nbSolidKmers = it->item(); it->next();
-	_nbSharedKmers = it->item(); it->next();
-
-    for(size_t i=0; i<_nbBanks; i++){ _nbSolidDistinctKmersPerBank[i] = it->item(); it->next();}
-    for(size_t i=0; i<_nbBanks; i++){ _nbKmersPerBank[i] = it->item(); it->next();}
-    for(size_t i=0; i<_nbBanks; i++){ _nbSolidKmersPerBank[i] = it->item(); it->next();}
+	long double kmerCounts[5];
+	for(size_t i=0; i<5; i++){ kmerCounts[i] = it->item(); it->next();}
+	if(loadKmerCounts){
+		_nbKmers += kmerCounts[0];
+		_nbErroneousKmers += kmerCounts[1];
+		_nbDistinctKmers += kmerCounts[2];
+		_nbSolidKmers += kmerCounts[3];
+		_nbSharedKmers += kmerCounts[4];
+	}
+
+    for(size_t i=0; i<nbBanks; i++){ it->next();}
+    for(size_t i=0; i<nbBanks; i++){ if(loadKmerCounts) _nbKmersPerBank[i] += it->item(); it->next();}
+    for(size_t i=0; i<nbBanks; i++){ it->next();}
     //for(size_t i=0; i<_nbBanks; i++){ _nbDistinctKmersSharedByBanksThreshold[i] = it->item(); it->next();}
     //for(size_t i=0; i<_nbBanks; i++){ _nbKmersSharedByBanksThreshold[i] = it->item(); it->next();}
 
+	if(_computeSimpleDistances){
+	    for(size_t i=0; i<nbBanks; i++){ it->next();}
+	}
 
-    for(size_t i=0; i<_nbBanks; i++){
-    	//cout << i << endl;
-    	//cout << _nbBanks << endl;
-    	//cout << _matrixNbDistinctSharedKmers[i].size() << endl;
-            for(size_t j=0; j<_nbBanks; j++){ _matrixNbSharedKmers[i][j] = it->item(); it->next();}
+	u_int64_t nbPairs = it->item(); it->next();
 
-            //for(size_t j=0; j<_nbBanks; j++){ _abundance_jaccard_intersection[i][j] = it->item(); it->next();}
-    }
+	SimkaPairCounts counts;
+	SimkaPairSimpleCounts simpleCounts;
+	SimkaPairComplexCounts complexCounts;
 
-    for(size_t i=0; i<_symetricDistanceMatrixSize; i++){
-        _matrixNbDistinctSharedKmers[i] = it->item(); it->next();
-        _brayCurtisNumerator[i] = it->item(); it->next();
-    }
+	for(u_int64_t pairId=0; pairId<nbPairs; pairId++){
 
-	if(_computeSimpleDistances){
-	    for(size_t i=0; i<_nbBanks; i++){ _chord_sqrt_N2[i] = it->item(); it->next();}
-	    for(size_t i=0; i<_nbBanks; i++){
-			for(size_t j=0; j<_nbBanks; j++){ _chord_NiNj[i][j] = it->item(); it->next();}
-			for(size_t j=0; j<_nbBanks; j++){ _hellinger_SqrtNiNj[i][j] = it->item(); it->next();}
-			for(size_t j=0; j<_nbBanks; j++){ _kulczynski_minNiNj[i][j] = it->item(); it->next();}
-	    }
-	}
+		size_t i = it->item(); it->next();
+		size_t j = it->item(); it->next();
 
+		counts._nbDistinctSharedKmers = it->item(); it->next();
+		counts._nbSharedKmersI = it->item(); it->next();
+		counts._nbSharedKmersJ = it->item(); it->next();
+		counts._brayCurtisNumerator = it->item(); it->next();
 
-	if(_computeComplexDistances){
-	    for(size_t i=0; i<_nbBanks; i++){
-			for(size_t j=0; j<_nbBanks; j++){ _canberra[i][j] = it->item(); it->next();}
-			for(size_t j=0; j<_nbBanks; j++){ _whittaker_minNiNj[i][j] = it->item(); it->next();}
-			for(size_t j=0; j<_nbBanks; j++){ _kullbackLeibler[i][j] = it->item(); it->next();}
-	    }
+		if(_computeSimpleDistances){
+			simpleCounts._chord_NiNj = it->item(); it->next();
+			simpleCounts._hellinger_SqrtNiNj = it->item(); it->next();
+			simpleCounts._kulczynski_minNiNj = it->item(); it->next();
+		}
+
+		if(_computeComplexDistances){
+			complexCounts._canberra = it->item(); it->next();
+			complexCounts._whittaker_minNiNj = it->item(); it->next();
+			complexCounts._kullbackLeibler = it->item(); it->next();
+		}
+
+		if((i >= _blockStart && i < _blockEnd) || (j >= _blockStart && j < _blockEnd)){
+			addPair(i, j, counts, simpleCounts, complexCounts);
+		}
 	}
 
 	delete file;
@@ -458,7 +532,7 @@ void SimkaStatistics::save (const string& filename){
 	BagGzFile<long double>* file = new BagGzFile<long double>(filename);
 
 
-	//file->insert(_nbBanks);
+	file->insert((long double)_nbBanks);
 	file->insert((long double)_computeSimpleDistances);
 	file->insert((long double)_computeComplexDistances);
 	file->insert((long double)_nbKmers);
@@ -474,37 +548,51 @@ void SimkaStatistics::save (const string& filename){
     //for(size_t i=0; i<_nbBanks; i++){ file->insert((long double)_nbKmersSharedByBanksThreshold[i]);}
 
 
-    for(size_t i=0; i<_nbBanks; i++){
-    	//cout << i << endl;
-    	//cout << _nbBanks << endl;
-    	//cout << _matrixNbDistinctSharedKmers[i].size() << endl;
-            for(size_t j=0; j<_nbBanks; j++){ file->insert((long double)_matrixNbSharedKmers[i][j]);}
+	if(_computeSimpleDistances){
+	    for(size_t i=0; i<_nbBanks; i++){ file->insert((long double)_chord_sqrt_N2[i]);}
+	}
 
-            //for(size_t j=0; j<_nbBanks; j++){ file->insert((long double)_abundance_jaccard_intersection[i][j]);}
-    }
+	//Only the pairs that have statistics are written
+	vector<bool> isPairEmpty(_pairCounts.size(), false);
+	u_int64_t nbPairs = 0;
 
+	for(u_int64_t pairId=0; pairId<_pairCounts.size(); pairId++){
+		isPairEmpty[pairId] = _pairCounts[pairId].isEmpty() &&
+			(!_computeSimpleDistances || _pairSimpleCounts[pairId].isEmpty()) &&
+			(!_computeComplexDistances || _pairComplexCounts[pairId].isEmpty());
+		if(!isPairEmpty[pairId]) nbPairs += 1;
+	}
 
-    for(size_t i=0; i<_symetricDistanceMatrixSize; i++){
-        file->insert((long double)_matrixNbDistinctSharedKmers[i]);
-    	file->insert((long double)_brayCurtisNumerator[i]);
-    }
+	file->insert((long double)nbPairs);
 
-	if(_computeSimpleDistances){
-	    for(size_t i=0; i<_nbBanks; i++){ file->insert((long double)_chord_sqrt_N2[i]);}
-	    for(size_t i=0; i<_nbBanks; i++){
-			for(size_t j=0; j<_nbBanks; j++){ file->insert((long double)_chord_NiNj[i][j]);}
-			for(size_t j=0; j<_nbBanks; j++){ file->insert((long double)_hellinger_SqrtNiNj[i][j]);}
-			for(size_t j=0; j<_nbBanks; j++){ file->insert((long double)_kulczynski_minNiNj[i][j]);}
-	    }
-	}
+	size_t i, j;
+	for(u_int64_t pairId=0; pairId<_pairCounts.size(); pairId++){
 
+		if(isPairEmpty[pairId]) continue;
 
-	if(_computeComplexDistances){
-	    for(size_t i=0; i<_nbBanks; i++){
-			for(size_t j=0; j<_nbBanks; j++){ file->insert((long double)_canberra[i][j]);}
-			for(size_t j=0; j<_nbBanks; j++){ file->insert((long double)_whittaker_minNiNj[i][j]);}
-			for(size_t j=0; j<_nbBanks; j++){ file->insert((long double)_kullbackLeibler[i][j]);}
-	    }
+		getPair(pairId, i, j);
+		file->insert((long double)i);
+		file->insert((long double)j);
+
+		const SimkaPairCounts& counts = _pairCounts[pairId];
+		file->insert((long double)counts._nbDistinctSharedKmers);
+		file->insert((long double)counts._nbSharedKmersI);
+		file->insert((long double)counts._nbSharedKmersJ);
+		file->insert((long double)counts._brayCurtisNumerator);
+
+		if(_computeSimpleDistances){
+			const SimkaPairSimpleCounts& simpleCounts = _pairSimpleCounts[pairId];
+			file->insert((long double)simpleCounts._chord_NiNj);
+			file->insert((long double)simpleCounts._hellinger_SqrtNiNj);
+			file->insert((long double)simpleCounts._kulczynski_minNiNj);
+		}
+
+		if(_computeComplexDistances){
+			const SimkaPairComplexCounts& complexCounts = _pairComplexCounts[pairId];
+			file->insert((long double)complexCounts._canberra);
+			file->insert((long double)complexCounts._whittaker_minNiNj);
+			file->insert((long double)complexCounts._kullbackLeibler);
+		}
 	}
 	/*
 	file->insert(_nbKmersPerBank, 0);
@@ -600,119 +688,332 @@ void SimkaStatistics::save (const string& filename){
     os.flush();*/
 }
 
-void SimkaStatistics::outputMatrix(const string& outputDir, const vector<string>& bankNames){
+void SimkaStatistics::outputMatrix(const string& outputDir, const vector<string>& bankNames, size_t nbNeighbors, double maxDistance){
 
+	_outputFilenameSuffix = "";
 
-	SimkaDistance _simkaDistance(*this);
+	SimkaMatrixOutput output(outputDir, bankNames, _computeSimpleDistances, _computeComplexDistances, 0, _nbBanks, nbNeighbors, maxDistance);
+	output.writeRows(*this, 0, _nbBanks);
+}
 
-	_outputFilenameSuffix = "";
 
-	char buffer[200];
+
+SimkaMatrixOutput::SimkaMatrixOutput(const string& outputDir, const vector<string>& bankNames, bool computeSimpleDistances, bool computeComplexDistances,
+		size_t colStart, size_t colEnd, size_t nbNeighbors, double maxDistance){
 
 	//string strKmerSize = "_k";
 	//snprintf(buffer,200,"%llu",_kmerSize);
 	//strKmerSize += string(buffer);
 	//_outputFilenameSuffix += strKmerSize;
 
-	dumpMatrix(outputDir, bankNames, "mat_presenceAbsence_chord", _simkaDistance._matrix_presenceAbsence_chordHellinger());
-	dumpMatrix(outputDir, bankNames, "mat_presenceAbsence_whittaker", _simkaDistance._matrix_presenceAbsence_Whittaker());
-	dumpMatrix(outputDir, bankNames, "mat_presenceAbsence_kulczynski", _simkaDistance._matrix_presenceAbsence_kulczynski());
-	dumpMatrix(outputDir, bankNames, "mat_presenceAbsence_braycurtis", _simkaDistance._matrix_presenceAbsence_sorensenBrayCurtis());
-	dumpMatrix(outputDir, bankNames, "mat_presenceAbsence_jaccard", _simkaDistance._matrix_presenceAbsence_jaccardCanberra());
-	dumpMatrix(outputDir, bankNames, "mat_presenceAbsence_simka-jaccard", _simkaDistance._matrix_presenceAbsence_jaccard_simka());
-	dumpMatrix(outputDir, bankNames, "mat_presenceAbsence_simka-jaccard_asym", _simkaDistance._matrix_presenceAbsence_jaccard_simka_asym());
-	dumpMatrix(outputDir, bankNames, "mat_presenceAbsence_ochiai", _simkaDistance._matrix_presenceAbsence_ochiai());
+	vector<string> outputFilenames;
 
+	outputFilenames.push_back("mat_presenceAbsence_chord"); _rowFunctions.push_back(&SimkaDistance::_matrix_presenceAbsence_chordHellinger);
+	outputFilenames.push_back("mat_presenceAbsence_whittaker"); _rowFunctions.push_back(&SimkaDistance::_matrix_presenceAbsence_Whittaker);
+	outputFilenames.push_back("mat_presenceAbsence_kulczynski"); _rowFunctions.push_back(&SimkaDistance::_matrix_presenceAbsence_kulczynski);
+	outputFilenames.push_back("mat_presenceAbsence_braycurtis"); _rowFunctions.push_back(&SimkaDistance::_matrix_presenceAbsence_sorensenBrayCurtis);
+	outputFilenames.push_back("mat_presenceAbsence_jaccard"); _rowFunctions.push_back(&SimkaDistance::_matrix_presenceAbsence_jaccardCanberra);
+	outputFilenames.push_back("mat_presenceAbsence_simka-jaccard"); _rowFunctions.push_back(&SimkaDistance::_matrix_presenceAbsence_jaccard_simka);
+	outputFilenames.push_back("mat_presenceAbsence_simka-jaccard_asym"); _rowFunctions.push_back(&SimkaDistance::_matrix_presenceAbsence_jaccard_simka_asym);
+	outputFilenames.push_back("mat_presenceAbsence_ochiai"); _rowFunctions.push_back(&SimkaDistance::_matrix_presenceAbsence_ochiai);
 
-	dumpMatrix(outputDir, bankNames, "mat_abundance_simka-jaccard", _simkaDistance._matrixSymJaccardAbundance());
-	dumpMatrix(outputDir, bankNames, "mat_abundance_simka-jaccard_asym", _simkaDistance._matrixAsymJaccardAbundance());
-	dumpMatrix(outputDir, bankNames, "mat_abundance_ab-ochiai", _simkaDistance._matrixOchiai());
-	dumpMatrix(outputDir, bankNames, "mat_abundance_ab-sorensen", _simkaDistance._matrixSorensen());
-	dumpMatrix(outputDir, bankNames, "mat_abundance_ab-jaccard", _simkaDistance._matrixJaccardAbundance());
 
-	const vector<vector<float> >& matrix = _simkaDistance._matrixBrayCurtis();
-	dumpMatrix(outputDir, bankNames, "mat_abundance_braycurtis", matrix);
-	dumpMatrix(outputDir, bankNames, "mat_abundance_jaccard", _simkaDistance.computeJaccardDistanceFromBrayCurtis(matrix));
+	outputFilenames.push_back("mat_abundance_simka-jaccard"); _rowFunctions.push_back(&SimkaDistance::_matrixSymJaccardAbundance);
+	outputFilenames.push_back("mat_abundance_simka-jaccard_asym"); _rowFunctions.push_back(&SimkaDistance::_matrixAsymJaccardAbundance);
+	outputFilenames.push_back("mat_abundance_ab-ochiai"); _rowFunctions.push_back(&SimkaDistance::_matrixOchiai);
+	outputFilenames.push_back("mat_abundance_ab-sorensen"); _rowFunctions.push_back(&SimkaDistance::_matrixSorensen);
+	outputFilenames.push_back("mat_abundance_ab-jaccard"); _rowFunctions.push_back(&SimkaDistance::_matrixJaccardAbundance);
 
-	if(_computeSimpleDistances){
-		//dumpMatrix(outputDir, bankNames, "mat_abundance_braycurtis-simple", _simkaDistance._matrixJaccardIntersection);
-		dumpMatrix(outputDir, bankNames, "mat_abundance_chord", _simkaDistance._matrixChord());
-		dumpMatrix(outputDir, bankNames, "mat_abundance_hellinger", _simkaDistance._matrixHellinger());
-		dumpMatrix(outputDir, bankNames, "mat_abundance_kulczynski", _simkaDistance._matrixKulczynski());
+	outputFilenames.push_back("mat_abundance_braycurtis"); _rowFunctions.push_back(&SimkaDistance::_matrixBrayCurtis);
+	outputFilenames.push_back("mat_abundance_jaccard"); _rowFunctions.push_back(&SimkaDistance::computeJaccardDistanceFromBrayCurtis);
+
+	if(computeSimpleDistances){
+		//outputFilenames.push_back("mat_abundance_braycurtis-simple"); _rowFunctions.push_back(&SimkaDistance::_matrixJaccardIntersection);
+		outputFilenames.push_back("mat_abundance_chord"); _rowFunctions.push_back(&SimkaDistance::_matrixChord);
+		outputFilenames.push_back("mat_abundance_hellinger"); _rowFunctions.push_back(&SimkaDistance::_matrixHellinger);
+		outputFilenames.push_back("mat_abundance_kulczynski"); _rowFunctions.push_back(&SimkaDistance::_matrixKulczynski);
 	}
 
-	if(_computeComplexDistances){
-		dumpMatrix(outputDir, bankNames, "mat_abundance_whittaker", _simkaDistance._matrixWhittaker());
-		dumpMatrix(outputDir, bankNames, "mat_abundance_jensenshannon", _simkaDistance._matrixKullbackLeibler());
-		dumpMatrix(outputDir, bankNames, "mat_abundance_canberra", _simkaDistance._matrixCanberra());
+	if(computeComplexDistances){
+		outputFilenames.push_back("mat_abundance_whittaker"); _rowFunctions.push_back(&SimkaDistance::_matrixWhittaker);
+		outputFilenames.push_back("mat_abundance_jensenshannon"); _rowFunctions.push_back(&SimkaDistance::_matrixKullbackLeibler);
+		outputFilenames.push_back("mat_abundance_canberra"); _rowFunctions.push_back(&SimkaDistance::_matrixCanberra);
+	}
+
+	//All the matrices are written row by row, only one row per matrix is in memory
+	bool isEdgeList = nbNeighbors > 0 || maxDistance >= 0;
+	for(size_t m=0; m<outputFilenames.size(); m++){
+		if(isEdgeList){
+			string outputFilename = "edges_" + outputFilenames[m].substr(4); //mat_<distance> -> edges_<distance>
+			_edgeWriters.push_back(new SimkaEdgeListWriter(outputDir, outputFilename, bankNames, colStart, min(colEnd, bankNames.size()), nbNeighbors, maxDistance));
+		}
+		else{
+			_writers.push_back(new SimkaMatrixWriter(outputDir, outputFilenames[m], bankNames, colStart, min(colEnd, bankNames.size())));
+		}
+	}
+
+	_row.resize(bankNames.size(), 0);
+}
+
+SimkaMatrixOutput::~SimkaMatrixOutput(){
+	for(size_t m=0; m<_writers.size(); m++){
+		delete _writers[m];
+	}
+	for(size_t m=0; m<_edgeWriters.size(); m++){
+		delete _edgeWriters[m];
 	}
 }
 
+void SimkaMatrixOutput::writeRows(SimkaStatistics& stats, size_t rowStart, size_t rowEnd){
 
+	SimkaDistance simkaDistance(stats);
 
-void SimkaStatistics::dumpMatrix(const string& outputDir, const vector<string>& bankNames, const string& outputFilename, const vector<vector<float> >& matrix){
+	for(size_t i=rowStart; i<rowEnd; i++){
 
+		simkaDistance.setRow(i);
+
+		for(size_t m=0; m<_rowFunctions.size(); m++){
+			(simkaDistance.*_rowFunctions[m])(_row);
+			if(_edgeWriters.empty())
+				_writers[m]->writeRow(i, _row);
+			else
+				_edgeWriters[m]->writeRow(i, _row);
+		}
+	}
+}
+
+
+
+SimkaMatrixWriter::SimkaMatrixWriter(const string& outputDir, const string& outputFilename, const vector<string>& bankNames, size_t colStart, size_t colEnd) :
+_bankNames(bankNames), _colStart(colStart), _colEnd(colEnd)
+{
 
 	string filename = outputDir + "/" + outputFilename + ".csv";
-	gzFile out = gzopen((filename + ".gz").c_str(),"wb");
+	_out = gzopen((filename + ".gz").c_str(),"wb");
 
-	//char buffer[200];
 	string str;
 
-	for(size_t i=0; i<matrix.size(); i++){
-		str += ";" + bankNames[i];
+	for(size_t i=_colStart; i<_colEnd; i++){
+		str += ";" + _bankNames[i];
 		//str += ";" + datasetInfos[i]._name;
 	}
 	str += '\n';
-	gzwrite(out, str.c_str(), str.size());
+	gzwrite(_out, str.c_str(), str.size());
+}
+
+SimkaMatrixWriter::~SimkaMatrixWriter(){
+	gzclose(_out);
+}
+
+void SimkaMatrixWriter::writeRow(size_t i, const vector<float>& row){
+
+	string str = "";
+	str += _bankNames[i];
+	//str += datasetInfos[i]._name + ";";
+	for(size_t j=_colStart; j<_colEnd; j++){
+
+		str += ";" + Stringify::format("%f", row[j]);
+		//snprintf(buffer,200,"%.2f", matrix[i][j]);
+		//snprintf(buffer,200,"%f", matrix[i][j]);
+		//str += string(buffer) + ";";
+
+		//str += to_string(matrix[i][j]) + ";";
+	}
+
+	//matrixNormalizedStr.erase(matrixNormalizedStr.end()-1);
+	//str.erase(str.size()-1);
+	//str.pop_back(); //remove ; at the end of the line
+	str += '\n';
+
+	gzwrite(_out, str.c_str(), str.size());
+}
+
+
+
+SimkaEdgeListWriter::SimkaEdgeListWriter(const string& outputDir, const string& outputFilename, const vector<string>& bankNames, size_t colStart, size_t colEnd, size_t nbNeighbors, double maxDistance) :
+_bankNames(bankNames), _colStart(colStart), _colEnd(colEnd), _nbNeighbors(nbNeighbors), _maxDistance(maxDistance)
+{
+	string filename = outputDir + "/" + outputFilename + ".csv";
+	_out = gzopen((filename + ".gz").c_str(),"wb");
+
+	string str = "bank;neighbor;distance\n";
+	gzwrite(_out, str.c_str(), str.size());
+}
 
-	for(size_t i=0; i<matrix.size(); i++){
+SimkaEdgeListWriter::~SimkaEdgeListWriter(){
+	gzclose(_out);
+}
+
+void SimkaEdgeListWriter::writeRow(size_t i, const vector<float>& row){
+
+	_heap.clear();
+
+	for(size_t j=_colStart; j<_colEnd; j++){
 
-		str = "";
-		str += bankNames[i];
-		//str += datasetInfos[i]._name + ";";
-		for(size_t j=0; j<matrix.size(); j++){
+		if(j == i) continue;
 
-			str += ";" + Stringify::format("%f", matrix[i][j]);
-			//snprintf(buffer,200,"%.2f", matrix[i][j]);
-			//snprintf(buffer,200,"%f", matrix[i][j]);
-			//str += string(buffer) + ";";
+		float distance = row[j];
+		if(_maxDistance >= 0 && distance > _maxDistance) continue;
 
-			//str += to_string(matrix[i][j]) + ";";
+		if(_nbNeighbors == 0 || _heap.size() < _nbNeighbors){
+			_heap.push_back(pair<float, size_t>(distance, j));
+			push_heap(_heap.begin(), _heap.end());
 		}
+		else if(pair<float, size_t>(distance, j) < _heap.front()){
+			pop_heap(_heap.begin(), _heap.end());
+			_heap.back() = pair<float, size_t>(distance, j);
+			push_heap(_heap.begin(), _heap.end());
+		}
+	}
+
+	//Closest neighbors first, ties by bank index
+	sort_heap(_heap.begin(), _heap.end());
+
+	string str = "";
+	for(size_t n=0; n<_heap.size(); n++){
+		str += _bankNames[i] + ";" + _bankNames[_heap[n].second] + ";" + Stringify::format("%f", _heap[n].first) + "\n";
+	}
+
+	gzwrite(_out, str.c_str(), str.size());
+}
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
 
-		//matrixNormalizedStr.erase(matrixNormalizedStr.end()-1);
-		//str.erase(str.size()-1);
-		//str.pop_back(); //remove ; at the end of the line
-		str += '\n';
 
-		gzwrite(out, str.c_str(), str.size());
+
+SimkaMatrixReader::SimkaMatrixReader(const string& filename){
+
+	_in = gzopen(filename.c_str(), "rb");
+	if(_in == 0) return;
+
+	//Header: ;name1;name2...
+	readLine();
+	size_t pos = _line.find(';');
+	while(pos != string::npos){
+		size_t next = _line.find(';', pos + 1);
+		_bankNames.push_back(_line.substr(pos + 1, (next == string::npos ? _line.size() : next) - pos - 1));
+		pos = next;
 	}
+}
+
+SimkaMatrixReader::~SimkaMatrixReader(){
+	if(_in != 0) gzclose(_in);
+}
+
+bool SimkaMatrixReader::readLine(){
 
-	gzclose(out);
+	char buffer[4096];
+	_line.clear();
 
-	//gatb::core::system::IFile* file = gatb::core::system::impl::System::file().newFile(outputDir + "/" + outputFilename + _outputFilenameSuffix + ".csv", "wb");
-	//file->fwrite(str.c_str(), str.size(), 1);
-	//file->flush();
-	//delete file;
+	while(gzgets(_in, buffer, sizeof(buffer)) != 0){
+		_line += buffer;
+		if(_line[_line.size()-1] == '\n') break;
+	}
+	if(!_line.empty() && _line[_line.size()-1] == '\n') _line.erase(_line.size()-1);
 
+	return !_line.empty();
 }
 
+bool SimkaMatrixReader::readRow(string& name, vector<float>& row){
 
+	row.clear();
+	if(!readLine()) return false;
 
+	size_t pos = _line.find(';');
+	name = _line.substr(0, pos);
+	while(pos != string::npos){
+		row.push_back(atof(_line.c_str() + pos + 1));
+		pos = _line.find(';', pos + 1);
+	}
 
+	return true;
+}
 
+void SimkaMatrixIntervals::write(const string& runDir, const vector<string>& replicateDirs, const string& outputDir, const string& outputFilename, const vector<string>& bankNames, double confidence){
 
+	size_t nbReplicates = replicateDirs.size();
+	size_t nbBanks = bankNames.size();
 
+	SimkaMatrixReader runReader(runDir + "/" + outputFilename + ".csv.gz");
+	if(!runReader.isOpen()){
+		cout << "Error: can't open the matrix of the run " << runDir << "/" << outputFilename << ".csv.gz" << endl;
+		exit(1);
+	}
 
+	vector<SimkaMatrixReader*> readers(nbReplicates);
+	for(size_t r=0; r<nbReplicates; r++){
+		string filename = replicateDirs[r] + "/" + outputFilename + ".csv.gz";
+		readers[r] = new SimkaMatrixReader(filename);
+		if(!readers[r]->isOpen()){
+			cout << "Error: can't open the matrix of replicate " << filename << endl;
+			exit(1);
+		}
+	}
 
+	SimkaMatrixWriter lowWriter(outputDir, outputFilename + "_low", bankNames, 0, nbBanks);
+	SimkaMatrixWriter highWriter(outputDir, outputFilename + "_high", bankNames, 0, nbBanks);
 
+	size_t lowIndex = (size_t)floor((1 - confidence) / 2 * (nbReplicates - 1));
+	size_t highIndex = (size_t)ceil((1 + confidence) / 2 * (nbReplicates - 1));
 
+	string name;
+	vector<float> runRow;
+	vector<vector<float> > rows(nbReplicates);
+	vector<float> values(nbReplicates);
+	vector<float> lowRow(nbBanks);
+	vector<float> highRow(nbBanks);
 
+	for(size_t i=0; i<nbBanks; i++){
 
+		if(!runReader.readRow(name, runRow) || runRow.size() != nbBanks){
+			cout << "Error: wrong row " << i << " in the matrix " << outputFilename << " of " << runDir << endl;
+			exit(1);
+		}
 
+		for(size_t r=0; r<nbReplicates; r++){
+			if(!readers[r]->readRow(name, rows[r]) || rows[r].size() != nbBanks){
+				cout << "Error: wrong row " << i << " in the matrix " << outputFilename << " of " << replicateDirs[r] << endl;
+				exit(1);
+			}
+		}
 
+		for(size_t j=0; j<nbBanks; j++){
 
+			double mean = 0;
+			for(size_t r=0; r<nbReplicates; r++){
+				values[r] = rows[r][j];
+				mean += values[r];
+			}
+			mean /= nbReplicates;
+
+			//The spread of the replicates around their mean is kept, the interval always holds the distance of the run
+			double shift = runRow[j] - mean;
+			std::nth_element(values.begin(), values.begin() + lowIndex, values.end());
+			lowRow[j] = max(0.0, min((double)runRow[j], values[lowIndex] + shift));
+			std::nth_element(values.begin(), values.begin() + highIndex, values.end());
+			highRow[j] = max((double)runRow[j], values[highIndex] + shift);
+		}
+
+		lowWriter.writeRow(i, lowRow);
+		highWriter.writeRow(i, highRow);
+	}
+
+	for(size_t r=0; r<nbReplicates; r++) delete readers[r];
+}
 
 
 
@@ -721,6 +1022,11 @@ SimkaDistance::SimkaDistance(SimkaStatistics& stats) : _stats(stats){
 
 	_nbBanks = _stats._nbBanks;
 
+	_i = 0;
+	_rowCounts.resize(_nbBanks, &_stats._emptyPairCounts);
+	_rowSimpleCounts.resize(_nbBanks, &_stats._emptyPairSimpleCounts);
+	_rowComplexCounts.resize(_nbBanks, &_stats._emptyPairComplexCounts);
+
 
 	//AnB is symetrical
 	//for(size_t i=0; i<_nbBanks; i++)
@@ -905,33 +1211,43 @@ SimkaDistance::SimkaDistance(SimkaStatistics& stats) : _stats(stats){
 
 
 
-vector<vector<float> > SimkaDistance::createSquaredMatrix(size_t n){
-    vector<vector<float> > matrix;
+void SimkaDistance::setRow(size_t i){
+
+	_i = i;
 
-    matrix.resize(n);
-    for(size_t i=0; i<n; i++)
-    	matrix[i].resize(n, 0);
+	for(size_t j=0; j<_nbBanks; j++){
 
-    return matrix;
+		_rowCounts[j] = &_stats._emptyPairCounts;
+		_rowSimpleCounts[j] = &_stats._emptyPairSimpleCounts;
+		_rowComplexCounts[j] = &_stats._emptyPairComplexCounts;
 
+		if(i == j) continue;
+
+		u_int64_t pairId = _stats.findPairId(min(i, j), max(i, j));
+		if(pairId >= _stats._pairCounts.size()) continue;
+
+		_rowCounts[j] = &_stats._pairCounts[pairId];
+		if(_stats._computeSimpleDistances) _rowSimpleCounts[j] = &_stats._pairSimpleCounts[pairId];
+		if(_stats._computeComplexDistances) _rowComplexCounts[j] = &_stats._pairComplexCounts[pairId];
+	}
 }
 
 
-void SimkaDistance::get_abc(size_t i, size_t j, size_t symetricIndex, u_int64_t& a, u_int64_t& b, u_int64_t& c){
+void SimkaDistance::get_abc(size_t i, size_t j, const SimkaPairCounts& counts, u_int64_t& a, u_int64_t& b, u_int64_t& c){
 
-	a = _stats._matrixNbDistinctSharedKmers[symetricIndex];
+	a = counts._nbDistinctSharedKmers;
 	b = (_stats._nbSolidDistinctKmersPerBank[i] - a);
 	c = (_stats._nbSolidDistinctKmersPerBank[j] - a);
 
 }
 
-double SimkaDistance::distance_abundance_brayCurtis(size_t i, size_t j, size_t symetricIndex){
+double SimkaDistance::distance_abundance_brayCurtis(size_t i, size_t j, const SimkaPairCounts& counts){
 
 	//double intersection = _stats._abundance_jaccard_intersection[i][j];
 	double union_ = _stats._nbSolidKmersPerBank[i] + _stats._nbSolidKmersPerBank[j];
 	if(union_ == 0) return 1;
 
-	double intersection = 2 * _stats._brayCurtisNumerator[symetricIndex];
+	double intersection = 2 * counts._brayCurtisNumerator;
 
 	double jaccard = 1 - intersection / union_;
 
@@ -939,12 +1255,12 @@ double SimkaDistance::distance_abundance_brayCurtis(size_t i, size_t j, size_t s
 }
 
 //Abundance Chord
-double SimkaDistance::distance_abundance_chord(size_t i, size_t j){
+double SimkaDistance::distance_abundance_chord(size_t i, size_t j, const SimkaPairSimpleCounts& counts){
 
 	double den = _stats._chord_sqrt_N2[i]*_stats._chord_sqrt_N2[j];
 	if(den == 0) return sqrt(2);
 
-	long double chordDistance =  sqrtl(2 - 2*_stats._chord_NiNj[i][j] / den);
+	long double chordDistance =  sqrtl(2 - 2*counts._chord_NiNj / den);
 	/*
 	long double intersection = 2*_stats._chord_NiNj[i][j];
 	if(intersection == 0) return sqrt(2);
@@ -959,12 +1275,12 @@ double SimkaDistance::distance_abundance_chord(size_t i, size_t j){
 }
 
 //Abundance Hellinger
-double SimkaDistance::distance_abundance_hellinger(size_t i, size_t j){
+double SimkaDistance::distance_abundance_hellinger(size_t i, size_t j, const SimkaPairSimpleCounts& counts){
 
 	double union_ = sqrt(_stats._nbSolidKmersPerBank[i]) * sqrt(_stats._nbSolidKmersPerBank[j]);
 	if(union_ == 0) return sqrt(2);
 
-	double intersection = 2*_stats._hellinger_SqrtNiNj[i][j];
+	double intersection = 2*counts._hellinger_SqrtNiNj;
 
 	double hellingerDistance = sqrt(2 - (intersection / union_));
 
@@ -985,12 +1301,12 @@ double SimkaDistance::distance_abundance_hellinger(size_t i, size_t j){
 //}
 
 //Abundance Whittaker
-double SimkaDistance::distance_abundance_whittaker(size_t i, size_t j){
+double SimkaDistance::distance_abundance_whittaker(size_t i, size_t j, const SimkaPairComplexCounts& counts){
 
 	long double union_ = _stats._nbSolidKmersPerBank[i] * _stats._nbSolidKmersPerBank[j];
 	if(union_ == 0) return 1;
 
-	long double intersection = _stats._whittaker_minNiNj[i][j];
+	long double intersection = counts._whittaker_minNiNj;
 
 	double whittakerDistance = 0.5 * (intersection / union_);
 
@@ -998,16 +1314,16 @@ double SimkaDistance::distance_abundance_whittaker(size_t i, size_t j){
 }
 
 //Abundance Kullback Leibler
-double SimkaDistance::distance_abundance_kullbackLeibler(size_t i, size_t j){
+double SimkaDistance::distance_abundance_kullbackLeibler(size_t i, size_t j, const SimkaPairComplexCounts& counts){
 
-	if(_stats._kullbackLeibler[i][j] == 0) return 1;
+	if(counts._kullbackLeibler == 0) return 1;
 
-	return sqrt(0.5 * _stats._kullbackLeibler[i][j]);
+	return sqrt(0.5 * counts._kullbackLeibler);
 	//return _stats._kullbackLeibler[i][j];
 }
 
 //Abundance Canberra
-double SimkaDistance::distance_abundance_canberra(size_t i, size_t j, u_int64_t& ua, u_int64_t& ub, u_int64_t& uc){
+double SimkaDistance::distance_abundance_canberra(size_t i, size_t j, const SimkaPairComplexCounts& counts, u_int64_t& ua, u_int64_t& ub, u_int64_t& uc){
 
 	double a = (double) ua;
 	double b = (double) ub;
@@ -1015,18 +1331,19 @@ double SimkaDistance::distance_abundance_canberra(size_t i, size_t j, u_int64_t&
 
 	if((a+b+c) == 0) return 1;
 
-	double canberraDistance = (1 / (a+b+c)) * _stats._canberra[i][j];
+	double canberraDistance = (1 / (a+b+c)) * counts._canberra;
 
 	return canberraDistance;
 }
 
 //Abundance Kulczynski
-double SimkaDistance::distance_abundance_kulczynski(size_t i, size_t j){
+double SimkaDistance::distance_abundance_kulczynski(size_t i, size_t j, const SimkaPairSimpleCounts& counts){
 
 	if(_stats._nbSolidKmersPerBank[i] == 0 || _stats._nbSolidKmersPerBank[j] == 0) return 1;
 
-	long double n1 = (double) _stats._kulczynski_minNiNj[i][j] / (double) _stats._nbSolidKmersPerBank[i];
-	long double n2 = (double) _stats._kulczynski_minNiNj[j][i] / (double) _stats._nbSolidKmersPerBank[j];
+	//min(Ni, Nj) is only accumulated for i<j, the (j, i) term has always been 0
+	long double n1 = (double) counts._kulczynski_minNiNj / (double) _stats._nbSolidKmersPerBank[i];
+	long double n2 = 0;
 
 	//long double numerator = (_stats._nbSolidKmersPerBank[i] + _stats._nbSolidKmersPerBank[j]) * _stats._kulczynski_minNiNj[i][j];
 	//long double denominator = _stats._nbSolidKmersPerBank[i] * _stats._nbSolidKmersPerBank[j];
@@ -1038,13 +1355,13 @@ double SimkaDistance::distance_abundance_kulczynski(size_t i, size_t j){
 }
 
 //abundance jaccard simka
-double SimkaDistance::distance_abundance_jaccard_simka(size_t i, size_t j, SIMKA_MATRIX_TYPE type){
+double SimkaDistance::distance_abundance_jaccard_simka(size_t i, size_t j, const SimkaPairCounts& counts, SIMKA_MATRIX_TYPE type){
 
 	double numerator = 0;
 	double denominator = 0;
 
-	double A1 = _stats._matrixNbSharedKmers[i][j];
-	double B1 = _stats._matrixNbSharedKmers[j][i];
+	double A1 = getNbSharedKmers(i, j, counts);
+	double B1 = getNbSharedKmers(j, i, counts);
 	double A0 = _stats._nbSolidKmersPerBank[i];
 	double B0 = _stats._nbSolidKmersPerBank[j];
 
@@ -1065,10 +1382,10 @@ double SimkaDistance::distance_abundance_jaccard_simka(size_t i, size_t j, SIMKA
 }
 
 //abundance Ochiai
-double SimkaDistance::distance_abundance_ochiai(size_t i, size_t j){
+double SimkaDistance::distance_abundance_ochiai(size_t i, size_t j, const SimkaPairCounts& counts){
 
-	double A1 = _stats._matrixNbSharedKmers[i][j];
-	double B1 = _stats._matrixNbSharedKmers[j][i];
+	double A1 = getNbSharedKmers(i, j, counts);
+	double B1 = getNbSharedKmers(j, i, counts);
 	double A0 = _stats._nbSolidKmersPerBank[i];
 	double B0 = _stats._nbSolidKmersPerBank[j];
 
@@ -1078,13 +1395,13 @@ double SimkaDistance::distance_abundance_ochiai(size_t i, size_t j){
 }
 
 //abundance Sorensen
-double SimkaDistance::distance_abundance_sorensen(size_t i, size_t j){
+double SimkaDistance::distance_abundance_sorensen(size_t i, size_t j, const SimkaPairCounts& counts){
 
 	double numerator = 0;
 	double denominator = 0;
 
-	double A1 = _stats._matrixNbSharedKmers[i][j];
-	double B1 = _stats._matrixNbSharedKmers[j][i];
+	double A1 = getNbSharedKmers(i, j, counts);
+	double B1 = getNbSharedKmers(j, i, counts);
 	double A0 = _stats._nbSolidKmersPerBank[i];
 	double B0 = _stats._nbSolidKmersPerBank[j];
 
@@ -1096,13 +1413,13 @@ double SimkaDistance::distance_abundance_sorensen(size_t i, size_t j){
 }
 
 //abundance jaccard
-double SimkaDistance::distance_abundance_jaccard(size_t i, size_t j){
+double SimkaDistance::distance_abundance_jaccard(size_t i, size_t j, const SimkaPairCounts& counts){
 
 	double numerator = 0;
 	double denominator = 0;
 
-	double A1 = _stats._matrixNbSharedKmers[i][j];
-	double B1 = _stats._matrixNbSharedKmers[j][i];
+	double A1 = getNbSharedKmers(i, j, counts);
+	double B1 = getNbSharedKmers(j, i, counts);
 	double A0 = _stats._nbSolidKmersPerBank[i];
 	double B0 = _stats._nbSolidKmersPerBank[j];
 
@@ -1207,17 +1524,17 @@ double SimkaDistance::distance_presenceAbsence_jaccardCanberra(u_int64_t& ua, u_
 	return (b+c) / (a+b+c);
 }
 
-double SimkaDistance::distance_presenceAbsence_jaccard_simka(size_t i, size_t j, size_t symetricIndex, SIMKA_MATRIX_TYPE type){
+double SimkaDistance::distance_presenceAbsence_jaccard_simka(size_t i, size_t j, const SimkaPairCounts& counts, SIMKA_MATRIX_TYPE type){
 
 	double numerator = 0;
 	double denominator = 0;
 
     if(type == SYMETRICAL){
-    	numerator = 2*_stats._matrixNbDistinctSharedKmers[symetricIndex];
+    	numerator = 2*counts._nbDistinctSharedKmers;
     	denominator = _stats._nbSolidDistinctKmersPerBank[i] + _stats._nbSolidDistinctKmersPerBank[j];
     }
     else if(type == ASYMETRICAL){
-    	numerator = _stats._matrixNbDistinctSharedKmers[symetricIndex];
+    	numerator = counts._nbDistinctSharedKmers;
     	denominator = _stats._nbSolidDistinctKmersPerBank[i];
     }
 
@@ -22,6 +22,9 @@
 #define TOOLS_SIMKA_SRC_SIMKADISTANCE_HPP_
 
 #include <gatb/gatb_core.hpp>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 const string STR_SIMKA_DISTANCE_BRAYCURTIS = "-bray-curtis";
 const string STR_SIMKA_DISTANCE_CHORD = "-chord";
@@ -65,19 +68,502 @@ public:
 };*/
 
 
+/*********************************************************************
+* ** Statistics of a pair of banks (i<j)
+*********************************************************************/
+
+//Accumulators of the distances computed by default
+struct SimkaPairCounts{
+
+	u_int64_t _nbDistinctSharedKmers;
+	u_int64_t _nbSharedKmersI; //abundance in bank i of the kmers shared with bank j
+	u_int64_t _nbSharedKmersJ; //abundance in bank j of the kmers shared with bank i
+	u_int64_t _brayCurtisNumerator;
+
+	SimkaPairCounts() : _nbDistinctSharedKmers(0), _nbSharedKmersI(0), _nbSharedKmersJ(0), _brayCurtisNumerator(0) {}
+
+	bool isEmpty() const { return _nbDistinctSharedKmers == 0 && _nbSharedKmersI == 0 && _nbSharedKmersJ == 0 && _brayCurtisNumerator == 0; }
+};
+
+//Accumulators of the simple distances (-simple-dist)
+struct SimkaPairSimpleCounts{
+
+	long double _chord_NiNj;
+	u_int64_t _hellinger_SqrtNiNj;
+	u_int64_t _kulczynski_minNiNj;
+
+	SimkaPairSimpleCounts() : _chord_NiNj(0), _hellinger_SqrtNiNj(0), _kulczynski_minNiNj(0) {}
+
+	bool isEmpty() const { return _chord_NiNj == 0 && _hellinger_SqrtNiNj == 0 && _kulczynski_minNiNj == 0; }
+};
+
+//Accumulators of the complex distances (-complex-dist)
+struct SimkaPairComplexCounts{
+
+	u_int64_t _canberra;
+	u_int64_t _whittaker_minNiNj;
+	long double _kullbackLeibler;
+
+	SimkaPairComplexCounts() : _canberra(0), _whittaker_minNiNj(0), _kullbackLeibler(0) {}
+
+	bool isEmpty() const { return _canberra == 0 && _whittaker_minNiNj == 0 && _kullbackLeibler == 0; }
+};
+
+
+/*********************************************************************
+* ** SimkaTile
+*
+* Window on the pairs of banks: the pairs (i<j) with i in [_rowStart, _rowEnd) and j in [_colStart, _colEnd).
+* In tiled mode, the banks are split in blocks of tileSize banks and tile (a, b), with a <= b,
+* holds the pairs of block a x block b. A merge job then only keeps the pairs of one tile.
+*********************************************************************/
+class SimkaTile{
+
+public:
+
+	/** Empty window, replaced by all the pairs when the statistics are created */
+	SimkaTile() : _rowStart(0), _rowEnd(0), _colStart(0), _colEnd(0) {}
+
+	/** All the pairs of nbBanks banks */
+	SimkaTile(size_t nbBanks) : _rowStart(0), _rowEnd(nbBanks), _colStart(0), _colEnd(nbBanks) {}
+
+	/** Pairs (i<j) with i in [rowStart, rowEnd) and j in [colStart, colEnd). The pairs of the datasets added by an
+	 * incremental run are the window [0, nbBanks) x [firstNewBank, nbBanks). */
+	SimkaTile(size_t rowStart, size_t rowEnd, size_t colStart, size_t colEnd) : _rowStart(rowStart), _rowEnd(rowEnd), _colStart(colStart), _colEnd(colEnd) {}
+
+	/** Tile tileId of nbBanks banks split in blocks of tileSize banks. Tiles are numbered row by row:
+	 * (0,0), (0,1)... (0,nbBlocks-1), (1,1)... */
+	SimkaTile(size_t tileId, size_t tileSize, size_t nbBanks){
+
+		size_t nbBlocks = getNbBlocks(nbBanks, tileSize);
+		size_t rowBlock = 0;
+		while(tileId >= nbBlocks - rowBlock){
+			tileId -= nbBlocks - rowBlock;
+			rowBlock += 1;
+		}
+		size_t colBlock = rowBlock + tileId;
+
+		_rowStart = rowBlock * tileSize;
+		_rowEnd = min(nbBanks, _rowStart + tileSize);
+		_colStart = colBlock * tileSize;
+		_colEnd = min(nbBanks, _colStart + tileSize);
+	}
+
+	static size_t getNbBlocks(size_t nbBanks, size_t tileSize){ return (nbBanks + tileSize - 1) / tileSize; }
+	static size_t getNbTiles(size_t nbBanks, size_t tileSize){
+		size_t nbBlocks = getNbBlocks(nbBanks, tileSize);
+		return nbBlocks * (nbBlocks+1) / 2;
+	}
+
+	bool isEmpty() const { return _rowEnd == 0; }
+	/** Tile of the diagonal, only the pairs i<j of the block are in the tile */
+	bool isDiagonal() const { return _rowStart == _colStart; }
+	bool isRow(size_t i) const { return i >= _rowStart && i < _rowEnd; }
+	bool isCol(size_t j) const { return j >= _colStart && j < _colEnd; }
+	/** The bank has pairs in the tile */
+	bool hasBank(size_t i) const { return isRow(i) || isCol(i); }
+	/** A bank of [first, last] has pairs in the tile */
+	bool hasBanks(size_t first, size_t last) const {
+		return (first < _rowEnd && last >= _rowStart) || (first < _colEnd && last >= _colStart);
+	}
+	/** The tile has pairs of a bank of [first, last) */
+	bool hasBlock(size_t first, size_t last) const { return first < last && hasBanks(first, last-1); }
+
+	size_t getNbRows() const { return _rowEnd - _rowStart; }
+	size_t getNbCols() const { return _colEnd - _colStart; }
+	u_int64_t getNbPairs() const {
+		if(isDiagonal()) return ((u_int64_t)getNbRows()*(getNbRows()-1))/2;
+		return (u_int64_t)getNbRows()*getNbCols();
+	}
+
+	size_t _rowStart;
+	size_t _rowEnd;
+	size_t _colStart;
+	size_t _colEnd;
+};
+
+
+/*********************************************************************
+* ** SimkaMergeJob
+*
+* Kmers merged by a merge job: the consecutive partitions [_partitionId, _partitionId+_nbPartitions),
+* or the kmer range _rangeId of _nbRanges of a single partition. The ranges split a partition much
+* larger than the others, so that the merge jobs are balanced.
+*********************************************************************/
+class SimkaMergeJob{
+
+public:
+
+	SimkaMergeJob(size_t partitionId, size_t nbPartitions, size_t rangeId, size_t nbRanges) :
+		_partitionId(partitionId), _nbPartitions(nbPartitions), _rangeId(rangeId), _nbRanges(nbRanges) {}
+
+	/** Name of the stats and synchro files of the job: <partition>, <first>-<last> or <partition>.<range> */
+	string getId() const {
+		string id = Stringify::format("%i", _partitionId);
+		if(_nbPartitions > 1) id += "-" + Stringify::format("%i", _partitionId + _nbPartitions - 1);
+		if(_nbRanges > 1) id += "." + Stringify::format("%i", _rangeId);
+		return id;
+	}
+
+	size_t _partitionId;
+	size_t _nbPartitions;
+	size_t _rangeId;
+	size_t _nbRanges;
+};
+
+
+#define SIMKA_COUNT_INDEX_MAGIC 0x31584449414b4d53ULL //"SMKAIDX1"
+
+/*********************************************************************
+* ** SimkaCountIndex
+*
+* Number of distinct kmers and size of the count file of each dataset in each partition, in a single
+* binary file mapped in memory by the merge jobs:
+*   header: magic, nbBanks, nbPartitions
+*   nbKmers of each partition, summed over the datasets (nbPartitions values)
+*   nbKmers of each dataset in each partition (nbBanks x nbPartitions values)
+*   size of the count file of each partition (nbBanks x nbPartitions values), stored for the first
+*   dataset of the file, the datasets counted by the same job share a count file
+*********************************************************************/
+class SimkaCountIndex{
+
+public:
+
+	SimkaCountIndex() : _data(0), _mapSize(0), _nbBanks(0), _nbPartitions(0) {}
+
+	~SimkaCountIndex(){
+		if(_data != 0) munmap(_data, _mapSize);
+	}
+
+	/** Return false if the file is missing or is not an index */
+	bool load(const string& filename){
+
+		int fd = open(filename.c_str(), O_RDONLY);
+		if(fd < 0) return false;
+
+		off_t size = lseek(fd, 0, SEEK_END);
+		if(size < (off_t)(3*sizeof(u_int64_t))){
+			close(fd);
+			return false;
+		}
+
+		void* data = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if(data == MAP_FAILED) return false;
+
+		_data = (u_int64_t*) data;
+		_mapSize = size;
+		_nbBanks = _data[1];
+		_nbPartitions = _data[2];
+
+		if(_data[0] != SIMKA_COUNT_INDEX_MAGIC || (u_int64_t)size != getIndexSize(_nbBanks, _nbPartitions)){
+			munmap(_data, _mapSize);
+			_data = 0;
+			return false;
+		}
+
+		return true;
+	}
+
+	/** nbKmers and fileSizes hold nbBanks x nbPartitions values, dataset by dataset */
+	static void write(const string& filename, size_t nbBanks, size_t nbPartitions, const vector<u_int64_t>& nbKmers, const vector<u_int64_t>& fileSizes){
+
+		vector<u_int64_t> data(getIndexSize(nbBanks, nbPartitions) / sizeof(u_int64_t), 0);
+		data[0] = SIMKA_COUNT_INDEX_MAGIC;
+		data[1] = nbBanks;
+		data[2] = nbPartitions;
+
+		u_int64_t* partitionKmers = &data[3];
+		u_int64_t* bankKmers = partitionKmers + nbPartitions;
+		u_int64_t* bankSizes = bankKmers + nbBanks*nbPartitions;
+		for(size_t i=0; i<nbBanks*nbPartitions; i++){
+			partitionKmers[i % nbPartitions] += nbKmers[i];
+			bankKmers[i] = nbKmers[i];
+			bankSizes[i] = fileSizes[i];
+		}
+
+		//Written aside and renamed, the merge jobs never see a partial index
+		string tempFilename = filename + ".temp";
+		IFile* file = System::file().newFile(tempFilename, "wb");
+		file->fwrite(&data[0], sizeof(u_int64_t), data.size());
+		file->flush();
+		delete file;
+		System::file().rename(tempFilename, filename);
+	}
+
+	size_t getNbBanks() const { return _nbBanks; }
+	size_t getNbPartitions() const { return _nbPartitions; }
+
+	u_int64_t getNbKmers(size_t partitionId) const { return _data[3 + partitionId]; }
+	u_int64_t getNbKmers(size_t bankId, size_t partitionId) const { return _data[3 + _nbPartitions + bankId*_nbPartitions + partitionId]; }
+	u_int64_t getFileSize(size_t bankId, size_t partitionId) const { return _data[3 + _nbPartitions + (_nbBanks + bankId)*_nbPartitions + partitionId]; }
+
+private:
+
+	static u_int64_t getIndexSize(u_int64_t nbBanks, u_int64_t nbPartitions){
+		return (3 + nbPartitions + 2*nbBanks*nbPartitions) * sizeof(u_int64_t);
+	}
+
+	u_int64_t* _data;
+	size_t _mapSize;
+	size_t _nbBanks;
+	size_t _nbPartitions;
+};
+
+
+#define SIMKA_RUN_DESCRIPTOR_MAGIC 0x4e55524b4d4953ULL //"SIMKRUN"
+#define SIMKA_RUN_DESCRIPTOR_VERSION 2
+#define SIMKA_RUN_DESCRIPTOR_HEADER_SIZE 12 //u_int64 values before the offsets of the dataset ids
+
+/*********************************************************************
+* ** SimkaRunDescriptor
+*
+* Parameters of a run shared by all its jobs, in a binary file mapped in memory by the jobs:
+*   header: magic, version, kmerSize, nbPartitions, abundanceMin, abundanceMax, maxReads, minReadSize,
+*   minReadShannonIndex, minKmerShannonIndex (doubles), nbBanks, sketchScale
+*   offsets of the dataset ids in the names (nbBanks+1 values)
+*   names: the dataset ids, concatenated
+*********************************************************************/
+class SimkaRunDescriptor{
+
+public:
+
+	SimkaRunDescriptor() : _kmerSize(0), _nbPartitions(0), _abundanceMin(0), _abundanceMax(0), _maxReads(0), _minReadSize(0),
+		_minReadShannonIndex(0), _minKmerShannonIndex(0), _sketchScale(1) {}
+
+	void write(const string& filename) const {
+
+		vector<u_int64_t> header(SIMKA_RUN_DESCRIPTOR_HEADER_SIZE, 0);
+		header[0] = SIMKA_RUN_DESCRIPTOR_MAGIC;
+		header[1] = SIMKA_RUN_DESCRIPTOR_VERSION;
+		header[2] = _kmerSize;
+		header[3] = _nbPartitions;
+		header[4] = _abundanceMin;
+		header[5] = _abundanceMax;
+		header[6] = _maxReads;
+		header[7] = _minReadSize;
+		memcpy(&header[8], &_minReadShannonIndex, sizeof(double));
+		memcpy(&header[9], &_minKmerShannonIndex, sizeof(double));
+		header[10] = _datasetIds.size();
+		header[11] = _sketchScale;
+
+		string names = "";
+		for(size_t i=0; i<_datasetIds.size(); i++){
+			header.push_back(names.size());
+			names += _datasetIds[i];
+		}
+		header.push_back(names.size());
+
+		//Written aside and renamed, the jobs never see a partial descriptor
+		string tempFilename = filename + ".temp";
+		IFile* file = System::file().newFile(tempFilename, "wb");
+		file->fwrite(&header[0], sizeof(u_int64_t), header.size());
+		if(!names.empty()) file->fwrite(names.c_str(), names.size(), 1);
+		file->flush();
+		delete file;
+		System::file().rename(tempFilename, filename);
+	}
+
+	/** Return false if the file is missing, is not a descriptor or was written by another version of simka */
+	bool load(const string& filename){
+
+		int fd = open(filename.c_str(), O_RDONLY);
+		if(fd < 0) return false;
+
+		off_t size = lseek(fd, 0, SEEK_END);
+		if(size < (off_t)(SIMKA_RUN_DESCRIPTOR_HEADER_SIZE*sizeof(u_int64_t))){
+			close(fd);
+			return false;
+		}
+
+		void* data = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if(data == MAP_FAILED) return false;
+
+		const u_int64_t* header = (const u_int64_t*) data;
+		u_int64_t nbBanks = header[10];
+		u_int64_t namesOffset = (SIMKA_RUN_DESCRIPTOR_HEADER_SIZE + nbBanks + 1) * sizeof(u_int64_t);
+		bool isValid = header[0] == SIMKA_RUN_DESCRIPTOR_MAGIC && header[1] == SIMKA_RUN_DESCRIPTOR_VERSION &&
+				(u_int64_t)size >= namesOffset && (u_int64_t)size == namesOffset + header[SIMKA_RUN_DESCRIPTOR_HEADER_SIZE + nbBanks];
+
+		if(isValid){
+			_kmerSize = header[2];
+			_nbPartitions = header[3];
+			_abundanceMin = header[4];
+			_abundanceMax = header[5];
+			_maxReads = header[6];
+			_minReadSize = header[7];
+			memcpy(&_minReadShannonIndex, &header[8], sizeof(double));
+			memcpy(&_minKmerShannonIndex, &header[9], sizeof(double));
+			_sketchScale = header[11];
+
+			const u_int64_t* offsets = header + SIMKA_RUN_DESCRIPTOR_HEADER_SIZE;
+			const char* names = (const char*) data + namesOffset;
+			_datasetIds.clear();
+			_datasetIds.reserve(nbBanks);
+			for(size_t i=0; i<nbBanks; i++){
+				_datasetIds.push_back(string(names + offsets[i], offsets[i+1] - offsets[i]));
+			}
+		}
+
+		munmap(data, size);
+		return isValid;
+	}
+
+	u_int64_t _kmerSize;
+	u_int64_t _nbPartitions;
+	u_int64_t _abundanceMin;
+	u_int64_t _abundanceMax;
+	u_int64_t _maxReads;
+	u_int64_t _minReadSize;
+	double _minReadShannonIndex;
+	double _minKmerShannonIndex;
+	u_int64_t _sketchScale;
+	vector<string> _datasetIds;
+};
+
+
+/*********************************************************************
+* ** SimkaPairIndex
+*
+* Open addressing hash table giving the index of a pair of banks from its key (i*nbBanks+j).
+* Pairs are numbered in insertion order. Used when the dense pair matrix does not fit in memory,
+* only the pairs of banks that share kmers are then allocated.
+*********************************************************************/
+class SimkaPairIndex{
+
+public:
+
+	SimkaPairIndex() : _mask(0) {}
+
+	size_t size() const { return _keys.size(); }
+	u_int64_t getKey(u_int64_t pairId) const { return _keys[pairId]; }
+
+	/** Get the index of a pair.
+	 * \return the index of the pair, or size() if the pair is not in the table */
+	u_int64_t find(u_int64_t key) const {
+
+		if(_table.empty()) return _keys.size();
+
+		u_int64_t slot = hash(key) & _mask;
+		while(true){
+			u_int64_t pairId = _table[slot];
+			if(pairId == 0) return _keys.size();
+			if(_keys[pairId-1] == key) return pairId-1;
+			slot = (slot+1) & _mask;
+		}
+	}
+
+	/** Get the index of a pair, the pair is added (with index size()) if it is not in the table */
+	u_int64_t insert(u_int64_t key){
+
+		u_int64_t pairId = find(key);
+		if(pairId != _keys.size()) return pairId;
+
+		if((_keys.size()+1)*2 > _table.size()) grow();
+
+		_keys.push_back(key);
+		u_int64_t slot = hash(key) & _mask;
+		while(_table[slot] != 0) slot = (slot+1) & _mask;
+		_table[slot] = _keys.size();
+
+		return pairId;
+	}
+
+	/** Memory used per pair, in bytes (the table is kept at most half full) */
+	static u_int64_t getMemoryPerPair(){ return sizeof(u_int64_t)*5; }
+
+private:
+
+	static u_int64_t hash(u_int64_t key){
+		key ^= key >> 33;
+		key *= 0xff51afd7ed558ccdULL;
+		key ^= key >> 33;
+		return key;
+	}
+
+	void grow(){
+		size_t tableSize = max((size_t)1024, _table.size()*2);
+		_table.assign(tableSize, 0);
+		_mask = tableSize-1;
+
+		for(size_t i=0; i<_keys.size(); i++){
+			u_int64_t slot = hash(_keys[i]) & _mask;
+			while(_table[slot] != 0) slot = (slot+1) & _mask;
+			_table[slot] = i+1;
+		}
+	}
+
+	vector<u_int64_t> _keys;
+	vector<u_int64_t> _table; //pair index + 1, 0 is an empty slot
+	u_int64_t _mask;
+};
+
+
+
 class SimkaStatistics{
 
 public:
 
-	SimkaStatistics(size_t nbBanks, bool computeSimpleDistances, bool computeComplexDistances, const string& tmpDir, const vector<string>& datasetIds);
+	SimkaStatistics(size_t nbBanks, bool computeSimpleDistances, bool computeComplexDistances, const string& tmpDir, const vector<string>& datasetIds, bool isSparse=false, const SimkaTile& tile=SimkaTile());
 	SimkaStatistics& operator+=  (const SimkaStatistics& other);
-	void print();
-	void load(const string& filename);
+	/** The distinct kmers after merging are unknown if the statistics were computed by tiles */
+	void print(bool isTiled=false);
+	/** Add the statistics of a file. The kmer counts of the banks are not read, they are the ones of the run or of
+	 * loadBankCounts. */
+	void load(const string& filename, bool loadKmerCounts=true);
 	void save(const string& filename);
-	void outputMatrix(const string& outputDir, const vector<string>& _bankNames);
+	void outputMatrix(const string& outputDir, const vector<string>& _bankNames, size_t nbNeighbors=0, double maxDistance=-1);
+
+	/** Replace the kmer counts of the banks by the ones of another threshold of -multi-abundance-min or of a replicate
+	 * of -bootstrap, read from the extra lines of the finish signals of the counts: countsId distinct kmers chord_N2 */
+	void loadBankCounts(const string& tmpDir, const vector<string>& datasetIds, const string& countsId);
+
+	/** Add the kmer counters of other (not the pair statistics) */
+	void addKmerCounts(const SimkaStatistics& other);
+	/** Remove the statistics of all the pairs (sparse mode only), kmer counters are kept */
+	void clearPairs();
+	/** The next loads only keep the pairs of a bank of [blockStart, blockEnd), the pairs of a block of rows of the matrices */
+	void setBlock(size_t blockStart, size_t blockEnd){
+		_blockStart = blockStart;
+		_blockEnd = blockEnd;
+	}
+
+	/** Memory required by the dense pair matrix of a tile, in MB */
+	static u_int64_t getDenseMemoryMB(const SimkaTile& tile, bool computeSimpleDistances, bool computeComplexDistances);
+	/** Largest tile size whose dense pair matrix fits in maxMemory (MB) */
+	static size_t getTileSize(u_int64_t maxMemory, bool computeSimpleDistances, bool computeComplexDistances);
+	/** The pair statistics are sparse if the dense pair matrix of the tile does not fit in maxMemory (MB) */
+	static bool isSparse(const SimkaTile& tile, bool computeSimpleDistances, bool computeComplexDistances, u_int64_t maxMemory){
+		return getDenseMemoryMB(tile, computeSimpleDistances, computeComplexDistances) > maxMemory;
+	}
+
+	/** Get the index of the pair of banks (i<j) in the _pair* vectors, the pair must be in the tile.
+	 * In sparse mode, the pair is allocated if it does not exist yet, references on the _pair* vectors
+	 * are then invalidated. */
+	u_int64_t getPairId(size_t i, size_t j){
+		if(!_isSparse) return getDensePairId(i, j);
+
+		u_int64_t pairId = _pairIndex.insert((u_int64_t)i*_nbBanks + j);
+		if(pairId == _pairCounts.size()) addPair();
+		return pairId;
+	}
+
+	/** Get the index of the pair of banks (i<j), or _pairCounts.size() if the pair has no statistics */
+	u_int64_t findPairId(size_t i, size_t j) const {
+		if(!_isSparse){
+			if(!_tile.isRow(i) || !_tile.isCol(j)) return _pairCounts.size();
+			return getDensePairId(i, j);
+		}
+		return _pairIndex.find((u_int64_t)i*_nbBanks + j);
+	}
 
     size_t _nbBanks;
-    size_t _symetricDistanceMatrixSize;
+    u_int64_t _nbPairs;
+    bool _isSparse;
+    SimkaTile _tile;
+    size_t _blockStart;
+    size_t _blockEnd;
     bool _computeSimpleDistances;
     bool _computeComplexDistances;
 
@@ -89,30 +575,20 @@ public:
 	vector<u_int64_t> _nbDistinctKmersSharedByBanksThreshold;
 	vector<u_int64_t> _nbKmersSharedByBanksThreshold;
 
-	vector<u_int64_t> _matrixNbDistinctSharedKmers;
-	vector<vector<u_int64_t> > _matrixNbSharedKmers;
-
-	vector<u_int64_t> _brayCurtisNumerator;
-	//vector<vector<u_int64_t> > _brayCurtisNumerator;
-	//vector<vector<double> > _kullbackLeibler;
+	//Statistics of the pairs of banks, the complex and simple ones are only allocated if needed
+	vector<SimkaPairCounts> _pairCounts;
+	vector<SimkaPairSimpleCounts> _pairSimpleCounts;
+	vector<SimkaPairComplexCounts> _pairComplexCounts;
+	SimkaPairIndex _pairIndex;
 
+	//Used for the pairs that have no statistics in sparse mode
+	SimkaPairCounts _emptyPairCounts;
+	SimkaPairSimpleCounts _emptyPairSimpleCounts;
+	SimkaPairComplexCounts _emptyPairComplexCounts;
 
     //Abundance Chord
-	vector<vector<long double> > _chord_NiNj;
 	vector<long double> _chord_sqrt_N2;
 
-    //Abundance Hellinger
-	vector<vector<u_int64_t> > _hellinger_SqrtNiNj;
-	vector<vector<u_int64_t> > _whittaker_minNiNj;
-	vector<vector<long double> > _kullbackLeibler;
-	vector<vector<u_int64_t> > _abundance_jaccard_intersection;
-
-    //Abundance Canberra
-	vector<vector<u_int64_t> > _canberra;
-
-	//Abundance Kulczynski
-	vector<vector<u_int64_t> > _kulczynski_minNiNj;
-
 	//string _outputDir;
 
 	u_int64_t _nbKmers;
@@ -134,366 +610,332 @@ public:
 
 private:
 
-	void dumpMatrix(const string& outputDir, const vector<string>& _bankNames, const string& outputFilename, const vector<vector<float> >& matrix);
+	void addPair(){
+		_pairCounts.push_back(SimkaPairCounts());
+		if(_computeSimpleDistances) _pairSimpleCounts.push_back(SimkaPairSimpleCounts());
+		if(_computeComplexDistances) _pairComplexCounts.push_back(SimkaPairComplexCounts());
+	}
+
+	void addPair(size_t i, size_t j, const SimkaPairCounts& counts, const SimkaPairSimpleCounts& simpleCounts, const SimkaPairComplexCounts& complexCounts);
+	void getPair(u_int64_t pairId, size_t& i, size_t& j) const;
+	static u_int64_t getPairSize(bool computeSimpleDistances, bool computeComplexDistances);
+
+	//Pairs of a diagonal tile are stored as an upper triangle, the other tiles as a rectangle
+	u_int64_t getDensePairId(size_t i, size_t j) const {
+		if(_tile.isDiagonal()){
+			i -= _tile._rowStart;
+			j -= _tile._rowStart;
+			return (u_int64_t)i*(2*_tile.getNbRows()-i-1)/2 + (j-i-1);
+		}
+		return (u_int64_t)(i-_tile._rowStart)*_tile.getNbCols() + (j-_tile._colStart);
+	}
+
 	string _outputFilenameSuffix;
 };
 
 
-class SimkaDistance {
+/*********************************************************************
+* ** SimkaMatrixWriter
+*
+* Writes a distance matrix (gz compressed csv) row by row, so that the full matrix is never in memory.
+* The columns are the banks [colStart, colEnd), all the banks for a square matrix.
+*********************************************************************/
+class SimkaMatrixWriter{
 
 public:
 
-	SimkaDistance(SimkaStatistics& stats);
-	//virtual ~SimkaDistance();
+	SimkaMatrixWriter(const string& outputDir, const string& outputFilename, const vector<string>& bankNames, size_t colStart, size_t colEnd);
+	~SimkaMatrixWriter();
 
-	//vector<vector<float> > getMatrixSorensen(SIMKA_MATRIX_TYPE type);
-	//vector<vector<float> > getMatrixJaccard();
-	//vector<vector<float> > getMatrixAKS(SIMKA_MATRIX_TYPE type);
-	//vector<vector<float> > getMatrixBrayCurtis();
-	//vector<vector<float> > getMatrixKullbackLeibler();
-
-    vector<vector<float> > _matrixJaccardAbundance(){
-    	vector<vector<float> > matrix = createSquaredMatrix(_nbBanks);
-
-    	for(size_t i=0; i<_nbBanks; i++){
-    		for(size_t j=i+1; j<_nbBanks; j++){
-    			double dist = distance_abundance_jaccard(i, j);
-    			matrix[i][j] = dist;
-    			matrix[j][i] = dist;
-    		}
-    	}
+	void writeRow(size_t i, const vector<float>& row);
 
-		return matrix;
-    }
-
-    vector<vector<float> > _matrixBrayCurtis(){
-    	vector<vector<float> > matrix = createSquaredMatrix(_nbBanks);
+private:
 
-    	for(size_t i=0; i<_nbBanks; i++){
-    		for(size_t j=i+1; j<_nbBanks; j++){
-    			double dist = distance_abundance_brayCurtis(i, j, j + ((_nbBanks-1)*i) - (i*(i-1)/2));
-    			matrix[i][j] = dist;
-    			matrix[j][i] = dist;
-    		}
-    	}
+	gzFile _out;
+	const vector<string>& _bankNames;
+	size_t _colStart;
+	size_t _colEnd;
+};
 
-		return matrix;
-    }
 
-    vector<vector<float> > _matrixChord(){
-    	vector<vector<float> > matrix = createSquaredMatrix(_nbBanks);
+/*********************************************************************
+* ** SimkaEdgeListWriter
+*
+* Sparse version of SimkaMatrixWriter (-output-knn, -output-max-distance): only the closest banks of
+* each row are written, one line "bank;neighbor;distance" per edge. The nbNeighbors closest banks are
+* selected with a bounded heap, the banks farther than maxDistance are skipped. 0 and a negative
+* value disable these limits.
+*********************************************************************/
+class SimkaEdgeListWriter{
 
-    	for(size_t i=0; i<_nbBanks; i++){
-    		for(size_t j=i+1; j<_nbBanks; j++){
-    			double dist = distance_abundance_chord(i, j);
-    			matrix[i][j] = dist;
-    			matrix[j][i] = dist;
-    		}
-    	}
+public:
 
-		return matrix;
-    }
+	SimkaEdgeListWriter(const string& outputDir, const string& outputFilename, const vector<string>& bankNames, size_t colStart, size_t colEnd, size_t nbNeighbors, double maxDistance);
+	~SimkaEdgeListWriter();
 
-    vector<vector<float> > _matrixHellinger(){
-    	vector<vector<float> > matrix = createSquaredMatrix(_nbBanks);
+	void writeRow(size_t i, const vector<float>& row);
 
-    	for(size_t i=0; i<_nbBanks; i++){
-    		for(size_t j=i+1; j<_nbBanks; j++){
-    			double dist = distance_abundance_hellinger(i, j);
-    			matrix[i][j] = dist;
-    			matrix[j][i] = dist;
-    		}
-    	}
+private:
 
-		return matrix;
-    }
+	gzFile _out;
+	const vector<string>& _bankNames;
+	size_t _colStart;
+	size_t _colEnd;
+	size_t _nbNeighbors;
+	double _maxDistance;
+	vector<pair<float, size_t> > _heap; //(distance, bank) of the neighbors of the row, the farthest on top
+};
 
-    vector<vector<float> > _matrixWhittaker(){
-    	vector<vector<float> > matrix = createSquaredMatrix(_nbBanks);
 
-    	for(size_t i=0; i<_nbBanks; i++){
-    		for(size_t j=i+1; j<_nbBanks; j++){
-    			double dist = distance_abundance_whittaker(i, j);
-    			matrix[i][j] = dist;
-    			matrix[j][i] = dist;
-    		}
-    	}
+/*********************************************************************
+* ** SimkaMatrixReader
+*
+* Reads a distance matrix written by SimkaMatrixWriter row by row. The names of the columns are read
+* from the header when the file is opened.
+*********************************************************************/
+class SimkaMatrixReader{
 
-		return matrix;
-    }
+public:
 
-    vector<vector<float> > _matrixKullbackLeibler(){
-    	vector<vector<float> > matrix = createSquaredMatrix(_nbBanks);
+	SimkaMatrixReader(const string& filename);
+	~SimkaMatrixReader();
 
-    	for(size_t i=0; i<_nbBanks; i++){
-    		for(size_t j=i+1; j<_nbBanks; j++){
-    			double dist = distance_abundance_kullbackLeibler(i, j);
-    			matrix[i][j] = dist;
-    			matrix[j][i] = dist;
-    		}
-    	}
+	bool isOpen(){ return _in != 0; }
+	/** Read the next row: the name of the bank and the distances, false at the end of the file */
+	bool readRow(string& name, vector<float>& row);
 
-		return matrix;
-    }
+	vector<string> _bankNames;
 
-    vector<vector<float> > _matrixCanberra(){
-    	vector<vector<float> > matrix = createSquaredMatrix(_nbBanks);
-    	u_int64_t a, b, c;
+private:
 
-    	for(size_t i=0; i<_nbBanks; i++){
-    		for(size_t j=i+1; j<_nbBanks; j++){
+	bool readLine();
 
-    			get_abc(i, j, j + ((_nbBanks-1)*i) - (i*(i-1)/2), a, b ,c);
-    			double dist = distance_abundance_canberra(i, j, a, b, c);
-    			matrix[i][j] = dist;
-    			matrix[j][i] = dist;
-    		}
-    	}
+	gzFile _in;
+	string _line;
+};
 
-		return matrix;
-    }
+/*********************************************************************
+* ** SimkaMatrixIntervals
+*
+* Intervals of the replicates of a distance matrix (-bootstrap): the lower and upper percentiles of
+* each distance over the replicates, shifted by the difference between the distance of the run and
+* the mean of the replicates, so that the intervals are centered on the distances of the run and
+* not on the biased ones of the replicates. They are written as two matrices. The matrix files of
+* the run and of the replicates are read row by row at the same time, only one row per replicate
+* is in memory.
+*********************************************************************/
+class SimkaMatrixIntervals{
 
-    vector<vector<float> > _matrixKulczynski(){
-    	vector<vector<float> > matrix = createSquaredMatrix(_nbBanks);
+public:
 
-    	for(size_t i=0; i<_nbBanks; i++){
-    		for(size_t j=i+1; j<_nbBanks; j++){
-    			double dist = distance_abundance_kulczynski(i, j);
-    			matrix[i][j] = dist;
-    			matrix[j][i] = dist;
-    		}
-    	}
+	static void write(const string& runDir, const vector<string>& replicateDirs, const string& outputDir, const string& outputFilename, const vector<string>& bankNames, double confidence);
+};
 
-		return matrix;
-    }
+class SimkaDistance {
 
-    vector<vector<float> > _matrixSymJaccardAbundance(){
-    	vector<vector<float> > matrix = createSquaredMatrix(_nbBanks);
+public:
 
-    	for(size_t i=0; i<_nbBanks; i++){
-    		for(size_t j=i+1; j<_nbBanks; j++){
-    			double dist = distance_abundance_jaccard_simka(i, j, SYMETRICAL);
-    			matrix[i][j] = dist;
-    			matrix[j][i] = dist;
-    		}
-    	}
+	SimkaDistance(SimkaStatistics& stats);
+	//virtual ~SimkaDistance();
 
-		return matrix;
-    }
+	/** Select the row i of the matrices, the statistics of the pairs of the row are fetched once
+	 * for all the matrices */
+	void setRow(size_t i);
 
-    vector<vector<float> > _matrixAsymJaccardAbundance(){
-    	vector<vector<float> > matrix = createSquaredMatrix(_nbBanks);
+	//Each function below computes the current row of a distance matrix
+	typedef void (SimkaDistance::*RowFunction)(vector<float>& row);
 
-    	for(size_t i=0; i<_nbBanks; i++){
-    		for(size_t j=i+1; j<_nbBanks; j++){
-    			matrix[i][j] = distance_abundance_jaccard_simka(i, j, ASYMETRICAL);
-    			matrix[j][i] = distance_abundance_jaccard_simka(j, i, ASYMETRICAL);
-    		}
+    void _matrixJaccardAbundance(vector<float>& row){
+    	for(size_t j=0; j<_nbBanks; j++){
+    		if(j == _i) { row[j] = 0; continue; }
+    		row[j] = distance_abundance_jaccard(min(_i, j), max(_i, j), *_rowCounts[j]);
     	}
-
-		return matrix;
     }
 
-    vector<vector<float> > _matrixOchiai(){
-    	vector<vector<float> > matrix = createSquaredMatrix(_nbBanks);
-
-    	for(size_t i=0; i<_nbBanks; i++){
-    		for(size_t j=i+1; j<_nbBanks; j++){
-    			double dist = distance_abundance_ochiai(i, j);
-    			matrix[i][j] = dist;
-    			matrix[j][i] = dist;
-    		}
+    void _matrixBrayCurtis(vector<float>& row){
+    	for(size_t j=0; j<_nbBanks; j++){
+    		if(j == _i) { row[j] = 0; continue; }
+    		row[j] = distance_abundance_brayCurtis(min(_i, j), max(_i, j), *_rowCounts[j]);
     	}
+    }
 
-		return matrix;
+    void _matrixChord(vector<float>& row){
+    	for(size_t j=0; j<_nbBanks; j++){
+    		if(j == _i) { row[j] = 0; continue; }
+    		row[j] = distance_abundance_chord(min(_i, j), max(_i, j), *_rowSimpleCounts[j]);
+    	}
     }
 
-    vector<vector<float> > _matrixSorensen(){
-    	vector<vector<float> > matrix = createSquaredMatrix(_nbBanks);
+    void _matrixHellinger(vector<float>& row){
+    	for(size_t j=0; j<_nbBanks; j++){
+    		if(j == _i) { row[j] = 0; continue; }
+    		row[j] = distance_abundance_hellinger(min(_i, j), max(_i, j), *_rowSimpleCounts[j]);
+    	}
+    }
 
-    	for(size_t i=0; i<_nbBanks; i++){
-    		for(size_t j=i+1; j<_nbBanks; j++){
-    			double dist = distance_abundance_sorensen(i, j);
-    			matrix[i][j] = dist;
-    			matrix[j][i] = dist;
-    		}
+    void _matrixWhittaker(vector<float>& row){
+    	for(size_t j=0; j<_nbBanks; j++){
+    		if(j == _i) { row[j] = 0; continue; }
+    		row[j] = distance_abundance_whittaker(min(_i, j), max(_i, j), *_rowComplexCounts[j]);
     	}
+    }
 
-		return matrix;
+    void _matrixKullbackLeibler(vector<float>& row){
+    	for(size_t j=0; j<_nbBanks; j++){
+    		if(j == _i) { row[j] = 0; continue; }
+    		row[j] = distance_abundance_kullbackLeibler(min(_i, j), max(_i, j), *_rowComplexCounts[j]);
+    	}
     }
 
-    vector<vector<float> > _matrix_presenceAbsence_sorensenBrayCurtis(){
-    	vector<vector<float> > matrix = createSquaredMatrix(_nbBanks);
+    void _matrixCanberra(vector<float>& row){
     	u_int64_t a, b, c;
 
-    	for(size_t i=0; i<_nbBanks; i++){
-    		for(size_t j=i+1; j<_nbBanks; j++){
-
-    			get_abc(i, j, j + ((_nbBanks-1)*i) - (i*(i-1)/2), a, b ,c);
-
-    			double dist = distance_presenceAbsence_sorensenBrayCurtis(a, b, c);
-    			matrix[i][j] = dist;
-    			matrix[j][i] = dist;
-    		}
+    	for(size_t j=0; j<_nbBanks; j++){
+    		if(j == _i) { row[j] = 0; continue; }
+    		get_abc(min(_i, j), max(_i, j), *_rowCounts[j], a, b ,c);
+    		row[j] = distance_abundance_canberra(min(_i, j), max(_i, j), *_rowComplexCounts[j], a, b, c);
     	}
-
-		return matrix;
     }
 
-    vector<vector<float> > _matrix_presenceAbsence_Whittaker(){
-    	vector<vector<float> > matrix = createSquaredMatrix(_nbBanks);
-    	u_int64_t a, b, c;
+    void _matrixKulczynski(vector<float>& row){
+    	for(size_t j=0; j<_nbBanks; j++){
+    		if(j == _i) { row[j] = 0; continue; }
+    		row[j] = distance_abundance_kulczynski(min(_i, j), max(_i, j), *_rowSimpleCounts[j]);
+    	}
+    }
 
-    	for(size_t i=0; i<_nbBanks; i++){
-    		for(size_t j=i+1; j<_nbBanks; j++){
+    void _matrixSymJaccardAbundance(vector<float>& row){
+    	for(size_t j=0; j<_nbBanks; j++){
+    		if(j == _i) { row[j] = 0; continue; }
+    		row[j] = distance_abundance_jaccard_simka(min(_i, j), max(_i, j), *_rowCounts[j], SYMETRICAL);
+    	}
+    }
 
-    			get_abc(i, j, j + ((_nbBanks-1)*i) - (i*(i-1)/2), a, b ,c);
+    void _matrixAsymJaccardAbundance(vector<float>& row){
+    	for(size_t j=0; j<_nbBanks; j++){
+    		if(j == _i) { row[j] = 0; continue; }
+    		row[j] = distance_abundance_jaccard_simka(_i, j, *_rowCounts[j], ASYMETRICAL);
+    	}
+    }
 
-    			double dist = distance_presenceAbsence_whittaker(a, b, c);
-    			matrix[i][j] = dist;
-    			matrix[j][i] = dist;
-    		}
+    void _matrixOchiai(vector<float>& row){
+    	for(size_t j=0; j<_nbBanks; j++){
+    		if(j == _i) { row[j] = 0; continue; }
+    		row[j] = distance_abundance_ochiai(min(_i, j), max(_i, j), *_rowCounts[j]);
     	}
+    }
 
-		return matrix;
+    void _matrixSorensen(vector<float>& row){
+    	for(size_t j=0; j<_nbBanks; j++){
+    		if(j == _i) { row[j] = 0; continue; }
+    		row[j] = distance_abundance_sorensen(min(_i, j), max(_i, j), *_rowCounts[j]);
+    	}
     }
 
-    vector<vector<float> > _matrix_presenceAbsence_kulczynski(){
-    	vector<vector<float> > matrix = createSquaredMatrix(_nbBanks);
+    void _matrix_presenceAbsence_sorensenBrayCurtis(vector<float>& row){
     	u_int64_t a, b, c;
 
-    	for(size_t i=0; i<_nbBanks; i++){
-    		for(size_t j=i+1; j<_nbBanks; j++){
-
-    			get_abc(i, j, j + ((_nbBanks-1)*i) - (i*(i-1)/2), a, b ,c);
-
-    			double dist = distance_presenceAbsence_kulczynski(a, b, c);
-    			matrix[i][j] = dist;
-    			matrix[j][i] = dist;
-    		}
+    	for(size_t j=0; j<_nbBanks; j++){
+    		if(j == _i) { row[j] = 0; continue; }
+    		get_abc(min(_i, j), max(_i, j), *_rowCounts[j], a, b ,c);
+    		row[j] = distance_presenceAbsence_sorensenBrayCurtis(a, b, c);
     	}
-
-		return matrix;
     }
 
-    vector<vector<float> > _matrix_presenceAbsence_ochiai(){
-    	vector<vector<float> > matrix = createSquaredMatrix(_nbBanks);
+    void _matrix_presenceAbsence_Whittaker(vector<float>& row){
     	u_int64_t a, b, c;
 
-    	for(size_t i=0; i<_nbBanks; i++){
-    		for(size_t j=i+1; j<_nbBanks; j++){
-
-    			get_abc(i, j, j + ((_nbBanks-1)*i) - (i*(i-1)/2), a, b ,c);
-
-    			double dist = distance_presenceAbsence_ochiai(a, b, c);
-    			matrix[i][j] = dist;
-    			matrix[j][i] = dist;
-    		}
+    	for(size_t j=0; j<_nbBanks; j++){
+    		if(j == _i) { row[j] = 0; continue; }
+    		get_abc(min(_i, j), max(_i, j), *_rowCounts[j], a, b ,c);
+    		row[j] = distance_presenceAbsence_whittaker(a, b, c);
     	}
-
-		return matrix;
     }
 
-    vector<vector<float> > _matrix_presenceAbsence_chordHellinger(){
-    	vector<vector<float> > matrix = createSquaredMatrix(_nbBanks);
+    void _matrix_presenceAbsence_kulczynski(vector<float>& row){
     	u_int64_t a, b, c;
 
-    	for(size_t i=0; i<_nbBanks; i++){
-    		for(size_t j=i+1; j<_nbBanks; j++){
-
-    			get_abc(i, j, j + ((_nbBanks-1)*i) - (i*(i-1)/2), a, b ,c);
-
-    			double dist = distance_presenceAbsence_chordHellinger(a, b, c);
-    			matrix[i][j] = dist;
-    			matrix[j][i] = dist;
-    		}
+    	for(size_t j=0; j<_nbBanks; j++){
+    		if(j == _i) { row[j] = 0; continue; }
+    		get_abc(min(_i, j), max(_i, j), *_rowCounts[j], a, b ,c);
+    		row[j] = distance_presenceAbsence_kulczynski(a, b, c);
     	}
-
-		return matrix;
     }
 
-    vector<vector<float> > _matrix_presenceAbsence_jaccardCanberra(){
-    	vector<vector<float> > matrix = createSquaredMatrix(_nbBanks);
+    void _matrix_presenceAbsence_ochiai(vector<float>& row){
     	u_int64_t a, b, c;
 
-    	for(size_t i=0; i<_nbBanks; i++){
-    		for(size_t j=i+1; j<_nbBanks; j++){
-
-    			get_abc(i, j, j + ((_nbBanks-1)*i) - (i*(i-1)/2), a, b ,c);
-
-    			double dist = distance_presenceAbsence_jaccardCanberra(a, b, c);
-    			matrix[i][j] = dist;
-    			matrix[j][i] = dist;
-    		}
+    	for(size_t j=0; j<_nbBanks; j++){
+    		if(j == _i) { row[j] = 0; continue; }
+    		get_abc(min(_i, j), max(_i, j), *_rowCounts[j], a, b ,c);
+    		row[j] = distance_presenceAbsence_ochiai(a, b, c);
     	}
-
-		return matrix;
     }
 
-    vector<vector<float> > _matrix_presenceAbsence_jaccard_simka(){
-    	vector<vector<float> > matrix = createSquaredMatrix(_nbBanks);
-
-    	for(size_t i=0; i<_nbBanks; i++){
-    		for(size_t j=i+1; j<_nbBanks; j++){
+    void _matrix_presenceAbsence_chordHellinger(vector<float>& row){
+    	u_int64_t a, b, c;
 
-    			double dist = distance_presenceAbsence_jaccard_simka(i, j, j + ((_nbBanks-1)*i) - (i*(i-1)/2), SYMETRICAL);
-    			matrix[i][j] = dist;
-    			matrix[j][i] = dist;
-    		}
+    	for(size_t j=0; j<_nbBanks; j++){
+    		if(j == _i) { row[j] = 0; continue; }
+    		get_abc(min(_i, j), max(_i, j), *_rowCounts[j], a, b ,c);
+    		row[j] = distance_presenceAbsence_chordHellinger(a, b, c);
     	}
-
-		return matrix;
     }
 
-    vector<vector<float> > _matrix_presenceAbsence_jaccard_simka_asym(){
-    	vector<vector<float> > matrix = createSquaredMatrix(_nbBanks);
-
-    	for(size_t i=0; i<_nbBanks; i++){
-    		for(size_t j=i+1; j<_nbBanks; j++){
+    void _matrix_presenceAbsence_jaccardCanberra(vector<float>& row){
+    	u_int64_t a, b, c;
 
-    			matrix[i][j] = distance_presenceAbsence_jaccard_simka(i, j, j + ((_nbBanks-1)*i) - (i*(i-1)/2), ASYMETRICAL);
-    			matrix[j][i] = distance_presenceAbsence_jaccard_simka(j, i, j + ((_nbBanks-1)*i) - (i*(i-1)/2), ASYMETRICAL);
-    		}
+    	for(size_t j=0; j<_nbBanks; j++){
+    		if(j == _i) { row[j] = 0; continue; }
+    		get_abc(min(_i, j), max(_i, j), *_rowCounts[j], a, b ,c);
+    		row[j] = distance_presenceAbsence_jaccardCanberra(a, b, c);
     	}
+    }
 
-		return matrix;
+    void _matrix_presenceAbsence_jaccard_simka(vector<float>& row){
+    	for(size_t j=0; j<_nbBanks; j++){
+    		if(j == _i) { row[j] = 0; continue; }
+    		row[j] = distance_presenceAbsence_jaccard_simka(min(_i, j), max(_i, j), *_rowCounts[j], SYMETRICAL);
+    	}
     }
 
+    void _matrix_presenceAbsence_jaccard_simka_asym(vector<float>& row){
+    	for(size_t j=0; j<_nbBanks; j++){
+    		if(j == _i) { row[j] = 0; continue; }
+    		row[j] = distance_presenceAbsence_jaccard_simka(_i, j, *_rowCounts[j], ASYMETRICAL);
+    	}
+    }
 
-    vector<vector<float> > computeJaccardDistanceFromBrayCurtis(const vector<vector<float> >& brayDistanceMatrix){
-    	vector<vector<float> > jaccardDistanceMatrix = createSquaredMatrix(_nbBanks);
+    //Jaccard distance computed from the (float) Bray-Curtis distance
+    void computeJaccardDistanceFromBrayCurtis(vector<float>& row){
+    	_matrixBrayCurtis(row);
 
-    	for(size_t i=0; i<_nbBanks; i++){
-    		for(size_t j=0; j<_nbBanks; j++){
-    			double B = brayDistanceMatrix[i][j];
-    			double J = (2*B) / (1+B);
-    			jaccardDistanceMatrix[i][j] = J;
-    		}
+    	for(size_t j=0; j<_nbBanks; j++){
+    		double B = row[j];
+    		double J = (2*B) / (1+B);
+    		row[j] = J;
     	}
-
-    	return jaccardDistanceMatrix;
     }
 
 
 private:
 
 
-	vector<vector<float> > createSquaredMatrix(size_t n);
-	void get_abc(size_t bank1, size_t bank2, size_t symetricIndex, u_int64_t& a, u_int64_t& b, u_int64_t& c);
+	void get_abc(size_t bank1, size_t bank2, const SimkaPairCounts& counts, u_int64_t& a, u_int64_t& b, u_int64_t& c);
 
 
-    double distance_abundance_brayCurtis(size_t bank1, size_t bank2, size_t symetricIndex);
-    double distance_abundance_chord(size_t i, size_t j);
-    double distance_abundance_hellinger(size_t i, size_t j);
+    double distance_abundance_brayCurtis(size_t bank1, size_t bank2, const SimkaPairCounts& counts);
+    double distance_abundance_chord(size_t i, size_t j, const SimkaPairSimpleCounts& counts);
+    double distance_abundance_hellinger(size_t i, size_t j, const SimkaPairSimpleCounts& counts);
     //double distance_abundance_jaccard_intersection(size_t i, size_t j);
-    double distance_abundance_whittaker(size_t i, size_t j);
-    double distance_abundance_kullbackLeibler(size_t i, size_t j);
-    double distance_abundance_canberra(size_t i, size_t j, u_int64_t& ua, u_int64_t& ub, u_int64_t& uc);
-    double distance_abundance_kulczynski(size_t i, size_t j);
-    double distance_abundance_ochiai(size_t i, size_t j);
-    double distance_abundance_sorensen(size_t i, size_t j);
-    double distance_abundance_jaccard(size_t i, size_t j);
-    double distance_abundance_jaccard_simka(size_t i, size_t j, SIMKA_MATRIX_TYPE type);
+    double distance_abundance_whittaker(size_t i, size_t j, const SimkaPairComplexCounts& counts);
+    double distance_abundance_kullbackLeibler(size_t i, size_t j, const SimkaPairComplexCounts& counts);
+    double distance_abundance_canberra(size_t i, size_t j, const SimkaPairComplexCounts& counts, u_int64_t& ua, u_int64_t& ub, u_int64_t& uc);
+    double distance_abundance_kulczynski(size_t i, size_t j, const SimkaPairSimpleCounts& counts);
+    double distance_abundance_ochiai(size_t i, size_t j, const SimkaPairCounts& counts);
+    double distance_abundance_sorensen(size_t i, size_t j, const SimkaPairCounts& counts);
+    double distance_abundance_jaccard(size_t i, size_t j, const SimkaPairCounts& counts);
+    double distance_abundance_jaccard_simka(size_t i, size_t j, const SimkaPairCounts& counts, SIMKA_MATRIX_TYPE type);
 
 
     double distance_presenceAbsence_chordHellinger(u_int64_t& ua, u_int64_t& ub, u_int64_t& uc);
@@ -504,12 +946,51 @@ private:
     double distance_presenceAbsence_ochiai(u_int64_t& ua, u_int64_t& ub, u_int64_t& uc);
     double distance_presenceAbsence_sorensenBrayCurtis(u_int64_t& ua, u_int64_t& ub, u_int64_t& uc);
     double distance_presenceAbsence_jaccardCanberra(u_int64_t& ua, u_int64_t& ub, u_int64_t& uc);
-    double distance_presenceAbsence_jaccard_simka(size_t i, size_t j, size_t symetricIndex, SIMKA_MATRIX_TYPE type);
+    double distance_presenceAbsence_jaccard_simka(size_t i, size_t j, const SimkaPairCounts& counts, SIMKA_MATRIX_TYPE type);
+
+    //Abundance in bank i of the kmers shared with bank j
+    u_int64_t getNbSharedKmers(size_t i, size_t j, const SimkaPairCounts& counts){
+    	return (i < j) ? counts._nbSharedKmersI : counts._nbSharedKmersJ;
+    }
 
 	SimkaStatistics& _stats;
 	//SimkaDistanceParam _distanceParams;
 	size_t _nbBanks;
 
+	//Current row and statistics of the pairs (_i, j)
+	size_t _i;
+	vector<const SimkaPairCounts*> _rowCounts;
+	vector<const SimkaPairSimpleCounts*> _rowSimpleCounts;
+	vector<const SimkaPairComplexCounts*> _rowComplexCounts;
+};
+
+
+/*********************************************************************
+* ** SimkaMatrixOutput
+*
+* All the distance matrices of a run. Rows can be written by blocks of banks, so that only the
+* statistics of the pairs of a block of rows have to be in memory (tiled mode). The matrices of a
+* query run are rectangular: the rows are the queries and the columns the banks [colStart, colEnd).
+* With nbNeighbors or maxDistance, edge lists (edges_*.csv.gz) are written instead of the matrices,
+* their size is linear in the number of banks.
+*********************************************************************/
+class SimkaMatrixOutput{
+
+public:
+
+	SimkaMatrixOutput(const string& outputDir, const vector<string>& bankNames, bool computeSimpleDistances, bool computeComplexDistances,
+			size_t colStart=0, size_t colEnd=(size_t)-1, size_t nbNeighbors=0, double maxDistance=-1);
+	~SimkaMatrixOutput();
+
+	/** Write the rows [rowStart, rowEnd) of the matrices, stats must hold all the pairs of these rows */
+	void writeRows(SimkaStatistics& stats, size_t rowStart, size_t rowEnd);
+
+private:
+
+	vector<SimkaDistance::RowFunction> _rowFunctions;
+	vector<SimkaMatrixWriter*> _writers;
+	vector<SimkaEdgeListWriter*> _edgeWriters;
+	vector<float> _row;
 };
 
 #endif /* TOOLS_SIMKA_SRC_SIMKADISTANCE_HPP_ */
@@ -38,22 +38,24 @@ public:
 	};
 
     //SimkaCompressedProcessor(vector<BagGzFile<Count>* >& bags, vector<vector<Count> >& caches, vector<size_t>& cacheIndexes, CountNumber abundanceMin, CountNumber abundanceMax) : _bags(bags), _caches(caches), _cacheIndexes(cacheIndexes)
-    SimkaCompressedProcessor(vector<Bag<Kmer_BankId_Count>* >& bags, vector<u_int64_t>& nbKmerPerParts, vector<u_int64_t>& nbDistinctKmerPerParts, vector<u_int64_t>& chordPerParts, CountNumber abundanceMin, CountNumber abundanceMax, size_t bankIndex) :
-    	_bags(bags), _nbDistinctKmerPerParts(nbDistinctKmerPerParts), _nbKmerPerParts(nbKmerPerParts), _chordPerParts(chordPerParts)
+    SimkaCompressedProcessor(vector<Bag<Kmer_BankId_Count>* >& bags, vector<u_int64_t>& nbKmerPerParts, vector<u_int64_t>& nbDistinctKmerPerParts, vector<u_int64_t>& chordPerParts, CountNumber abundanceMin, CountNumber abundanceMax, size_t bankIndex, u_int64_t sketchThreshold, const vector<u_int64_t>& abundanceMins, vector<u_int64_t>& abundanceMinCountsPerParts) :
+    	_bags(bags), _nbDistinctKmerPerParts(nbDistinctKmerPerParts), _nbKmerPerParts(nbKmerPerParts), _chordPerParts(chordPerParts), _abundanceMins(abundanceMins), _abundanceMinCountsPerParts(abundanceMinCountsPerParts)
     {
     	_abundanceMin = abundanceMin;
     	_abundanceMax = abundanceMax;
     	_bankIndex = bankIndex;
+    	_sketchThreshold = sketchThreshold;
     }
 
 	~SimkaCompressedProcessor(){}
-    CountProcessorAbstract<span>* clone ()  {  return new SimkaCompressedProcessor (_bags, _nbKmerPerParts, _nbDistinctKmerPerParts, _chordPerParts, _abundanceMin, _abundanceMax, _bankIndex);  }
+    CountProcessorAbstract<span>* clone ()  {  return new SimkaCompressedProcessor (_bags, _nbKmerPerParts, _nbDistinctKmerPerParts, _chordPerParts, _abundanceMin, _abundanceMax, _bankIndex, _sketchThreshold, _abundanceMins, _abundanceMinCountsPerParts);  }
     //CountProcessorAbstract<span>* clone ()  {  return new SimkaCompressedProcessor (_bags, _caches, _cacheIndexes, _abundanceMin, _abundanceMax);  }
 	void finishClones (vector<ICountProcessor<span>*>& clones){}
 
 	bool process (size_t partId, const typename Kmer<span>::Type& kmer, const CountVector& count, CountNumber sum){
 
 		if(count[0] < _abundanceMin || count[0] > _abundanceMax) return false;
+		if(!SimkaSketch<span>::isKept(kmer, _sketchThreshold)) return false;
 
 		Kmer_BankId_Count item(kmer, _bankIndex, count[0]);
 		_bags[partId]->insert(item);
@@ -61,6 +63,15 @@ public:
 		_nbKmerPerParts[partId] += count[0];
 		_chordPerParts[partId] += pow(count[0], 2);
 
+		//Distinct kmers, kmers and chord N2 of the partition at each threshold of -multi-abundance-min
+		for(size_t i=0; i<_abundanceMins.size(); i++){
+			if(count[0] < _abundanceMins[i]) continue;
+			u_int64_t* counts = &_abundanceMinCountsPerParts[(partId*_abundanceMins.size() + i) * 3];
+			counts[0] += 1;
+			counts[1] += count[0];
+			counts[2] += pow(count[0], 2);
+		}
+
 		/*
 		size_t index = _cacheIndexes[partId];
 
@@ -86,6 +97,9 @@ public:
 	CountNumber _abundanceMin;
 	CountNumber _abundanceMax;
 	size_t _bankIndex;
+	u_int64_t _sketchThreshold; //hash threshold of the kept kmers (SimkaSketch)
+	const vector<u_int64_t>& _abundanceMins; //thresholds of -multi-abundance-min, the kmers are kept with the lowest one
+	vector<u_int64_t>& _abundanceMinCountsPerParts; //3 counters per partition and threshold
 	//_stats->_chord_N2[i] += pow(abundanceI, 2);
 	//vector<vector<Count> >& _caches;
 	//vector<size_t>& _cacheIndexes;
@@ -246,6 +260,7 @@ public:
 			if(count == 0) continue;
 
 			kmer.setVal(i);
+			if(!SimkaSketch<span>::isKept(kmer, _proc->_sketchThreshold)) continue;
 
 			//cout << i << " " << model.toString(kmer) << endl;
 			//Type kmer(i);
@@ -0,0 +1,122 @@
+
+#Compares the trees and the PCoA coordinates of simkaAnalyze with those of R (hclust with methods ward.D2 and
+#average, cmdscale) on the matrices of the example and on a random matrix. The trees are compared by their
+#cophenetic distances, the coordinates up to the sign of each axis. Skipped if Rscript or the R package ape
+#is missing.
+#Usage: python analyze_test.py
+
+import sys, os, shutil, random, gzip
+os.chdir(os.path.split(os.path.realpath(__file__))[0])
+
+suffix = " > /dev/null 2>&1"
+dir = "__results_analyze__"
+truth_dir = "truth/results_k31_t0"
+matrices = ["mat_abundance_braycurtis", "mat_presenceAbsence_jaccard"]
+nb_axes = 3
+nb_points = 40
+tolerance = 1e-3
+
+r_script = """
+args <- commandArgs(trailingOnly = TRUE)
+if(!suppressPackageStartupMessages(require(ape))) quit(status=2)
+tolerance = as.numeric(args[4])
+distanceMatrix = as.matrix(read.table(file=args[1], sep=";", header=TRUE, row.names=1, check.names=FALSE))
+d = as.dist(distanceMatrix)
+ok = TRUE
+
+for(linkage in c("ward", "average")){
+	method = if(linkage == "ward") "ward.D2" else "average"
+	truth = cophenetic(hclust(d, method=method))
+	tree = as.hclust(read.tree(paste0(args[2], "_", linkage, ".newick")))
+	result = as.matrix(cophenetic(tree))[labels(truth), labels(truth)]
+	error = max(abs(result - as.matrix(truth)))
+	if(error > tolerance * max(as.matrix(truth))){
+		cat("\\t- TEST ERROR:    tree", linkage, error, "\\n")
+		ok = FALSE
+	}
+}
+
+nbAxes = as.numeric(args[5])
+truth = cmdscale(d, k=nbAxes, eig=TRUE)
+coordinates = as.matrix(read.table(file=paste0(args[3], ".csv"), sep=";", header=TRUE, row.names=1, check.names=FALSE))[rownames(distanceMatrix),]
+eigenvalues = read.table(file=paste0(args[3], "_eigenvalues.csv"), sep=";", header=TRUE)
+for(a in 1:nbAxes){
+	scale = max(abs(truth$points[,a]))
+	error = min(max(abs(coordinates[,a] - truth$points[,a])), max(abs(coordinates[,a] + truth$points[,a])))
+	if(error > tolerance * scale || abs(eigenvalues$eigenvalue[a] - truth$eig[a]) > tolerance * truth$eig[1]){
+		cat("\\t- TEST ERROR:    pcoa axis", a, error, "\\n")
+		ok = FALSE
+	}
+}
+
+if(!ok) quit(status=1)
+"""
+
+def clear():
+	if os.path.exists(dir):
+		shutil.rmtree(dir)
+	os.mkdir(dir)
+
+def write_gz(filename, content):
+	f = gzip.open(filename, "wb")
+	f.write(content.encode())
+	f.close()
+
+#Euclidean distances of points close to a 3D subspace, so that the first eigenvalues are well separated
+def write_random_matrix(filename):
+	random.seed(0)
+	points = [[random.gauss(0, 4 - d) for d in range(3)] + [random.gauss(0, 0.1) for d in range(5)] for i in range(nb_points)]
+	names = ["S" + str(i) for i in range(nb_points)]
+	content = ";" + ";".join(names) + "\n"
+	for i in range(nb_points):
+		distances = [sum((points[i][d] - points[j][d]) ** 2 for d in range(len(points[i]))) ** 0.5 for j in range(nb_points)]
+		content += names[i] + ";" + ";".join("%f" % distance for distance in distances) + "\n"
+	write_gz(filename, content)
+
+def run(matrix_filename):
+	name = os.path.split(matrix_filename)[1][:-len(".csv.gz")]
+	print("TESTING " + name)
+
+	for linkage in ["ward", "average"]:
+		command = "../build/bin/simkaAnalyze -in " + matrix_filename + " -out " + dir + "/" + linkage + " -tree -pcoa -pcoa-axes " + str(nb_axes) + " -linkage " + linkage
+		if os.system(command + suffix) != 0:
+			print("\tFAILED: " + command)
+			sys.exit(1)
+		shutil.copy(dir + "/" + linkage + "/hclust_" + name[4:] + ".newick", dir + "/" + name + "_" + linkage + ".newick")
+
+	csv_filename = dir + "/" + name + ".csv"
+	f = gzip.open(matrix_filename, "rb")
+	open(csv_filename, "w").write(f.read().decode())
+	f.close()
+
+	ret = os.system("Rscript " + dir + "/compare.r " + csv_filename + " " + dir + "/" + name + " " + dir + "/ward/pcoa_" + name[4:] + " " + str(tolerance) + " " + str(nb_axes))
+	if os.WEXITSTATUS(ret) == 2:
+		print("\tSKIPPED: R package ape is missing")
+		return
+	if ret != 0:
+		print("\tFAILED")
+		sys.exit(1)
+	print("\tOK")
+
+
+#----------------------------------------------------------------
+#----------------------------------------------------------------
+#----------------------------------------------------------------
+
+
+if os.system("Rscript --version" + suffix) != 0:
+	print("SKIPPED: Rscript is missing")
+	sys.exit(0)
+
+clear()
+open(dir + "/compare.r", "w").write(r_script)
+for matrix in matrices:
+	write_gz(dir + "/" + matrix + ".csv.gz", open(os.path.join(truth_dir, matrix + ".csv")).read())
+	run(dir + "/" + matrix + ".csv.gz")
+write_random_matrix(dir + "/mat_random.csv.gz")
+run(dir + "/mat_random.csv.gz")
+
+#----------------------------------------------------------------
+#----------------------------------------------------------------
+#----------------------------------------------------------------
+shutil.rmtree(dir)
@@ -0,0 +1,131 @@
+#Runs simka on a large number of tiny synthetic datasets (more than 65535 by default). The distances are written as
+#edge lists of the nearest datasets, the matrices would be too large. The peak memory of each merge job is checked.
+#Usage: python large_scale_test.py [nb_datasets] [-untiled]
+#-untiled: also runs simka without tiles, with the statistics of all the pairs in the memory of each merge job
+
+import sys, os, shutil, random, gzip, glob, re
+os.chdir(os.path.split(os.path.realpath(__file__))[0])
+
+suffix = " > /dev/null 2>&1"
+dir = "__results_large__"
+nb_datasets = 100000
+nb_groups = 100
+read_size = 100
+nb_reads = 4
+nb_neighbors = 5
+max_memory = 4000
+
+args = [arg for arg in sys.argv[1:] if arg != "-untiled"]
+untiled = "-untiled" in sys.argv[1:]
+if len(args) > 0:
+	nb_datasets = int(args[0])
+
+def clear():
+	if os.path.exists("temp_output_large"):
+		shutil.rmtree("temp_output_large")
+	if os.path.exists(dir):
+		shutil.rmtree(dir)
+	os.mkdir(dir)
+	os.mkdir(dir + "/datasets")
+
+def random_sequence(size):
+	return "".join(random.choice("ACGT") for i in range(size))
+
+#Datasets of the same group share their reads, so that most pairs of datasets share no kmer
+def create_datasets():
+	random.seed(0)
+	groups = [[random_sequence(read_size) for i in range(nb_reads)] for j in range(nb_groups)]
+
+	input_file = open(dir + "/simka_input.txt", "w")
+	for i in range(nb_datasets):
+		filename = dir + "/datasets/" + str(i) + ".fasta"
+		f = open(filename, "w")
+		for j, read in enumerate(groups[i % nb_groups]):
+			f.write(">" + str(j) + "\n" + read + "\n")
+		f.close()
+		input_file.write("D" + str(i) + ": " + os.path.abspath(filename) + "\n")
+	input_file.close()
+
+#Datasets of the same group are identical, the others share no kmer: the nearest datasets of a dataset are the other
+#datasets of its group at distance 0, then the other datasets at distance 1, closest first then by index
+def get_neighbors(i):
+	neighbors = [(j, 0.0) for j in range(i % nb_groups, nb_datasets, nb_groups) if j != i][:nb_neighbors]
+	j = 0
+	while len(neighbors) < nb_neighbors and j < nb_datasets:
+		if j % nb_groups != i % nb_groups: neighbors.append((j, 1.0))
+		j += 1
+	return neighbors
+
+#The edge lists are read line by line, they are checked against the expected neighbors of every dataset
+def check_edges(filename):
+	f = gzip.open(filename, "rb")
+	f.readline()
+	for i in range(nb_datasets):
+		for j, distance in get_neighbors(i):
+			values = f.readline().decode().strip().split(";")
+			if len(values) != 3 or values[0] != "D" + str(i) or values[1] != "D" + str(j) or float(values[2]) != distance:
+				return False
+	ok = f.readline().decode().strip() == ""
+	f.close()
+	return ok
+
+#Peak memory of each merge job, written at the end of its log
+def get_merge_peak_memories():
+	memories = []
+	for filename in glob.glob("temp_output_large/simka_output_temp/log/merge_*.txt"):
+		for line in open(filename):
+			match = re.match(r"Peak memory: (\d+) MB", line)
+			if match: memories.append(int(match.group(1)))
+	return memories
+
+def run(result_dir, options):
+	if os.path.exists("temp_output_large"):
+		shutil.rmtree("temp_output_large")
+	command = "../build/bin/simka -in " + dir + "/simka_input.txt -out ./" + dir + "/" + result_dir + " -out-tmp ./temp_output_large -kmer-size 31 -abundance-min 0 -max-memory " + str(max_memory) + " -output-knn " + str(nb_neighbors) + " -verbose 0" + options
+	print(command)
+	return os.system(command + suffix)
+
+def test(result_dir, options):
+	ret = run(result_dir, options)
+
+	memories = get_merge_peak_memories()
+	if len(memories) > 0:
+		print("\tPeak memory of the merge jobs: " + str(max(memories)) + " MB")
+
+	ok = ret == 0
+	if len(memories) == 0 or max(memories) > max_memory:
+		print("\t- TEST ERROR:    peak memory of the merge jobs")
+		ok = False
+	for distance in ["edges_abundance_braycurtis", "edges_presenceAbsence_jaccard"]:
+		filename = dir + "/" + result_dir + "/" + distance + ".csv.gz"
+		if not ok or not os.path.exists(filename) or not check_edges(filename):
+			print("\t- TEST ERROR:    " + distance)
+			ok = False
+
+	if ok:
+		print("\tOK")
+	else:
+		print("\tFAILED")
+		sys.exit(1)
+
+
+#----------------------------------------------------------------
+#----------------------------------------------------------------
+#----------------------------------------------------------------
+
+
+clear()
+create_datasets()
+
+print("TESTING " + str(nb_datasets) + " datasets")
+test("results", " -tile-size " + str(max(nb_datasets // 4, 1)))
+
+if untiled:
+	print("TESTING " + str(nb_datasets) + " datasets without tiles")
+	test("results_untiled", " -tile-size 0")
+
+#----------------------------------------------------------------
+#----------------------------------------------------------------
+#----------------------------------------------------------------
+clear()
+shutil.rmtree(dir)
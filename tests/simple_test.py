@@ -1,5 +1,5 @@
 
-import sys, os, shutil, glob, gzip
+import sys, os, shutil, glob, gzip, re
 os.chdir(os.path.split(os.path.realpath(__file__))[0])
 
 suffix = " > /dev/null 2>&1"
@@ -67,14 +67,123 @@ def __test_matrices(simka_vs_truth, result_dir, truth_dir):
 	return ok
 
 
-def test_dists(dir):
-	if(__test_matrices(True, "__results__/" + dir, "truth/" + dir)):
+def test_dists(dir, truth_dir=None):
+	if truth_dir is None: truth_dir = dir
+	if(__test_matrices(True, "__results__/" + dir, "truth/" + truth_dir)):
 		print("\tOK")
 	else:
 		print("\tFAILED")
 		sys.exit(1)
 
 
+def read_matrix(filename):
+	lines = [line.rstrip("\n").split(";") for line in open(filename) if line.strip() != ""]
+	columns = lines[0][1:]
+	return dict(((line[0], columns[j]), line[j+1]) for line in lines[1:] for j in range(len(columns)))
+
+#The rectangular matrices of a query run are the pairs query x reference of the matrices of a full run
+def test_sub_matrices(dir, truth_dir):
+	result_dir = "__results__/" + dir
+	decompress_simka_results(result_dir)
+	result_filenames = glob.glob(os.path.join(result_dir, '*.csv'))
+	if len(result_filenames) == 0:
+		print("Error: no results")
+		exit(1)
+
+	ok = True
+	for result_filename in result_filenames:
+		distanceName = os.path.split(result_filename)[1]
+		truth_filename = os.path.join("truth", truth_dir, distanceName)
+		if not os.path.exists(truth_filename): continue
+		result = read_matrix(result_filename)
+		truth = read_matrix(truth_filename)
+		for pair in result:
+			if result[pair] != truth[pair]:
+				print("\t- TEST ERROR:    " + distanceName + " " + pair[0] + " " + pair[1])
+				ok = False
+				break
+
+	if ok:
+		print("\tOK")
+	else:
+		print("\tFAILED")
+		sys.exit(1)
+
+#For each dataset, the other datasets sorted by distance
+def get_ranks(filename):
+	matrix = read_matrix(filename)
+	names = sorted(set(pair[0] for pair in matrix))
+	return dict((name, sorted([other for other in names if other != name], key=lambda other: float(matrix[(name, other)]))) for name in names)
+
+#The edge lists of -output-knn and -output-max-distance are the closest neighbors of each dataset in the full matrices
+def test_edges(dir, truth_dir, nb_neighbors, max_distance):
+	result_dir = "__results__/" + dir
+	decompress_simka_results(result_dir)
+	result_filenames = glob.glob(os.path.join(result_dir, 'edges_*.csv'))
+	if len(result_filenames) == 0:
+		print("Error: no results")
+		exit(1)
+
+	ok = True
+	for result_filename in result_filenames:
+		distanceName = os.path.split(result_filename)[1].replace("edges_", "mat_", 1)
+		lines = [line.rstrip("\n").split(";") for line in open(os.path.join("truth", truth_dir, distanceName)) if line.strip() != ""]
+		names = lines[0][1:]
+		truth = []
+		for line in lines[1:]:
+			neighbors = sorted((float(line[j+1]), j) for j in range(len(names)) if names[j] != line[0] and float(line[j+1]) <= max_distance)
+			truth += [line[0] + ";" + names[j] + ";" + line[j+1] for distance, j in neighbors[:nb_neighbors]]
+		result = [line.rstrip("\n") for line in open(result_filename) if line.strip() != ""][1:]
+		if result != truth:
+			print("\t- TEST ERROR:    " + distanceName)
+			ok = False
+
+	if ok:
+		print("\tOK")
+	else:
+		print("\tFAILED")
+		sys.exit(1)
+
+#Input file of the given datasets of the example, with absolute paths. The datasets of streamed are read from a command
+#The datasets are written in the order of the list
+def write_example_input(filename, datasets, streamed=[]):
+	example_dir = os.path.realpath("../example")
+	lines = {}
+	for line in open(os.path.join(example_dir, "simka_input.txt")):
+		if line.strip() == "": continue
+		name, files = line.split(":", 1)
+		files = " ".join([f if f in [",", ";"] else os.path.join(example_dir, f) for f in files.split()])
+		if name in streamed: files = "<cat " + files
+		lines[name] = name + ": " + files + "\n"
+	input_file = open(filename, "w")
+	for name in datasets:
+		input_file.write(lines[name])
+	input_file.close()
+
+#The matrices of a run whose datasets are in another order are the ones of the truth, pair by pair
+def test_dists_by_pairs(dir, truth_dir):
+	ok = True
+	result_dir = "__results__/" + dir
+	decompress_simka_results(result_dir)
+	truth_filenames = glob.glob(os.path.join("truth/" + truth_dir, 'mat_*.csv'))
+	for truth_filename in truth_filenames:
+		distanceName = os.path.split(truth_filename)[1]
+		result_filename = os.path.join(result_dir, distanceName)
+		if not os.path.exists(result_filename):
+			print("\t- TEST ERROR:    " + distanceName)
+			ok = False
+			continue
+		truth = read_matrix(truth_filename)
+		result = read_matrix(result_filename)
+		if set(truth.keys()) != set(result.keys()) or any(abs(float(truth[key]) - float(result[key])) > 1e-6 for key in truth):
+			print("\t- TEST ERROR:    " + distanceName)
+			ok = False
+	if ok:
+		print("\tOK")
+	else:
+		print("\tFAILED")
+		sys.exit(1)
+
 def test_parallelization():
 	if(__test_matrices(False, "__results__/results_resources1", "__results__/results_resources2")):
 		print("\tOK")
@@ -120,6 +229,190 @@ print(command)
 os.system(command + suffix)
 test_dists("results_k21_t2")
 
+#test k=31 t=0, several datasets per counting job
+clear()
+print("TESTING batched counting")
+command = "../build/bin/simka -in ../example/simka_input.txt -out ./__results__/results_k31_t0 -out-tmp ./temp_output -simple-dist -complex-dist -kmer-size 31 -abundance-min 0 -count-batch 3 -verbose 0"
+print(command)
+os.system(command + suffix)
+test_dists("results_k31_t0")
+
+#test k=31 t=0, a dataset of a batch counted again by another job
+clear()
+print("TESTING batched counting, dataset counted again")
+command = "../build/bin/simka -in ../example/simka_input.txt -out ./__results__/results_batch -out-tmp ./temp_output -simple-dist -complex-dist -kmer-size 31 -abundance-min 0 -count-batch 3 -keep-tmp -verbose 0"
+os.system(command + suffix)
+os.remove("temp_output/simka_output_temp/count_synchro/B.ok")
+command = "../build/bin/simka -in ../example/simka_input.txt -out ./__results__/results_k31_t0 -out-tmp ./temp_output -simple-dist -complex-dist -kmer-size 31 -abundance-min 0 -count-batch 1 -keep-tmp -verbose 0"
+print(command)
+os.system(command + suffix)
+test_dists("results_k31_t0")
+
+#test k=31 t=0, every partition merged by several jobs of kmer ranges
+clear()
+print("TESTING merge in kmer ranges")
+command = "../build/bin/simka -in ../example/simka_input.txt -out ./__results__/results_k31_t0 -out-tmp ./temp_output -simple-dist -complex-dist -kmer-size 31 -abundance-min 0 -merge-ranges 4 -verbose 0"
+print(command)
+os.system(command + suffix)
+test_dists("results_k31_t0")
+
+#test k=31 t=0, a dataset read from a command, with a memory that may need several passes of the counting
+clear()
+print("TESTING stream input")
+write_example_input("__results__/stream_input.txt", ["A", "B", "C", "D", "E"], ["A"])
+command = "../build/bin/simka -in ./__results__/stream_input.txt -out ./__results__/results_k31_t0 -out-tmp ./temp_output -simple-dist -complex-dist -kmer-size 31 -abundance-min 0 -max-memory 100 -stream-reads 100000000 -verbose 0"
+print(command)
+os.system(command + suffix)
+test_dists("results_k31_t0")
+
+#test k=31 t=0, two runs share a count cache, the second one reuses the counts of the first one with the datasets in
+#another order
+clear()
+print("TESTING count cache")
+write_example_input("__results__/cache_input1.txt", ["A", "B", "C", "D", "E"])
+command = "../build/bin/simka -in ./__results__/cache_input1.txt -out ./__results__/results_cache1 -out-tmp ./temp_output/cache1 -simple-dist -complex-dist -kmer-size 31 -abundance-min 0 -count-cache ./__results__/count_cache -verbose 0"
+os.system(command + suffix)
+write_example_input("__results__/cache_input2.txt", ["E", "C", "A", "D", "B"])
+command = "../build/bin/simka -in ./__results__/cache_input2.txt -out ./__results__/results_cache2 -out-tmp ./temp_output/cache2 -simple-dist -complex-dist -kmer-size 31 -abundance-min 0 -count-cache ./__results__/count_cache -verbose 0"
+print(command)
+os.system(command + suffix)
+test_dists("results_cache1", "results_k31_t0")
+test_dists_by_pairs("results_cache2", "results_k31_t0")
+
+#test k=31 t=0, the last datasets added to a previous run
+clear()
+print("TESTING incremental run")
+write_example_input("__results__/incremental_input.txt", ["A", "B", "C"])
+command = "../build/bin/simka -in ./__results__/incremental_input.txt -out ./__results__/results_incremental -out-tmp ./temp_output -simple-dist -complex-dist -kmer-size 31 -abundance-min 0 -incremental -verbose 0"
+os.system(command + suffix)
+write_example_input("__results__/incremental_input.txt", ["A", "B", "C", "D", "E"])
+command = "../build/bin/simka -in ./__results__/incremental_input.txt -out ./__results__/results_k31_t0 -out-tmp ./temp_output -simple-dist -complex-dist -kmer-size 31 -abundance-min 0 -incremental -verbose 0"
+print(command)
+os.system(command + suffix)
+test_dists("results_k31_t0")
+
+#test k=31 t=0, the new datasets D and E against a reference run of A, B and C
+clear()
+print("TESTING query run")
+write_example_input("__results__/reference_input.txt", ["A", "B", "C"])
+command = "../build/bin/simka -in ./__results__/reference_input.txt -out ./__results__/results_reference -out-tmp ./temp_output/reference -simple-dist -complex-dist -kmer-size 31 -abundance-min 0 -keep-tmp -verbose 0"
+os.system(command + suffix)
+write_example_input("__results__/query_input.txt", ["D", "E"])
+command = "../build/bin/simka -in ./__results__/query_input.txt -out ./__results__/results_query -out-tmp ./temp_output/query -simple-dist -complex-dist -kmer-size 31 -abundance-min 0 -reference ./temp_output/reference -verbose 0"
+print(command)
+os.system(command + suffix)
+test_sub_matrices("results_query", "results_k31_t0")
+
+#test k=31, the preview sorts the datasets like the presence-absence Jaccard distances of the full run
+clear()
+print("TESTING preview")
+write_example_input("__results__/preview_input.txt", ["A", "B", "C", "D"])
+command = "../build/bin/simka -in ./__results__/preview_input.txt -out ./__results__/results_full -out-tmp ./temp_output/full -kmer-size 31 -abundance-min 0 -verbose 0"
+os.system(command + suffix)
+command = "../build/bin/simka -in ./__results__/preview_input.txt -out ./__results__/results_preview -out-tmp ./temp_output/preview -kmer-size 31 -preview -verbose 0"
+print(command)
+os.system(command + suffix)
+decompress_simka_results("__results__/results_full")
+decompress_simka_results("__results__/results_preview")
+if get_ranks("__results__/results_preview/mat_preview_presenceAbsence_jaccard.csv") == get_ranks("__results__/results_full/mat_presenceAbsence_jaccard.csv"):
+	print("\tOK")
+else:
+	print("\tFAILED")
+	sys.exit(1)
+
+#test k=31 and k=21 t=0 from the same counting jobs
+clear()
+print("TESTING multiple kmer sizes")
+command = "../build/bin/simka -in ../example/simka_input.txt -out ./__results__/results_multi_k -out-tmp ./temp_output -simple-dist -complex-dist -kmer-size 31 -multi-kmer-size 21,31 -abundance-min 0 -verbose 0"
+print(command)
+os.system(command + suffix)
+test_dists("results_multi_k", "results_k31_t0")
+test_dists("results_multi_k/k21", "results_k21_t0")
+
+#test k=31 t=0 and t=2 from the same counting jobs
+clear()
+print("TESTING multiple abundance thresholds")
+command = "../build/bin/simka -in ../example/simka_input.txt -out ./__results__/results_multi_t -out-tmp ./temp_output -simple-dist -complex-dist -kmer-size 31 -abundance-min 0 -multi-abundance-min 2 -verbose 0"
+print(command)
+os.system(command + suffix)
+test_dists("results_multi_t", "results_k31_t0")
+test_dists("results_multi_t/t2", "results_k31_t2")
+
+#test k=31 t=0, the matrices of a run with bootstrap replicates are those of the run, each interval holds the distance
+#of the run
+clear()
+print("TESTING bootstrap")
+command = "../build/bin/simka -in ../example/simka_input.txt -out ./__results__/results_bootstrap -out-tmp ./temp_output -simple-dist -complex-dist -kmer-size 31 -abundance-min 0 -bootstrap 10 -verbose 0"
+print(command)
+os.system(command + suffix)
+test_dists("results_bootstrap", "results_k31_t0")
+decompress_simka_results("__results__/results_bootstrap/bootstrap")
+ok = len(glob.glob("__results__/results_bootstrap/bootstrap/b9/mat_*.csv.gz")) > 0
+for low_filename in glob.glob("__results__/results_bootstrap/bootstrap/mat_*_low.csv"):
+	low = read_matrix(low_filename)
+	high = read_matrix(low_filename[:-len("_low.csv")] + "_high.csv")
+	run = read_matrix("__results__/results_bootstrap/" + os.path.split(low_filename)[1][:-len("_low.csv")] + ".csv")
+	for key in low:
+		if float(low[key]) > float(run[key]) + 1e-6 or float(run[key]) > float(high[key]) + 1e-6:
+			print("\t- TEST ERROR:    " + os.path.split(low_filename)[1] + " " + str(key))
+			ok = False
+if ok:
+	print("\tOK")
+else:
+	print("\tFAILED")
+	sys.exit(1)
+
+#test k=31 t=0, the edge lists are computed by blocks of rows, without tiles and with tiles of 2 datasets
+clear()
+print("TESTING edge lists")
+command = "../build/bin/simka -in ../example/simka_input.txt -out ./__results__/results_edges -out-tmp ./temp_output -simple-dist -complex-dist -kmer-size 31 -abundance-min 0 -output-knn 2 -output-max-distance 0.55 -verbose 0"
+print(command)
+os.system(command + suffix)
+test_edges("results_edges", "results_k31_t0", 2, 0.55)
+clear()
+command = "../build/bin/simka -in ../example/simka_input.txt -out ./__results__/results_edges_tiles -out-tmp ./temp_output -simple-dist -complex-dist -kmer-size 31 -abundance-min 0 -output-knn 2 -output-max-distance 0.55 -tile-size 2 -verbose 0"
+print(command)
+os.system(command + suffix)
+test_edges("results_edges_tiles", "results_k31_t0", 2, 0.55)
+
+#test k=31 t=0, the merge jobs open at most 2 count files at once, the 5 count files of a partition are pre-merged in
+#2 levels at least
+clear()
+print("TESTING pre-merge levels")
+command = "../build/bin/simka -in ../example/simka_input.txt -out ./__results__/results_k31_t0 -out-tmp ./temp_output -simple-dist -complex-dist -kmer-size 31 -abundance-min 0 -merge-max-fan-in 2 -verbose 0"
+print(command)
+os.system(command + suffix)
+levels = [0]
+for filename in glob.glob("temp_output/simka_output_temp/log/merge_*.txt"):
+	for line in open(filename):
+		match = re.match(r"Pre-merge: (\d+) levels", line)
+		if match: levels.append(int(match.group(1)))
+if max(levels) < 2:
+	print("\t- TEST ERROR:    pre-merge levels " + str(max(levels)))
+	print("\tFAILED")
+	sys.exit(1)
+test_dists("results_k31_t0")
+
+#test k=31 t=0, the paired files and the parts of D and E read at the same time give the matrices of the sequential
+#reading, with all the reads and with the first 50 reads of each paired file (-max-reads 50)
+clear()
+print("TESTING concurrent input")
+command = "../build/bin/simka -in ../example/simka_input.txt -out ./__results__/results_k31_t0 -out-tmp ./temp_output -simple-dist -complex-dist -kmer-size 31 -abundance-min 0 -concurrent-input -verbose 0"
+print(command)
+os.system(command + suffix)
+test_dists("results_k31_t0")
+clear()
+command = "../build/bin/simka -in ../example/simka_input.txt -out ./__results__/results_max_reads -out-tmp ./temp_output -simple-dist -complex-dist -kmer-size 31 -abundance-min 0 -max-reads 50 -verbose 0"
+os.system(command + suffix)
+command = "../build/bin/simka -in ../example/simka_input.txt -out ./__results__/results_max_reads_concurrent -out-tmp ./temp_output -simple-dist -complex-dist -kmer-size 31 -abundance-min 0 -max-reads 50 -concurrent-input -verbose 0"
+print(command)
+os.system(command + suffix)
+if len(glob.glob("__results__/results_max_reads/mat_*.csv.gz")) > 0 and __test_matrices(False, "__results__/results_max_reads_concurrent", "__results__/results_max_reads"):
+	print("\tOK")
+else:
+	print("\tFAILED")
+	sys.exit(1)
+
 #test resources 1
 clear()
 print("TESTING parallelization")
@@ -0,0 +1,116 @@
+
+#Measures the error of the distances computed with -sketch-scale against the exact distances (-sketch-scale 1)
+#on the example datasets and on synthetic datasets sharing a known fraction of their genomes. The test fails if
+#a mean error of the synthetic datasets is above the bound of its scale.
+#Usage: python sketch_error_test.py [scale1,scale2,...]
+
+import sys, os, shutil, random, glob, gzip
+os.chdir(os.path.split(os.path.realpath(__file__))[0])
+
+suffix = " > /dev/null 2>&1"
+dir = "__results_sketch__"
+scales = [1, 2, 10, 100]
+nb_datasets = 10
+genome_size = 200000
+read_size = 100
+coverage = 5
+
+if len(sys.argv) > 1:
+	scales = [1] + [int(s) for s in sys.argv[1].split(",") if int(s) != 1]
+
+def clear():
+	if os.path.exists("temp_output_sketch"):
+		shutil.rmtree("temp_output_sketch")
+	if os.path.exists(dir):
+		shutil.rmtree(dir)
+	os.mkdir(dir)
+	os.mkdir(dir + "/datasets")
+
+def random_sequence(size):
+	return "".join(random.choice("ACGT") for i in range(size))
+
+#Dataset i shares a fraction i/nb_datasets of its genome with the genome of dataset 0
+def create_datasets():
+	random.seed(0)
+	reference = random_sequence(genome_size)
+
+	input_file = open(dir + "/simka_input.txt", "w")
+	for i in range(nb_datasets):
+		shared = genome_size * i // nb_datasets
+		genome = reference[:shared] + random_sequence(genome_size - shared)
+		filename = dir + "/datasets/" + str(i) + ".fasta"
+		f = open(filename, "w")
+		for j in range(genome_size * coverage // read_size):
+			pos = random.randint(0, genome_size - read_size)
+			f.write(">" + str(j) + "\n" + genome[pos:pos+read_size] + "\n")
+		f.close()
+		input_file.write("D" + str(i) + ": " + os.path.abspath(filename) + "\n")
+	input_file.close()
+
+def load_matrices(result_dir):
+	matrices = {}
+	for filename in glob.glob(os.path.join(result_dir, "mat_*.csv.gz")):
+		f = gzip.open(filename, "rb")
+		lines = f.read().decode().strip().split("\n")[1:]
+		f.close()
+		matrices[os.path.split(filename)[1][:-7]] = [[float(x) for x in line.split(";")[1:]] for line in lines]
+	return matrices
+
+def mean_error(matrix, exact):
+	errors = [abs(matrix[i][j] - exact[i][j]) for i in range(len(exact)) for j in range(len(exact)) if i != j]
+	return sum(errors) / len(errors)
+
+#A distance is a ratio of sums over the kmers kept, about genome_size/scale per synthetic dataset: its error is
+#about 1/sqrt(genome_size/scale), the bound allows three times more
+def max_error(scale):
+	return 3.0 / (genome_size / float(scale)) ** 0.5
+
+#The example datasets have too few kmers for a bound at the large scales, their errors are only printed
+def run(name, input_filename, has_bound):
+	print("TESTING " + name)
+	ok = True
+	exact = None
+	for scale in scales:
+		result_dir = dir + "/results_" + name + "_" + str(scale)
+		if os.path.exists("temp_output_sketch"):
+			shutil.rmtree("temp_output_sketch")
+		command = "../build/bin/simka -in " + input_filename + " -out ./" + result_dir + " -out-tmp ./temp_output_sketch -simple-dist -complex-dist -kmer-size 21 -abundance-min 0 -sketch-scale " + str(scale) + " -verbose 0"
+		ret = os.system(command + suffix)
+		if ret != 0:
+			print("\tFAILED: " + command)
+			sys.exit(1)
+
+		matrices = load_matrices(result_dir)
+		if exact is None:
+			exact = matrices
+			continue
+
+		print("\t-sketch-scale " + str(scale) + ": mean absolute error" + (" (max %.5f)" % max_error(scale) if has_bound else ""))
+		for distance in sorted(exact):
+			error = mean_error(matrices[distance], exact[distance])
+			print("\t\t" + distance + ": " + "%.5f" % error)
+			if has_bound and error > max_error(scale):
+				print("\t\t- TEST ERROR:    " + distance)
+				ok = False
+
+	if not ok:
+		print("\tFAILED")
+		sys.exit(1)
+	print("\tOK")
+
+
+#----------------------------------------------------------------
+#----------------------------------------------------------------
+#----------------------------------------------------------------
+
+
+clear()
+run("example", "../example/simka_input.txt", False)
+create_datasets()
+run("synthetic", dir + "/simka_input.txt", True)
+
+#----------------------------------------------------------------
+#----------------------------------------------------------------
+#----------------------------------------------------------------
+clear()
+shutil.rmtree(dir)
@@ -0,0 +1,143 @@
+#Checks the reads sampled by -subsample-mode block from a synthetic uncompressed FASTQ file and from the same file
+#compressed with BGZF (block gzip). The sampled reads are kept with -keep-tmp: they must be about -max-reads, be
+#complete records of the input file, and be the same in a second run.
+#Usage: python subsample_test.py
+
+import sys, os, shutil, random, glob, struct, zlib
+os.chdir(os.path.split(os.path.realpath(__file__))[0])
+
+suffix = " > /dev/null 2>&1"
+dir = "__results_subsample__"
+nb_reads = 200000
+read_size = 100
+max_reads = 50000
+block_size = 1048576 #SIMKA_SUBSAMPLE_BLOCK_SIZE
+bgzf_block_size = 65280 #uncompressed bytes per BGZF block, as bgzip
+
+def clear():
+	if os.path.exists("temp_output_subsample"):
+		shutil.rmtree("temp_output_subsample")
+	if os.path.exists(dir):
+		shutil.rmtree(dir)
+	os.mkdir(dir)
+	os.mkdir(dir + "/datasets")
+
+def random_sequence(size, letters):
+	return "".join(random.choice(letters) for i in range(size))
+
+#The qualities use the whole Illumina range, some quality lines start with '@' like the headers
+def create_reads():
+	random.seed(0)
+	genome = random_sequence(nb_reads, "ACGT")
+	qualities = random_sequence(nb_reads, "".join(chr(c) for c in range(33, 75)))
+	reads = {}
+	for i in range(nb_reads):
+		pos = random.randint(0, nb_reads - read_size)
+		reads["r" + str(i)] = (genome[pos:pos+read_size], qualities[pos:pos+read_size])
+	return reads
+
+def write_fastq(filename, reads):
+	f = open(filename, "w")
+	for i in range(nb_reads):
+		name = "r" + str(i)
+		f.write("@" + name + "\n" + reads[name][0] + "\n+\n" + reads[name][1] + "\n")
+	f.close()
+
+#BGZF: gzip members of at most 64 KB with the BC extra field giving their size, followed by an empty member
+def write_bgzf(filename, data):
+	f = open(filename, "wb")
+	for start in list(range(0, len(data), bgzf_block_size)) + [len(data)]:
+		block = data[start:start+bgzf_block_size]
+		compressor = zlib.compressobj(6, zlib.DEFLATED, -15)
+		compressed = compressor.compress(block) + compressor.flush()
+		f.write(struct.pack("<BBBBIBBHBBHH", 0x1f, 0x8b, 8, 4, 0, 0, 0xff, 6, ord("B"), ord("C"), 2, len(compressed) + 25))
+		f.write(compressed)
+		f.write(struct.pack("<II", zlib.crc32(block) & 0xffffffff, len(block)))
+	f.close()
+
+def create_datasets(reads):
+	plain_filename = os.path.abspath(dir + "/datasets/reads.fastq")
+	write_fastq(plain_filename, reads)
+	bgzf_filename = os.path.abspath(dir + "/datasets/reads.fastq.gz")
+	write_bgzf(bgzf_filename, open(plain_filename, "rb").read())
+
+	input_file = open(dir + "/simka_input.txt", "w")
+	input_file.write("PLAIN: " + plain_filename + "\n")
+	input_file.write("BGZF: " + bgzf_filename + "\n")
+	input_file.close()
+	return {"PLAIN": plain_filename, "BGZF": bgzf_filename}
+
+def run(tmp_dir):
+	command = "../build/bin/simka -in " + dir + "/simka_input.txt -out ./" + dir + "/results -out-tmp " + tmp_dir + " -kmer-size 31 -abundance-min 0 -max-reads " + str(max_reads) + " -subsample-mode block -keep-tmp -verbose 0"
+	print(command)
+	if os.system(command + suffix) != 0:
+		print("\tFAILED: " + command)
+		sys.exit(1)
+
+def get_sample(tmp_dir, dataset):
+	filenames = glob.glob(tmp_dir + "/simka_output_temp/temp/" + dataset + "/__s__*_0.fastq")
+	if len(filenames) != 1: return None
+	return open(filenames[0]).read()
+
+#Every record is a read of the input with its sequence and its quality, a read is sampled once at most
+def check_records(sample, reads):
+	lines = sample.split("\n")
+	if lines[-1] != "" or (len(lines) - 1) % 4 != 0: return -1
+	names = set()
+	for i in range(0, len(lines) - 1, 4):
+		name = lines[i][1:]
+		if lines[i][:1] != "@" or name not in reads or name in names: return -1
+		if lines[i+1] != reads[name][0] or lines[i+2] != "+" or lines[i+3] != reads[name][1]: return -1
+		names.add(name)
+	return len(names)
+
+#The sample has whole blocks of the file, it is within a block of reads of -max-reads (and the error of the estimated
+#number of reads of the input)
+def test(datasets, reads):
+	run("./temp_output_subsample/run1")
+	run("./temp_output_subsample/run2")
+
+	ok = True
+	for dataset in sorted(datasets):
+		print("TESTING " + dataset)
+		sample = get_sample("./temp_output_subsample/run1", dataset)
+		if sample is None:
+			print("\t- TEST ERROR:    no sample")
+			ok = False
+			continue
+
+		nb_sampled_reads = check_records(sample, reads)
+		reads_per_block = nb_reads * block_size // os.path.getsize(datasets[dataset])
+		print("\t" + str(nb_sampled_reads) + " reads sampled (" + str(reads_per_block) + " reads per block)")
+		if nb_sampled_reads < 0:
+			print("\t- TEST ERROR:    malformed records")
+			ok = False
+		elif abs(nb_sampled_reads - max_reads) > reads_per_block + max_reads // 5:
+			print("\t- TEST ERROR:    number of reads")
+			ok = False
+		if get_sample("./temp_output_subsample/run2", dataset) != sample:
+			print("\t- TEST ERROR:    sample of the second run")
+			ok = False
+
+	if ok:
+		print("\tOK")
+	else:
+		print("\tFAILED")
+		sys.exit(1)
+
+
+#----------------------------------------------------------------
+#----------------------------------------------------------------
+#----------------------------------------------------------------
+
+
+clear()
+reads = create_reads()
+datasets = create_datasets(reads)
+test(datasets, reads)
+
+#----------------------------------------------------------------
+#----------------------------------------------------------------
+#----------------------------------------------------------------
+clear()
+shutil.rmtree(dir)